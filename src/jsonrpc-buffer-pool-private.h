@@ -0,0 +1,43 @@
+/* jsonrpc-buffer-pool-private.h
+ *
+ * Copyright (C) 2026 Christian Hergert <chergert@redhat.com>
+ *
+ * This file is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation; either version 2.1 of the License, or (at your option)
+ * any later version.
+ *
+ * This file is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef JSONRPC_BUFFER_POOL_PRIVATE_H
+#define JSONRPC_BUFFER_POOL_PRIVATE_H
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+typedef struct _JsonrpcBufferPool JsonrpcBufferPool;
+
+JsonrpcBufferPool *_jsonrpc_buffer_pool_new        (gsize               max_retained) G_GNUC_INTERNAL;
+JsonrpcBufferPool *_jsonrpc_buffer_pool_ref        (JsonrpcBufferPool  *self) G_GNUC_INTERNAL;
+void               _jsonrpc_buffer_pool_unref      (JsonrpcBufferPool  *self) G_GNUC_INTERNAL;
+gpointer           _jsonrpc_buffer_pool_alloc      (JsonrpcBufferPool  *self,
+                                                    gsize               size) G_GNUC_INTERNAL;
+void               _jsonrpc_buffer_pool_get_stats  (JsonrpcBufferPool  *self,
+                                                    guint64            *n_allocations,
+                                                    guint64            *n_reused,
+                                                    gsize              *retained) G_GNUC_INTERNAL;
+void               _jsonrpc_buffer_free            (gpointer            buffer) G_GNUC_INTERNAL;
+GBytes            *_jsonrpc_buffer_free_to_bytes   (gpointer            buffer,
+                                                    gsize               size) G_GNUC_INTERNAL;
+
+G_END_DECLS
+
+#endif /* JSONRPC_BUFFER_POOL_PRIVATE_H */
@@ -0,0 +1,266 @@
+/* jsonrpc-buffer-pool.c
+ *
+ * Copyright (C) 2026 Christian Hergert <chergert@redhat.com>
+ *
+ * This file is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation; either version 2.1 of the License, or (at your option)
+ * any later version.
+ *
+ * This file is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define G_LOG_DOMAIN "jsonrpc-buffer-pool"
+
+#include "config.h"
+
+#include "jsonrpc-buffer-pool-private.h"
+
+/*
+ * Buffers are grouped into power of two size classes starting at
+ * MIN_CLASS_SIZE. Released buffers are kept on a per-class free list until
+ * the pool retains max_retained bytes, after which they are freed.
+ *
+ * Every buffer is preceded by a small header pointing back to the pool (and
+ * holding a reference to it) so that a buffer may be released from any
+ * thread without knowing where it came from. This is what allows handing
+ * buffers out inside a GBytes whose free function returns them to the pool.
+ *
+ * Buffers larger than the biggest size class are not pooled.
+ */
+
+#define MIN_CLASS_SHIFT 9  /* 512 bytes */
+#define N_CLASSES       12 /* up to 1 MiB */
+#define NOT_POOLED      G_MAXUINT
+
+typedef union
+{
+  struct {
+    JsonrpcBufferPool *pool;
+    guint              size_class;
+  };
+  /* Keep the data following the header suitably aligned for GVariant */
+  gint64  align_int;
+  gdouble align_double;
+  gpointer align_pointer[2];
+} BufferHeader;
+
+typedef struct _FreeBuffer
+{
+  struct _FreeBuffer *next;
+} FreeBuffer;
+
+struct _JsonrpcBufferPool
+{
+  GMutex      mutex;
+  FreeBuffer *free_lists[N_CLASSES];
+  gsize       retained;
+  gsize       max_retained;
+  guint64     n_allocations;
+  guint64     n_reused;
+};
+
+static gsize
+class_size (guint size_class)
+{
+  return (gsize)1 << (MIN_CLASS_SHIFT + size_class);
+}
+
+static guint
+size_to_class (gsize size)
+{
+  guint i;
+
+  for (i = 0; i < N_CLASSES; i++)
+    {
+      if (size <= class_size (i))
+        return i;
+    }
+
+  return NOT_POOLED;
+}
+
+static inline BufferHeader *
+get_header (gpointer buffer)
+{
+  return (BufferHeader *)(gpointer)((guint8 *)buffer - sizeof (BufferHeader));
+}
+
+JsonrpcBufferPool *
+_jsonrpc_buffer_pool_new (gsize max_retained)
+{
+  JsonrpcBufferPool *self;
+
+  self = g_atomic_rc_box_new0 (JsonrpcBufferPool);
+  g_mutex_init (&self->mutex);
+  self->max_retained = max_retained;
+
+  return self;
+}
+
+JsonrpcBufferPool *
+_jsonrpc_buffer_pool_ref (JsonrpcBufferPool *self)
+{
+  return g_atomic_rc_box_acquire (self);
+}
+
+static void
+jsonrpc_buffer_pool_finalize (gpointer data)
+{
+  JsonrpcBufferPool *self = data;
+  guint i;
+
+  for (i = 0; i < N_CLASSES; i++)
+    {
+      while (self->free_lists[i] != NULL)
+        {
+          FreeBuffer *buf = self->free_lists[i];
+
+          self->free_lists[i] = buf->next;
+          g_free (get_header (buf));
+        }
+    }
+
+  g_mutex_clear (&self->mutex);
+}
+
+void
+_jsonrpc_buffer_pool_unref (JsonrpcBufferPool *self)
+{
+  g_atomic_rc_box_release_full (self, jsonrpc_buffer_pool_finalize);
+}
+
+/*
+ * _jsonrpc_buffer_pool_alloc:
+ *
+ * Gets a buffer of at least @size bytes, reusing a previously released
+ * buffer if possible. The buffer must be released with _jsonrpc_buffer_free()
+ * or _jsonrpc_buffer_free_to_bytes().
+ */
+gpointer
+_jsonrpc_buffer_pool_alloc (JsonrpcBufferPool *self,
+                            gsize              size)
+{
+  BufferHeader *header = NULL;
+  guint size_class;
+
+  g_assert (self != NULL);
+
+  size_class = size_to_class (size);
+
+  g_mutex_lock (&self->mutex);
+
+  self->n_allocations++;
+
+  if (size_class != NOT_POOLED && self->free_lists[size_class] != NULL)
+    {
+      FreeBuffer *buf = self->free_lists[size_class];
+
+      self->free_lists[size_class] = buf->next;
+      self->retained -= class_size (size_class);
+      self->n_reused++;
+
+      header = get_header (buf);
+    }
+
+  g_mutex_unlock (&self->mutex);
+
+  if (header == NULL)
+    {
+      gsize alloc_size = size_class != NOT_POOLED ? class_size (size_class) : size;
+
+      header = g_malloc (sizeof (BufferHeader) + alloc_size);
+      header->size_class = size_class;
+    }
+
+  header->pool = _jsonrpc_buffer_pool_ref (self);
+
+  return (guint8 *)header + sizeof (BufferHeader);
+}
+
+/*
+ * _jsonrpc_buffer_free:
+ *
+ * Returns @buffer to the pool it was allocated from. This may be called
+ * from any thread.
+ */
+void
+_jsonrpc_buffer_free (gpointer buffer)
+{
+  BufferHeader *header;
+  JsonrpcBufferPool *self;
+  gboolean retained = FALSE;
+
+  if (buffer == NULL)
+    return;
+
+  header = get_header (buffer);
+  self = g_steal_pointer (&header->pool);
+
+  if (header->size_class != NOT_POOLED)
+    {
+      gsize size = class_size (header->size_class);
+
+      g_mutex_lock (&self->mutex);
+
+      if (self->retained + size <= self->max_retained)
+        {
+          FreeBuffer *buf = buffer;
+
+          buf->next = self->free_lists[header->size_class];
+          self->free_lists[header->size_class] = buf;
+          self->retained += size;
+          retained = TRUE;
+        }
+
+      g_mutex_unlock (&self->mutex);
+    }
+
+  if (!retained)
+    g_free (header);
+
+  _jsonrpc_buffer_pool_unref (self);
+}
+
+/*
+ * _jsonrpc_buffer_free_to_bytes:
+ *
+ * Transfers ownership of @buffer to a new #GBytes of @size bytes. The
+ * buffer is returned to its pool when the #GBytes is released.
+ */
+GBytes *
+_jsonrpc_buffer_free_to_bytes (gpointer buffer,
+                               gsize    size)
+{
+  g_assert (buffer != NULL);
+
+  return g_bytes_new_with_free_func (buffer, size, _jsonrpc_buffer_free, buffer);
+}
+
+void
+_jsonrpc_buffer_pool_get_stats (JsonrpcBufferPool *self,
+                                guint64           *n_allocations,
+                                guint64           *n_reused,
+                                gsize             *retained)
+{
+  g_assert (self != NULL);
+
+  g_mutex_lock (&self->mutex);
+
+  if (n_allocations != NULL)
+    *n_allocations = self->n_allocations;
+
+  if (n_reused != NULL)
+    *n_reused = self->n_reused;
+
+  if (retained != NULL)
+    *retained = self->retained;
+
+  g_mutex_unlock (&self->mutex);
+}
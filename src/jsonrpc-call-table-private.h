@@ -0,0 +1,76 @@
+/* jsonrpc-call-table-private.h
+ *
+ * Copyright (C) 2026 Christian Hergert <chergert@redhat.com>
+ *
+ * This file is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation; either version 2.1 of the License, or (at your option)
+ * any later version.
+ *
+ * This file is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef JSONRPC_CALL_TABLE_PRIVATE_H
+#define JSONRPC_CALL_TABLE_PRIVATE_H
+
+#include <gio/gio.h>
+
+G_BEGIN_DECLS
+
+typedef struct
+{
+  gint64  id;
+  GTask  *task;
+  /* The monotonic time by which the call fails, or zero */
+  gint64  deadline;
+} JsonrpcCallSlot;
+
+typedef struct
+{
+  JsonrpcCallSlot  *slots;
+  gsize             n_slots;
+  gsize             n_calls;
+  gint64            last_id;
+
+  /* Timer wheel of the ids of calls with a deadline, created on demand */
+  GArray          **wheel;
+  gsize             n_deadlines;
+  gint64            last_tick;
+
+  /* Ring of the ids of calls which timed out or were cancelled */
+  gint64           *stale;
+  guint             stale_pos;
+} JsonrpcCallTable;
+
+void       _jsonrpc_call_table_init                (JsonrpcCallTable *table) G_GNUC_INTERNAL;
+void       _jsonrpc_call_table_clear               (JsonrpcCallTable *table) G_GNUC_INTERNAL;
+gint64     _jsonrpc_call_table_add                 (JsonrpcCallTable *table,
+                                                    GTask            *task,
+                                                    gint64            deadline) G_GNUC_INTERNAL;
+void       _jsonrpc_call_table_set_deadline        (JsonrpcCallTable *table,
+                                                    gint64            id,
+                                                    gint64            deadline) G_GNUC_INTERNAL;
+GTask     *_jsonrpc_call_table_lookup              (JsonrpcCallTable *table,
+                                                    gint64            id) G_GNUC_INTERNAL;
+GTask     *_jsonrpc_call_table_remove              (JsonrpcCallTable *table,
+                                                    gint64            id) G_GNUC_INTERNAL;
+void       _jsonrpc_call_table_mark_stale          (JsonrpcCallTable *table,
+                                                    gint64            id) G_GNUC_INTERNAL;
+gboolean   _jsonrpc_call_table_is_stale            (JsonrpcCallTable *table,
+                                                    gint64            id) G_GNUC_INTERNAL;
+GPtrArray *_jsonrpc_call_table_steal_all           (JsonrpcCallTable *table) G_GNUC_INTERNAL;
+GPtrArray *_jsonrpc_call_table_steal_expired       (JsonrpcCallTable *table,
+                                                    gint64            now) G_GNUC_INTERNAL;
+gint64     _jsonrpc_call_table_get_next_expiration (JsonrpcCallTable *table) G_GNUC_INTERNAL;
+
+G_DEFINE_AUTO_CLEANUP_CLEAR_FUNC (JsonrpcCallTable, _jsonrpc_call_table_clear)
+
+G_END_DECLS
+
+#endif /* JSONRPC_CALL_TABLE_PRIVATE_H */
@@ -0,0 +1,450 @@
+/* jsonrpc-call-table.c
+ *
+ * Copyright (C) 2026 Christian Hergert <chergert@redhat.com>
+ *
+ * This file is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation; either version 2.1 of the License, or (at your option)
+ * any later version.
+ *
+ * This file is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define G_LOG_DOMAIN "jsonrpc-call-table"
+
+#include "config.h"
+
+#include "jsonrpc-call-table-private.h"
+
+/*
+ * The table keeps the tasks of calls awaiting a reply from the peer, keyed
+ * by the id of the call.
+ *
+ * Since we pick the ids ourselves, the slot of a call is simply its id
+ * masked by the (power of two) number of slots. The full id is kept in the
+ * slot to tell calls sharing a slot apart. When the slot of the next id is
+ * still taken by an older call, such as one the peer is slow to reply to,
+ * that id is skipped. Ids stay unique and increasing, just not contiguous.
+ *
+ * The table grows once three quarters of the slots are taken, which also
+ * bounds how many ids may be skipped. Calls never collide when growing as
+ * ids in distinct slots stay in distinct slots with more of them.
+ *
+ * Calls with a deadline also have their id added to a timer wheel, in the
+ * bucket of the first tick at or after their deadline. Ids are not removed
+ * from the wheel when their call completes, instead they are dropped once
+ * their bucket is processed and the call is found to be gone. Deadlines
+ * further away than a full turn of the wheel stay in their bucket until
+ * the turn they expire in.
+ *
+ * The peer may still reply to calls which timed out or were cancelled, so
+ * the ids of the most recent of them are kept in a small ring. A reply to
+ * any other id which is not in the table is a protocol error.
+ */
+
+#define MIN_SLOTS 16
+#define N_STALE   256
+
+#define N_WHEEL_BUCKETS 256
+#define WHEEL_TICK_USEC (10 * 1000)
+
+void
+_jsonrpc_call_table_init (JsonrpcCallTable *table)
+{
+  g_assert (table != NULL);
+
+  table->slots = NULL;
+  table->n_slots = 0;
+  table->n_calls = 0;
+  table->last_id = 0;
+  table->wheel = NULL;
+  table->n_deadlines = 0;
+  table->last_tick = 0;
+  table->stale = NULL;
+  table->stale_pos = 0;
+}
+
+void
+_jsonrpc_call_table_clear (JsonrpcCallTable *table)
+{
+  g_assert (table != NULL);
+
+  for (gsize i = 0; i < table->n_slots; i++)
+    g_clear_object (&table->slots[i].task);
+
+  g_clear_pointer (&table->slots, g_free);
+  table->n_slots = 0;
+  table->n_calls = 0;
+
+  if (table->wheel != NULL)
+    {
+      for (guint i = 0; i < N_WHEEL_BUCKETS; i++)
+        g_clear_pointer (&table->wheel[i], g_array_unref);
+      g_clear_pointer (&table->wheel, g_free);
+    }
+
+  table->n_deadlines = 0;
+
+  g_clear_pointer (&table->stale, g_free);
+  table->stale_pos = 0;
+}
+
+static inline JsonrpcCallSlot *
+get_slot (JsonrpcCallTable *table,
+          gint64            id)
+{
+  return &table->slots[(guint64)id & (table->n_slots - 1)];
+}
+
+static inline GArray *
+get_bucket (JsonrpcCallTable *table,
+            gint64            tick)
+{
+  return table->wheel[(guint64)tick % N_WHEEL_BUCKETS];
+}
+
+static void
+jsonrpc_call_table_add_timer (JsonrpcCallTable *table,
+                              gint64            id,
+                              gint64            deadline)
+{
+  gint64 tick;
+
+  if (table->wheel == NULL)
+    {
+      table->wheel = g_new0 (GArray *, N_WHEEL_BUCKETS);
+      for (guint i = 0; i < N_WHEEL_BUCKETS; i++)
+        table->wheel[i] = g_array_new (FALSE, FALSE, sizeof (gint64));
+    }
+
+  /* Restart the wheel from now if it was idle, dropping stale ids */
+  if (table->n_deadlines == 0)
+    {
+      for (guint i = 0; i < N_WHEEL_BUCKETS; i++)
+        g_array_set_size (table->wheel[i], 0);
+      table->last_tick = g_get_monotonic_time () / WHEEL_TICK_USEC;
+    }
+
+  /* Round up so that the call has expired once its tick is reached */
+  tick = deadline / WHEEL_TICK_USEC + (deadline % WHEEL_TICK_USEC != 0);
+  tick = MAX (tick, table->last_tick + 1);
+
+  g_array_append_val (get_bucket (table, tick), id);
+  table->n_deadlines++;
+}
+
+static void
+jsonrpc_call_table_grow (JsonrpcCallTable *table)
+{
+  JsonrpcCallSlot *old_slots = table->slots;
+  gsize old_n_slots = table->n_slots;
+
+  table->n_slots = MAX (MIN_SLOTS, old_n_slots * 2);
+  table->slots = g_new0 (JsonrpcCallSlot, table->n_slots);
+
+  for (gsize i = 0; i < old_n_slots; i++)
+    {
+      if (old_slots[i].task != NULL)
+        {
+          JsonrpcCallSlot *slot = get_slot (table, old_slots[i].id);
+
+          g_assert (slot->task == NULL);
+
+          *slot = old_slots[i];
+        }
+    }
+
+  g_free (old_slots);
+}
+
+/*
+ * _jsonrpc_call_table_add:
+ *
+ * Adds @task to the table under a new id. If @deadline is not zero, the
+ * call is returned by _jsonrpc_call_table_steal_expired() once the
+ * monotonic time reaches @deadline.
+ *
+ * Returns: the id of the call, which is always positive
+ */
+gint64
+_jsonrpc_call_table_add (JsonrpcCallTable *table,
+                         GTask            *task,
+                         gint64            deadline)
+{
+  JsonrpcCallSlot *slot;
+
+  g_assert (table != NULL);
+  g_assert (G_IS_TASK (task));
+
+  if ((table->n_calls + 1) * 4 > table->n_slots * 3)
+    jsonrpc_call_table_grow (table);
+
+  do
+    slot = get_slot (table, ++table->last_id);
+  while (slot->task != NULL);
+
+  slot->id = table->last_id;
+  slot->task = g_object_ref (task);
+  slot->deadline = MAX (deadline, 0);
+  table->n_calls++;
+
+  if (slot->deadline != 0)
+    jsonrpc_call_table_add_timer (table, slot->id, slot->deadline);
+
+  return slot->id;
+}
+
+/*
+ * _jsonrpc_call_table_set_deadline:
+ *
+ * Sets the deadline of the call @id, which was added without one. This
+ * allows the id of a call to be handed out before it is sent.
+ */
+void
+_jsonrpc_call_table_set_deadline (JsonrpcCallTable *table,
+                                  gint64            id,
+                                  gint64            deadline)
+{
+  JsonrpcCallSlot *slot;
+
+  g_assert (table != NULL);
+  g_assert (_jsonrpc_call_table_lookup (table, id) != NULL);
+
+  slot = get_slot (table, id);
+
+  g_assert (slot->deadline == 0);
+
+  if (deadline > 0)
+    {
+      slot->deadline = deadline;
+      jsonrpc_call_table_add_timer (table, id, deadline);
+    }
+}
+
+/*
+ * _jsonrpc_call_table_lookup:
+ *
+ * Returns: (transfer none) (nullable): the task of the call @id
+ */
+GTask *
+_jsonrpc_call_table_lookup (JsonrpcCallTable *table,
+                            gint64            id)
+{
+  JsonrpcCallSlot *slot;
+
+  g_assert (table != NULL);
+
+  if (table->n_calls == 0 || id <= 0)
+    return NULL;
+
+  slot = get_slot (table, id);
+
+  if (slot->task == NULL || slot->id != id)
+    return NULL;
+
+  return slot->task;
+}
+
+/*
+ * _jsonrpc_call_table_remove:
+ *
+ * Removes the call @id from the table.
+ *
+ * Returns: (transfer full) (nullable): the task of the call @id
+ */
+GTask *
+_jsonrpc_call_table_remove (JsonrpcCallTable *table,
+                            gint64            id)
+{
+  JsonrpcCallSlot *slot;
+
+  g_assert (table != NULL);
+
+  if (_jsonrpc_call_table_lookup (table, id) == NULL)
+    return NULL;
+
+  slot = get_slot (table, id);
+  table->n_calls--;
+
+  if (slot->deadline != 0)
+    {
+      slot->deadline = 0;
+      table->n_deadlines--;
+    }
+
+  return g_steal_pointer (&slot->task);
+}
+
+/*
+ * _jsonrpc_call_table_mark_stale:
+ *
+ * Remembers that the call @id, which was removed from the table, was
+ * abandoned without waiting for its reply, such as when it was cancelled.
+ */
+void
+_jsonrpc_call_table_mark_stale (JsonrpcCallTable *table,
+                                gint64            id)
+{
+  g_assert (table != NULL);
+  g_assert (id > 0 && id <= table->last_id);
+
+  if (table->stale == NULL)
+    table->stale = g_new0 (gint64, N_STALE);
+
+  table->stale[table->stale_pos] = id;
+  table->stale_pos = (table->stale_pos + 1) % N_STALE;
+}
+
+/*
+ * _jsonrpc_call_table_is_stale:
+ *
+ * Checks if @id is a recent call which timed out or was cancelled, see
+ * _jsonrpc_call_table_mark_stale(). A reply to such a call is not a
+ * protocol error. The id is forgotten, so that a second reply is.
+ */
+gboolean
+_jsonrpc_call_table_is_stale (JsonrpcCallTable *table,
+                              gint64            id)
+{
+  g_assert (table != NULL);
+
+  if (table->stale == NULL || id <= 0)
+    return FALSE;
+
+  /* Only looked at for unexpected replies, so a scan is fine */
+  for (guint i = 0; i < N_STALE; i++)
+    {
+      if (table->stale[i] == id)
+        {
+          table->stale[i] = 0;
+          return TRUE;
+        }
+    }
+
+  return FALSE;
+}
+
+/*
+ * _jsonrpc_call_table_steal_all:
+ *
+ * Removes every call from the table. Ids keep increasing from where they
+ * were, so that a late reply cannot be mistaken for a reply to a new call.
+ *
+ * Returns: (transfer full) (element-type GTask): the tasks of the calls
+ */
+GPtrArray *
+_jsonrpc_call_table_steal_all (JsonrpcCallTable *table)
+{
+  GPtrArray *tasks;
+
+  g_assert (table != NULL);
+
+  tasks = g_ptr_array_new_full (table->n_calls, g_object_unref);
+
+  for (gsize i = 0; i < table->n_slots; i++)
+    {
+      if (table->slots[i].task != NULL)
+        g_ptr_array_add (tasks, g_steal_pointer (&table->slots[i].task));
+      table->slots[i].deadline = 0;
+    }
+
+  table->n_calls = 0;
+  table->n_deadlines = 0;
+
+  return tasks;
+}
+
+/*
+ * _jsonrpc_call_table_steal_expired:
+ *
+ * Removes the calls whose deadline is at or before @now from the table.
+ *
+ * Returns: (transfer full) (element-type GTask) (nullable): the tasks of
+ *   the expired calls, or %NULL if none expired
+ */
+GPtrArray *
+_jsonrpc_call_table_steal_expired (JsonrpcCallTable *table,
+                                   gint64            now)
+{
+  GPtrArray *tasks = NULL;
+  gint64 now_tick;
+  gint64 tick;
+
+  g_assert (table != NULL);
+
+  if (table->n_deadlines == 0)
+    return NULL;
+
+  now_tick = now / WHEEL_TICK_USEC;
+
+  /* A full turn of the wheel visits every bucket */
+  tick = MAX (table->last_tick + 1, now_tick - N_WHEEL_BUCKETS + 1);
+
+  for (; tick <= now_tick; tick++)
+    {
+      GArray *bucket = get_bucket (table, tick);
+      guint n_kept = 0;
+
+      for (guint i = 0; i < bucket->len; i++)
+        {
+          gint64 id = g_array_index (bucket, gint64, i);
+          JsonrpcCallSlot *slot;
+
+          /* The call completed already */
+          if (_jsonrpc_call_table_lookup (table, id) == NULL)
+            continue;
+
+          slot = get_slot (table, id);
+
+          if (slot->deadline > now)
+            {
+              g_array_index (bucket, gint64, n_kept++) = id;
+              continue;
+            }
+
+          if (tasks == NULL)
+            tasks = g_ptr_array_new_with_free_func (g_object_unref);
+          g_ptr_array_add (tasks, _jsonrpc_call_table_remove (table, id));
+          _jsonrpc_call_table_mark_stale (table, id);
+        }
+
+      g_array_set_size (bucket, n_kept);
+    }
+
+  table->last_tick = MAX (table->last_tick, now_tick);
+
+  return tasks;
+}
+
+/*
+ * _jsonrpc_call_table_get_next_expiration:
+ *
+ * Gets when _jsonrpc_call_table_steal_expired() should next be called.
+ * This may be before any call actually expires.
+ *
+ * Returns: a monotonic time, or -1 if no call has a deadline
+ */
+gint64
+_jsonrpc_call_table_get_next_expiration (JsonrpcCallTable *table)
+{
+  g_assert (table != NULL);
+
+  if (table->n_deadlines == 0)
+    return -1;
+
+  for (gint64 tick = table->last_tick + 1; tick <= table->last_tick + N_WHEEL_BUCKETS; tick++)
+    {
+      if (get_bucket (table, tick)->len > 0)
+        return tick * WHEEL_TICK_USEC;
+    }
+
+  g_assert_not_reached ();
+
+  return -1;
+}
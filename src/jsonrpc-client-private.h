@@ -0,0 +1,32 @@
+/* jsonrpc-client-private.h
+ *
+ * Copyright (C) 2026 Christian Hergert <chergert@redhat.com>
+ *
+ * This file is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation; either version 2.1 of the License, or (at your option)
+ * any later version.
+ *
+ * This file is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef JSONRPC_CLIENT_PRIVATE_H
+#define JSONRPC_CLIENT_PRIVATE_H
+
+#include "jsonrpc-client.h"
+#include "jsonrpc-output-stream.h"
+
+G_BEGIN_DECLS
+
+void _jsonrpc_client_send_encoded (JsonrpcClient         *self,
+                                   JsonrpcEncodedMessage *encoded) G_GNUC_INTERNAL;
+
+G_END_DECLS
+
+#endif /* JSONRPC_CLIENT_PRIVATE_H */
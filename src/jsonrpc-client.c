@@ -56,22 +56,24 @@
 #include <glib.h>
 
 #include "jsonrpc-client.h"
+#include "jsonrpc-client-private.h"
+#include "jsonrpc-call-table-private.h"
 #include "jsonrpc-input-stream.h"
 #include "jsonrpc-input-stream-private.h"
 #include "jsonrpc-marshalers.h"
+#include "jsonrpc-message.h"
 #include "jsonrpc-output-stream.h"
+#include "jsonrpc-output-stream-private.h"
 
 typedef struct
 {
   /*
-   * The invocations field contains a hashtable that maps request ids to
-   * the GTask that is awaiting their completion. The tasks are removed
-   * from the hashtable automatically upon completion by connecting to
-   * the GTask::completed signal. When reading a message from the input
-   * stream, we use the request id as a string to lookup the inflight
-   * invocation. The result is passed as the result of the task.
+   * The invocations field maps request ids to the GTask that is awaiting
+   * their completion. It also hands out the ids, which are monotonic. When
+   * reading a reply from the input stream, we remove the inflight
+   * invocation by the request id and pass the result to its task.
    */
-  GHashTable *invocations;
+  JsonrpcCallTable invocations;
 
   /*
    * We hold an extra reference to the GIOStream pair to make things
@@ -103,10 +105,30 @@ typedef struct
   GCancellable *read_loop_cancellable;
 
   /*
-   * Every JSONRPC invocation needs a request id. This is a monotonic
-   * integer that we encode as a string to the server.
+   * Fails calls which reached their deadline. There is a single source
+   * for all of the calls, which is ready once the timer wheel of the
+   * invocations table next expires.
    */
-  gint64 sequence;
+  GSource *timer_source;
+
+  /*
+   * The method of the notification sent to the peer when a call is
+   * cancelled, such as "$/cancelRequest", or NULL to keep waiting for
+   * the reply of cancelled calls.
+   */
+  gchar *cancel_method;
+
+  /*
+   * Maps the ids of calls received in a batch to the IncomingBatch
+   * collecting their replies, until each of them has been replied to.
+   */
+  GHashTable *batch_replies;
+
+  /*
+   * How messages are delimited. With JSONRPC_FRAMING_AUTO, we switch our
+   * output to whatever framing the input stream detected.
+   */
+  JsonrpcFraming framing;
 
   /*
    * This bit indicates if we have sent a call yet. Once we send our
@@ -140,20 +162,77 @@ typedef struct
    * overhead.
    */
   guint use_gvariant : 1;
+
+  /*
+   * If large message bodies should be compressed when sent to the peer.
+   * This is enabled automatically once the peer sends compressed bodies.
+   */
+  guint use_compression : 1;
+
+  /*
+   * If large messages should be decoded on a worker thread so that the
+   * main loop is not blocked while parsing them.
+   */
+  guint decode_in_thread : 1;
+
+  /*
+   * Mirrors JsonrpcOutputStream:congested so that we can notify when it
+   * changes, including when the output stream goes away.
+   */
+  guint congested : 1;
 } JsonrpcClientPrivate;
 
 typedef struct
 {
-  GHashTable *invocations;
+  GPtrArray *invocations;
   GError *error;
 } PanicData;
 
+typedef struct
+{
+  /* The replies made so far, written together once there are no more */
+  GPtrArray *replies;
+
+  /* The tasks of the replies, completed once the replies are written */
+  GPtrArray *tasks;
+
+  /* The number of calls waiting for a reply, plus one while dispatching */
+  guint      n_pending;
+} IncomingBatch;
+
+struct _JsonrpcClientBatch
+{
+  grefcount      ref_count;
+  JsonrpcClient *client;
+
+  /* The a{sv} messages making up the batch, in order */
+  GPtrArray     *messages;
+
+  /* The calls in the batch, which must fail if it is never sent */
+  GArray        *calls;
+
+  guint          sent : 1;
+};
+
+typedef struct
+{
+  gint64 id;
+  gint64 deadline;
+  /* The position of the message of the call in the batch */
+  guint  index;
+} BatchCall;
+
 G_DEFINE_TYPE_WITH_PRIVATE (JsonrpcClient, jsonrpc_client, G_TYPE_OBJECT)
+G_DEFINE_BOXED_TYPE (JsonrpcClientBatch, jsonrpc_client_batch, jsonrpc_client_batch_ref, jsonrpc_client_batch_unref)
 
 enum {
   PROP_0,
   PROP_IO_STREAM,
   PROP_USE_GVARIANT,
+  PROP_USE_COMPRESSION,
+  PROP_DECODE_IN_THREAD,
+  PROP_CONGESTED,
+  PROP_CANCEL_METHOD,
   N_PROPS
 };
 
@@ -227,31 +306,65 @@ is_jsonrpc_call (GVariantDict *dict)
           g_variant_dict_contains (dict, "params"));
 }
 
+/*
+ * jsonrpc_client_unwatch_call:
+ *
+ * Destroys the source watching the cancellable of @task, a call which is
+ * no longer in the call table. The task and the source reference each
+ * other, so neither would be freed until the cancellable is cancelled.
+ */
+static void
+jsonrpc_client_unwatch_call (GTask *task)
+{
+  g_assert (G_IS_TASK (task));
+
+  g_task_set_task_data (task, NULL, NULL);
+}
+
+/*
+ * jsonrpc_client_remove_call:
+ *
+ * Removes the call @id from the call table.
+ *
+ * Returns: (transfer full) (nullable): the #GTask of the call, or %NULL
+ */
+static GTask *
+jsonrpc_client_remove_call (JsonrpcClient *self,
+                            gint64         id)
+{
+  JsonrpcClientPrivate *priv = jsonrpc_client_get_instance_private (self);
+  GTask *task;
+
+  g_assert (JSONRPC_IS_CLIENT (self));
+
+  if ((task = _jsonrpc_call_table_remove (&priv->invocations, id)))
+    jsonrpc_client_unwatch_call (task);
+
+  return task;
+}
+
 static gboolean
 error_invocations_from_idle (gpointer data)
 {
   PanicData *pd = data;
-  GHashTableIter iter;
-  GTask *task;
 
   g_assert (pd != NULL);
   g_assert (pd->invocations != NULL);
   g_assert (pd->error != NULL);
 
-  g_hash_table_iter_init (&iter, pd->invocations);
-  while (g_hash_table_iter_next (&iter, NULL, (gpointer *)&task))
-    {
-      if (!g_task_get_completed (task))
-        g_task_return_error (task, g_error_copy (pd->error));
-    }
+  for (guint i = 0; i < pd->invocations->len; i++)
+    g_task_return_error (g_ptr_array_index (pd->invocations, i), g_error_copy (pd->error));
 
-  g_clear_pointer (&pd->invocations, g_hash_table_unref);
+  g_clear_pointer (&pd->invocations, g_ptr_array_unref);
   g_clear_pointer (&pd->error, g_error_free);
   g_slice_free (PanicData, pd);
 
   return G_SOURCE_REMOVE;
 }
 
+static void jsonrpc_client_abandon_batches (JsonrpcClient *self,
+                                            GPtrArray     *tasks);
+
 static void
 cancel_pending_from_main (JsonrpcClient *self,
                           const GError  *error)
@@ -268,12 +381,33 @@ cancel_pending_from_main (JsonrpcClient *self,
    * re-entrancy cases.
    */
   pd = g_slice_new0 (PanicData);
-  pd->invocations = g_steal_pointer (&priv->invocations);
+  pd->invocations = _jsonrpc_call_table_steal_all (&priv->invocations);
   pd->error = g_error_copy (error);
+
+  g_ptr_array_foreach (pd->invocations, (GFunc)jsonrpc_client_unwatch_call, NULL);
+
+  /* Replies to incoming batches fail along with our own calls */
+  jsonrpc_client_abandon_batches (self, pd->invocations);
+
   g_idle_add_full (G_MAXINT, error_invocations_from_idle, pd, NULL);
+}
+
+static void
+jsonrpc_client_update_congested (JsonrpcClient *self)
+{
+  JsonrpcClientPrivate *priv = jsonrpc_client_get_instance_private (self);
+  gboolean congested;
+
+  g_assert (JSONRPC_IS_CLIENT (self));
+
+  congested = priv->output_stream != NULL &&
+              jsonrpc_output_stream_get_congested (priv->output_stream);
 
-  /* Keep a hashtable around for code that expects a pointer there */
-  priv->invocations = g_hash_table_new_full (NULL, NULL, NULL, g_object_unref);
+  if (congested != priv->congested)
+    {
+      priv->congested = congested;
+      g_object_notify_by_pspec (G_OBJECT (self), properties [PROP_CONGESTED]);
+    }
 }
 
 static gboolean
@@ -324,6 +458,8 @@ jsonrpc_client_panic (JsonrpcClient *self,
   g_clear_object (&priv->input_stream);
   g_clear_object (&priv->output_stream);
 
+  jsonrpc_client_update_congested (self);
+
   /*
    * Queue a "failed" signal from a main loop callback so that we don't
    * get the client into weird stuff from signal callbacks here.
@@ -363,6 +499,182 @@ jsonrpc_client_check_ready (JsonrpcClient  *self,
   return TRUE;
 }
 
+static IncomingBatch *
+incoming_batch_new (void)
+{
+  IncomingBatch *batch;
+
+  batch = g_slice_new0 (IncomingBatch);
+  batch->replies = g_ptr_array_new_with_free_func ((GDestroyNotify)g_variant_unref);
+  batch->tasks = g_ptr_array_new_with_free_func (g_object_unref);
+  batch->n_pending = 1;
+
+  return batch;
+}
+
+static void
+incoming_batch_free (IncomingBatch *batch)
+{
+  g_clear_pointer (&batch->replies, g_ptr_array_unref);
+  g_clear_pointer (&batch->tasks, g_ptr_array_unref);
+  g_slice_free (IncomingBatch, batch);
+}
+
+static void
+jsonrpc_client_batch_replies_cb (GObject      *object,
+                                 GAsyncResult *result,
+                                 gpointer      user_data)
+{
+  JsonrpcOutputStream *stream = (JsonrpcOutputStream *)object;
+  g_autoptr(GPtrArray) tasks = user_data;
+  g_autoptr(GError) error = NULL;
+
+  g_assert (JSONRPC_IS_OUTPUT_STREAM (stream));
+  g_assert (G_IS_ASYNC_RESULT (result));
+  g_assert (tasks != NULL);
+
+  jsonrpc_output_stream_write_message_finish (stream, result, &error);
+
+  for (guint i = 0; i < tasks->len; i++)
+    {
+      GTask *task = g_ptr_array_index (tasks, i);
+
+      if (error != NULL)
+        g_task_return_error (task, g_error_copy (error));
+      else
+        g_task_return_boolean (task, TRUE);
+    }
+}
+
+/*
+ * jsonrpc_client_release_batch:
+ *
+ * Drops a pending reply of @batch. Once none are left, the replies are
+ * written to the peer as a single batch and @batch is freed.
+ */
+static void
+jsonrpc_client_release_batch (JsonrpcClient *self,
+                              IncomingBatch *batch)
+{
+  JsonrpcClientPrivate *priv = jsonrpc_client_get_instance_private (self);
+  g_autoptr(GVariant) message = NULL;
+  g_autoptr(GError) error = NULL;
+
+  g_assert (JSONRPC_IS_CLIENT (self));
+  g_assert (batch != NULL);
+  g_assert (batch->n_pending > 0);
+
+  if (--batch->n_pending > 0)
+    return;
+
+  /* A batch of notifications gets no reply at all */
+  if (batch->replies->len == 0)
+    goto cleanup;
+
+  if (!jsonrpc_client_check_ready (self, &error))
+    {
+      for (guint i = 0; i < batch->tasks->len; i++)
+        g_task_return_error (g_ptr_array_index (batch->tasks, i), g_error_copy (error));
+      goto cleanup;
+    }
+
+  message = g_variant_take_ref (g_variant_new_array (G_VARIANT_TYPE_VARDICT,
+                                                     (GVariant * const *)batch->replies->pdata,
+                                                     batch->replies->len));
+
+  jsonrpc_output_stream_queue_message_async (priv->output_stream,
+                                             message,
+                                             JSONRPC_WRITE_PRIORITY_REPLY,
+                                             NULL,
+                                             NULL,
+                                             batch->tasks->len ? jsonrpc_client_batch_replies_cb : NULL,
+                                             batch->tasks->len ? g_steal_pointer (&batch->tasks) : NULL);
+
+cleanup:
+  incoming_batch_free (batch);
+}
+
+/*
+ * jsonrpc_client_take_batch_reply:
+ *
+ * Collects @message if it replies to a call which was received in a batch,
+ * along with @task to complete once it has been written.
+ *
+ * Returns: %TRUE if @message was collected and must not be written
+ */
+static gboolean
+jsonrpc_client_take_batch_reply (JsonrpcClient *self,
+                                 GVariant      *message,
+                                 GTask         *task)
+{
+  JsonrpcClientPrivate *priv = jsonrpc_client_get_instance_private (self);
+  g_autoptr(GVariant) id = NULL;
+  IncomingBatch *batch;
+
+  g_assert (JSONRPC_IS_CLIENT (self));
+  g_assert (message != NULL);
+  g_assert (!task || G_IS_TASK (task));
+
+  if (priv->batch_replies == NULL || g_hash_table_size (priv->batch_replies) == 0)
+    return FALSE;
+
+  if (!(id = g_variant_lookup_value (message, "id", NULL)) ||
+      !g_variant_type_is_basic (g_variant_get_type (id)) ||
+      !(batch = g_hash_table_lookup (priv->batch_replies, id)))
+    return FALSE;
+
+  g_hash_table_remove (priv->batch_replies, id);
+
+  g_ptr_array_add (batch->replies, g_variant_ref (message));
+
+  if (task != NULL)
+    g_ptr_array_add (batch->tasks, g_object_ref (task));
+
+  jsonrpc_client_release_batch (self, batch);
+
+  return TRUE;
+}
+
+/*
+ * jsonrpc_client_abandon_batches:
+ *
+ * Stops waiting for replies to the calls of incoming batches, dropping the
+ * replies made so far. Their tasks are moved to @tasks so that they can
+ * fail.
+ */
+static void
+jsonrpc_client_abandon_batches (JsonrpcClient *self,
+                                GPtrArray     *tasks)
+{
+  JsonrpcClientPrivate *priv = jsonrpc_client_get_instance_private (self);
+  GHashTableIter iter;
+  gpointer value;
+
+  g_assert (JSONRPC_IS_CLIENT (self));
+  g_assert (tasks != NULL);
+
+  if (priv->batch_replies == NULL)
+    return;
+
+  g_hash_table_iter_init (&iter, priv->batch_replies);
+
+  while (g_hash_table_iter_next (&iter, NULL, &value))
+    {
+      IncomingBatch *batch = value;
+
+      g_hash_table_iter_remove (&iter);
+
+      for (guint i = 0; i < batch->tasks->len; i++)
+        g_ptr_array_add (tasks, g_object_ref (g_ptr_array_index (batch->tasks, i)));
+
+      /* Nothing is written for a batch which cannot be completed */
+      g_ptr_array_set_size (batch->tasks, 0);
+      g_ptr_array_set_size (batch->replies, 0);
+
+      jsonrpc_client_release_batch (self, batch);
+    }
+}
+
 static void
 jsonrpc_client_constructed (GObject *object)
 {
@@ -385,6 +697,15 @@ jsonrpc_client_constructed (GObject *object)
 
   priv->input_stream = jsonrpc_input_stream_new (input_stream);
   priv->output_stream = jsonrpc_output_stream_new (output_stream);
+
+  g_signal_connect_object (priv->output_stream,
+                           "notify::congested",
+                           G_CALLBACK (jsonrpc_client_update_congested),
+                           self,
+                           G_CONNECT_SWAPPED);
+
+  /* Only decode params and results once we know they will be used */
+  jsonrpc_input_stream_set_lazy_decoding (priv->input_stream, TRUE);
 }
 
 static void
@@ -393,7 +714,34 @@ jsonrpc_client_dispose (GObject *object)
   JsonrpcClient *self = (JsonrpcClient *)object;
   JsonrpcClientPrivate *priv = jsonrpc_client_get_instance_private (self);
 
-  g_clear_pointer (&priv->invocations, g_hash_table_unref);
+  {
+    g_autoptr(GPtrArray) calls = _jsonrpc_call_table_steal_all (&priv->invocations);
+
+    g_ptr_array_foreach (calls, (GFunc)jsonrpc_client_unwatch_call, NULL);
+  }
+
+  _jsonrpc_call_table_clear (&priv->invocations);
+
+  if (priv->batch_replies != NULL)
+    {
+      g_autoptr(GPtrArray) tasks = g_ptr_array_new_with_free_func (g_object_unref);
+
+      jsonrpc_client_abandon_batches (self, tasks);
+
+      for (guint i = 0; i < tasks->len; i++)
+        g_task_return_new_error (g_ptr_array_index (tasks, i),
+                                 G_IO_ERROR,
+                                 G_IO_ERROR_CLOSED,
+                                 "The client was disposed");
+
+      g_clear_pointer (&priv->batch_replies, g_hash_table_unref);
+    }
+
+  if (priv->timer_source != NULL)
+    {
+      g_source_destroy (priv->timer_source);
+      g_clear_pointer (&priv->timer_source, g_source_unref);
+    }
 
   g_clear_object (&priv->input_stream);
   g_clear_object (&priv->output_stream);
@@ -403,6 +751,17 @@ jsonrpc_client_dispose (GObject *object)
   G_OBJECT_CLASS (jsonrpc_client_parent_class)->dispose (object);
 }
 
+static void
+jsonrpc_client_finalize (GObject *object)
+{
+  JsonrpcClient *self = (JsonrpcClient *)object;
+  JsonrpcClientPrivate *priv = jsonrpc_client_get_instance_private (self);
+
+  g_clear_pointer (&priv->cancel_method, g_free);
+
+  G_OBJECT_CLASS (jsonrpc_client_parent_class)->finalize (object);
+}
+
 static void
 jsonrpc_client_get_property (GObject    *object,
                              guint       prop_id,
@@ -417,6 +776,22 @@ jsonrpc_client_get_property (GObject    *object,
       g_value_set_boolean (value, jsonrpc_client_get_use_gvariant (self));
       break;
 
+    case PROP_USE_COMPRESSION:
+      g_value_set_boolean (value, jsonrpc_client_get_use_compression (self));
+      break;
+
+    case PROP_DECODE_IN_THREAD:
+      g_value_set_boolean (value, jsonrpc_client_get_decode_in_thread (self));
+      break;
+
+    case PROP_CONGESTED:
+      g_value_set_boolean (value, jsonrpc_client_get_congested (self));
+      break;
+
+    case PROP_CANCEL_METHOD:
+      g_value_set_string (value, jsonrpc_client_get_cancel_method (self));
+      break;
+
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
     }
@@ -441,6 +816,18 @@ jsonrpc_client_set_property (GObject      *object,
       jsonrpc_client_set_use_gvariant (self, g_value_get_boolean (value));
       break;
 
+    case PROP_USE_COMPRESSION:
+      jsonrpc_client_set_use_compression (self, g_value_get_boolean (value));
+      break;
+
+    case PROP_DECODE_IN_THREAD:
+      jsonrpc_client_set_decode_in_thread (self, g_value_get_boolean (value));
+      break;
+
+    case PROP_CANCEL_METHOD:
+      jsonrpc_client_set_cancel_method (self, g_value_get_string (value));
+      break;
+
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
     }
@@ -453,6 +840,7 @@ jsonrpc_client_class_init (JsonrpcClientClass *klass)
 
   object_class->constructed = jsonrpc_client_constructed;
   object_class->dispose = jsonrpc_client_dispose;
+  object_class->finalize = jsonrpc_client_finalize;
   object_class->get_property = jsonrpc_client_get_property;
   object_class->set_property = jsonrpc_client_set_property;
 
@@ -492,6 +880,85 @@ jsonrpc_client_class_init (JsonrpcClientClass *klass)
                           FALSE,
                           (G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
 
+  /**
+   * JsonrpcClient:use-compression:
+   *
+   * The "use-compression" property denotes if large message bodies should
+   * be compressed before being sent to the peer. You should only set this
+   * if you know the peer supports the "Content-Encoding" header.
+   *
+   * This is enabled automatically when the peer sends a compressed message,
+   * much like [property@Client:use-gvariant].
+   *
+   * Since: 3.46
+   */
+  properties [PROP_USE_COMPRESSION] =
+    g_param_spec_boolean ("use-compression",
+                          "Use Compression",
+                          "If large message bodies should be compressed",
+                          FALSE,
+                          (G_PARAM_READWRITE | G_PARAM_EXPLICIT_NOTIFY | G_PARAM_STATIC_STRINGS));
+
+  /**
+   * JsonrpcClient:decode-in-thread:
+   *
+   * The "decode-in-thread" property denotes if large messages received from
+   * the peer should be decoded on a worker thread.
+   *
+   * This keeps the main loop responsive while receiving large responses.
+   * Messages are still dispatched on the main context in the order they
+   * were received.
+   *
+   * Since: 3.46
+   */
+  properties [PROP_DECODE_IN_THREAD] =
+    g_param_spec_boolean ("decode-in-thread",
+                          "Decode in Thread",
+                          "If large messages should be decoded on a worker thread",
+                          FALSE,
+                          (G_PARAM_READWRITE | G_PARAM_EXPLICIT_NOTIFY | G_PARAM_STATIC_STRINGS));
+
+  /**
+   * JsonrpcClient:congested:
+   *
+   * The "congested" property is set while the peer is not keeping up with
+   * the messages sent to it, and more data is waiting to be written than
+   * allowed by the high water mark of the underlying
+   * [class@OutputStream].
+   *
+   * Servers should stop generating notifications for a client while it
+   * is congested. See [method@Client.wait_writable_async].
+   *
+   * Since: 3.46
+   */
+  properties [PROP_CONGESTED] =
+    g_param_spec_boolean ("congested",
+                          "Congested",
+                          "If the peer is not keeping up with our messages",
+                          FALSE,
+                          (G_PARAM_READABLE | G_PARAM_EXPLICIT_NOTIFY | G_PARAM_STATIC_STRINGS));
+
+  /**
+   * JsonrpcClient:cancel-method:
+   *
+   * The "cancel-method" property is the method of the notification sent to
+   * the peer when the #GCancellable of a call is cancelled, such as
+   * "$/cancelRequest" for the Language Server Protocol. The notification
+   * has the id of the call as its "id" parameter.
+   *
+   * When set, cancelled calls complete right away with %G_IO_ERROR_CANCELLED
+   * and the reply of the peer, if any, is discarded. Otherwise, which is the
+   * default, cancelled calls still wait for the reply of the peer.
+   *
+   * Since: 3.46
+   */
+  properties [PROP_CANCEL_METHOD] =
+    g_param_spec_string ("cancel-method",
+                         "Cancel Method",
+                         "The method of the notification sent when a call is cancelled",
+                         NULL,
+                         (G_PARAM_READWRITE | G_PARAM_EXPLICIT_NOTIFY | G_PARAM_STATIC_STRINGS));
+
   g_object_class_install_properties (object_class, N_PROPS, properties);
 
   /**
@@ -525,6 +992,9 @@ jsonrpc_client_class_init (JsonrpcClientClass *klass)
    *
    * If you handle the message, you are responsible for replying to the peer
    * in a timely manner using [method@Client.reply] or [method@Client.reply_async].
+   * The replies to calls received in a batch are written together once all
+   * of them have been replied to, so a call which is never replied to holds
+   * back the replies of its whole batch.
    *
    * Additionally, since 3.28 you may connect to the "detail" of this signal
    * to handle a specific method call. Use the method name as the detail of
@@ -582,7 +1052,7 @@ jsonrpc_client_init (JsonrpcClient *self)
 {
   JsonrpcClientPrivate *priv = jsonrpc_client_get_instance_private (self);
 
-  priv->invocations = g_hash_table_new_full (NULL, NULL, NULL, g_object_unref);
+  _jsonrpc_call_table_init (&priv->invocations);
   priv->is_first_call = TRUE;
   priv->read_loop_cancellable = g_cancellable_new ();
 }
@@ -611,38 +1081,250 @@ jsonrpc_client_new (GIOStream *io_stream)
                        NULL);
 }
 
-static void
-jsonrpc_client_remove_from_invocations (JsonrpcClient *self,
-                                        GTask         *task)
+static gboolean
+jsonrpc_client_timer_dispatch (GSource     *source,
+                               GSourceFunc  callback,
+                               gpointer     user_data)
+{
+  return callback (user_data);
+}
+
+static GSourceFuncs timer_source_funcs = {
+  .dispatch = jsonrpc_client_timer_dispatch,
+};
+
+static void jsonrpc_client_update_timer (JsonrpcClient *self);
+
+static gboolean
+jsonrpc_client_timer_cb (gpointer data)
 {
+  JsonrpcClient *self = data;
   JsonrpcClientPrivate *priv = jsonrpc_client_get_instance_private (self);
-  gpointer id;
+  g_autoptr(GPtrArray) expired = NULL;
 
   g_assert (JSONRPC_IS_CLIENT (self));
-  g_assert (G_IS_TASK (task));
 
-  id = g_task_get_task_data (task);
+  expired = _jsonrpc_call_table_steal_expired (&priv->invocations,
+                                               g_source_get_time (priv->timer_source));
+
+  jsonrpc_client_update_timer (self);
+
+  /* Nothing touches @self past this point, callbacks may release it */
+  if (expired != NULL)
+    {
+      g_ptr_array_foreach (expired, (GFunc)jsonrpc_client_unwatch_call, NULL);
+
+      for (guint i = 0; i < expired->len; i++)
+        g_task_return_new_error (g_ptr_array_index (expired, i),
+                                 G_IO_ERROR,
+                                 G_IO_ERROR_TIMED_OUT,
+                                 "The peer did not reply in time");
+    }
 
-  g_hash_table_remove (priv->invocations, id);
+  return G_SOURCE_CONTINUE;
 }
 
+/*
+ * jsonrpc_client_update_timer:
+ *
+ * Arms the timer failing calls which reached their deadline, for the next
+ * expiration of the timer wheel of the call table. A single #GSource is
+ * used for all of the calls.
+ */
 static void
-jsonrpc_client_call_notify_completed (JsonrpcClient *self,
-                                      GParamSpec    *pspec,
-                                      GTask         *task)
+jsonrpc_client_update_timer (JsonrpcClient *self)
 {
+  JsonrpcClientPrivate *priv = jsonrpc_client_get_instance_private (self);
+  gint64 next;
+
   g_assert (JSONRPC_IS_CLIENT (self));
-  g_assert (pspec != NULL);
-  g_assert (g_str_equal (pspec->name, "completed"));
-  g_assert (G_IS_TASK (task));
 
-  jsonrpc_client_remove_from_invocations (self, task);
+  next = _jsonrpc_call_table_get_next_expiration (&priv->invocations);
+
+  if (priv->timer_source == NULL)
+    {
+      if (next < 0)
+        return;
+
+      priv->timer_source = g_source_new (&timer_source_funcs, sizeof (GSource));
+      g_source_set_callback (priv->timer_source, jsonrpc_client_timer_cb, self, NULL);
+      g_source_set_name (priv->timer_source, "[jsonrpc-client-timer]");
+      g_source_attach (priv->timer_source, g_main_context_get_thread_default ());
+    }
+
+  g_source_set_ready_time (priv->timer_source, next);
 }
 
-static void
-jsonrpc_client_call_write_cb (GObject      *object,
-                              GAsyncResult *result,
-                              gpointer      user_data)
+typedef struct
+{
+  GSource *source;
+  gint64   id;
+} CancelData;
+
+static void
+cancel_data_free (gpointer data)
+{
+  CancelData *cd = data;
+
+  g_source_destroy (cd->source);
+  g_source_unref (cd->source);
+  g_slice_free (CancelData, cd);
+}
+
+static gboolean
+jsonrpc_client_call_cancelled (GCancellable *cancellable,
+                               gpointer      user_data)
+{
+  GTask *task = user_data;
+  JsonrpcClient *self = g_task_get_source_object (task);
+  JsonrpcClientPrivate *priv = jsonrpc_client_get_instance_private (self);
+  CancelData *cd = g_task_get_task_data (task);
+  g_autoptr(GTask) removed = NULL;
+  gint64 id;
+
+  g_assert (G_IS_TASK (task));
+  g_assert (JSONRPC_IS_CLIENT (self));
+
+  /* @cd is freed once the call leaves the call table */
+  id = cd->id;
+
+  /* The call completed already */
+  if (!(removed = jsonrpc_client_remove_call (self, id)))
+    return G_SOURCE_REMOVE;
+
+  g_assert (removed == task);
+
+  /* The peer may still reply to the call */
+  _jsonrpc_call_table_mark_stale (&priv->invocations, id);
+
+  if (priv->cancel_method != NULL && jsonrpc_client_check_ready (self, NULL))
+    {
+      g_autoptr(GVariant) message = NULL;
+      GVariantDict params;
+      GVariantDict dict;
+
+      g_variant_dict_init (&params, NULL);
+      g_variant_dict_insert (&params, "id", "x", id);
+
+      g_variant_dict_init (&dict, NULL);
+      g_variant_dict_insert (&dict, "jsonrpc", "s", "2.0");
+      g_variant_dict_insert (&dict, "method", "s", priv->cancel_method);
+      g_variant_dict_insert_value (&dict, "params", g_variant_dict_end (&params));
+
+      message = g_variant_take_ref (g_variant_dict_end (&dict));
+
+      /*
+       * Use the same lane as calls so that the notification can never
+       * reach the peer before the request it refers to.
+       */
+      jsonrpc_output_stream_queue_message_async (priv->output_stream,
+                                                 message,
+                                                 JSONRPC_WRITE_PRIORITY_NORMAL,
+                                                 NULL,
+                                                 NULL,
+                                                 NULL,
+                                                 NULL);
+    }
+
+  g_task_return_error_if_cancelled (task);
+
+  return G_SOURCE_REMOVE;
+}
+
+/*
+ * jsonrpc_client_watch_cancellable:
+ *
+ * Completes the call @id as soon as the cancellable of @task is cancelled
+ * and notifies the peer, see [property@Client:cancel-method].
+ */
+static void
+jsonrpc_client_watch_cancellable (JsonrpcClient *self,
+                                  GTask         *task,
+                                  gint64         id)
+{
+  CancelData *cd;
+
+  g_assert (JSONRPC_IS_CLIENT (self));
+  g_assert (G_IS_TASK (task));
+  g_assert (g_task_get_cancellable (task) != NULL);
+
+  cd = g_slice_new0 (CancelData);
+  cd->source = g_cancellable_source_new (g_task_get_cancellable (task));
+  cd->id = id;
+
+  /* The source goes away along with @task */
+  g_task_attach_source (task, cd->source, (GSourceFunc)jsonrpc_client_call_cancelled);
+  g_task_set_task_data (task, cd, cancel_data_free);
+}
+
+/*
+ * jsonrpc_client_register_call:
+ *
+ * Tracks @task as a call to @method until the peer replies. The call has
+ * no deadline and is not watched for cancellation until it is armed with
+ * jsonrpc_client_arm_call().
+ *
+ * Returns: (transfer full): the message to write to the peer
+ */
+static GVariant *
+jsonrpc_client_register_call (JsonrpcClient *self,
+                              const gchar   *method,
+                              GVariant      *params,
+                              GTask         *task,
+                              gint64        *idval)
+{
+  JsonrpcClientPrivate *priv = jsonrpc_client_get_instance_private (self);
+  GVariantDict dict;
+
+  g_assert (JSONRPC_IS_CLIENT (self));
+  g_assert (method != NULL);
+  g_assert (params != NULL);
+  g_assert (G_IS_TASK (task));
+  g_assert (idval != NULL);
+
+  *idval = _jsonrpc_call_table_add (&priv->invocations, task, 0);
+
+  g_variant_dict_init (&dict, NULL);
+  g_variant_dict_insert (&dict, "jsonrpc", "s", "2.0");
+  g_variant_dict_insert (&dict, "id", "x", *idval);
+  g_variant_dict_insert (&dict, "method", "s", method);
+  g_variant_dict_insert_value (&dict, "params", params);
+
+  return g_variant_take_ref (g_variant_dict_end (&dict));
+}
+
+/*
+ * jsonrpc_client_arm_call:
+ *
+ * Makes the call @id of @task time out at @deadline and, with
+ * [property@Client:cancel-method] set, be cancelled along with @task.
+ * This is done once the call is being sent.
+ */
+static void
+jsonrpc_client_arm_call (JsonrpcClient *self,
+                         GTask         *task,
+                         gint64         id,
+                         gint64         deadline)
+{
+  JsonrpcClientPrivate *priv = jsonrpc_client_get_instance_private (self);
+
+  g_assert (JSONRPC_IS_CLIENT (self));
+  g_assert (G_IS_TASK (task));
+
+  if (deadline > 0)
+    {
+      _jsonrpc_call_table_set_deadline (&priv->invocations, id, deadline);
+      jsonrpc_client_update_timer (self);
+    }
+
+  if (g_task_get_cancellable (task) != NULL && priv->cancel_method != NULL)
+    jsonrpc_client_watch_cancellable (self, task, id);
+}
+
+static void
+jsonrpc_client_call_write_cb (GObject      *object,
+                              GAsyncResult *result,
+                              gpointer      user_data)
 {
   JsonrpcOutputStream *stream = (JsonrpcOutputStream *)object;
   g_autoptr(GTask) task = user_data;
@@ -669,59 +1351,216 @@ jsonrpc_client_call_write_cb (GObject      *object,
    */
 }
 
-static void
-jsonrpc_client_call_read_cb (GObject      *object,
-                             GAsyncResult *result,
-                             gpointer      user_data)
+static gboolean jsonrpc_client_dispatch (JsonrpcClient *self,
+                                         GVariant      *message,
+                                         IncomingBatch *batch);
+
+/*
+ * create_invalid_request:
+ *
+ * Creates the error replied to a message which is not a valid request,
+ * such as an empty batch, an element of a batch which is not an object or
+ * a call reusing the id of one still awaiting its reply. @id is %NULL if
+ * the message has no id to reply to.
+ *
+ * Returns: (transfer full): the reply
+ */
+static GVariant *
+create_invalid_request (GVariant *id)
+{
+  GVariantDict error_dict;
+  GVariantDict reply;
+
+  g_variant_dict_init (&error_dict, NULL);
+  g_variant_dict_insert (&error_dict, "code", "i", JSONRPC_CLIENT_ERROR_INVALID_REQUEST);
+  g_variant_dict_insert (&error_dict, "message", "s", "Invalid Request");
+
+  /* Without an id to reply to, it is null */
+  if (id == NULL)
+    id = g_variant_new_maybe (G_VARIANT_TYPE_VARIANT, NULL);
+
+  g_variant_dict_init (&reply, NULL);
+  g_variant_dict_insert (&reply, "jsonrpc", "s", "2.0");
+  g_variant_dict_insert_value (&reply, "id", id);
+  g_variant_dict_insert_value (&reply, "error", g_variant_dict_end (&error_dict));
+
+  return g_variant_take_ref (g_variant_dict_end (&reply));
+}
+
+/*
+ * is_valid_batch_element:
+ *
+ * Checks if @element of a batch is a JSONRPC 2.0 message. Anything else,
+ * such as a number or a nested batch, gets an Invalid Request error in
+ * the reply to the batch rather than failing the connection.
+ */
+static gboolean
+is_valid_batch_element (GVariant *element)
 {
-  JsonrpcInputStream *stream = (JsonrpcInputStream *)object;
-  g_autoptr(JsonrpcClient) self = user_data;
-  JsonrpcClientPrivate *priv = jsonrpc_client_get_instance_private (self);
-  g_autoptr(GVariant) message = NULL;
-  g_autoptr(GError) error = NULL;
   g_autoptr(GVariantDict) dict = NULL;
 
-  g_assert (JSONRPC_IS_INPUT_STREAM (stream));
+  if (!g_variant_is_of_type (element, G_VARIANT_TYPE_VARDICT))
+    return FALSE;
+
+  dict = g_variant_dict_new (element);
+
+  return is_jsonrpc_reply (dict);
+}
+
+static GVariant *
+get_batch_element (GVariant *batch,
+                   gsize     position)
+{
+  g_autoptr(GVariant) child = g_variant_get_child_value (batch, position);
+
+  if (g_variant_is_of_type (child, G_VARIANT_TYPE_VARIANT))
+    return g_variant_get_variant (child);
+
+  return g_steal_pointer (&child);
+}
+
+/*
+ * jsonrpc_client_track_call:
+ *
+ * Remembers that the call with @id received in @batch awaits a reply, so
+ * that the reply is collected into @batch. Calls received on their own are
+ * not tracked, so calls which are never replied to cost nothing.
+ *
+ * An id may not be shared with a call of a batch which still awaits its
+ * reply, as we could not tell which of them a reply is for.
+ *
+ * Returns: %FALSE if the call must be rejected
+ */
+static gboolean
+jsonrpc_client_track_call (JsonrpcClient *self,
+                           GVariant      *id,
+                           IncomingBatch *batch)
+{
+  JsonrpcClientPrivate *priv = jsonrpc_client_get_instance_private (self);
+
+  g_assert (JSONRPC_IS_CLIENT (self));
+  g_assert (id != NULL);
+
+  /* Replies to these cannot be matched, so they are written on their own */
+  if (!g_variant_type_is_basic (g_variant_get_type (id)))
+    return TRUE;
+
+  /* Without a batch in flight, there is nothing to look up */
+  if (batch == NULL)
+    return priv->batch_replies == NULL ||
+           g_hash_table_size (priv->batch_replies) == 0 ||
+           !g_hash_table_contains (priv->batch_replies, id);
+
+  if (priv->batch_replies == NULL)
+    priv->batch_replies = g_hash_table_new_full (g_variant_hash,
+                                                  g_variant_equal,
+                                                  (GDestroyNotify)g_variant_unref,
+                                                  NULL);
+
+  if (g_hash_table_contains (priv->batch_replies, id))
+    return FALSE;
+
+  g_hash_table_insert (priv->batch_replies, g_variant_ref (id), batch);
+  batch->n_pending++;
+
+  return TRUE;
+}
+
+/*
+ * jsonrpc_client_dispatch_batch:
+ *
+ * Handles each message of a batch received from the peer. The handlers of
+ * the calls run right away, and their replies are collected so that they
+ * are written back as a single batch once all of them have replied. Calls
+ * with an id we cannot track are replied to on their own.
+ *
+ * As required by JSONRPC 2.0, an empty batch gets a single Invalid Request
+ * error and each invalid element of a batch gets one in the reply.
+ */
+static gboolean
+jsonrpc_client_dispatch_batch (JsonrpcClient *self,
+                               GVariant      *batch)
+{
+  JsonrpcClientPrivate *priv = jsonrpc_client_get_instance_private (self);
+  gsize n_children = g_variant_n_children (batch);
+  IncomingBatch *incoming;
+  gboolean ret = TRUE;
+
   g_assert (JSONRPC_IS_CLIENT (self));
+  g_assert (batch != NULL);
 
-  if (!jsonrpc_input_stream_read_message_finish (stream, result, &message, &error))
+  if (n_children == 0)
     {
-      /* Handle jsonrpc_client_close() conditions gracefully. */
-      if (priv->in_shutdown &&
-          g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
-        return;
+      g_autoptr(GVariant) reply = NULL;
 
-      /*
-       * If we fail to read a message, that means we couldn't even receive
-       * a message describing the error. All we can do in this case is panic
-       * and shutdown the whole client.
-       */
-      jsonrpc_client_panic (self, error);
-      return;
-    }
+      if (jsonrpc_client_check_ready (self, NULL))
+        {
+          reply = create_invalid_request (NULL);
+          jsonrpc_output_stream_queue_message_async (priv->output_stream,
+                                                     reply,
+                                                     JSONRPC_WRITE_PRIORITY_REPLY,
+                                                     NULL,
+                                                     NULL,
+                                                     NULL,
+                                                     NULL);
+        }
 
-  g_assert (message != NULL);
+      return TRUE;
+    }
 
-  /* If we received a gvariant-based message, upgrade connection */
-  if (_jsonrpc_input_stream_get_has_seen_gvariant (stream))
-    jsonrpc_client_set_use_gvariant (self, TRUE);
+  incoming = incoming_batch_new ();
 
-  if (g_variant_is_of_type (message, G_VARIANT_TYPE ("aa{sv}")))
+  for (gsize i = 0; i < n_children; i++)
     {
-      /* TODO: Handle incoming batch mode */
-      error = g_error_new_literal (G_IO_ERROR,
-                                   G_IO_ERROR_INVALID_DATA,
-                                   "Batch mode not supported");
-      jsonrpc_client_panic (self, error);
-      return;
+      g_autoptr(GVariant) element = get_batch_element (batch, i);
+
+      if (!is_valid_batch_element (element))
+        {
+          g_ptr_array_add (incoming->replies, create_invalid_request (NULL));
+          continue;
+        }
+
+      if (!(ret = jsonrpc_client_dispatch (self, element, incoming)))
+        break;
     }
+
+  jsonrpc_client_release_batch (self, incoming);
+
+  return ret;
+}
+
+/*
+ * jsonrpc_client_dispatch:
+ *
+ * Handles a single message received from the peer. @batch is the batch
+ * which @message is part of, if any.
+ *
+ * Returns: %FALSE if the client panicked and no further messages
+ *   should be processed.
+ */
+static gboolean
+jsonrpc_client_dispatch (JsonrpcClient *self,
+                         GVariant      *message,
+                         IncomingBatch *batch)
+{
+  JsonrpcClientPrivate *priv = jsonrpc_client_get_instance_private (self);
+  g_autoptr(GError) error = NULL;
+  g_autoptr(GVariantDict) dict = NULL;
+
+  g_assert (JSONRPC_IS_CLIENT (self));
+  g_assert (message != NULL);
+
+  /* Batches are aa{sv} with GVariant encoding and av when decoded from JSON */
+  if (g_variant_is_of_type (message, G_VARIANT_TYPE ("aa{sv}")) ||
+      g_variant_is_of_type (message, G_VARIANT_TYPE ("av")))
+    return jsonrpc_client_dispatch_batch (self, message);
   else if (!g_variant_is_of_type (message, G_VARIANT_TYPE_VARDICT))
     {
       error = g_error_new_literal (G_IO_ERROR,
                                    G_IO_ERROR_INVALID_DATA,
                                    "Improper reply from peer, not a vardict");
       jsonrpc_client_panic (self, error);
-      return;
+      return FALSE;
     }
 
   dict = g_variant_dict_new (message);
@@ -737,7 +1576,7 @@ jsonrpc_client_call_read_cb (GObject      *object,
                                    G_IO_ERROR_INVALID_DATA,
                                    "Improper reply from peer");
       jsonrpc_client_panic (self, error);
-      return;
+      return FALSE;
     }
 
   /*
@@ -753,35 +1592,53 @@ jsonrpc_client_call_read_cb (GObject      *object,
         {
           GQuark detail = g_quark_try_string (method_name);
 
-          params = g_variant_dict_lookup_value (dict, "params", NULL);
+          /* Don't decode params if nobody is going to look at them */
+          if (JSONRPC_CLIENT_GET_CLASS (self)->notification == NULL &&
+              !g_signal_has_handler_pending (self, signals [NOTIFICATION], detail, FALSE))
+            return TRUE;
+
+          if (!(params = jsonrpc_message_lookup_value (message, "params", &error)) && error != NULL)
+            {
+              jsonrpc_client_panic (self, error);
+              return FALSE;
+            }
+
           g_signal_emit (self, signals [NOTIFICATION], detail, method_name, params);
         }
 
-      goto begin_next_read;
+      return TRUE;
     }
 
   if (is_jsonrpc_result (dict))
     {
       g_autoptr(GVariant) params = NULL;
+      g_autoptr(GTask) task = NULL;
       gint64 id = -1;
-      GTask *task;
 
-      if (!g_variant_dict_lookup (dict, "id", "x", &id) ||
-          NULL == (task = g_hash_table_lookup (priv->invocations, GINT_TO_POINTER (id))))
+      if (!g_variant_dict_lookup (dict, "id", "x", &id))
+        id = -1;
+
+      /* The call timed out or was cancelled, nobody waits for the reply */
+      if (_jsonrpc_call_table_is_stale (&priv->invocations, id))
+        return TRUE;
+
+      if (NULL == (task = jsonrpc_client_remove_call (self, id)))
         {
           error = g_error_new_literal (G_IO_ERROR,
                                        G_IO_ERROR_INVALID_DATA,
                                        "Reply to missing or invalid task");
           jsonrpc_client_panic (self, error);
-          return;
+          return FALSE;
         }
 
-      if (NULL != (params = g_variant_dict_lookup_value (dict, "result", NULL)))
+      if (NULL != (params = jsonrpc_message_lookup_value (message, "result", &error)))
         g_task_return_pointer (task, g_steal_pointer (&params), (GDestroyNotify)g_variant_unref);
+      else if (error != NULL)
+        g_task_return_error (task, g_steal_pointer (&error));
       else
         g_task_return_pointer (task, NULL, NULL);
 
-      goto begin_next_read;
+      return TRUE;
     }
 
   /*
@@ -802,15 +1659,50 @@ jsonrpc_client_call_read_cb (GObject      *object,
                                        G_IO_ERROR_INVALID_DATA,
                                        "Call contains invalid method or id field");
           jsonrpc_client_panic (self, error);
-          return;
+          return FALSE;
         }
 
-      params = g_variant_dict_lookup_value (dict, "params", NULL);
-
       g_assert (method_name != NULL);
       g_assert (id != NULL);
 
+      /* The peer may not reuse the id of a batched call awaiting its reply */
+      if (!jsonrpc_client_track_call (self, id, batch))
+        {
+          g_autoptr(GVariant) reply = create_invalid_request (id);
+
+          if (batch != NULL)
+            g_ptr_array_add (batch->replies, g_steal_pointer (&reply));
+          else if (jsonrpc_client_check_ready (self, NULL))
+            jsonrpc_output_stream_queue_message_async (priv->output_stream,
+                                                       reply,
+                                                       JSONRPC_WRITE_PRIORITY_REPLY,
+                                                       NULL,
+                                                       NULL,
+                                                       NULL,
+                                                       NULL);
+
+          return TRUE;
+        }
+
       detail = g_quark_try_string (method_name);
+
+      /* Reply without decoding params if nobody can handle the call */
+      if (JSONRPC_CLIENT_GET_CLASS (self)->handle_call == NULL &&
+          !g_signal_has_handler_pending (self, signals [HANDLE_CALL], detail, FALSE))
+        {
+          jsonrpc_client_reply_error_async (self, id, JSONRPC_CLIENT_ERROR_METHOD_NOT_FOUND,
+                                            "The method does not exist or is not available",
+                                            NULL, NULL, NULL);
+          return TRUE;
+        }
+
+      if (!(params = jsonrpc_message_lookup_value (message, "params", &error)) && error != NULL)
+        {
+          jsonrpc_client_reply_error_async (self, id, JSONRPC_CLIENT_ERROR_PARSE_ERROR,
+                                            error->message, NULL, NULL, NULL);
+          return TRUE;
+        }
+
       g_signal_emit (self, signals [HANDLE_CALL], detail, method_name, id, params, &ret);
 
       if (ret == FALSE)
@@ -818,7 +1710,7 @@ jsonrpc_client_call_read_cb (GObject      *object,
                                           "The method does not exist or is not available",
                                           NULL, NULL, NULL);
 
-      goto begin_next_read;
+      return TRUE;
     }
 
   /*
@@ -848,14 +1740,14 @@ jsonrpc_client_call_read_cb (GObject      *object,
 
       if (g_variant_dict_lookup (dict, "id", "x", &id))
         {
-          GTask *task = g_hash_table_lookup (priv->invocations, GINT_TO_POINTER (id));
+          g_autoptr(GTask) task = jsonrpc_client_remove_call (self, id);
 
           if (task != NULL)
             g_task_return_error (task, g_steal_pointer (&error));
-          else
+          else if (!_jsonrpc_call_table_is_stale (&priv->invocations, id))
             g_warning ("Received error for task %"G_GINT64_FORMAT" which is unknown", id);
 
-          goto begin_next_read;
+          return TRUE;
         }
 
       /*
@@ -863,153 +1755,581 @@ jsonrpc_client_call_read_cb (GObject      *object,
        * take this as a failure case and panic on the line.
        */
       jsonrpc_client_panic (self, error);
-      return;
+      return FALSE;
     }
 
   g_warning ("Unhandled RPC from peer!");
 
-begin_next_read:
-  if (priv->input_stream != NULL &&
-      priv->in_shutdown == FALSE &&
-      priv->failed == FALSE)
-    jsonrpc_input_stream_read_message_async (priv->input_stream,
-                                             priv->read_loop_cancellable,
-                                             jsonrpc_client_call_read_cb,
-                                             g_steal_pointer (&self));
+  return TRUE;
 }
 
 static void
-jsonrpc_client_call_sync_cb (GObject      *object,
+jsonrpc_client_call_read_cb (GObject      *object,
                              GAsyncResult *result,
                              gpointer      user_data)
 {
-  JsonrpcClient *self = (JsonrpcClient *)object;
-  GTask *task = user_data;
-  g_autoptr(GVariant) return_value = NULL;
+  JsonrpcInputStream *stream = (JsonrpcInputStream *)object;
+  g_autoptr(JsonrpcClient) self = user_data;
+  JsonrpcClientPrivate *priv = jsonrpc_client_get_instance_private (self);
+  g_autoptr(GPtrArray) messages = NULL;
   g_autoptr(GError) error = NULL;
 
+  g_assert (JSONRPC_IS_INPUT_STREAM (stream));
   g_assert (JSONRPC_IS_CLIENT (self));
-  g_assert (G_IS_ASYNC_RESULT (result));
-  g_assert (G_IS_TASK (task));
 
-  if (!jsonrpc_client_call_finish (self, result, &return_value, &error))
-    g_task_return_error (task, g_steal_pointer (&error));
-  else
-    g_task_return_pointer (task, g_steal_pointer (&return_value), (GDestroyNotify)g_variant_unref);
+  if (!(messages = jsonrpc_input_stream_read_messages_finish (stream, result, &error)))
+    {
+      /* Handle jsonrpc_client_close() conditions gracefully. */
+      if (priv->in_shutdown &&
+          g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+        return;
+
+      /*
+       * If we fail to read a message, that means we couldn't even receive
+       * a message describing the error. All we can do in this case is panic
+       * and shutdown the whole client.
+       */
+      jsonrpc_client_panic (self, error);
+      return;
+    }
+
+  g_assert (messages->len > 0);
+
+  /* If we received a gvariant-based message, upgrade connection */
+  if (_jsonrpc_input_stream_get_has_seen_gvariant (stream))
+    jsonrpc_client_set_use_gvariant (self, TRUE);
+
+  /* If the peer compresses messages, it can decompress ours too */
+  if (_jsonrpc_input_stream_get_seen_compression (stream) != JSONRPC_COMPRESSION_NONE)
+    jsonrpc_client_set_use_compression (self, TRUE);
+
+  /* Reply using the same framing as the peer */
+  if (priv->framing == JSONRPC_FRAMING_AUTO)
+    jsonrpc_output_stream_set_framing (priv->output_stream,
+                                       jsonrpc_input_stream_get_framing (stream));
+
+  /*
+   * Dispatch everything that was already buffered. Handlers may close the
+   * client while we are dispatching, so stop as soon as that happens.
+   */
+  for (guint i = 0; i < messages->len; i++)
+    {
+      if (priv->in_shutdown || priv->failed)
+        return;
+
+      if (!jsonrpc_client_dispatch (self, g_ptr_array_index (messages, i), NULL))
+        return;
+    }
+
+  if (priv->input_stream != NULL &&
+      priv->in_shutdown == FALSE &&
+      priv->failed == FALSE)
+    jsonrpc_input_stream_read_messages_async (priv->input_stream,
+                                              priv->read_loop_cancellable,
+                                              jsonrpc_client_call_read_cb,
+                                              g_steal_pointer (&self));
+}
+
+static void
+jsonrpc_client_call_sync_cb (GObject      *object,
+                             GAsyncResult *result,
+                             gpointer      user_data)
+{
+  JsonrpcClient *self = (JsonrpcClient *)object;
+  GTask *task = user_data;
+  g_autoptr(GVariant) return_value = NULL;
+  g_autoptr(GError) error = NULL;
+
+  g_assert (JSONRPC_IS_CLIENT (self));
+  g_assert (G_IS_ASYNC_RESULT (result));
+  g_assert (G_IS_TASK (task));
+
+  if (!jsonrpc_client_call_finish (self, result, &return_value, &error))
+    g_task_return_error (task, g_steal_pointer (&error));
+  else
+    g_task_return_pointer (task, g_steal_pointer (&return_value), (GDestroyNotify)g_variant_unref);
+}
+
+/**
+ * jsonrpc_client_call:
+ * @self: A #JsonrpcClient
+ * @method: The name of the method to call
+ * @params: (transfer none) (nullable): A [struct@GLib.Variant] of parameters or %NULL
+ * @cancellable: (nullable): A #GCancellable or %NULL
+ * @return_value: (nullable) (out): A location for a [struct@GLib.Variant]
+ *
+ * Synchronously calls @method with @params on the remote peer.
+ *
+ * once a reply has been received, or failure, this function will return.
+ * If successful, @return_value will be set with the reslut field of
+ * the response.
+ *
+ * If @params is floating then this function consumes the reference.
+ *
+ * Returns: %TRUE on success; otherwise %FALSE and @error is set.
+ *
+ * Since: 3.26
+ */
+gboolean
+jsonrpc_client_call (JsonrpcClient  *self,
+                     const gchar    *method,
+                     GVariant       *params,
+                     GCancellable   *cancellable,
+                     GVariant      **return_value,
+                     GError        **error)
+{
+  JsonrpcClientPrivate *priv = jsonrpc_client_get_instance_private (self);
+  g_autoptr(JsonrpcOutputStream) output_stream = NULL;
+  g_autoptr(GTask) task = NULL;
+  g_autoptr(GMainContext) main_context = NULL;
+  g_autoptr(GVariant) local_return_value = NULL;
+  gboolean ret;
+
+  g_return_val_if_fail (JSONRPC_IS_CLIENT (self), FALSE);
+  g_return_val_if_fail (method != NULL, FALSE);
+  g_return_val_if_fail (!cancellable || G_IS_CANCELLABLE (cancellable), FALSE);
+
+  main_context = g_main_context_ref_thread_default ();
+
+  task = g_task_new (self, NULL, NULL, NULL);
+  g_task_set_source_tag (task, jsonrpc_client_call);
+
+  /* The call must be written even if corked, or we would wait forever */
+  if (priv->output_stream != NULL)
+    {
+      output_stream = g_object_ref (priv->output_stream);
+      _jsonrpc_output_stream_begin_sync (output_stream);
+    }
+
+  jsonrpc_client_call_async (self,
+                             method,
+                             params,
+                             cancellable,
+                             jsonrpc_client_call_sync_cb,
+                             task);
+
+  while (!g_task_get_completed (task))
+    g_main_context_iteration (main_context, TRUE);
+
+  if (output_stream != NULL)
+    _jsonrpc_output_stream_end_sync (output_stream);
+
+  local_return_value = g_task_propagate_pointer (task, error);
+  ret = local_return_value != NULL;
+
+  if (return_value != NULL)
+    *return_value = g_steal_pointer (&local_return_value);
+
+  return ret;
+}
+
+/**
+ * jsonrpc_client_call_with_id_async:
+ * @self: A #JsonrpcClient
+ * @method: The name of the method to call
+ * @params: (transfer none) (nullable): A [struct@GLib.Variant] of parameters or %NULL
+ * @id: (out) (transfer full) (optional): A location for a [struct@GLib.Variant]
+ *   describing the identifier used for the method call, or %NULL.
+ * @cancellable: (nullable): A #GCancellable or %NULL
+ * @callback: Callback to executed upon completion
+ * @user_data: User data for @callback
+ *
+ * Asynchronously calls @method with @params on the remote peer.
+ *
+ * Upon completion or failure, @callback is executed and it should
+ * call [method@Client.call_finish] to complete the request and release
+ * any memory held.
+ *
+ * This function is similar to [method@Client.call_async] except that
+ * it allows the caller to get the id of the command which might be useful
+ * in systems where you can cancel the operation (such as the Language
+ * Server Protocol).
+ *
+ * If @params is floating, the floating reference is consumed.
+ *
+ * Since: 3.30
+ */
+void
+jsonrpc_client_call_with_id_async (JsonrpcClient       *self,
+                                   const gchar         *method,
+                                   GVariant            *params,
+                                   GVariant           **id,
+                                   GCancellable        *cancellable,
+                                   GAsyncReadyCallback  callback,
+                                   gpointer             user_data)
+{
+  jsonrpc_client_call_with_deadline_async (self, method, params, -1, id, cancellable, callback, user_data);
+}
+
+/**
+ * jsonrpc_client_call_with_deadline_async:
+ * @self: A #JsonrpcClient
+ * @method: The name of the method to call
+ * @params: (transfer none) (nullable): A [struct@GLib.Variant] of parameters or %NULL
+ * @deadline: the monotonic time by which the peer must reply, or -1
+ * @id: (out) (transfer full) (optional): A location for a [struct@GLib.Variant]
+ *   describing the identifier used for the method call, or %NULL.
+ * @cancellable: (nullable): A #GCancellable or %NULL
+ * @callback: Callback to executed upon completion
+ * @user_data: User data for @callback
+ *
+ * Like [method@Client.call_with_id_async], except that the call fails with
+ * %G_IO_ERROR_TIMED_OUT if the peer has not replied by @deadline, which is
+ * in the time base of [func@GLib.get_monotonic_time]. A @deadline of -1
+ * means the call may wait forever.
+ *
+ * Deadlines are checked by a single timer shared by all the calls of
+ * @self, with a resolution of a few milliseconds, so setting one on every
+ * call is cheap. A reply received after the call timed out is ignored.
+ *
+ * Call [method@Client.call_finish] to complete the operation.
+ *
+ * If @params is floating, the floating reference is consumed.
+ *
+ * Since: 3.46
+ */
+void
+jsonrpc_client_call_with_deadline_async (JsonrpcClient       *self,
+                                         const gchar         *method,
+                                         GVariant            *params,
+                                         gint64               deadline,
+                                         GVariant           **id,
+                                         GCancellable        *cancellable,
+                                         GAsyncReadyCallback  callback,
+                                         gpointer             user_data)
+{
+  JsonrpcClientPrivate *priv = jsonrpc_client_get_instance_private (self);
+  g_autoptr(GVariant) message = NULL;
+  g_autoptr(GVariant) sunk_variant = NULL;
+  g_autoptr(GTask) task = NULL;
+  g_autoptr(GError) error = NULL;
+  gint64 idval;
+
+  g_return_if_fail (JSONRPC_IS_CLIENT (self));
+  g_return_if_fail (method != NULL);
+  g_return_if_fail (!cancellable || G_IS_CANCELLABLE (cancellable));
+
+  if (id != NULL)
+    *id = NULL;
+
+  task = g_task_new (self, cancellable, callback, user_data);
+  g_task_set_source_tag (task, jsonrpc_client_call_async);
+
+  if (params == NULL)
+    params = g_variant_new_maybe (G_VARIANT_TYPE_VARIANT, NULL);
+
+  /* If we got a floating reference, we should consume it */
+  if (g_variant_is_floating (params))
+    sunk_variant = g_variant_ref_sink (params);
+
+  if (!jsonrpc_client_check_ready (self, &error))
+    {
+      g_task_return_error (task, g_steal_pointer (&error));
+      return;
+    }
+
+  message = jsonrpc_client_register_call (self, method, params, task, &idval);
+  jsonrpc_client_arm_call (self, task, idval, deadline);
+
+  /*
+   * When the peer is notified of cancellation, the request itself must reach
+   * the peer in full, so the cancellable is not used for the write.
+   */
+  if (priv->cancel_method != NULL)
+    cancellable = NULL;
+
+  jsonrpc_output_stream_write_message_async (priv->output_stream,
+                                             message,
+                                             cancellable,
+                                             jsonrpc_client_call_write_cb,
+                                             g_steal_pointer (&task));
+
+  if (priv->is_first_call)
+    jsonrpc_client_start_listening (self);
+
+  if (id != NULL)
+    *id = g_variant_take_ref (g_variant_new_int64 (idval));
+}
+
+/**
+ * jsonrpc_client_call_async:
+ * @self: A #JsonrpcClient
+ * @method: The name of the method to call
+ * @params: (transfer none) (nullable): A [struct@GLib.Variant] of parameters or %NULL
+ * @cancellable: (nullable): A #GCancellable or %NULL
+ * @callback: a callback to executed upon completion
+ * @user_data: user data for @callback
+ *
+ * Asynchronously calls @method with @params on the remote peer.
+ *
+ * Upon completion or failure, @callback is executed and it should
+ * call [method@Client.call_finish] to complete the request and release
+ * any memory held.
+ *
+ * If @params is floating, the floating reference is consumed.
+ *
+ * Since: 3.26
+ */
+void
+jsonrpc_client_call_async (JsonrpcClient       *self,
+                           const gchar         *method,
+                           GVariant            *params,
+                           GCancellable        *cancellable,
+                           GAsyncReadyCallback  callback,
+                           gpointer             user_data)
+{
+  jsonrpc_client_call_with_id_async (self, method, params, NULL, cancellable, callback, user_data);
+}
+
+/**
+ * jsonrpc_client_call_finish:
+ * @self: A #JsonrpcClient.
+ * @result: A #GAsyncResult provided to the callback in [method@Client.call_async]
+ * @return_value: (out) (nullable): A location for a [struct@GLib.Variant] or %NULL
+ * @error: a location for a #GError or %NULL
+ *
+ * Completes an asynchronous call to [method@Client.call_async].
+ *
+ * Returns: %TRUE if successful and @return_value is set, otherwise %FALSE and @error is set.
+ *
+ * Since: 3.26
+ */
+gboolean
+jsonrpc_client_call_finish (JsonrpcClient  *self,
+                            GAsyncResult   *result,
+                            GVariant      **return_value,
+                            GError        **error)
+{
+  g_autoptr(GVariant) local_return_value = NULL;
+  gboolean ret;
+
+  g_return_val_if_fail (JSONRPC_IS_CLIENT (self), FALSE);
+  g_return_val_if_fail (G_IS_TASK (result), FALSE);
+
+  local_return_value = g_task_propagate_pointer (G_TASK (result), error);
+  ret = local_return_value != NULL;
+
+  if (return_value != NULL)
+    *return_value = g_steal_pointer (&local_return_value);
+
+  return ret;
+}
+
+static void
+jsonrpc_client_batch_write_cb (GObject      *object,
+                               GAsyncResult *result,
+                               gpointer      user_data)
+{
+  JsonrpcOutputStream *stream = (JsonrpcOutputStream *)object;
+  g_autoptr(JsonrpcClient) self = user_data;
+  g_autoptr(GError) error = NULL;
+
+  g_assert (JSONRPC_IS_OUTPUT_STREAM (stream));
+  g_assert (G_IS_ASYNC_RESULT (result));
+  g_assert (JSONRPC_IS_CLIENT (self));
+
+  /* Panic will fail the calls of the batch along with all the others */
+  if (!jsonrpc_output_stream_write_message_finish (stream, result, &error))
+    jsonrpc_client_panic (self, error);
+}
+
+/*
+ * jsonrpc_client_batch_fail:
+ *
+ * Completes the calls of @self which are still waiting for a reply
+ * with @error.
+ */
+static void
+jsonrpc_client_batch_fail (JsonrpcClientBatch *self,
+                           const GError       *error)
+{
+  g_assert (self != NULL);
+  g_assert (error != NULL);
+
+  for (guint i = 0; i < self->calls->len; i++)
+    {
+      g_autoptr(GTask) task = jsonrpc_client_remove_call (self->client,
+                                                          g_array_index (self->calls, BatchCall, i).id);
+
+      if (task != NULL)
+        g_task_return_error (task, g_error_copy (error));
+    }
+
+  g_array_set_size (self->calls, 0);
+}
+
+/*
+ * jsonrpc_client_batch_arm_call:
+ *
+ * Arms @call as the batch is being sent. A call which was cancelled while
+ * the batch was built completes right away instead.
+ *
+ * Returns: %TRUE if the call must be sent
+ */
+static gboolean
+jsonrpc_client_batch_arm_call (JsonrpcClientBatch *self,
+                               const BatchCall    *call)
+{
+  JsonrpcClientPrivate *priv = jsonrpc_client_get_instance_private (self->client);
+  GTask *task;
+
+  g_assert (self != NULL);
+  g_assert (call != NULL);
+
+  if (!(task = _jsonrpc_call_table_lookup (&priv->invocations, call->id)))
+    return FALSE;
+
+  if (g_cancellable_is_cancelled (g_task_get_cancellable (task)))
+    {
+      g_autoptr(GTask) removed = jsonrpc_client_remove_call (self->client, call->id);
+
+      g_task_return_error_if_cancelled (removed);
+
+      return FALSE;
+    }
+
+  jsonrpc_client_arm_call (self->client, task, call->id, call->deadline);
+
+  return TRUE;
 }
 
 /**
- * jsonrpc_client_call:
- * @self: A #JsonrpcClient
- * @method: The name of the method to call
- * @params: (transfer none) (nullable): A [struct@GLib.Variant] of parameters or %NULL
- * @cancellable: (nullable): A #GCancellable or %NULL
- * @return_value: (nullable) (out): A location for a [struct@GLib.Variant]
- *
- * Synchronously calls @method with @params on the remote peer.
+ * jsonrpc_client_batch_new:
+ * @client: A #JsonrpcClient
  *
- * once a reply has been received, or failure, this function will return.
- * If successful, @return_value will be set with the reslut field of
- * the response.
+ * Creates a new batch to send calls and notifications to the peer of
+ * @client in a single message, which saves the framing and the writes of
+ * sending them one by one.
  *
- * If @params is floating then this function consumes the reference.
+ * Add calls with [method@ClientBatch.add_call] and notifications with
+ * [method@ClientBatch.add_notification], then send them all at once with
+ * [method@ClientBatch.send]. Each call completes on its own as the peer
+ * replies to it.
  *
- * Returns: %TRUE on success; otherwise %FALSE and @error is set.
+ * Returns: (transfer full): a new #JsonrpcClientBatch
  *
- * Since: 3.26
+ * Since: 3.46
  */
-gboolean
-jsonrpc_client_call (JsonrpcClient  *self,
-                     const gchar    *method,
-                     GVariant       *params,
-                     GCancellable   *cancellable,
-                     GVariant      **return_value,
-                     GError        **error)
+JsonrpcClientBatch *
+jsonrpc_client_batch_new (JsonrpcClient *client)
 {
-  g_autoptr(GTask) task = NULL;
-  g_autoptr(GMainContext) main_context = NULL;
-  g_autoptr(GVariant) local_return_value = NULL;
-  gboolean ret;
+  JsonrpcClientBatch *self;
 
-  g_return_val_if_fail (JSONRPC_IS_CLIENT (self), FALSE);
-  g_return_val_if_fail (method != NULL, FALSE);
-  g_return_val_if_fail (!cancellable || G_IS_CANCELLABLE (cancellable), FALSE);
+  g_return_val_if_fail (JSONRPC_IS_CLIENT (client), NULL);
 
-  main_context = g_main_context_ref_thread_default ();
+  self = g_slice_new0 (JsonrpcClientBatch);
+  g_ref_count_init (&self->ref_count);
+  self->client = g_object_ref (client);
+  self->messages = g_ptr_array_new_with_free_func ((GDestroyNotify)g_variant_unref);
+  self->calls = g_array_new (FALSE, FALSE, sizeof (BatchCall));
 
-  task = g_task_new (self, NULL, NULL, NULL);
-  g_task_set_source_tag (task, jsonrpc_client_call);
+  return self;
+}
 
-  jsonrpc_client_call_async (self,
-                             method,
-                             params,
-                             cancellable,
-                             jsonrpc_client_call_sync_cb,
-                             task);
+/**
+ * jsonrpc_client_batch_ref:
+ * @self: A #JsonrpcClientBatch
+ *
+ * Increments the reference count of @self.
+ *
+ * Returns: (transfer full): @self
+ *
+ * Since: 3.46
+ */
+JsonrpcClientBatch *
+jsonrpc_client_batch_ref (JsonrpcClientBatch *self)
+{
+  g_return_val_if_fail (self != NULL, NULL);
 
-  while (!g_task_get_completed (task))
-    g_main_context_iteration (main_context, TRUE);
+  g_ref_count_inc (&self->ref_count);
 
-  local_return_value = g_task_propagate_pointer (task, error);
-  ret = local_return_value != NULL;
+  return self;
+}
 
-  if (return_value != NULL)
-    *return_value = g_steal_pointer (&local_return_value);
+/**
+ * jsonrpc_client_batch_unref:
+ * @self: (transfer full): A #JsonrpcClientBatch
+ *
+ * Decrements the reference count of @self, freeing it once it reaches
+ * zero. If the batch was never sent, its calls fail with
+ * %G_IO_ERROR_CANCELLED.
+ *
+ * Since: 3.46
+ */
+void
+jsonrpc_client_batch_unref (JsonrpcClientBatch *self)
+{
+  g_return_if_fail (self != NULL);
 
-  return ret;
+  if (!g_ref_count_dec (&self->ref_count))
+    return;
+
+  if (!self->sent && self->calls->len > 0)
+    {
+      g_autoptr(GError) error = g_error_new_literal (G_IO_ERROR,
+                                                     G_IO_ERROR_CANCELLED,
+                                                     "The batch was never sent");
+      jsonrpc_client_batch_fail (self, error);
+    }
+
+  g_clear_pointer (&self->messages, g_ptr_array_unref);
+  g_clear_pointer (&self->calls, g_array_unref);
+  g_clear_object (&self->client);
+  g_slice_free (JsonrpcClientBatch, self);
 }
 
 /**
- * jsonrpc_client_call_with_id_async:
- * @self: A #JsonrpcClient
+ * jsonrpc_client_batch_add_call:
+ * @self: A #JsonrpcClientBatch
  * @method: The name of the method to call
  * @params: (transfer none) (nullable): A [struct@GLib.Variant] of parameters or %NULL
+ * @deadline: the monotonic time by which the peer must reply, or -1
  * @id: (out) (transfer full) (optional): A location for a [struct@GLib.Variant]
  *   describing the identifier used for the method call, or %NULL.
  * @cancellable: (nullable): A #GCancellable or %NULL
  * @callback: Callback to executed upon completion
  * @user_data: User data for @callback
  *
- * Asynchronously calls @method with @params on the remote peer.
+ * Adds a call to @method with @params to the batch. It is sent to the peer
+ * by [method@ClientBatch.send] and otherwise behaves like
+ * [method@Client.call_with_deadline_async].
  *
- * Upon completion or failure, @callback is executed and it should
- * call [method@Client.call_finish] to complete the request and release
- * any memory held.
+ * The call is left out of the batch if @cancellable is cancelled before the
+ * batch is sent, and @deadline is only enforced from then on. Once sent, the
+ * call shares its message with the rest of the batch so @cancellable only
+ * takes effect when [property@Client:cancel-method] is set.
  *
- * This function is similar to [method@Client.call_async] except that
- * it allows the caller to get the id of the command which might be useful
- * in systems where you can cancel the operation (such as the Language
- * Server Protocol).
+ * Call [method@Client.call_finish] to complete the operation.
  *
  * If @params is floating, the floating reference is consumed.
  *
- * Since: 3.30
+ * Since: 3.46
  */
 void
-jsonrpc_client_call_with_id_async (JsonrpcClient       *self,
-                                   const gchar         *method,
-                                   GVariant            *params,
-                                   GVariant           **id,
-                                   GCancellable        *cancellable,
-                                   GAsyncReadyCallback  callback,
-                                   gpointer             user_data)
+jsonrpc_client_batch_add_call (JsonrpcClientBatch   *self,
+                               const gchar          *method,
+                               GVariant             *params,
+                               gint64                deadline,
+                               GVariant            **id,
+                               GCancellable         *cancellable,
+                               GAsyncReadyCallback   callback,
+                               gpointer              user_data)
 {
-  JsonrpcClientPrivate *priv = jsonrpc_client_get_instance_private (self);
   g_autoptr(GVariant) message = NULL;
   g_autoptr(GVariant) sunk_variant = NULL;
   g_autoptr(GTask) task = NULL;
   g_autoptr(GError) error = NULL;
-  GVariantDict dict;
-  gint64 idval;
+  BatchCall call;
 
-  g_return_if_fail (JSONRPC_IS_CLIENT (self));
+  g_return_if_fail (self != NULL);
+  g_return_if_fail (!self->sent);
   g_return_if_fail (method != NULL);
   g_return_if_fail (!cancellable || G_IS_CANCELLABLE (cancellable));
 
   if (id != NULL)
     *id = NULL;
 
-  task = g_task_new (self, cancellable, callback, user_data);
+  task = g_task_new (self->client, cancellable, callback, user_data);
   g_task_set_source_tag (task, jsonrpc_client_call_async);
 
   if (params == NULL)
@@ -1019,107 +2339,129 @@ jsonrpc_client_call_with_id_async (JsonrpcClient       *self,
   if (g_variant_is_floating (params))
     sunk_variant = g_variant_ref_sink (params);
 
-  if (!jsonrpc_client_check_ready (self, &error))
+  if (!jsonrpc_client_check_ready (self->client, &error))
     {
       g_task_return_error (task, g_steal_pointer (&error));
       return;
     }
 
-  g_signal_connect_object (task,
-                           "notify::completed",
-                           G_CALLBACK (jsonrpc_client_call_notify_completed),
-                           self,
-                           G_CONNECT_SWAPPED);
-
-  idval = ++priv->sequence;
+  /* The call is armed once the batch is sent */
+  message = jsonrpc_client_register_call (self->client, method, params, task, &call.id);
+  call.deadline = deadline;
+  call.index = self->messages->len;
 
-  g_task_set_task_data (task, GINT_TO_POINTER (idval), NULL);
-
-  g_variant_dict_init (&dict, NULL);
-  g_variant_dict_insert (&dict, "jsonrpc", "s", "2.0");
-  g_variant_dict_insert (&dict, "id", "x", idval);
-  g_variant_dict_insert (&dict, "method", "s", method);
-  g_variant_dict_insert_value (&dict, "params", params);
-
-  message = g_variant_take_ref (g_variant_dict_end (&dict));
-
-  g_hash_table_insert (priv->invocations, GINT_TO_POINTER (idval), g_object_ref (task));
-
-  jsonrpc_output_stream_write_message_async (priv->output_stream,
-                                             message,
-                                             cancellable,
-                                             jsonrpc_client_call_write_cb,
-                                             g_steal_pointer (&task));
-
-  if (priv->is_first_call)
-    jsonrpc_client_start_listening (self);
+  g_ptr_array_add (self->messages, g_steal_pointer (&message));
+  g_array_append_val (self->calls, call);
 
   if (id != NULL)
-    *id = g_variant_take_ref (g_variant_new_int64 (idval));
+    *id = g_variant_take_ref (g_variant_new_int64 (call.id));
 }
 
 /**
- * jsonrpc_client_call_async:
- * @self: A #JsonrpcClient
+ * jsonrpc_client_batch_add_notification:
+ * @self: A #JsonrpcClientBatch
  * @method: The name of the method to call
  * @params: (transfer none) (nullable): A [struct@GLib.Variant] of parameters or %NULL
- * @cancellable: (nullable): A #GCancellable or %NULL
- * @callback: a callback to executed upon completion
- * @user_data: user data for @callback
- *
- * Asynchronously calls @method with @params on the remote peer.
  *
- * Upon completion or failure, @callback is executed and it should
- * call [method@Client.call_finish] to complete the request and release
- * any memory held.
+ * Adds a notification of @method with @params to the batch. It is sent to
+ * the peer by [method@ClientBatch.send].
  *
  * If @params is floating, the floating reference is consumed.
  *
- * Since: 3.26
+ * Since: 3.46
  */
 void
-jsonrpc_client_call_async (JsonrpcClient       *self,
-                           const gchar         *method,
-                           GVariant            *params,
-                           GCancellable        *cancellable,
-                           GAsyncReadyCallback  callback,
-                           gpointer             user_data)
+jsonrpc_client_batch_add_notification (JsonrpcClientBatch *self,
+                                       const gchar        *method,
+                                       GVariant           *params)
 {
-  jsonrpc_client_call_with_id_async (self, method, params, NULL, cancellable, callback, user_data);
+  GVariantDict dict;
+
+  g_return_if_fail (self != NULL);
+  g_return_if_fail (!self->sent);
+  g_return_if_fail (method != NULL);
+
+  if (params == NULL)
+    params = g_variant_new_maybe (G_VARIANT_TYPE_VARIANT, NULL);
+
+  g_variant_dict_init (&dict, NULL);
+  g_variant_dict_insert (&dict, "jsonrpc", "s", "2.0");
+  g_variant_dict_insert (&dict, "method", "s", method);
+  g_variant_dict_insert_value (&dict, "params", params);
+
+  g_ptr_array_add (self->messages, g_variant_take_ref (g_variant_dict_end (&dict)));
 }
 
 /**
- * jsonrpc_client_call_finish:
- * @self: A #JsonrpcClient.
- * @result: A #GAsyncResult provided to the callback in [method@Client.call_async]
- * @return_value: (out) (nullable): A location for a [struct@GLib.Variant] or %NULL
- * @error: a location for a #GError or %NULL
+ * jsonrpc_client_batch_send:
+ * @self: A #JsonrpcClientBatch
  *
- * Completes an asynchronous call to [method@Client.call_async].
+ * Sends the calls and notifications of the batch to the peer as a single
+ * message. Nothing is sent if the batch is empty. Calls which were
+ * cancelled meanwhile complete with %G_IO_ERROR_CANCELLED and are left out.
  *
- * Returns: %TRUE if successful and @return_value is set, otherwise %FALSE and @error is set.
+ * A batch may only be sent once.
  *
- * Since: 3.26
+ * Since: 3.46
  */
-gboolean
-jsonrpc_client_call_finish (JsonrpcClient  *self,
-                            GAsyncResult   *result,
-                            GVariant      **return_value,
-                            GError        **error)
+void
+jsonrpc_client_batch_send (JsonrpcClientBatch *self)
 {
-  g_autoptr(GVariant) local_return_value = NULL;
-  gboolean ret;
+  JsonrpcClientPrivate *priv;
+  g_autoptr(GPtrArray) messages = NULL;
+  g_autoptr(GVariant) message = NULL;
+  g_autoptr(GError) error = NULL;
+  gboolean has_calls = FALSE;
+  guint n_calls = 0;
 
-  g_return_val_if_fail (JSONRPC_IS_CLIENT (self), FALSE);
-  g_return_val_if_fail (G_IS_TASK (result), FALSE);
+  g_return_if_fail (self != NULL);
+  g_return_if_fail (!self->sent);
 
-  local_return_value = g_task_propagate_pointer (G_TASK (result), error);
-  ret = local_return_value != NULL;
+  priv = jsonrpc_client_get_instance_private (self->client);
 
-  if (return_value != NULL)
-    *return_value = g_steal_pointer (&local_return_value);
+  self->sent = TRUE;
 
-  return ret;
+  if (self->messages->len == 0)
+    return;
+
+  if (!jsonrpc_client_check_ready (self->client, &error))
+    {
+      jsonrpc_client_batch_fail (self, error);
+      return;
+    }
+
+  messages = g_ptr_array_sized_new (self->messages->len);
+
+  for (guint i = 0; i < self->messages->len; i++)
+    {
+      if (n_calls < self->calls->len &&
+          g_array_index (self->calls, BatchCall, n_calls).index == i)
+        {
+          if (!jsonrpc_client_batch_arm_call (self, &g_array_index (self->calls, BatchCall, n_calls++)))
+            continue;
+
+          has_calls = TRUE;
+        }
+
+      g_ptr_array_add (messages, g_ptr_array_index (self->messages, i));
+    }
+
+  /* Every call was cancelled and there were no notifications */
+  if (messages->len == 0)
+    return;
+
+  message = g_variant_take_ref (g_variant_new_array (G_VARIANT_TYPE_VARDICT,
+                                                     (GVariant * const *)messages->pdata,
+                                                     messages->len));
+
+  jsonrpc_output_stream_write_message_async (priv->output_stream,
+                                             message,
+                                             NULL,
+                                             jsonrpc_client_batch_write_cb,
+                                             g_object_ref (self->client));
+
+  if (has_calls && priv->is_first_call)
+    jsonrpc_client_start_listening (self->client);
 }
 
 GQuark
@@ -1200,6 +2542,52 @@ jsonrpc_client_send_notification (JsonrpcClient  *self,
   return ret;
 }
 
+static void
+jsonrpc_client_queue_notification (JsonrpcClient *self,
+                                   const gchar   *method,
+                                   GVariant      *params,
+                                   const gchar   *coalesce_key,
+                                   GCancellable  *cancellable,
+                                   GTask         *task)
+{
+  JsonrpcClientPrivate *priv = jsonrpc_client_get_instance_private (self);
+  g_autoptr(GVariant) message = NULL;
+  g_autoptr(GError) error = NULL;
+  GVariantDict dict;
+
+  g_assert (JSONRPC_IS_CLIENT (self));
+  g_assert (method != NULL);
+  g_assert (!task || G_IS_TASK (task));
+
+  if (!jsonrpc_client_check_ready (self, &error))
+    {
+      if (task != NULL)
+        {
+          g_task_return_error (task, g_steal_pointer (&error));
+          g_object_unref (task);
+        }
+      return;
+    }
+
+  if (params == NULL)
+    params = g_variant_new_maybe (G_VARIANT_TYPE_VARIANT, NULL);
+
+  g_variant_dict_init (&dict, NULL);
+  g_variant_dict_insert (&dict, "jsonrpc", "s", "2.0");
+  g_variant_dict_insert (&dict, "method", "s", method);
+  g_variant_dict_insert_value (&dict, "params", params);
+
+  message = g_variant_take_ref (g_variant_dict_end (&dict));
+
+  jsonrpc_output_stream_queue_message_async (priv->output_stream,
+                                             message,
+                                             JSONRPC_WRITE_PRIORITY_NORMAL,
+                                             coalesce_key,
+                                             cancellable,
+                                             task ? jsonrpc_client_send_notification_write_cb : NULL,
+                                             task);
+}
+
 /**
  * jsonrpc_client_send_notification_async:
  * @self: A #JsonrpcClient
@@ -1227,47 +2615,108 @@ jsonrpc_client_send_notification_async (JsonrpcClient       *self,
                                         GAsyncReadyCallback  callback,
                                         gpointer             user_data)
 {
-  JsonrpcClientPrivate *priv = jsonrpc_client_get_instance_private (self);
-  g_autoptr(GVariant) message = NULL;
-  g_autoptr(GTask) task = NULL;
-  g_autoptr(GError) error = NULL;
-  GVariantDict dict;
+  GTask *task = NULL;
 
   g_return_if_fail (JSONRPC_IS_CLIENT (self));
   g_return_if_fail (method != NULL);
   g_return_if_fail (!cancellable || G_IS_CANCELLABLE (cancellable));
 
-  task = g_task_new (self, cancellable, callback, user_data);
-  g_task_set_source_tag (task, jsonrpc_client_send_notification_async);
+  /* Without a callback, there is nothing to complete */
+  if (callback != NULL)
+    {
+      task = g_task_new (self, cancellable, callback, user_data);
+      g_task_set_source_tag (task, jsonrpc_client_send_notification_async);
+    }
 
-  if (!jsonrpc_client_check_ready (self, &error))
+  jsonrpc_client_queue_notification (self, method, params, NULL, cancellable, task);
+}
+
+/**
+ * jsonrpc_client_send_coalesced_async:
+ * @self: A #JsonrpcClient
+ * @method: The name of the method to call
+ * @params: (transfer none) (nullable): A [struct@GLib.Variant] of parameters or %NULL
+ * @coalesce_key: A key identifying notifications superseding each other
+ * @cancellable: (nullable): A #GCancellable or %NULL
+ * @callback: (nullable): A #GAsyncReadyCallback or %NULL
+ * @user_data: Closure data for @callback
+ *
+ * Like [method@Client.send_notification_async], except that if a
+ * notification sent with the same @coalesce_key is still waiting to be
+ * written, it is replaced by this one instead of both being sent.
+ *
+ * This is meant for notifications where only the latest state matters,
+ * such as "$/progress" for a given token or "textDocument/publishDiagnostics"
+ * for a given URI, so that a slow peer does not make them pile up. The
+ * replacement takes the place of the replaced notification, and therefore
+ * may be written before messages which were sent after it.
+ *
+ * Call [method@Client.send_notification_finish] to complete the operation.
+ * The operation of a replaced notification completes along with that of
+ * its replacement.
+ *
+ * If @params is floating then the reference is consumed.
+ *
+ * Since: 3.46
+ */
+void
+jsonrpc_client_send_coalesced_async (JsonrpcClient       *self,
+                                     const gchar         *method,
+                                     GVariant            *params,
+                                     const gchar         *coalesce_key,
+                                     GCancellable        *cancellable,
+                                     GAsyncReadyCallback  callback,
+                                     gpointer             user_data)
+{
+  GTask *task = NULL;
+
+  g_return_if_fail (JSONRPC_IS_CLIENT (self));
+  g_return_if_fail (method != NULL);
+  g_return_if_fail (coalesce_key != NULL);
+  g_return_if_fail (!cancellable || G_IS_CANCELLABLE (cancellable));
+
+  /* Without a callback, there is nothing to complete */
+  if (callback != NULL)
     {
-      g_task_return_error (task, g_steal_pointer (&error));
-      return;
+      task = g_task_new (self, cancellable, callback, user_data);
+      g_task_set_source_tag (task, jsonrpc_client_send_coalesced_async);
     }
 
-  if (params == NULL)
-    params = g_variant_new_maybe (G_VARIANT_TYPE_VARIANT, NULL);
+  jsonrpc_client_queue_notification (self, method, params, coalesce_key, cancellable, task);
+}
+
+/*
+ * _jsonrpc_client_send_encoded:
+ *
+ * Sends a notification which has been encoded with
+ * jsonrpc_encoded_message_new() without waiting for it to be written.
+ */
+void
+_jsonrpc_client_send_encoded (JsonrpcClient         *self,
+                              JsonrpcEncodedMessage *encoded)
+{
+  JsonrpcClientPrivate *priv = jsonrpc_client_get_instance_private (self);
 
-  g_variant_dict_init (&dict, NULL);
-  g_variant_dict_insert (&dict, "jsonrpc", "s", "2.0");
-  g_variant_dict_insert (&dict, "method", "s", method);
-  g_variant_dict_insert_value (&dict, "params", params);
+  g_assert (JSONRPC_IS_CLIENT (self));
+  g_assert (encoded != NULL);
 
-  message = g_variant_take_ref (g_variant_dict_end (&dict));
+  if (!jsonrpc_client_check_ready (self, NULL))
+    return;
 
-  jsonrpc_output_stream_write_message_async (priv->output_stream,
-                                             message,
-                                             cancellable,
-                                             jsonrpc_client_send_notification_write_cb,
-                                             g_steal_pointer (&task));
+  jsonrpc_output_stream_queue_encoded_async (priv->output_stream,
+                                             encoded,
+                                             JSONRPC_WRITE_PRIORITY_NORMAL,
+                                             NULL,
+                                             NULL,
+                                             NULL);
 }
 
 /**
  * jsonrpc_client_send_notification_finish:
  * @self: A #JsonrpcClient
  *
- * Completes an asynchronous call to [method@Client.send_notification_async].
+ * Completes an asynchronous call to [method@Client.send_notification_async]
+ * or [method@Client.send_coalesced_async].
  *
  * Successful completion of this function only indicates that the request
  * has been written to the underlying buffer, not that the peer has received
@@ -1312,7 +2761,6 @@ jsonrpc_client_close (JsonrpcClient  *self,
                       GError        **error)
 {
   JsonrpcClientPrivate *priv = jsonrpc_client_get_instance_private (self);
-  g_autoptr(GHashTable) invocations = NULL;
   g_autoptr(GError) local_error = NULL;
   gboolean ret;
 
@@ -1332,6 +2780,9 @@ jsonrpc_client_close (JsonrpcClient  *self,
    */
   ret = g_io_stream_close (priv->io_stream, cancellable, error);
 
+  /* Fail the messages still queued, such as those held back by a cork */
+  g_output_stream_close (G_OUTPUT_STREAM (priv->output_stream), NULL, NULL);
+
   /*
    * Closing the input stream will fail, so just rely on the callback
    * from the async function to complete/close the stream.
@@ -1462,13 +2913,18 @@ jsonrpc_client_reply_error_async (JsonrpcClient       *self,
   if (message == NULL)
     message = "An error occurred";
 
-  task = g_task_new (self, cancellable, callback, user_data);
-  g_task_set_source_tag (task, jsonrpc_client_reply_error_async);
-  g_task_set_priority (task, G_PRIORITY_LOW);
+  /* Without a callback, there is nothing to complete */
+  if (callback != NULL)
+    {
+      task = g_task_new (self, cancellable, callback, user_data);
+      g_task_set_source_tag (task, jsonrpc_client_reply_error_async);
+      g_task_set_priority (task, G_PRIORITY_LOW);
+    }
 
   if (!jsonrpc_client_check_ready (self, &error))
     {
-      g_task_return_error (task, g_steal_pointer (&error));
+      if (task != NULL)
+        g_task_return_error (task, g_steal_pointer (&error));
       return;
     }
 
@@ -1483,10 +2939,15 @@ jsonrpc_client_reply_error_async (JsonrpcClient       *self,
 
   vreply = g_variant_take_ref (g_variant_dict_end (&reply));
 
-  jsonrpc_output_stream_write_message_async (priv->output_stream,
+  if (jsonrpc_client_take_batch_reply (self, vreply, task))
+    return;
+
+  jsonrpc_output_stream_queue_message_async (priv->output_stream,
                                              vreply,
+                                             JSONRPC_WRITE_PRIORITY_REPLY,
+                                             NULL,
                                              cancellable,
-                                             jsonrpc_client_reply_error_cb,
+                                             task ? jsonrpc_client_reply_error_cb : NULL,
                                              g_steal_pointer (&task));
 }
 
@@ -1545,7 +3006,14 @@ jsonrpc_client_reply (JsonrpcClient  *self,
 
   message = g_variant_take_ref (g_variant_dict_end (&dict));
 
-  ret = jsonrpc_output_stream_write_message (priv->output_stream, message, cancellable, error);
+  if (jsonrpc_client_take_batch_reply (self, message, NULL))
+    return TRUE;
+
+  ret = _jsonrpc_output_stream_queue_message (priv->output_stream,
+                                              message,
+                                              JSONRPC_WRITE_PRIORITY_REPLY,
+                                              cancellable,
+                                              error);
 
   return ret;
 }
@@ -1589,6 +3057,9 @@ jsonrpc_client_reply_cb (GObject      *object,
  * If no signal handler has handled [signal@Client::handle-call] then
  * an error will be synthesized to the peer.
  *
+ * Replies are written ahead of any calls or notifications which are
+ * still queued, since the peer may be waiting on them.
+ *
  * Call [method@Client.reply_finish] to complete the operation. Note
  * that since the peer does not reply to replies, completion of this
  * asynchronous message does not indicate that the peer has received
@@ -1616,12 +3087,17 @@ jsonrpc_client_reply_async (JsonrpcClient       *self,
   g_return_if_fail (id != NULL);
   g_return_if_fail (!cancellable || G_IS_CANCELLABLE (cancellable));
 
-  task = g_task_new (self, cancellable, callback, user_data);
-  g_task_set_source_tag (task, jsonrpc_client_reply_async);
+  /* Without a callback, there is nothing to complete */
+  if (callback != NULL)
+    {
+      task = g_task_new (self, cancellable, callback, user_data);
+      g_task_set_source_tag (task, jsonrpc_client_reply_async);
+    }
 
   if (!jsonrpc_client_check_ready (self, &error))
     {
-      g_task_return_error (task, g_steal_pointer (&error));
+      if (task != NULL)
+        g_task_return_error (task, g_steal_pointer (&error));
       return;
     }
 
@@ -1635,10 +3111,15 @@ jsonrpc_client_reply_async (JsonrpcClient       *self,
 
   message = g_variant_take_ref (g_variant_dict_end (&dict));
 
-  jsonrpc_output_stream_write_message_async (priv->output_stream,
+  if (jsonrpc_client_take_batch_reply (self, message, task))
+    return;
+
+  jsonrpc_output_stream_queue_message_async (priv->output_stream,
                                              message,
+                                             JSONRPC_WRITE_PRIORITY_REPLY,
+                                             NULL,
                                              cancellable,
-                                             jsonrpc_client_reply_cb,
+                                             task ? jsonrpc_client_reply_cb : NULL,
                                              g_steal_pointer (&task));
 }
 
@@ -1697,10 +3178,10 @@ jsonrpc_client_start_listening (JsonrpcClient *self)
        * jsonrpc_client_close_async() so that we can cancel the operation and
        * allow it to cleanup any outstanding references.
        */
-      jsonrpc_input_stream_read_message_async (priv->input_stream,
-                                               priv->read_loop_cancellable,
-                                               jsonrpc_client_call_read_cb,
-                                               g_object_ref (self));
+      jsonrpc_input_stream_read_messages_async (priv->input_stream,
+                                                priv->read_loop_cancellable,
+                                                jsonrpc_client_call_read_cb,
+                                                g_object_ref (self));
     }
 }
 
@@ -1758,3 +3239,369 @@ jsonrpc_client_set_use_gvariant (JsonrpcClient *self,
       g_object_notify_by_pspec (G_OBJECT (self), properties[PROP_USE_GVARIANT]);
     }
 }
+
+/**
+ * jsonrpc_client_get_use_compression:
+ * @self: A #JsonrpcClient
+ *
+ * Gets the [property@Client:use-compression] property.
+ *
+ * Returns: %TRUE if large message bodies are compressed; otherwise %FALSE.
+ *
+ * Since: 3.46
+ */
+gboolean
+jsonrpc_client_get_use_compression (JsonrpcClient *self)
+{
+  JsonrpcClientPrivate *priv = jsonrpc_client_get_instance_private (self);
+
+  g_return_val_if_fail (JSONRPC_IS_CLIENT (self), FALSE);
+
+  return priv->use_compression;
+}
+
+/**
+ * jsonrpc_client_set_use_compression:
+ * @self: A #JsonrpcClient
+ * @use_compression: If large message bodies should be compressed
+ *
+ * Sets the [property@Client:use-compression] property.
+ *
+ * Compressing large responses greatly reduces the time spent sending them
+ * over slow transports. However, it requires that the peer supports the
+ * "Content-Encoding" header.
+ *
+ * Since: 3.46
+ */
+void
+jsonrpc_client_set_use_compression (JsonrpcClient *self,
+                                    gboolean       use_compression)
+{
+  JsonrpcClientPrivate *priv = jsonrpc_client_get_instance_private (self);
+
+  g_return_if_fail (JSONRPC_IS_CLIENT (self));
+
+  use_compression = !!use_compression;
+
+  if (priv->use_compression != use_compression)
+    {
+      priv->use_compression = use_compression;
+      if (priv->output_stream != NULL)
+        jsonrpc_output_stream_set_compression (priv->output_stream,
+                                               use_compression ? JSONRPC_COMPRESSION_GZIP
+                                                               : JSONRPC_COMPRESSION_NONE);
+      g_object_notify_by_pspec (G_OBJECT (self), properties[PROP_USE_COMPRESSION]);
+    }
+}
+
+/**
+ * jsonrpc_client_get_decode_in_thread:
+ * @self: A #JsonrpcClient
+ *
+ * Gets the [property@Client:decode-in-thread] property.
+ *
+ * Returns: %TRUE if large messages are decoded on a worker thread
+ *
+ * Since: 3.46
+ */
+gboolean
+jsonrpc_client_get_decode_in_thread (JsonrpcClient *self)
+{
+  JsonrpcClientPrivate *priv = jsonrpc_client_get_instance_private (self);
+
+  g_return_val_if_fail (JSONRPC_IS_CLIENT (self), FALSE);
+
+  return priv->decode_in_thread;
+}
+
+/**
+ * jsonrpc_client_set_decode_in_thread:
+ * @self: A #JsonrpcClient
+ * @decode_in_thread: if large messages should be decoded on a worker thread
+ *
+ * Sets the [property@Client:decode-in-thread] property.
+ *
+ * See [method@InputStream.set_decode_in_thread] for details.
+ *
+ * Since: 3.46
+ */
+void
+jsonrpc_client_set_decode_in_thread (JsonrpcClient *self,
+                                     gboolean       decode_in_thread)
+{
+  JsonrpcClientPrivate *priv = jsonrpc_client_get_instance_private (self);
+
+  g_return_if_fail (JSONRPC_IS_CLIENT (self));
+
+  decode_in_thread = !!decode_in_thread;
+
+  if (priv->decode_in_thread != decode_in_thread)
+    {
+      priv->decode_in_thread = decode_in_thread;
+      if (priv->input_stream != NULL)
+        jsonrpc_input_stream_set_decode_in_thread (priv->input_stream, decode_in_thread);
+      g_object_notify_by_pspec (G_OBJECT (self), properties[PROP_DECODE_IN_THREAD]);
+    }
+}
+
+/**
+ * jsonrpc_client_get_cancel_method:
+ * @self: A #JsonrpcClient
+ *
+ * Gets the [property@Client:cancel-method] property.
+ *
+ * Returns: (nullable): the method of the notification sent when a call
+ *   is cancelled, or %NULL
+ *
+ * Since: 3.46
+ */
+const gchar *
+jsonrpc_client_get_cancel_method (JsonrpcClient *self)
+{
+  JsonrpcClientPrivate *priv = jsonrpc_client_get_instance_private (self);
+
+  g_return_val_if_fail (JSONRPC_IS_CLIENT (self), NULL);
+
+  return priv->cancel_method;
+}
+
+/**
+ * jsonrpc_client_set_cancel_method:
+ * @self: A #JsonrpcClient
+ * @cancel_method: (nullable): the method of the notification to send, or %NULL
+ *
+ * Sets the [property@Client:cancel-method] property.
+ *
+ * For the Language Server Protocol, this should be "$/cancelRequest".
+ *
+ * This only applies to calls made after it has been set.
+ *
+ * Since: 3.46
+ */
+void
+jsonrpc_client_set_cancel_method (JsonrpcClient *self,
+                                  const gchar   *cancel_method)
+{
+  JsonrpcClientPrivate *priv = jsonrpc_client_get_instance_private (self);
+
+  g_return_if_fail (JSONRPC_IS_CLIENT (self));
+
+  if (g_strcmp0 (cancel_method, priv->cancel_method) != 0)
+    {
+      g_free (priv->cancel_method);
+      priv->cancel_method = g_strdup (cancel_method);
+      g_object_notify_by_pspec (G_OBJECT (self), properties[PROP_CANCEL_METHOD]);
+    }
+}
+
+/**
+ * jsonrpc_client_get_congested:
+ * @self: A #JsonrpcClient
+ *
+ * Gets the [property@Client:congested] property.
+ *
+ * Returns: %TRUE if the peer is not keeping up with our messages
+ *
+ * Since: 3.46
+ */
+gboolean
+jsonrpc_client_get_congested (JsonrpcClient *self)
+{
+  JsonrpcClientPrivate *priv = jsonrpc_client_get_instance_private (self);
+
+  g_return_val_if_fail (JSONRPC_IS_CLIENT (self), FALSE);
+
+  return priv->congested;
+}
+
+static void
+jsonrpc_client_wait_writable_cb (GObject      *object,
+                                 GAsyncResult *result,
+                                 gpointer      user_data)
+{
+  JsonrpcOutputStream *stream = (JsonrpcOutputStream *)object;
+  g_autoptr(GTask) task = user_data;
+  g_autoptr(GError) error = NULL;
+
+  g_assert (JSONRPC_IS_OUTPUT_STREAM (stream));
+  g_assert (G_IS_ASYNC_RESULT (result));
+  g_assert (G_IS_TASK (task));
+
+  if (!jsonrpc_output_stream_wait_writable_finish (stream, result, &error))
+    g_task_return_error (task, g_steal_pointer (&error));
+  else
+    g_task_return_boolean (task, TRUE);
+}
+
+/**
+ * jsonrpc_client_wait_writable_async:
+ * @self: A #JsonrpcClient
+ * @cancellable: (nullable): A #GCancellable or %NULL
+ * @callback: A #GAsyncReadyCallback to execute upon completion
+ * @user_data: Closure data for @callback
+ *
+ * Asynchronously waits for [property@Client:congested] to be unset, which
+ * completes right away if the client is not congested.
+ *
+ * This allows producers of messages to throttle themselves when the peer
+ * is not reading them fast enough.
+ *
+ * Call [method@Client.wait_writable_finish] to complete the operation.
+ *
+ * Since: 3.46
+ */
+void
+jsonrpc_client_wait_writable_async (JsonrpcClient       *self,
+                                    GCancellable        *cancellable,
+                                    GAsyncReadyCallback  callback,
+                                    gpointer             user_data)
+{
+  JsonrpcClientPrivate *priv = jsonrpc_client_get_instance_private (self);
+  g_autoptr(GTask) task = NULL;
+  g_autoptr(GError) error = NULL;
+
+  g_return_if_fail (JSONRPC_IS_CLIENT (self));
+  g_return_if_fail (!cancellable || G_IS_CANCELLABLE (cancellable));
+
+  task = g_task_new (self, cancellable, callback, user_data);
+  g_task_set_source_tag (task, jsonrpc_client_wait_writable_async);
+
+  if (!jsonrpc_client_check_ready (self, &error))
+    {
+      g_task_return_error (task, g_steal_pointer (&error));
+      return;
+    }
+
+  jsonrpc_output_stream_wait_writable_async (priv->output_stream,
+                                             cancellable,
+                                             jsonrpc_client_wait_writable_cb,
+                                             g_steal_pointer (&task));
+}
+
+/**
+ * jsonrpc_client_wait_writable_finish:
+ * @self: A #JsonrpcClient
+ * @result: A #GAsyncResult
+ * @error: A location for a #GError or %NULL
+ *
+ * Completes an asynchronous request to [method@Client.wait_writable_async].
+ *
+ * Returns: %TRUE if the client is no longer congested; otherwise %FALSE
+ *   and @error is set.
+ *
+ * Since: 3.46
+ */
+gboolean
+jsonrpc_client_wait_writable_finish (JsonrpcClient  *self,
+                                     GAsyncResult   *result,
+                                     GError        **error)
+{
+  g_return_val_if_fail (JSONRPC_IS_CLIENT (self), FALSE);
+  g_return_val_if_fail (g_task_is_valid (result, self), FALSE);
+
+  return g_task_propagate_boolean (G_TASK (result), error);
+}
+
+/**
+ * jsonrpc_client_cork:
+ * @self: A #JsonrpcClient
+ *
+ * Holds back messages sent to the peer until [method@Client.uncork] is
+ * called, so that a burst of messages such as a reply followed by a number
+ * of notifications is written at once.
+ *
+ * Calls may be nested. Note that replies to calls made while corked can
+ * only arrive once the calls have been written, with the exception of
+ * synchronous calls which are never held back.
+ *
+ * See [method@OutputStream.cork] and [func@Client.corker_new].
+ *
+ * Since: 3.46
+ */
+void
+jsonrpc_client_cork (JsonrpcClient *self)
+{
+  JsonrpcClientPrivate *priv = jsonrpc_client_get_instance_private (self);
+
+  g_return_if_fail (JSONRPC_IS_CLIENT (self));
+
+  if (priv->output_stream != NULL)
+    jsonrpc_output_stream_cork (priv->output_stream);
+}
+
+/**
+ * jsonrpc_client_uncork:
+ * @self: A #JsonrpcClient
+ *
+ * Undoes a call to [method@Client.cork], sending the messages held back
+ * if this is the last one.
+ *
+ * Since: 3.46
+ */
+void
+jsonrpc_client_uncork (JsonrpcClient *self)
+{
+  JsonrpcClientPrivate *priv = jsonrpc_client_get_instance_private (self);
+
+  g_return_if_fail (JSONRPC_IS_CLIENT (self));
+
+  if (priv->output_stream != NULL)
+    jsonrpc_output_stream_uncork (priv->output_stream);
+}
+
+/**
+ * jsonrpc_client_get_framing:
+ * @self: A #JsonrpcClient
+ *
+ * Gets how messages are delimited when communicating with the peer.
+ *
+ * Returns: a [enum@Framing]
+ *
+ * Since: 3.46
+ */
+JsonrpcFraming
+jsonrpc_client_get_framing (JsonrpcClient *self)
+{
+  JsonrpcClientPrivate *priv = jsonrpc_client_get_instance_private (self);
+
+  g_return_val_if_fail (JSONRPC_IS_CLIENT (self), JSONRPC_FRAMING_CONTENT_LENGTH);
+
+  return priv->framing;
+}
+
+/**
+ * jsonrpc_client_set_framing:
+ * @self: A #JsonrpcClient
+ * @framing: a [enum@Framing]
+ *
+ * Sets how messages are delimited when communicating with the peer.
+ *
+ * Use %JSONRPC_FRAMING_NEWLINE to communicate with peers using newline
+ * delimited JSON (NDJSON) rather than "Content-Length" headers.
+ *
+ * With %JSONRPC_FRAMING_AUTO, the framing is detected from the first
+ * message received and used for messages sent afterwards. This is only
+ * useful when the peer sends the first message, such as for the clients
+ * accepted by a [class@Server], see [method@Server.set_framing].
+ *
+ * This should be called before communicating with the peer.
+ *
+ * Since: 3.46
+ */
+void
+jsonrpc_client_set_framing (JsonrpcClient  *self,
+                            JsonrpcFraming  framing)
+{
+  JsonrpcClientPrivate *priv = jsonrpc_client_get_instance_private (self);
+
+  g_return_if_fail (JSONRPC_IS_CLIENT (self));
+  g_return_if_fail (framing <= JSONRPC_FRAMING_AUTO);
+
+  priv->framing = framing;
+
+  if (priv->input_stream != NULL)
+    jsonrpc_input_stream_set_framing (priv->input_stream, framing);
+
+  if (priv->output_stream != NULL)
+    jsonrpc_output_stream_set_framing (priv->output_stream, framing);
+}
@@ -21,12 +21,14 @@
 
 #include <gio/gio.h>
 
+#include "jsonrpc-framing.h"
 #include "jsonrpc-version-macros.h"
 
 G_BEGIN_DECLS
 
-#define JSONRPC_TYPE_CLIENT  (jsonrpc_client_get_type())
-#define JSONRPC_CLIENT_ERROR (jsonrpc_client_error_quark())
+#define JSONRPC_TYPE_CLIENT       (jsonrpc_client_get_type())
+#define JSONRPC_TYPE_CLIENT_BATCH (jsonrpc_client_batch_get_type())
+#define JSONRPC_CLIENT_ERROR      (jsonrpc_client_error_quark())
 
 typedef enum
 {
@@ -40,6 +42,16 @@ typedef enum
 JSONRPC_AVAILABLE_IN_3_26
 G_DECLARE_DERIVABLE_TYPE (JsonrpcClient, jsonrpc_client, JSONRPC, CLIENT, GObject)
 
+/**
+ * JsonrpcClientBatch:
+ *
+ * Collects calls and notifications to be sent to the peer of a
+ * [class@Client] as a single JSON-RPC 2.0 batch.
+ *
+ * Since: 3.46
+ */
+typedef struct _JsonrpcClientBatch JsonrpcClientBatch;
+
 struct _JsonrpcClientClass
 {
   GObjectClass parent_class;
@@ -71,6 +83,41 @@ gboolean       jsonrpc_client_get_use_gvariant         (JsonrpcClient        *se
 JSONRPC_AVAILABLE_IN_3_26
 void           jsonrpc_client_set_use_gvariant         (JsonrpcClient        *self,
                                                         gboolean              use_gvariant);
+JSONRPC_AVAILABLE_IN_3_46
+gboolean       jsonrpc_client_get_use_compression      (JsonrpcClient        *self);
+JSONRPC_AVAILABLE_IN_3_46
+void           jsonrpc_client_set_use_compression      (JsonrpcClient        *self,
+                                                        gboolean              use_compression);
+JSONRPC_AVAILABLE_IN_3_46
+gboolean       jsonrpc_client_get_congested            (JsonrpcClient        *self);
+JSONRPC_AVAILABLE_IN_3_46
+void           jsonrpc_client_wait_writable_async      (JsonrpcClient        *self,
+                                                        GCancellable         *cancellable,
+                                                        GAsyncReadyCallback   callback,
+                                                        gpointer              user_data);
+JSONRPC_AVAILABLE_IN_3_46
+gboolean       jsonrpc_client_wait_writable_finish     (JsonrpcClient        *self,
+                                                        GAsyncResult         *result,
+                                                        GError              **error);
+JSONRPC_AVAILABLE_IN_3_46
+void           jsonrpc_client_cork                     (JsonrpcClient        *self);
+JSONRPC_AVAILABLE_IN_3_46
+void           jsonrpc_client_uncork                   (JsonrpcClient        *self);
+JSONRPC_AVAILABLE_IN_3_46
+JsonrpcFraming jsonrpc_client_get_framing              (JsonrpcClient        *self);
+JSONRPC_AVAILABLE_IN_3_46
+void           jsonrpc_client_set_framing              (JsonrpcClient        *self,
+                                                        JsonrpcFraming        framing);
+JSONRPC_AVAILABLE_IN_3_46
+gboolean       jsonrpc_client_get_decode_in_thread     (JsonrpcClient        *self);
+JSONRPC_AVAILABLE_IN_3_46
+void           jsonrpc_client_set_decode_in_thread     (JsonrpcClient        *self,
+                                                        gboolean              decode_in_thread);
+JSONRPC_AVAILABLE_IN_3_46
+const gchar   *jsonrpc_client_get_cancel_method        (JsonrpcClient        *self);
+JSONRPC_AVAILABLE_IN_3_46
+void           jsonrpc_client_set_cancel_method        (JsonrpcClient        *self,
+                                                        const gchar          *cancel_method);
 JSONRPC_AVAILABLE_IN_3_26
 gboolean       jsonrpc_client_close                    (JsonrpcClient        *self,
                                                         GCancellable         *cancellable,
@@ -99,6 +146,15 @@ void           jsonrpc_client_call_with_id_async       (JsonrpcClient        *se
                                                         GCancellable         *cancellable,
                                                         GAsyncReadyCallback   callback,
                                                         gpointer              user_data);
+JSONRPC_AVAILABLE_IN_3_46
+void           jsonrpc_client_call_with_deadline_async (JsonrpcClient        *self,
+                                                        const gchar          *method,
+                                                        GVariant             *params,
+                                                        gint64                deadline,
+                                                        GVariant            **id,
+                                                        GCancellable         *cancellable,
+                                                        GAsyncReadyCallback   callback,
+                                                        gpointer              user_data);
 JSONRPC_AVAILABLE_IN_3_26
 void           jsonrpc_client_call_async               (JsonrpcClient        *self,
                                                         const gchar          *method,
@@ -124,6 +180,14 @@ void           jsonrpc_client_send_notification_async  (JsonrpcClient        *se
                                                         GCancellable         *cancellable,
                                                         GAsyncReadyCallback   callback,
                                                         gpointer              user_data);
+JSONRPC_AVAILABLE_IN_3_46
+void           jsonrpc_client_send_coalesced_async     (JsonrpcClient        *self,
+                                                        const gchar          *method,
+                                                        GVariant             *params,
+                                                        const gchar          *coalesce_key,
+                                                        GCancellable         *cancellable,
+                                                        GAsyncReadyCallback   callback,
+                                                        gpointer              user_data);
 JSONRPC_AVAILABLE_IN_3_26
 gboolean       jsonrpc_client_send_notification_finish (JsonrpcClient        *self,
                                                         GAsyncResult         *result,
@@ -160,6 +224,86 @@ gboolean       jsonrpc_client_reply_error_finish       (JsonrpcClient        *se
 JSONRPC_AVAILABLE_IN_3_26
 void           jsonrpc_client_start_listening          (JsonrpcClient        *self);
 
+JSONRPC_AVAILABLE_IN_3_46
+GType               jsonrpc_client_batch_get_type         (void) G_GNUC_CONST;
+JSONRPC_AVAILABLE_IN_3_46
+JsonrpcClientBatch *jsonrpc_client_batch_new              (JsonrpcClient        *client);
+JSONRPC_AVAILABLE_IN_3_46
+JsonrpcClientBatch *jsonrpc_client_batch_ref              (JsonrpcClientBatch   *self);
+JSONRPC_AVAILABLE_IN_3_46
+void                jsonrpc_client_batch_unref            (JsonrpcClientBatch   *self);
+JSONRPC_AVAILABLE_IN_3_46
+void                jsonrpc_client_batch_add_call         (JsonrpcClientBatch   *self,
+                                                           const gchar          *method,
+                                                           GVariant             *params,
+                                                           gint64                deadline,
+                                                           GVariant            **id,
+                                                           GCancellable         *cancellable,
+                                                           GAsyncReadyCallback   callback,
+                                                           gpointer              user_data);
+JSONRPC_AVAILABLE_IN_3_46
+void                jsonrpc_client_batch_add_notification (JsonrpcClientBatch   *self,
+                                                           const gchar          *method,
+                                                           GVariant             *params);
+JSONRPC_AVAILABLE_IN_3_46
+void                jsonrpc_client_batch_send             (JsonrpcClientBatch   *self);
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC (JsonrpcClientBatch, jsonrpc_client_batch_unref)
+
+/**
+ * JsonrpcClientCorker:
+ *
+ * Opaque type used with g_autoptr() to keep a [class@Client] corked until
+ * the end of a scope.
+ *
+ * ```c
+ * {
+ *   g_autoptr(JsonrpcClientCorker) corker = jsonrpc_client_corker_new (client);
+ *
+ *   jsonrpc_client_reply_async (client, id, result, NULL, NULL, NULL);
+ *   jsonrpc_client_send_notification_async (client, "$/progress", params, NULL, NULL, NULL);
+ * }
+ * ```
+ *
+ * Since: 3.46
+ */
+typedef void JsonrpcClientCorker;
+
+/**
+ * jsonrpc_client_corker_new:
+ * @self: A #JsonrpcClient
+ *
+ * Corks @self with [method@Client.cork] until the returned value is freed
+ * with [func@Client.corker_free].
+ *
+ * Returns: a #JsonrpcClientCorker
+ *
+ * Since: 3.46
+ */
+static inline JsonrpcClientCorker *
+jsonrpc_client_corker_new (JsonrpcClient *self)
+{
+  jsonrpc_client_cork (self);
+  return (JsonrpcClientCorker *)g_object_ref (self);
+}
+
+/**
+ * jsonrpc_client_corker_free:
+ * @corker: A #JsonrpcClientCorker
+ *
+ * Uncorks the client corked by [func@Client.corker_new].
+ *
+ * Since: 3.46
+ */
+static inline void
+jsonrpc_client_corker_free (JsonrpcClientCorker *corker)
+{
+  jsonrpc_client_uncork ((JsonrpcClient *)corker);
+  g_object_unref (corker);
+}
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC (JsonrpcClientCorker, jsonrpc_client_corker_free)
+
 G_END_DECLS
 
 #endif /* JSONRPC_CLIENT_H */
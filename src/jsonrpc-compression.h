@@ -0,0 +1,49 @@
+/* jsonrpc-compression.h
+ *
+ * Copyright (C) 2026 Christian Hergert <chergert@redhat.com>
+ *
+ * This file is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation; either version 2.1 of the License, or (at your option)
+ * any later version.
+ *
+ * This file is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef JSONRPC_COMPRESSION_H
+#define JSONRPC_COMPRESSION_H
+
+#include <glib.h>
+
+#include "jsonrpc-version-macros.h"
+
+G_BEGIN_DECLS
+
+/**
+ * JsonrpcCompression:
+ * @JSONRPC_COMPRESSION_NONE: message bodies are not compressed.
+ * @JSONRPC_COMPRESSION_GZIP: large message bodies are compressed with gzip
+ *   and sent with a "Content-Encoding: gzip" header.
+ *
+ * How message bodies are compressed when written to a stream.
+ *
+ * Compression requires %JSONRPC_FRAMING_CONTENT_LENGTH since the encoding
+ * is announced in the headers of each message.
+ *
+ * Since: 3.46
+ */
+typedef enum
+{
+  JSONRPC_COMPRESSION_NONE = 0,
+  JSONRPC_COMPRESSION_GZIP = 1,
+} JsonrpcCompression;
+
+G_END_DECLS
+
+#endif /* JSONRPC_COMPRESSION_H */
@@ -0,0 +1,52 @@
+/* jsonrpc-framing.h
+ *
+ * Copyright (C) 2026 Christian Hergert <chergert@redhat.com>
+ *
+ * This file is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation; either version 2.1 of the License, or (at your option)
+ * any later version.
+ *
+ * This file is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef JSONRPC_FRAMING_H
+#define JSONRPC_FRAMING_H
+
+#include <glib.h>
+
+#include "jsonrpc-version-macros.h"
+
+G_BEGIN_DECLS
+
+/**
+ * JsonrpcFraming:
+ * @JSONRPC_FRAMING_CONTENT_LENGTH: each message is preceded by a header
+ *   block containing a "Content-Length" header, as used by the Language
+ *   Server Protocol.
+ * @JSONRPC_FRAMING_NEWLINE: each message is a single line of compact JSON
+ *   terminated by a newline, also known as NDJSON.
+ * @JSONRPC_FRAMING_AUTO: the framing is detected from the first bytes
+ *   received from the peer. Messages are written using
+ *   %JSONRPC_FRAMING_CONTENT_LENGTH until then.
+ *
+ * How messages are delimited on a stream.
+ *
+ * Since: 3.46
+ */
+typedef enum
+{
+  JSONRPC_FRAMING_CONTENT_LENGTH = 0,
+  JSONRPC_FRAMING_NEWLINE        = 1,
+  JSONRPC_FRAMING_AUTO           = 2,
+} JsonrpcFraming;
+
+G_END_DECLS
+
+#endif /* JSONRPC_FRAMING_H */
@@ -26,6 +26,8 @@ G_BEGIN_DECLS
 
 #define JSONRPC_GLIB_INSIDE
 # include "jsonrpc-client.h"
+# include "jsonrpc-compression.h"
+# include "jsonrpc-framing.h"
 # include "jsonrpc-input-stream.h"
 # include "jsonrpc-message.h"
 # include "jsonrpc-output-stream.h"
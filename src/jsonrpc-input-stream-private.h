@@ -19,11 +19,13 @@
 #ifndef JSONRPC_INPUT_STREAM_PRIVATE_H
 #define JSONRPC_INPUT_STREAM_PRIVATE_H
 
+#include "jsonrpc-compression.h"
 #include "jsonrpc-input-stream.h"
 
 G_BEGIN_DECLS
 
-gboolean _jsonrpc_input_stream_get_has_seen_gvariant (JsonrpcInputStream *self) G_GNUC_INTERNAL;
+gboolean           _jsonrpc_input_stream_get_has_seen_gvariant (JsonrpcInputStream *self) G_GNUC_INTERNAL;
+JsonrpcCompression _jsonrpc_input_stream_get_seen_compression  (JsonrpcInputStream *self) G_GNUC_INTERNAL;
 
 G_END_DECLS
 
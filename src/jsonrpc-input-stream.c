@@ -17,48 +17,215 @@
  */
 
 #define G_LOG_DOMAIN "jsonrpc-input-stream"
+#define _GNU_SOURCE
 
 #include "config.h"
 
 #include <errno.h>
-#include <json-glib/json-glib.h>
 #include <string.h>
 
+#include <glib/gstdio.h>
+
+#ifdef G_OS_UNIX
+# include <sys/mman.h>
+# include <unistd.h>
+#endif
+
+#include "jsonrpc-buffer-pool-private.h"
 #include "jsonrpc-input-stream.h"
 #include "jsonrpc-input-stream-private.h"
+#include "jsonrpc-json-parser-private.h"
+
+/*
+ * The largest header block we are willing to buffer while waiting for the
+ * blank line terminating the headers.
+ */
+#define JSONRPC_INPUT_STREAM_MAX_HEADER_SIZE (64 * 1024)
+
+/*
+ * The amount of memory kept around by the body buffer pool so that steady
+ * state traffic does not need to allocate.
+ */
+#define JSONRPC_INPUT_STREAM_MAX_POOLED_SIZE (4 * 1024 * 1024)
+
+/*
+ * When decoding in a thread is enabled, JSON bodies of at least this size are
+ * decoded on a worker thread. Smaller bodies decode faster than the round
+ * trip to the worker would take.
+ */
+#define JSONRPC_INPUT_STREAM_THREAD_THRESHOLD (64 * 1024)
+
+/*
+ * The amount of space kept available in the output buffer while
+ * decompressing a body, so that every step can make progress.
+ */
+#define JSONRPC_INPUT_STREAM_INFLATE_SPACE (16 * 1024)
+
+/* The size of the reads used to copy a body into a spill file */
+#define JSONRPC_INPUT_STREAM_SPILL_CHUNK_SIZE (64 * 1024)
+
+typedef struct
+{
+  gint  fd;
+  gsize remaining;
+} SpillState;
 
 typedef struct
 {
+  JsonrpcInputStream *self;
   gssize        content_length;
+  /* Limit for the decompressed size of the body */
+  gssize        max_size;
   gchar        *buffer;
+  SpillState   *spill;
+  /* A body which is not in a pool buffer, followed by a NUL byte */
+  GBytes       *spilled;
   GVariantType *gvariant_type;
   gint16        priority;
   guint         use_gvariant : 1;
+  guint         lazy_decoding : 1;
+  guint         compression : 2;
+  /* Line ending following the body with JSONRPC_FRAMING_NEWLINE */
+  guint         trailer_len : 2;
 } ReadState;
 
 typedef struct
 {
-  gssize max_size_bytes;
-  guint  has_seen_gvariant : 1;
+  /* ReadState of each frame to decode, in the order they were received */
+  GArray    *states;
+  GPtrArray *messages;
+  GError    *error;
+} DecodeBatch;
+
+typedef struct
+{
+  /*
+   * If we fail to decode a message while draining the buffer for
+   * jsonrpc_input_stream_read_messages_async(), the messages decoded so far
+   * are still delivered and the error is reported from the next read.
+   */
+  GError *pending_error;
+
+  /*
+   * Frames which were consumed from the stream while draining the buffer
+   * but not decoded because an earlier frame failed to decode. They are
+   * delivered by the following reads, after pending_error.
+   */
+  GArray *pending_states;
+
+  /* Body buffers, returned to the pool when messages are released */
+  JsonrpcBufferPool *pool;
+
+  /* A ReadState kept for reuse by the next read */
+  ReadState *cached_state;
+
+  gssize  max_size_bytes;
+
+  /* Bodies of at least this size are read into a spill file, 0 disables */
+  gsize   spill_threshold;
+
+  /* Replaced with the detected framing if JSONRPC_FRAMING_AUTO */
+  JsonrpcFraming framing;
+
+  /* The last compression used by the peer */
+  JsonrpcCompression seen_compression;
+
+  guint   has_seen_gvariant : 1;
+  guint   lazy_decoding : 1;
+  guint   decode_in_thread : 1;
 } JsonrpcInputStreamPrivate;
 
 G_DEFINE_TYPE_WITH_PRIVATE (JsonrpcInputStream, jsonrpc_input_stream, G_TYPE_DATA_INPUT_STREAM)
 
 static gboolean jsonrpc_input_stream_debug;
 
+static ReadState *
+read_state_new (JsonrpcInputStream *self)
+{
+  JsonrpcInputStreamPrivate *priv = jsonrpc_input_stream_get_instance_private (self);
+  ReadState *state;
+
+  state = g_atomic_pointer_get (&priv->cached_state);
+
+  if (state == NULL ||
+      !g_atomic_pointer_compare_and_exchange (&priv->cached_state, state, NULL))
+    state = g_slice_new0 (ReadState);
+
+  state->self = g_object_ref (self);
+  state->content_length = -1;
+  state->priority = G_PRIORITY_LOW;
+
+  return state;
+}
+
 static void
-read_state_free (gpointer data)
+spill_state_free (gpointer data)
+{
+  SpillState *spill = data;
+
+#ifdef G_OS_UNIX
+  if (spill->fd != -1)
+    close (spill->fd);
+#endif
+
+  g_slice_free (SpillState, spill);
+}
+
+static void
+read_state_clear (gpointer data)
 {
   ReadState *state = data;
 
-  g_clear_pointer (&state->buffer, g_free);
+  g_clear_pointer (&state->buffer, _jsonrpc_buffer_free);
+  g_clear_pointer (&state->spill, spill_state_free);
+  g_clear_pointer (&state->spilled, g_bytes_unref);
   g_clear_pointer (&state->gvariant_type, g_free);
-  g_slice_free (ReadState, state);
+}
+
+static void
+read_state_free (gpointer data)
+{
+  ReadState *state = data;
+  JsonrpcInputStreamPrivate *priv;
+  JsonrpcInputStream *self;
+
+  read_state_clear (state);
+
+  self = g_steal_pointer (&state->self);
+  priv = jsonrpc_input_stream_get_instance_private (self);
+
+  memset (state, 0, sizeof *state);
+
+  /* Keep the state around for the next read, which usually follows */
+  if (!g_atomic_pointer_compare_and_exchange (&priv->cached_state, NULL, state))
+    g_slice_free (ReadState, state);
+
+  g_object_unref (self);
+}
+
+static void
+jsonrpc_input_stream_finalize (GObject *object)
+{
+  JsonrpcInputStream *self = (JsonrpcInputStream *)object;
+  JsonrpcInputStreamPrivate *priv = jsonrpc_input_stream_get_instance_private (self);
+
+  g_clear_error (&priv->pending_error);
+  g_clear_pointer (&priv->pending_states, g_array_unref);
+  g_clear_pointer (&priv->pool, _jsonrpc_buffer_pool_unref);
+
+  if (priv->cached_state != NULL)
+    g_slice_free (ReadState, priv->cached_state);
+
+  G_OBJECT_CLASS (jsonrpc_input_stream_parent_class)->finalize (object);
 }
 
 static void
 jsonrpc_input_stream_class_init (JsonrpcInputStreamClass *klass)
 {
+  GObjectClass *object_class = G_OBJECT_CLASS (klass);
+
+  object_class->finalize = jsonrpc_input_stream_finalize;
+
   jsonrpc_input_stream_debug = !!g_getenv ("JSONRPC_DEBUG");
 }
 
@@ -70,6 +237,11 @@ jsonrpc_input_stream_init (JsonrpcInputStream *self)
   /* 16 MB */
   priv->max_size_bytes = 16 * 1024 * 1024;
 
+  priv->pool = _jsonrpc_buffer_pool_new (JSONRPC_INPUT_STREAM_MAX_POOLED_SIZE);
+
+  priv->pending_states = g_array_new (FALSE, FALSE, sizeof (ReadState));
+  g_array_set_clear_func (priv->pending_states, read_state_clear);
+
   g_data_input_stream_set_newline_type (G_DATA_INPUT_STREAM (self),
                                         G_DATA_STREAM_NEWLINE_TYPE_ANY);
 }
@@ -82,49 +254,219 @@ jsonrpc_input_stream_new (GInputStream *base_stream)
                        NULL);
 }
 
+static DecodeBatch *
+decode_batch_new (void)
+{
+  DecodeBatch *batch = g_slice_new0 (DecodeBatch);
+
+  batch->states = g_array_new (FALSE, FALSE, sizeof (ReadState));
+  g_array_set_clear_func (batch->states, read_state_clear);
+  batch->messages = g_ptr_array_new_with_free_func ((GDestroyNotify)g_variant_unref);
+
+  return batch;
+}
+
 static void
-jsonrpc_input_stream_read_body_cb (GObject      *object,
-                                   GAsyncResult *result,
-                                   gpointer      user_data)
+decode_batch_free (gpointer data)
 {
-  JsonrpcInputStream *self = (JsonrpcInputStream *)object;
-  g_autoptr(GTask) task = user_data;
-  g_autoptr(GError) error = NULL;
-  g_autoptr(GVariant) message = NULL;
-  ReadState *state;
-  gsize n_read;
+  DecodeBatch *batch = data;
+
+  g_clear_pointer (&batch->states, g_array_unref);
+  g_clear_pointer (&batch->messages, g_ptr_array_unref);
+  g_clear_error (&batch->error);
+  g_slice_free (DecodeBatch, batch);
+}
+
+/*
+ * jsonrpc_input_stream_take_pending:
+ *
+ * Moves the oldest frame which was read but not yet decoded into @state.
+ *
+ * Returns: %TRUE if there was such a frame.
+ */
+static gboolean
+jsonrpc_input_stream_take_pending (JsonrpcInputStream *self,
+                                   ReadState          *state)
+{
+  JsonrpcInputStreamPrivate *priv = jsonrpc_input_stream_get_instance_private (self);
+  ReadState *pending;
 
   g_assert (JSONRPC_IS_INPUT_STREAM (self));
-  g_assert (G_IS_TASK (task));
+  g_assert (state != NULL);
+  g_assert (state->buffer == NULL);
 
-  state = g_task_get_task_data (task);
+  if (priv->pending_states->len == 0)
+    return FALSE;
 
-  if (!g_input_stream_read_all_finish (G_INPUT_STREAM (self), result, &n_read, &error))
+  pending = &g_array_index (priv->pending_states, ReadState, 0);
+
+  state->content_length = pending->content_length;
+  state->buffer = g_steal_pointer (&pending->buffer);
+  state->spilled = g_steal_pointer (&pending->spilled);
+  state->gvariant_type = g_steal_pointer (&pending->gvariant_type);
+  state->max_size = pending->max_size;
+  state->use_gvariant = pending->use_gvariant;
+  state->lazy_decoding = pending->lazy_decoding;
+  state->compression = pending->compression;
+
+  g_array_remove_index (priv->pending_states, 0);
+
+  return TRUE;
+}
+
+/*
+ * jsonrpc_input_stream_prepare_decode:
+ *
+ * Records everything needed from @self to decode @state so that the
+ * decoding itself does not touch @self and may happen on another thread.
+ */
+static void
+jsonrpc_input_stream_prepare_decode (JsonrpcInputStream *self,
+                                     ReadState          *state)
+{
+  JsonrpcInputStreamPrivate *priv = jsonrpc_input_stream_get_instance_private (self);
+
+  g_assert (JSONRPC_IS_INPUT_STREAM (self));
+  g_assert (state != NULL);
+
+  /* track if we've seen an application/gvariant */
+  priv->has_seen_gvariant |= state->use_gvariant;
+
+  if (state->compression != JSONRPC_COMPRESSION_NONE)
+    priv->seen_compression = state->compression;
+
+  state->lazy_decoding = priv->lazy_decoding;
+  state->max_size = priv->max_size_bytes;
+}
+
+/*
+ * jsonrpc_input_stream_decompress:
+ *
+ * Replaces the compressed body of @state with the decompressed body, which
+ * is stored in @state->spilled.
+ *
+ * This may be called from a worker thread.
+ */
+static gboolean
+jsonrpc_input_stream_decompress (ReadState  *state,
+                                 GError    **error)
+{
+  g_autoptr(GConverter) converter = NULL;
+  g_autoptr(GByteArray) buffer = NULL;
+  g_autoptr(GBytes) compressed = NULL;
+  const guint8 *data;
+  gsize in_pos = 0;
+  gsize out_pos = 0;
+  gsize len;
+
+  g_assert (state != NULL);
+  g_assert (state->compression == JSONRPC_COMPRESSION_GZIP);
+
+  if (state->spilled != NULL)
+    compressed = g_steal_pointer (&state->spilled);
+  else
+    compressed = _jsonrpc_buffer_free_to_bytes (g_steal_pointer (&state->buffer), state->content_length);
+
+  data = g_bytes_get_data (compressed, &len);
+  converter = G_CONVERTER (g_zlib_decompressor_new (G_ZLIB_COMPRESSOR_FORMAT_GZIP));
+  buffer = g_byte_array_new ();
+
+  for (;;)
     {
-      g_task_return_error (task, g_steal_pointer (&error));
-      return;
+      GConverterResult res;
+      gsize n_read = 0;
+      gsize n_written = 0;
+
+      /* Growing past max_size + INFLATE_SPACE is never needed */
+      if (buffer->len - out_pos < JSONRPC_INPUT_STREAM_INFLATE_SPACE)
+        g_byte_array_set_size (buffer,
+                               MIN (MAX (buffer->len * 2, len * 4),
+                                    (gsize)state->max_size + JSONRPC_INPUT_STREAM_INFLATE_SPACE));
+
+      res = g_converter_convert (converter,
+                                 data + in_pos,
+                                 len - in_pos,
+                                 buffer->data + out_pos,
+                                 buffer->len - out_pos,
+                                 G_CONVERTER_INPUT_AT_END,
+                                 &n_read,
+                                 &n_written,
+                                 error);
+
+      if (res == G_CONVERTER_ERROR)
+        return FALSE;
+
+      in_pos += n_read;
+      out_pos += n_written;
+
+      if (out_pos > (gsize)state->max_size)
+        {
+          g_set_error (error,
+                       G_IO_ERROR,
+                       G_IO_ERROR_INVALID_DATA,
+                       "Message received from peer is too large");
+          return FALSE;
+        }
+
+      if (res == G_CONVERTER_FINISHED)
+        break;
     }
 
-  if ((gssize)n_read != state->content_length)
+  g_byte_array_set_size (buffer, out_pos + 1);
+  buffer->data[out_pos] = 0;
+
+  state->content_length = out_pos;
+  state->compression = JSONRPC_COMPRESSION_NONE;
+  state->spilled = g_bytes_new_take (g_byte_array_free (g_steal_pointer (&buffer), FALSE), out_pos);
+
+  return TRUE;
+}
+
+/*
+ * jsonrpc_input_stream_decode:
+ *
+ * Decodes the body that has been read into @state. The buffer of @state is
+ * consumed by this function.
+ *
+ * This may be called from a worker thread.
+ *
+ * Returns: (transfer full): a non-floating #GVariant or %NULL and @error
+ *   is set.
+ */
+static GVariant *
+jsonrpc_input_stream_decode (ReadState  *state,
+                             GError    **error)
+{
+  g_autoptr(GVariant) message = NULL;
+  g_autoptr(GBytes) bytes = NULL;
+  const gchar *data;
+
+  g_assert (state != NULL);
+  g_assert (state->buffer != NULL || state->spilled != NULL);
+
+  if (state->compression != JSONRPC_COMPRESSION_NONE &&
+      !jsonrpc_input_stream_decompress (state, error))
+    return NULL;
+
+  if (state->spilled != NULL)
     {
-      g_task_return_new_error (task,
-                               G_IO_ERROR,
-                               G_IO_ERROR_INVALID_DATA,
-                               "Failed to read %"G_GSSIZE_FORMAT" bytes",
-                               state->content_length);
-      return;
+      /* Spilled bodies are already followed by a NUL byte */
+      bytes = g_steal_pointer (&state->spilled);
+      data = g_bytes_get_data (bytes, NULL);
+    }
+  else
+    {
+      state->buffer [state->content_length] = '\0';
+      data = state->buffer;
     }
-
-  state->buffer [state->content_length] = '\0';
 
   if G_UNLIKELY (jsonrpc_input_stream_debug && state->use_gvariant == FALSE)
-    g_message ("<<< %s", state->buffer);
+    g_message ("<<< %s", data);
 
   if (state->use_gvariant)
     {
-      g_autoptr(GBytes) bytes = NULL;
-
-      bytes = g_bytes_new_take (g_steal_pointer (&state->buffer), state->content_length);
+      if (bytes == NULL)
+        bytes = _jsonrpc_buffer_free_to_bytes (g_steal_pointer (&state->buffer), state->content_length);
       message = g_variant_new_from_bytes (state->gvariant_type ?  state->gvariant_type
                                                                : G_VARIANT_TYPE_VARDICT,
                                           bytes, FALSE);
@@ -135,19 +477,46 @@ jsonrpc_input_stream_read_body_cb (GObject      *object,
           g_message ("<<< %s", debugstr);
         }
     }
+  else if (state->lazy_decoding)
+    {
+      /* Deferred members keep a reference to the body */
+      if (bytes == NULL)
+        bytes = _jsonrpc_buffer_free_to_bytes (g_steal_pointer (&state->buffer), state->content_length);
+      message = _jsonrpc_json_parse_envelope (bytes, error);
+    }
   else
     {
-      message = json_gvariant_deserialize_data (state->buffer, state->content_length, NULL, &error);
-      g_clear_pointer (&state->buffer, g_free);
+      /* Parse directly into a GVariant without an intermediate JsonNode tree */
+      message = _jsonrpc_json_parse (data, state->content_length, error);
+      g_clear_pointer (&state->buffer, _jsonrpc_buffer_free);
     }
 
   g_assert (state->buffer == NULL);
-  g_assert (message != NULL || error != NULL);
 
   /* Don't let message be floating */
   if (message != NULL)
     g_variant_take_ref (message);
 
+  return g_steal_pointer (&message);
+}
+
+static void
+jsonrpc_input_stream_decode_worker (GTask        *task,
+                                    gpointer      source_object,
+                                    gpointer      task_data,
+                                    GCancellable *cancellable)
+{
+  ReadState *state = task_data;
+  g_autoptr(GError) error = NULL;
+  g_autoptr(GVariant) message = NULL;
+
+  g_assert (G_IS_TASK (task));
+  g_assert (state != NULL);
+
+  message = jsonrpc_input_stream_decode (state, &error);
+
+  g_assert (message != NULL || error != NULL);
+
   if (error != NULL)
     g_task_return_error (task, g_steal_pointer (&error));
   else
@@ -156,235 +525,1501 @@ jsonrpc_input_stream_read_body_cb (GObject      *object,
                            (GDestroyNotify)g_variant_unref);
 }
 
+static gboolean
+jsonrpc_input_stream_should_thread (JsonrpcInputStream *self,
+                                    gsize               length)
+{
+  JsonrpcInputStreamPrivate *priv = jsonrpc_input_stream_get_instance_private (self);
+
+  return priv->decode_in_thread && length >= JSONRPC_INPUT_STREAM_THREAD_THRESHOLD;
+}
+
 static void
-jsonrpc_input_stream_read_headers_cb (GObject      *object,
-                                      GAsyncResult *result,
-                                      gpointer      user_data)
+jsonrpc_input_stream_decode_body (JsonrpcInputStream *self,
+                                  GTask              *task)
+{
+  ReadState *state;
+
+  g_assert (JSONRPC_IS_INPUT_STREAM (self));
+  g_assert (G_IS_TASK (task));
+
+  state = g_task_get_task_data (task);
+
+  jsonrpc_input_stream_prepare_decode (self, state);
+
+  /*
+   * Reads are not started until the previous one completes, so handing
+   * the body off to a worker thread cannot reorder messages. GVariant
+   * bodies are only wrapped here, so there is nothing to offload unless
+   * they need to be decompressed first.
+   */
+  if ((!state->use_gvariant || state->compression != JSONRPC_COMPRESSION_NONE) &&
+      jsonrpc_input_stream_should_thread (self, state->content_length))
+    g_task_run_in_thread (task, jsonrpc_input_stream_decode_worker);
+  else
+    jsonrpc_input_stream_decode_worker (task, self, state, g_task_get_cancellable (task));
+}
+
+static void
+jsonrpc_input_stream_read_body_cb (GObject      *object,
+                                   GAsyncResult *result,
+                                   gpointer      user_data)
 {
   JsonrpcInputStream *self = (JsonrpcInputStream *)object;
-  JsonrpcInputStreamPrivate *priv = jsonrpc_input_stream_get_instance_private (self);
   g_autoptr(GTask) task = user_data;
   g_autoptr(GError) error = NULL;
-  g_autofree gchar *line = NULL;
-  GCancellable *cancellable = NULL;
   ReadState *state;
-  gsize length = 0;
+  gsize n_read;
 
   g_assert (JSONRPC_IS_INPUT_STREAM (self));
-  g_assert (G_IS_ASYNC_RESULT (result));
   g_assert (G_IS_TASK (task));
 
   state = g_task_get_task_data (task);
-  cancellable = g_task_get_cancellable (task);
-
-  line = g_data_input_stream_read_line_finish_utf8 (G_DATA_INPUT_STREAM (self), result, &length, &error);
 
-  if (line == NULL)
+  if (!g_input_stream_read_all_finish (G_INPUT_STREAM (self), result, &n_read, &error))
     {
-      if (error != NULL)
-        g_task_return_error (task, g_steal_pointer (&error));
-      else
-        g_task_return_new_error (task,
-                                 G_IO_ERROR,
-                                 G_IO_ERROR_FAILED,
-                                 "No data to read from peer");
+      g_task_return_error (task, g_steal_pointer (&error));
       return;
     }
 
-  if (strncasecmp ("Content-Length: ", line, 16) == 0)
+  if ((gssize)n_read != state->content_length)
     {
-      const gchar *lenptr = line + 16;
-      gint64 content_length;
+      g_task_return_new_error (task,
+                               G_IO_ERROR,
+                               G_IO_ERROR_INVALID_DATA,
+                               "Failed to read %"G_GSSIZE_FORMAT" bytes",
+                               state->content_length);
+      return;
+    }
 
-      content_length = g_ascii_strtoll (lenptr, NULL, 10);
+  jsonrpc_input_stream_decode_body (self, task);
+}
 
-      if (((content_length == G_MININT64 || content_length == G_MAXINT64) && errno == ERANGE) ||
-          (content_length < 0) ||
-          (content_length == G_MAXSSIZE) ||
-          (content_length > priv->max_size_bytes))
-        {
-          g_task_return_new_error (task,
-                                   G_IO_ERROR,
-                                   G_IO_ERROR_INVALID_DATA,
-                                   "Invalid Content-Length received from peer");
-          return;
-        }
+static gboolean
+jsonrpc_input_stream_should_spill (JsonrpcInputStream *self,
+                                   gsize               length)
+{
+#ifdef G_OS_UNIX
+  JsonrpcInputStreamPrivate *priv = jsonrpc_input_stream_get_instance_private (self);
 
-      state->content_length = content_length;
-    }
+  /* Lines are entirely buffered before they are read, nothing to gain */
+  return priv->spill_threshold > 0 &&
+         length >= priv->spill_threshold &&
+         priv->framing == JSONRPC_FRAMING_CONTENT_LENGTH;
+#else
+  return FALSE;
+#endif
+}
 
-  if (strncasecmp ("Content-Type: ", line, 14) == 0)
-    {
-      if (NULL != strstr (line, "application/gvariant"))
-        state->use_gvariant = TRUE;
-    }
+#ifdef G_OS_UNIX
+/*
+ * open_spill_file:
+ *
+ * Creates an anonymous file to read a message body into. The file is gone
+ * once the descriptor and any mapping of it are closed.
+ */
+static gint
+open_spill_file (GError **error)
+{
+  g_autofree gchar *path = NULL;
+  gint fd;
 
-  if (strncasecmp ("X-GVariant-Type: ", line, 17) == 0)
-    {
-      const gchar *type_string = line + 17;
+#ifdef HAVE_MEMFD_CREATE
+  if ((fd = memfd_create ("jsonrpc-message", MFD_CLOEXEC)) != -1)
+    return fd;
+#endif
 
-      if (!g_variant_type_string_is_valid (type_string))
-        {
-          g_task_return_new_error (task,
-                                   G_IO_ERROR,
-                                   G_IO_ERROR_INVALID_DATA,
-                                   "Invalid X-GVariant-Type received from peer");
-          return;
-        }
+  if ((fd = g_file_open_tmp ("jsonrpc-message-XXXXXX", &path, error)) == -1)
+    return -1;
 
-      g_clear_pointer (&state->gvariant_type, g_free);
-      state->gvariant_type = (GVariantType *)g_strdup (type_string);
-    }
+  g_unlink (path);
 
-  /*
-   * If we are at the end of the headers, we can make progress towards
-   * parsing the JSON content. Otherwise we need to continue parsing
-   * the next header.
-   */
+  return fd;
+}
 
-  if (line[0] == '\0')
+static gboolean
+write_all (gint          fd,
+           const gchar  *data,
+           gsize         len,
+           GError      **error)
+{
+  while (len > 0)
     {
-      if (state->content_length <= 0)
+      gssize n_written = write (fd, data, len);
+
+      if (n_written < 0)
         {
-          g_task_return_new_error (task,
-                                   G_IO_ERROR,
-                                   G_IO_ERROR_INVALID_DATA,
-                                   "Invalid or missing Content-Length header from peer");
-          return;
+          int errsv = errno;
+
+          if (errsv == EINTR)
+            continue;
+
+          g_set_error_literal (error,
+                               G_IO_ERROR,
+                               g_io_error_from_errno (errsv),
+                               g_strerror (errsv));
+          return FALSE;
         }
 
-      state->buffer = g_malloc (state->content_length + 1);
-      g_input_stream_read_all_async (G_INPUT_STREAM (self),
-                                     state->buffer,
-                                     state->content_length,
-                                     state->priority,
-                                     cancellable,
-                                     jsonrpc_input_stream_read_body_cb,
-                                     g_steal_pointer (&task));
-      return;
+      data += n_written;
+      len -= n_written;
     }
 
-  g_data_input_stream_read_line_async (G_DATA_INPUT_STREAM (self),
-                                       state->priority,
-                                       cancellable,
-                                       jsonrpc_input_stream_read_headers_cb,
-                                       g_steal_pointer (&task));
+  return TRUE;
 }
 
-void
-jsonrpc_input_stream_read_message_async (JsonrpcInputStream  *self,
-                                         GCancellable        *cancellable,
-                                         GAsyncReadyCallback  callback,
-                                         gpointer             user_data)
+static void jsonrpc_input_stream_spill_next (JsonrpcInputStream *self,
+                                             GTask              *task);
+
+static void
+jsonrpc_input_stream_spill_read_cb (GObject      *object,
+                                    GAsyncResult *result,
+                                    gpointer      user_data)
 {
-  g_autoptr(GTask) task = NULL;
+  JsonrpcInputStream *self = (JsonrpcInputStream *)object;
+  g_autoptr(GTask) task = user_data;
+  g_autoptr(GError) error = NULL;
   ReadState *state;
+  gssize n_read;
 
-  g_return_if_fail (JSONRPC_IS_INPUT_STREAM (self));
-  g_return_if_fail (!cancellable || G_IS_CANCELLABLE (cancellable));
+  g_assert (JSONRPC_IS_INPUT_STREAM (self));
+  g_assert (G_IS_TASK (task));
 
-  state = g_slice_new0 (ReadState);
-  state->content_length = -1;
-  state->priority = G_PRIORITY_LOW;
+  state = g_task_get_task_data (task);
+
+  g_assert (state->spill != NULL);
+
+  if (-1 == (n_read = g_input_stream_read_finish (G_INPUT_STREAM (self), result, &error)))
+    {
+      g_task_return_error (task, g_steal_pointer (&error));
+      return;
+    }
+
+  if (n_read == 0)
+    {
+      g_task_return_new_error (task,
+                               G_IO_ERROR,
+                               G_IO_ERROR_INVALID_DATA,
+                               "Failed to read %"G_GSSIZE_FORMAT" bytes",
+                               state->content_length);
+      return;
+    }
+
+  if (!write_all (state->spill->fd, state->buffer, n_read, &error))
+    {
+      g_task_return_error (task, g_steal_pointer (&error));
+      return;
+    }
+
+  state->spill->remaining -= n_read;
+
+  jsonrpc_input_stream_spill_next (self, task);
+}
+
+static void
+jsonrpc_input_stream_spill_next (JsonrpcInputStream *self,
+                                 GTask              *task)
+{
+  g_autoptr(GMappedFile) mapped = NULL;
+  g_autoptr(GBytes) bytes = NULL;
+  g_autoptr(GError) error = NULL;
+  ReadState *state;
+
+  g_assert (JSONRPC_IS_INPUT_STREAM (self));
+  g_assert (G_IS_TASK (task));
+
+  state = g_task_get_task_data (task);
+
+  g_assert (state->spill != NULL);
+
+  if (state->spill->remaining > 0)
+    {
+      g_input_stream_read_async (G_INPUT_STREAM (self),
+                                 state->buffer,
+                                 MIN (state->spill->remaining, JSONRPC_INPUT_STREAM_SPILL_CHUNK_SIZE),
+                                 state->priority,
+                                 g_task_get_cancellable (task),
+                                 jsonrpc_input_stream_spill_read_cb,
+                                 g_object_ref (task));
+      return;
+    }
+
+  /* Terminate the body like in-memory bodies so it may be parsed in place */
+  if (!write_all (state->spill->fd, "", 1, &error) ||
+      !(mapped = g_mapped_file_new_from_fd (state->spill->fd, FALSE, &error)))
+    {
+      g_task_return_error (task, g_steal_pointer (&error));
+      return;
+    }
+
+  /* The mapping remains valid once the descriptor is closed */
+  g_clear_pointer (&state->spill, spill_state_free);
+  g_clear_pointer (&state->buffer, _jsonrpc_buffer_free);
+
+  bytes = g_mapped_file_get_bytes (mapped);
+  state->spilled = g_bytes_new_from_bytes (bytes, 0, state->content_length);
+
+  jsonrpc_input_stream_decode_body (self, task);
+}
+
+/*
+ * jsonrpc_input_stream_spill_body:
+ *
+ * Reads the body into an anonymous file instead of the heap and maps it,
+ * so that large messages are backed by the page cache rather than being
+ * copied into memory. GVariant bodies are used from the mapping directly.
+ */
+static void
+jsonrpc_input_stream_spill_body (JsonrpcInputStream *self,
+                                 GTask              *task)
+{
+  JsonrpcInputStreamPrivate *priv = jsonrpc_input_stream_get_instance_private (self);
+  g_autoptr(GError) error = NULL;
+  ReadState *state;
+  gint fd;
+
+  g_assert (JSONRPC_IS_INPUT_STREAM (self));
+  g_assert (G_IS_TASK (task));
+
+  state = g_task_get_task_data (task);
+
+  if (-1 == (fd = open_spill_file (&error)))
+    {
+      g_task_return_error (task, g_steal_pointer (&error));
+      return;
+    }
+
+  state->spill = g_slice_new0 (SpillState);
+  state->spill->fd = fd;
+  state->spill->remaining = state->content_length;
+  state->buffer = _jsonrpc_buffer_pool_alloc (priv->pool, JSONRPC_INPUT_STREAM_SPILL_CHUNK_SIZE);
+
+  jsonrpc_input_stream_spill_next (self, task);
+}
+#endif
+
+static gboolean
+parse_content_length (const gchar *str,
+                      gsize        len,
+                      gint64      *content_length)
+{
+  gint64 value = 0;
+  gsize i = 0;
+
+  g_assert (str != NULL);
+  g_assert (content_length != NULL);
+
+  while (i < len && (str[i] == ' ' || str[i] == '\t'))
+    i++;
+
+  if (i == len)
+    return FALSE;
+
+  for (; i < len && g_ascii_isdigit (str[i]); i++)
+    {
+      if (value > (G_MAXINT64 - 9) / 10)
+        return FALSE;
+      value = (value * 10) + (str[i] - '0');
+    }
+
+  while (i < len && (str[i] == ' ' || str[i] == '\t'))
+    i++;
+
+  if (i != len)
+    return FALSE;
+
+  *content_length = value;
+
+  return TRUE;
+}
+
+static gboolean
+parse_content_encoding (const gchar        *str,
+                        gsize               len,
+                        JsonrpcCompression *compression)
+{
+  g_assert (str != NULL);
+  g_assert (compression != NULL);
+
+  while (len > 0 && (*str == ' ' || *str == '\t'))
+    {
+      str++;
+      len--;
+    }
+
+  while (len > 0 && (str[len - 1] == ' ' || str[len - 1] == '\t'))
+    len--;
+
+  if (len == 8 && g_ascii_strncasecmp (str, "identity", 8) == 0)
+    *compression = JSONRPC_COMPRESSION_NONE;
+  else if (len == 4 && g_ascii_strncasecmp (str, "gzip", 4) == 0)
+    *compression = JSONRPC_COMPRESSION_GZIP;
+  else
+    return FALSE;
+
+  return TRUE;
+}
+
+static inline gboolean
+header_has_name (const gchar *line,
+                 gsize        line_len,
+                 const gchar *name,
+                 gsize        name_len)
+{
+  return line_len >= name_len && g_ascii_strncasecmp (line, name, name_len) == 0;
+}
+
+/*
+ * jsonrpc_input_stream_scan_headers:
+ *
+ * Scans the data that is already available in the buffer of the stream for
+ * a complete header block. This lets us parse all of the headers in a single
+ * pass rather than bouncing through the main loop for every line.
+ *
+ * Returns: %TRUE if the header block was complete and @state was updated. In
+ *   that case @header_len is set to the number of bytes used by the headers.
+ *   If %FALSE is returned and @error is not set, more data is required.
+ */
+static gboolean
+jsonrpc_input_stream_scan_headers (JsonrpcInputStream  *self,
+                                   ReadState           *state,
+                                   gsize               *header_len,
+                                   GError             **error)
+{
+  JsonrpcInputStreamPrivate *priv = jsonrpc_input_stream_get_instance_private (self);
+  g_autofree gchar *gvariant_type = NULL;
+  JsonrpcCompression compression = JSONRPC_COMPRESSION_NONE;
+  gint64 content_length = -1;
+  gboolean use_gvariant = FALSE;
+  const gchar *buffer;
+  const gchar *end;
+  const gchar *line;
+  gsize available = 0;
+
+  g_assert (JSONRPC_IS_INPUT_STREAM (self));
+  g_assert (state != NULL);
+  g_assert (header_len != NULL);
+
+  buffer = g_buffered_input_stream_peek_buffer (G_BUFFERED_INPUT_STREAM (self), &available);
+  end = buffer + available;
+
+  for (line = buffer; line < end; )
+    {
+      const gchar *eol = memchr (line, '\n', end - line);
+      gsize line_len;
+
+      if (eol == NULL)
+        break;
+
+      line_len = eol - line;
+      if (line_len > 0 && line[line_len - 1] == '\r')
+        line_len--;
+
+      /*
+       * If we are at the end of the headers, we can make progress towards
+       * parsing the JSON content. Otherwise we need to continue parsing
+       * the next header.
+       */
+      if (line_len == 0)
+        {
+          if (content_length <= 0)
+            {
+              g_set_error (error,
+                           G_IO_ERROR,
+                           G_IO_ERROR_INVALID_DATA,
+                           "Invalid or missing Content-Length header from peer");
+              return FALSE;
+            }
+
+          state->content_length = content_length;
+          state->use_gvariant = use_gvariant;
+          state->compression = compression;
+          state->trailer_len = 0;
+          g_clear_pointer (&state->gvariant_type, g_free);
+          state->gvariant_type = (GVariantType *)g_steal_pointer (&gvariant_type);
+
+          *header_len = (eol + 1) - buffer;
+
+          return TRUE;
+        }
+
+      if (header_has_name (line, line_len, "Content-Length:", 15))
+        {
+          if (!parse_content_length (line + 15, line_len - 15, &content_length) ||
+              (content_length == G_MAXSSIZE) ||
+              (content_length > priv->max_size_bytes))
+            {
+              g_set_error (error,
+                           G_IO_ERROR,
+                           G_IO_ERROR_INVALID_DATA,
+                           "Invalid Content-Length received from peer");
+              return FALSE;
+            }
+        }
+      else if (header_has_name (line, line_len, "Content-Type:", 13))
+        {
+          if (g_strstr_len (line, line_len, "application/gvariant") != NULL)
+            use_gvariant = TRUE;
+        }
+      else if (header_has_name (line, line_len, "Content-Encoding:", 17))
+        {
+          if (!parse_content_encoding (line + 17, line_len - 17, &compression))
+            {
+              g_set_error (error,
+                           G_IO_ERROR,
+                           G_IO_ERROR_INVALID_DATA,
+                           "Unsupported Content-Encoding received from peer");
+              return FALSE;
+            }
+        }
+      else if (header_has_name (line, line_len, "X-GVariant-Type:", 16))
+        {
+          const gchar *type_string = line + 16;
+          gsize type_len = line_len - 16;
+
+          while (type_len > 0 && *type_string == ' ')
+            {
+              type_string++;
+              type_len--;
+            }
+
+          g_clear_pointer (&gvariant_type, g_free);
+          gvariant_type = g_strndup (type_string, type_len);
+
+          if (!g_variant_type_string_is_valid (gvariant_type))
+            {
+              g_set_error (error,
+                           G_IO_ERROR,
+                           G_IO_ERROR_INVALID_DATA,
+                           "Invalid X-GVariant-Type received from peer");
+              return FALSE;
+            }
+        }
+
+      line = eol + 1;
+    }
+
+  return FALSE;
+}
+
+static inline gboolean
+is_json_space (gchar c)
+{
+  return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
+
+/*
+ * jsonrpc_input_stream_scan_line:
+ *
+ * Like jsonrpc_input_stream_scan_headers() but for JSONRPC_FRAMING_NEWLINE,
+ * where every message is a single line. Blank lines between messages are
+ * skipped and reported as part of @header_len.
+ */
+static gboolean
+jsonrpc_input_stream_scan_line (JsonrpcInputStream  *self,
+                                ReadState           *state,
+                                gsize               *header_len,
+                                GError             **error)
+{
+  JsonrpcInputStreamPrivate *priv = jsonrpc_input_stream_get_instance_private (self);
+  const gchar *buffer;
+  const gchar *eol;
+  gsize available = 0;
+  gsize skip = 0;
+  gsize line_len;
+  guint trailer_len = 1;
+
+  g_assert (JSONRPC_IS_INPUT_STREAM (self));
+  g_assert (state != NULL);
+  g_assert (header_len != NULL);
+
+  buffer = g_buffered_input_stream_peek_buffer (G_BUFFERED_INPUT_STREAM (self), &available);
+
+  while (skip < available && is_json_space (buffer[skip]))
+    skip++;
+
+  if (!(eol = memchr (buffer + skip, '\n', available - skip)))
+    {
+      if (available - skip > (gsize)priv->max_size_bytes)
+        {
+          g_set_error (error,
+                       G_IO_ERROR,
+                       G_IO_ERROR_INVALID_DATA,
+                       "Message received from peer is too large");
+          return FALSE;
+        }
+
+      return FALSE;
+    }
+
+  line_len = eol - (buffer + skip);
+
+  if (line_len > 0 && eol[-1] == '\r')
+    {
+      line_len--;
+      trailer_len++;
+    }
+
+  if (line_len > (gsize)priv->max_size_bytes)
+    {
+      g_set_error (error,
+                   G_IO_ERROR,
+                   G_IO_ERROR_INVALID_DATA,
+                   "Message received from peer is too large");
+      return FALSE;
+    }
+
+  state->content_length = line_len;
+  state->use_gvariant = FALSE;
+  state->compression = JSONRPC_COMPRESSION_NONE;
+  state->trailer_len = trailer_len;
+  g_clear_pointer (&state->gvariant_type, g_free);
+
+  *header_len = skip;
+
+  return TRUE;
+}
+
+/*
+ * jsonrpc_input_stream_scan_frame:
+ *
+ * Scans the buffer for the next frame using the framing of the stream,
+ * detecting it first if necessary. See jsonrpc_input_stream_scan_headers()
+ * for the semantics.
+ */
+static gboolean
+jsonrpc_input_stream_scan_frame (JsonrpcInputStream  *self,
+                                 ReadState           *state,
+                                 gsize               *header_len,
+                                 GError             **error)
+{
+  JsonrpcInputStreamPrivate *priv = jsonrpc_input_stream_get_instance_private (self);
+
+  g_assert (JSONRPC_IS_INPUT_STREAM (self));
+
+  if (priv->framing == JSONRPC_FRAMING_AUTO)
+    {
+      const gchar *buffer;
+      gsize available = 0;
+      gsize i = 0;
+
+      buffer = g_buffered_input_stream_peek_buffer (G_BUFFERED_INPUT_STREAM (self), &available);
+
+      while (i < available && is_json_space (buffer[i]))
+        i++;
+
+      if (i == available)
+        return FALSE;
+
+      /* Header blocks never start with a JSON container */
+      if (buffer[i] == '{' || buffer[i] == '[')
+        priv->framing = JSONRPC_FRAMING_NEWLINE;
+      else
+        priv->framing = JSONRPC_FRAMING_CONTENT_LENGTH;
+    }
+
+  if (priv->framing == JSONRPC_FRAMING_NEWLINE)
+    return jsonrpc_input_stream_scan_line (self, state, header_len, error);
+
+  return jsonrpc_input_stream_scan_headers (self, state, header_len, error);
+}
+
+/*
+ * jsonrpc_input_stream_skip_trailer:
+ *
+ * Consumes the line ending following a body read with
+ * JSONRPC_FRAMING_NEWLINE, which is already buffered.
+ */
+static gboolean
+jsonrpc_input_stream_skip_trailer (JsonrpcInputStream  *self,
+                                   ReadState           *state,
+                                   GError             **error)
+{
+  g_assert (JSONRPC_IS_INPUT_STREAM (self));
+  g_assert (state != NULL);
+
+  if (state->trailer_len == 0)
+    return TRUE;
+
+  if (g_input_stream_skip (G_INPUT_STREAM (self), state->trailer_len, NULL, error) != (gssize)state->trailer_len)
+    {
+      if (error != NULL && *error == NULL)
+        g_set_error_literal (error,
+                             G_IO_ERROR,
+                             G_IO_ERROR_INVALID_DATA,
+                             "Failed to consume line ending from peer");
+      return FALSE;
+    }
+
+  return TRUE;
+}
+
+/*
+ * jsonrpc_input_stream_shrink_buffer:
+ *
+ * Lines of JSONRPC_FRAMING_NEWLINE must be buffered whole, which grows the
+ * buffer up to the maximum message size. Once a long line has been
+ * consumed, return to a buffer the size of the largest header block so
+ * that a single large message does not pin that memory for the lifetime
+ * of the stream.
+ */
+static void
+jsonrpc_input_stream_shrink_buffer (JsonrpcInputStream *self)
+{
+  GBufferedInputStream *buffered = G_BUFFERED_INPUT_STREAM (self);
+
+  g_assert (JSONRPC_IS_INPUT_STREAM (self));
+
+  if (g_buffered_input_stream_get_buffer_size (buffered) > JSONRPC_INPUT_STREAM_MAX_HEADER_SIZE &&
+      g_buffered_input_stream_get_available (buffered) <= JSONRPC_INPUT_STREAM_MAX_HEADER_SIZE)
+    g_buffered_input_stream_set_buffer_size (buffered, JSONRPC_INPUT_STREAM_MAX_HEADER_SIZE);
+}
+
+static void jsonrpc_input_stream_read_headers (JsonrpcInputStream *self,
+                                               GTask              *task);
+
+static void
+jsonrpc_input_stream_fill_cb (GObject      *object,
+                              GAsyncResult *result,
+                              gpointer      user_data)
+{
+  JsonrpcInputStream *self = (JsonrpcInputStream *)object;
+  g_autoptr(GTask) task = user_data;
+  g_autoptr(GError) error = NULL;
+  gssize n_read;
+
+  g_assert (JSONRPC_IS_INPUT_STREAM (self));
+  g_assert (G_IS_ASYNC_RESULT (result));
+  g_assert (G_IS_TASK (task));
+
+  n_read = g_buffered_input_stream_fill_finish (G_BUFFERED_INPUT_STREAM (self), result, &error);
+
+  if (n_read < 0)
+    {
+      g_task_return_error (task, g_steal_pointer (&error));
+      return;
+    }
+
+  if (n_read == 0)
+    {
+      g_task_return_new_error (task,
+                               G_IO_ERROR,
+                               G_IO_ERROR_FAILED,
+                               "No data to read from peer");
+      return;
+    }
+
+  jsonrpc_input_stream_read_headers (self, task);
+}
+
+static void
+jsonrpc_input_stream_read_headers (JsonrpcInputStream *self,
+                                   GTask              *task)
+{
+  JsonrpcInputStreamPrivate *priv = jsonrpc_input_stream_get_instance_private (self);
+  GBufferedInputStream *buffered = G_BUFFERED_INPUT_STREAM (self);
+  g_autoptr(GError) error = NULL;
+  GCancellable *cancellable;
+  ReadState *state;
+  gsize header_len = 0;
+  gsize buffer_size;
+
+  g_assert (JSONRPC_IS_INPUT_STREAM (self));
+  g_assert (G_IS_TASK (task));
+
+  state = g_task_get_task_data (task);
+  cancellable = g_task_get_cancellable (task);
+
+  if (!jsonrpc_input_stream_scan_frame (self, state, &header_len, &error))
+    {
+      if (error != NULL)
+        {
+          g_task_return_error (task, g_steal_pointer (&error));
+          return;
+        }
+
+      /*
+       * We don't have a complete header block (or line) yet. If the buffer
+       * is already full, it is too small to contain the headers and must
+       * grow before we can request more data from the base stream. Lines
+       * are limited by the maximum message size, see scan_line().
+       */
+      buffer_size = g_buffered_input_stream_get_buffer_size (buffered);
+
+      if (g_buffered_input_stream_get_available (buffered) >= buffer_size)
+        {
+          if (buffer_size >= JSONRPC_INPUT_STREAM_MAX_HEADER_SIZE &&
+              priv->framing != JSONRPC_FRAMING_NEWLINE)
+            {
+              g_task_return_new_error (task,
+                                       G_IO_ERROR,
+                                       G_IO_ERROR_INVALID_DATA,
+                                       "Headers received from peer are too large");
+              return;
+            }
+
+          g_buffered_input_stream_set_buffer_size (buffered, buffer_size * 2);
+        }
+
+      g_buffered_input_stream_fill_async (buffered,
+                                          -1,
+                                          state->priority,
+                                          cancellable,
+                                          jsonrpc_input_stream_fill_cb,
+                                          g_object_ref (task));
+      return;
+    }
+
+  /* Skipping already buffered data does not touch the base stream */
+  if (g_input_stream_skip (G_INPUT_STREAM (self), header_len, cancellable, &error) != (gssize)header_len)
+    {
+      if (error == NULL)
+        error = g_error_new_literal (G_IO_ERROR,
+                                     G_IO_ERROR_INVALID_DATA,
+                                     "Failed to consume headers from peer");
+      g_task_return_error (task, g_steal_pointer (&error));
+      return;
+    }
+
+#ifdef G_OS_UNIX
+  if (jsonrpc_input_stream_should_spill (self, state->content_length))
+    {
+      jsonrpc_input_stream_spill_body (self, task);
+      return;
+    }
+#endif
+
+  state->buffer = _jsonrpc_buffer_pool_alloc (priv->pool, state->content_length + 1);
+
+  /*
+   * If the whole body is already buffered we can copy it out immediately
+   * without another round trip through the main loop.
+   */
+  if (g_buffered_input_stream_get_available (buffered) >= (gsize)state->content_length)
+    {
+      gsize n_read = 0;
+
+      if (!g_input_stream_read_all (G_INPUT_STREAM (self),
+                                    state->buffer,
+                                    state->content_length,
+                                    &n_read,
+                                    cancellable,
+                                    &error))
+        {
+          g_task_return_error (task, g_steal_pointer (&error));
+          return;
+        }
+
+      g_assert (n_read == (gsize)state->content_length);
+
+      if (!jsonrpc_input_stream_skip_trailer (self, state, &error))
+        {
+          g_task_return_error (task, g_steal_pointer (&error));
+          return;
+        }
+
+      jsonrpc_input_stream_shrink_buffer (self);
+      jsonrpc_input_stream_decode_body (self, task);
+      return;
+    }
+
+  g_input_stream_read_all_async (G_INPUT_STREAM (self),
+                                 state->buffer,
+                                 state->content_length,
+                                 state->priority,
+                                 cancellable,
+                                 jsonrpc_input_stream_read_body_cb,
+                                 g_object_ref (task));
+}
+
+/* Unbox the variant if it is in a wrapper */
+static GVariant *
+unbox_message (GVariant *message)
+{
+  g_assert (message != NULL);
+
+  if (g_variant_is_of_type (message, G_VARIANT_TYPE_VARIANT))
+    {
+      GVariant *child = g_variant_get_variant (message);
+      g_variant_unref (message);
+      return child;
+    }
+
+  return message;
+}
+
+void
+jsonrpc_input_stream_read_message_async (JsonrpcInputStream  *self,
+                                         GCancellable        *cancellable,
+                                         GAsyncReadyCallback  callback,
+                                         gpointer             user_data)
+{
+  JsonrpcInputStreamPrivate *priv = jsonrpc_input_stream_get_instance_private (self);
+  g_autoptr(GTask) task = NULL;
+  ReadState *state;
+
+  g_return_if_fail (JSONRPC_IS_INPUT_STREAM (self));
+  g_return_if_fail (!cancellable || G_IS_CANCELLABLE (cancellable));
+
+  state = read_state_new (self);
+
+  task = g_task_new (self, cancellable, callback, user_data);
+  g_task_set_source_tag (task, jsonrpc_input_stream_read_message_async);
+  g_task_set_task_data (task, state, read_state_free);
+  g_task_set_priority (task, state->priority);
+
+  /* Deliver any failure deferred while draining buffered messages */
+  if (priv->pending_error != NULL)
+    {
+      g_task_return_error (task, g_steal_pointer (&priv->pending_error));
+      return;
+    }
+
+  /* Followed by the frames which were read past that failure */
+  if (jsonrpc_input_stream_take_pending (self, state))
+    {
+      jsonrpc_input_stream_decode_body (self, task);
+      return;
+    }
+
+  jsonrpc_input_stream_read_headers (self, task);
+}
+
+gboolean
+jsonrpc_input_stream_read_message_finish (JsonrpcInputStream  *self,
+                                          GAsyncResult        *result,
+                                          GVariant           **message,
+                                          GError             **error)
+{
+  g_autoptr(GVariant) local_message = NULL;
+  gboolean ret;
+
+  g_return_val_if_fail (JSONRPC_IS_INPUT_STREAM (self), FALSE);
+  g_return_val_if_fail (G_IS_TASK (result), FALSE);
+
+  local_message = g_task_propagate_pointer (G_TASK (result), error);
+  ret = local_message != NULL;
+
+  if (message != NULL)
+    {
+      if (local_message != NULL)
+        *message = unbox_message (g_steal_pointer (&local_message));
+      else
+        *message = NULL;
+    }
+
+  return ret;
+}
+
+static void
+jsonrpc_input_stream_read_message_sync_cb (GObject      *object,
+                                           GAsyncResult *result,
+                                           gpointer      user_data)
+{
+  JsonrpcInputStream *self = (JsonrpcInputStream *)object;
+  g_autoptr(GError) error = NULL;
+  g_autoptr(GVariant) message = NULL;
+  GTask *task = user_data;
+
+  g_assert (JSONRPC_IS_INPUT_STREAM (self));
+  g_assert (G_IS_TASK (task));
+
+  if (!jsonrpc_input_stream_read_message_finish (self, result, &message, &error))
+    g_task_return_error (task, g_steal_pointer (&error));
+  else
+    g_task_return_pointer (task, g_steal_pointer (&message), (GDestroyNotify)g_variant_unref);
+}
+
+gboolean
+jsonrpc_input_stream_read_message (JsonrpcInputStream  *self,
+                                   GCancellable        *cancellable,
+                                   GVariant           **message,
+                                   GError             **error)
+{
+  g_autoptr(GMainContext) main_context = NULL;
+  g_autoptr(GVariant) local_message = NULL;
+  g_autoptr(GTask) task = NULL;
+  gboolean ret;
+
+  g_return_val_if_fail (JSONRPC_IS_INPUT_STREAM (self), FALSE);
+  g_return_val_if_fail (!cancellable || G_IS_CANCELLABLE (cancellable), FALSE);
+
+  main_context = g_main_context_ref_thread_default ();
+
+  task = g_task_new (NULL, NULL, NULL, NULL);
+  g_task_set_source_tag (task, jsonrpc_input_stream_read_message);
+
+  jsonrpc_input_stream_read_message_async (self,
+                                           cancellable,
+                                           jsonrpc_input_stream_read_message_sync_cb,
+                                           task);
+
+  while (!g_task_get_completed (task))
+    g_main_context_iteration (main_context, TRUE);
+
+  local_message = g_task_propagate_pointer (task, error);
+  ret = local_message != NULL;
+
+  if (message != NULL)
+    *message = g_steal_pointer (&local_message);
+
+  return ret;
+}
+
+/*
+ * jsonrpc_input_stream_read_buffered:
+ *
+ * Reads the next frame into @state if the complete frame (headers and
+ * body) is already available in the buffer. Nothing is consumed from the
+ * stream unless the whole frame is available.
+ *
+ * Returns: %TRUE if a frame was consumed, in which case @error is set if
+ *   it could not be read. %FALSE is returned if no complete frame is
+ *   buffered, in which case nothing was consumed.
+ */
+static gboolean
+jsonrpc_input_stream_read_buffered (JsonrpcInputStream  *self,
+                                    ReadState           *state,
+                                    GError             **error)
+{
+  JsonrpcInputStreamPrivate *priv = jsonrpc_input_stream_get_instance_private (self);
+  GBufferedInputStream *buffered = G_BUFFERED_INPUT_STREAM (self);
+  g_autoptr(GError) local_error = NULL;
+  gsize header_len = 0;
+  gsize n_read = 0;
+
+  g_assert (JSONRPC_IS_INPUT_STREAM (self));
+  g_assert (state != NULL);
+  g_assert (state->buffer == NULL);
+
+  /*
+   * Malformed headers are reported by the next read, which re-scans them.
+   * Bodies which should be spilled are also left to the next read.
+   */
+  if (!jsonrpc_input_stream_scan_frame (self, state, &header_len, &local_error) ||
+      g_buffered_input_stream_get_available (buffered) < header_len + (gsize)state->content_length + state->trailer_len ||
+      jsonrpc_input_stream_should_spill (self, state->content_length))
+    {
+      g_clear_pointer (&state->gvariant_type, g_free);
+      return FALSE;
+    }
+
+  state->buffer = _jsonrpc_buffer_pool_alloc (priv->pool, state->content_length + 1);
+
+  if (g_input_stream_skip (G_INPUT_STREAM (self), header_len, NULL, error) != (gssize)header_len ||
+      !g_input_stream_read_all (G_INPUT_STREAM (self), state->buffer, state->content_length, &n_read, NULL, error) ||
+      !jsonrpc_input_stream_skip_trailer (self, state, error))
+    {
+      read_state_clear (state);
+      return TRUE;
+    }
+
+  g_assert (n_read == (gsize)state->content_length);
+
+  jsonrpc_input_stream_shrink_buffer (self);
+  jsonrpc_input_stream_prepare_decode (self, state);
+
+  return TRUE;
+}
+
+/*
+ * decode_batch:
+ *
+ * Decodes the frames of @batch in order, stopping at the first failure.
+ * Frames following the failure are left in @batch->states. A decoding
+ * failure takes precedence over a failure to read further frames since it
+ * happened earlier in the stream.
+ *
+ * This may be called from a worker thread.
+ */
+static void
+decode_batch (DecodeBatch *batch)
+{
+  guint i;
 
-  task = g_task_new (self, cancellable, callback, user_data);
-  g_task_set_source_tag (task, jsonrpc_input_stream_read_message_async);
-  g_task_set_task_data (task, state, read_state_free);
-  g_task_set_priority (task, state->priority);
+  g_assert (batch != NULL);
+
+  for (i = 0; i < batch->states->len; i++)
+    {
+      ReadState *state = &g_array_index (batch->states, ReadState, i);
+      g_autoptr(GError) error = NULL;
+      GVariant *message;
+
+      if (!(message = jsonrpc_input_stream_decode (state, &error)))
+        {
+          g_clear_error (&batch->error);
+          batch->error = g_steal_pointer (&error);
+          i++;
+          break;
+        }
+
+      g_ptr_array_add (batch->messages, unbox_message (message));
+    }
 
-  g_data_input_stream_read_line_async (G_DATA_INPUT_STREAM (self),
-                                       state->priority,
-                                       cancellable,
-                                       jsonrpc_input_stream_read_headers_cb,
-                                       g_steal_pointer (&task));
+  g_array_remove_range (batch->states, 0, i);
 }
 
-gboolean
-jsonrpc_input_stream_read_message_finish (JsonrpcInputStream  *self,
-                                          GAsyncResult        *result,
-                                          GVariant           **message,
-                                          GError             **error)
+static void
+decode_batch_worker (GTask        *task,
+                     gpointer      source_object,
+                     gpointer      task_data,
+                     GCancellable *cancellable)
 {
-  JsonrpcInputStreamPrivate *priv = jsonrpc_input_stream_get_instance_private (self);
-  g_autoptr(GVariant) local_message = NULL;
-  ReadState *state;
-  gboolean ret;
+  decode_batch (task_data);
+  g_task_return_boolean (task, TRUE);
+}
 
-  g_return_val_if_fail (JSONRPC_IS_INPUT_STREAM (self), FALSE);
-  g_return_val_if_fail (G_IS_TASK (result), FALSE);
+static void
+jsonrpc_input_stream_complete_batch (JsonrpcInputStream *self,
+                                     GTask              *task,
+                                     DecodeBatch        *batch)
+{
+  JsonrpcInputStreamPrivate *priv = jsonrpc_input_stream_get_instance_private (self);
 
-  /* track if we've seen an application/gvariant */
-  state = g_task_get_task_data (G_TASK (result));
-  priv->has_seen_gvariant |= state->use_gvariant;
+  g_assert (JSONRPC_IS_INPUT_STREAM (self));
+  g_assert (G_IS_TASK (task));
+  g_assert (batch != NULL);
+  g_assert (batch->messages->len > 0);
 
-  local_message = g_task_propagate_pointer (G_TASK (result), error);
-  ret = local_message != NULL;
+  if (batch->error != NULL)
+    {
+      g_assert (priv->pending_error == NULL);
+      priv->pending_error = g_steal_pointer (&batch->error);
+    }
 
-  if (message != NULL)
+  /* The pending frames were moved into @batch so they are still in order */
+  if (batch->states->len > 0)
     {
-      /* Unbox the variant if it is in a wrapper */
-      if (local_message && g_variant_is_of_type (local_message, G_VARIANT_TYPE_VARIANT))
-        *message = g_variant_get_variant (local_message);
-      else
-        *message = g_steal_pointer (&local_message);
+      g_assert (priv->pending_states->len == 0);
+
+      g_array_append_vals (priv->pending_states, batch->states->data, batch->states->len);
+      g_array_set_clear_func (batch->states, NULL);
+      g_array_set_size (batch->states, 0);
     }
 
-  return ret;
+  g_task_return_pointer (task,
+                         g_steal_pointer (&batch->messages),
+                         (GDestroyNotify)g_ptr_array_unref);
 }
 
 static void
-jsonrpc_input_stream_read_message_sync_cb (GObject      *object,
-                                           GAsyncResult *result,
-                                           gpointer      user_data)
+jsonrpc_input_stream_decode_batch_cb (GObject      *object,
+                                      GAsyncResult *result,
+                                      gpointer      user_data)
 {
   JsonrpcInputStream *self = (JsonrpcInputStream *)object;
-  g_autoptr(GError) error = NULL;
+  g_autoptr(GTask) task = user_data;
+
+  g_assert (JSONRPC_IS_INPUT_STREAM (self));
+  g_assert (G_IS_TASK (result));
+  g_assert (G_IS_TASK (task));
+
+  jsonrpc_input_stream_complete_batch (self, task, g_task_get_task_data (G_TASK (result)));
+}
+
+static void
+jsonrpc_input_stream_read_messages_cb (GObject      *object,
+                                       GAsyncResult *result,
+                                       gpointer      user_data)
+{
+  JsonrpcInputStream *self = (JsonrpcInputStream *)object;
+  g_autoptr(GTask) task = user_data;
   g_autoptr(GVariant) message = NULL;
-  GTask *task = user_data;
+  g_autoptr(GError) error = NULL;
+  DecodeBatch *batch;
+  gsize json_size = 0;
 
   g_assert (JSONRPC_IS_INPUT_STREAM (self));
+  g_assert (G_IS_ASYNC_RESULT (result));
   g_assert (G_IS_TASK (task));
 
   if (!jsonrpc_input_stream_read_message_finish (self, result, &message, &error))
-    g_task_return_error (task, g_steal_pointer (&error));
-  else
-    g_task_return_pointer (task, g_steal_pointer (&message), (GDestroyNotify)g_variant_unref);
+    {
+      g_task_return_error (task, g_steal_pointer (&error));
+      return;
+    }
+
+  batch = decode_batch_new ();
+  g_ptr_array_add (batch->messages, g_steal_pointer (&message));
+
+  /*
+   * Now drain every other message that is already sitting in our buffer so
+   * that the caller may dispatch them all without additional round trips
+   * through the main loop.
+   */
+  for (;;)
+    {
+      ReadState state = { NULL, -1 };
+
+      if (!jsonrpc_input_stream_take_pending (self, &state) &&
+          !jsonrpc_input_stream_read_buffered (self, &state, &batch->error))
+        break;
+
+      if (batch->error != NULL)
+        break;
+
+      if (!state.use_gvariant)
+        json_size += state.content_length;
+
+      g_array_append_val (batch->states, state);
+    }
+
+  if (jsonrpc_input_stream_should_thread (self, json_size))
+    {
+      g_autoptr(GTask) decode_task = NULL;
+
+      /* The next read cannot start before @task completes, keeping order */
+      decode_task = g_task_new (self, NULL, jsonrpc_input_stream_decode_batch_cb, g_steal_pointer (&task));
+      g_task_set_source_tag (decode_task, jsonrpc_input_stream_read_messages_cb);
+      g_task_set_priority (decode_task, G_PRIORITY_LOW);
+      g_task_set_task_data (decode_task, batch, decode_batch_free);
+      g_task_run_in_thread (decode_task, decode_batch_worker);
+      return;
+    }
+
+  decode_batch (batch);
+  jsonrpc_input_stream_complete_batch (self, task, batch);
+  decode_batch_free (batch);
 }
 
-gboolean
-jsonrpc_input_stream_read_message (JsonrpcInputStream  *self,
-                                   GCancellable        *cancellable,
-                                   GVariant           **message,
-                                   GError             **error)
+/**
+ * jsonrpc_input_stream_read_messages_async:
+ * @self: a #JsonrpcInputStream
+ * @cancellable: (nullable): a #GCancellable or %NULL
+ * @callback: a #GAsyncReadyCallback to execute upon completion
+ * @user_data: closure data for @callback
+ *
+ * Asynchronously reads at least one message from the peer.
+ *
+ * Once the first message has been read, every other message which has
+ * already been completely received and buffered by @self is decoded as
+ * well. This allows processing bursts of messages without bouncing through
+ * the main loop for every message.
+ *
+ * Call jsonrpc_input_stream_read_messages_finish() to get the messages.
+ *
+ * Since: 3.46
+ */
+void
+jsonrpc_input_stream_read_messages_async (JsonrpcInputStream  *self,
+                                          GCancellable        *cancellable,
+                                          GAsyncReadyCallback  callback,
+                                          gpointer             user_data)
 {
-  g_autoptr(GMainContext) main_context = NULL;
-  g_autoptr(GVariant) local_message = NULL;
   g_autoptr(GTask) task = NULL;
-  gboolean ret;
 
-  g_return_val_if_fail (JSONRPC_IS_INPUT_STREAM (self), FALSE);
-  g_return_val_if_fail (!cancellable || G_IS_CANCELLABLE (cancellable), FALSE);
-
-  main_context = g_main_context_ref_thread_default ();
+  g_return_if_fail (JSONRPC_IS_INPUT_STREAM (self));
+  g_return_if_fail (!cancellable || G_IS_CANCELLABLE (cancellable));
 
-  task = g_task_new (NULL, NULL, NULL, NULL);
-  g_task_set_source_tag (task, jsonrpc_input_stream_read_message);
+  task = g_task_new (self, cancellable, callback, user_data);
+  g_task_set_source_tag (task, jsonrpc_input_stream_read_messages_async);
+  g_task_set_priority (task, G_PRIORITY_LOW);
 
   jsonrpc_input_stream_read_message_async (self,
                                            cancellable,
-                                           jsonrpc_input_stream_read_message_sync_cb,
-                                           task);
+                                           jsonrpc_input_stream_read_messages_cb,
+                                           g_steal_pointer (&task));
+}
 
-  while (!g_task_get_completed (task))
-    g_main_context_iteration (main_context, TRUE);
+/**
+ * jsonrpc_input_stream_read_messages_finish:
+ * @self: a #JsonrpcInputStream
+ * @result: a #GAsyncResult provided to callback
+ * @error: a location for a #GError, or %NULL
+ *
+ * Completes a request to jsonrpc_input_stream_read_messages_async().
+ *
+ * The messages are provided in the order they were received.
+ *
+ * Returns: (transfer container) (element-type GVariant): a #GPtrArray
+ *   containing at least one #GVariant, or %NULL and @error is set.
+ *
+ * Since: 3.46
+ */
+GPtrArray *
+jsonrpc_input_stream_read_messages_finish (JsonrpcInputStream  *self,
+                                           GAsyncResult        *result,
+                                           GError             **error)
+{
+  g_return_val_if_fail (JSONRPC_IS_INPUT_STREAM (self), NULL);
+  g_return_val_if_fail (G_IS_TASK (result), NULL);
 
-  local_message = g_task_propagate_pointer (task, error);
-  ret = local_message != NULL;
+  return g_task_propagate_pointer (G_TASK (result), error);
+}
 
-  if (message != NULL)
-    *message = g_steal_pointer (&local_message);
+/**
+ * jsonrpc_input_stream_get_lazy_decoding:
+ * @self: a #JsonrpcInputStream
+ *
+ * Gets whether lazy decoding is enabled.
+ *
+ * Returns: %TRUE if lazy decoding is enabled
+ *
+ * Since: 3.46
+ */
+gboolean
+jsonrpc_input_stream_get_lazy_decoding (JsonrpcInputStream *self)
+{
+  JsonrpcInputStreamPrivate *priv = jsonrpc_input_stream_get_instance_private (self);
 
-  return ret;
+  g_return_val_if_fail (JSONRPC_IS_INPUT_STREAM (self), FALSE);
+
+  return priv->lazy_decoding;
+}
+
+/**
+ * jsonrpc_input_stream_set_lazy_decoding:
+ * @self: a #JsonrpcInputStream
+ * @lazy_decoding: if lazy decoding should be used
+ *
+ * Sets whether JSON messages should be decoded lazily.
+ *
+ * When enabled, only the envelope of each message is decoded. The "params"
+ * and "result" members are kept as an undecoded slice of the message body
+ * when they contain an object or an array, and must be accessed using
+ * jsonrpc_message_lookup_value() which decodes them on demand. This avoids
+ * decoding messages which are only routed or discarded.
+ *
+ * Messages in the GVariant encoding are always decoded on demand.
+ *
+ * Since: 3.46
+ */
+void
+jsonrpc_input_stream_set_lazy_decoding (JsonrpcInputStream *self,
+                                        gboolean            lazy_decoding)
+{
+  JsonrpcInputStreamPrivate *priv = jsonrpc_input_stream_get_instance_private (self);
+
+  g_return_if_fail (JSONRPC_IS_INPUT_STREAM (self));
+
+  priv->lazy_decoding = !!lazy_decoding;
+}
+
+/**
+ * jsonrpc_input_stream_get_decode_in_thread:
+ * @self: a #JsonrpcInputStream
+ *
+ * Gets whether large messages are decoded on a worker thread.
+ *
+ * Returns: %TRUE if large messages are decoded on a worker thread
+ *
+ * Since: 3.46
+ */
+gboolean
+jsonrpc_input_stream_get_decode_in_thread (JsonrpcInputStream *self)
+{
+  JsonrpcInputStreamPrivate *priv = jsonrpc_input_stream_get_instance_private (self);
+
+  g_return_val_if_fail (JSONRPC_IS_INPUT_STREAM (self), FALSE);
+
+  return priv->decode_in_thread;
+}
+
+/**
+ * jsonrpc_input_stream_set_decode_in_thread:
+ * @self: a #JsonrpcInputStream
+ * @decode_in_thread: if large messages should be decoded on a worker thread
+ *
+ * Sets whether large JSON messages should be decoded on a worker thread.
+ *
+ * When enabled, the bodies of large messages are handed to a worker thread
+ * for decoding so that the thread owning the #GMainContext is not blocked
+ * while they are parsed. Small messages are still decoded immediately as
+ * that is cheaper than the round trip to the worker thread.
+ *
+ * Messages are always delivered on the #GMainContext the read was started
+ * from and in the order they were received.
+ *
+ * Since: 3.46
+ */
+void
+jsonrpc_input_stream_set_decode_in_thread (JsonrpcInputStream *self,
+                                           gboolean            decode_in_thread)
+{
+  JsonrpcInputStreamPrivate *priv = jsonrpc_input_stream_get_instance_private (self);
+
+  g_return_if_fail (JSONRPC_IS_INPUT_STREAM (self));
+
+  priv->decode_in_thread = !!decode_in_thread;
+}
+
+/**
+ * jsonrpc_input_stream_get_framing:
+ * @self: a #JsonrpcInputStream
+ *
+ * Gets how messages are delimited on the stream.
+ *
+ * If the framing was set to %JSONRPC_FRAMING_AUTO, the detected framing is
+ * returned once data has been received from the peer.
+ *
+ * Returns: a #JsonrpcFraming
+ *
+ * Since: 3.46
+ */
+JsonrpcFraming
+jsonrpc_input_stream_get_framing (JsonrpcInputStream *self)
+{
+  JsonrpcInputStreamPrivate *priv = jsonrpc_input_stream_get_instance_private (self);
+
+  g_return_val_if_fail (JSONRPC_IS_INPUT_STREAM (self), JSONRPC_FRAMING_CONTENT_LENGTH);
+
+  return priv->framing;
+}
+
+/**
+ * jsonrpc_input_stream_set_framing:
+ * @self: a #JsonrpcInputStream
+ * @framing: a #JsonrpcFraming
+ *
+ * Sets how messages are delimited on the stream.
+ *
+ * The default is %JSONRPC_FRAMING_CONTENT_LENGTH. With
+ * %JSONRPC_FRAMING_NEWLINE, every line received is decoded as a JSON
+ * message and blank lines are ignored. With %JSONRPC_FRAMING_AUTO, the
+ * framing is detected from the first bytes received, which start with a
+ * JSON object or array when %JSONRPC_FRAMING_NEWLINE is used.
+ *
+ * This should be set before reading the first message.
+ *
+ * Since: 3.46
+ */
+void
+jsonrpc_input_stream_set_framing (JsonrpcInputStream *self,
+                                  JsonrpcFraming      framing)
+{
+  JsonrpcInputStreamPrivate *priv = jsonrpc_input_stream_get_instance_private (self);
+
+  g_return_if_fail (JSONRPC_IS_INPUT_STREAM (self));
+  g_return_if_fail (framing <= JSONRPC_FRAMING_AUTO);
+
+  priv->framing = framing;
+}
+
+/**
+ * jsonrpc_input_stream_get_max_size:
+ * @self: a #JsonrpcInputStream
+ *
+ * Gets the largest message body, in bytes, that will be accepted from
+ * the peer.
+ *
+ * Returns: the maximum body size in bytes
+ *
+ * Since: 3.46
+ */
+gsize
+jsonrpc_input_stream_get_max_size (JsonrpcInputStream *self)
+{
+  JsonrpcInputStreamPrivate *priv = jsonrpc_input_stream_get_instance_private (self);
+
+  g_return_val_if_fail (JSONRPC_IS_INPUT_STREAM (self), 0);
+
+  return priv->max_size_bytes;
+}
+
+/**
+ * jsonrpc_input_stream_set_max_size:
+ * @self: a #JsonrpcInputStream
+ * @max_size: the maximum body size in bytes
+ *
+ * Sets the largest message body, in bytes, that will be accepted from the
+ * peer. Reading a message with a larger body fails with
+ * %G_IO_ERROR_INVALID_DATA.
+ *
+ * The default is 16 MB. When raising the limit considerably, consider
+ * using jsonrpc_input_stream_set_spill_threshold() as well.
+ *
+ * Since: 3.46
+ */
+void
+jsonrpc_input_stream_set_max_size (JsonrpcInputStream *self,
+                                   gsize               max_size)
+{
+  JsonrpcInputStreamPrivate *priv = jsonrpc_input_stream_get_instance_private (self);
+
+  g_return_if_fail (JSONRPC_IS_INPUT_STREAM (self));
+  g_return_if_fail (max_size > 0);
+
+  priv->max_size_bytes = MIN (max_size, G_MAXSSIZE - 1);
+}
+
+/**
+ * jsonrpc_input_stream_get_spill_threshold:
+ * @self: a #JsonrpcInputStream
+ *
+ * Gets the body size at which messages are read into a temporary file.
+ *
+ * Returns: the threshold in bytes, or 0 if disabled
+ *
+ * Since: 3.46
+ */
+gsize
+jsonrpc_input_stream_get_spill_threshold (JsonrpcInputStream *self)
+{
+  JsonrpcInputStreamPrivate *priv = jsonrpc_input_stream_get_instance_private (self);
+
+  g_return_val_if_fail (JSONRPC_IS_INPUT_STREAM (self), 0);
+
+  return priv->spill_threshold;
+}
+
+/**
+ * jsonrpc_input_stream_set_spill_threshold:
+ * @self: a #JsonrpcInputStream
+ * @spill_threshold: the body size in bytes, or 0 to disable
+ *
+ * Sets the body size at which messages are read into an anonymous
+ * temporary file (a memfd where available) instead of a heap buffer.
+ *
+ * The file is memory-mapped once the body has been received. Messages
+ * using the GVariant encoding are then used directly from the mapping
+ * without copying, and lazily decoded JSON messages keep referencing it.
+ * This allows receiving very large messages without holding a second
+ * copy of them in memory.
+ *
+ * Spilling is only supported on UNIX-like systems and disabled by default.
+ *
+ * Since: 3.46
+ */
+void
+jsonrpc_input_stream_set_spill_threshold (JsonrpcInputStream *self,
+                                          gsize               spill_threshold)
+{
+  JsonrpcInputStreamPrivate *priv = jsonrpc_input_stream_get_instance_private (self);
+
+  g_return_if_fail (JSONRPC_IS_INPUT_STREAM (self));
+
+  priv->spill_threshold = spill_threshold;
+}
+
+/**
+ * jsonrpc_input_stream_get_pool_stats:
+ * @self: a #JsonrpcInputStream
+ * @n_allocations: (out) (optional): location for the number of body buffers
+ *   requested
+ * @n_reused: (out) (optional): location for the number of body buffers which
+ *   were satisfied from the pool
+ * @retained_bytes: (out) (optional): location for the number of bytes
+ *   currently kept by the pool
+ *
+ * Gets statistics about the pool of buffers used to read message bodies.
+ *
+ * Buffers are returned to the pool once the message they were decoded
+ * into is released, so @n_reused close to @n_allocations indicates that
+ * steady state traffic is not allocating.
+ *
+ * Since: 3.46
+ */
+void
+jsonrpc_input_stream_get_pool_stats (JsonrpcInputStream *self,
+                                     guint64            *n_allocations,
+                                     guint64            *n_reused,
+                                     gsize              *retained_bytes)
+{
+  JsonrpcInputStreamPrivate *priv = jsonrpc_input_stream_get_instance_private (self);
+
+  g_return_if_fail (JSONRPC_IS_INPUT_STREAM (self));
+
+  _jsonrpc_buffer_pool_get_stats (priv->pool, n_allocations, n_reused, retained_bytes);
 }
 
 gboolean
@@ -396,3 +2031,13 @@ _jsonrpc_input_stream_get_has_seen_gvariant (JsonrpcInputStream *self)
 
   return priv->has_seen_gvariant;
 }
+
+JsonrpcCompression
+_jsonrpc_input_stream_get_seen_compression (JsonrpcInputStream *self)
+{
+  JsonrpcInputStreamPrivate *priv = jsonrpc_input_stream_get_instance_private (self);
+
+  g_return_val_if_fail (JSONRPC_IS_INPUT_STREAM (self), JSONRPC_COMPRESSION_NONE);
+
+  return priv->seen_compression;
+}
@@ -21,6 +21,7 @@
 
 #include <gio/gio.h>
 
+#include "jsonrpc-framing.h"
 #include "jsonrpc-version-macros.h"
 
 G_BEGIN_DECLS
@@ -61,6 +62,45 @@ gboolean            jsonrpc_input_stream_read_message_finish (JsonrpcInputStream
                                                               GAsyncResult         *result,
                                                               GVariant            **message,
                                                               GError              **error);
+JSONRPC_AVAILABLE_IN_3_46
+gboolean            jsonrpc_input_stream_get_lazy_decoding    (JsonrpcInputStream   *self);
+JSONRPC_AVAILABLE_IN_3_46
+void                jsonrpc_input_stream_set_lazy_decoding    (JsonrpcInputStream   *self,
+                                                               gboolean              lazy_decoding);
+JSONRPC_AVAILABLE_IN_3_46
+gboolean            jsonrpc_input_stream_get_decode_in_thread (JsonrpcInputStream   *self);
+JSONRPC_AVAILABLE_IN_3_46
+void                jsonrpc_input_stream_set_decode_in_thread (JsonrpcInputStream   *self,
+                                                               gboolean              decode_in_thread);
+JSONRPC_AVAILABLE_IN_3_46
+JsonrpcFraming      jsonrpc_input_stream_get_framing          (JsonrpcInputStream   *self);
+JSONRPC_AVAILABLE_IN_3_46
+void                jsonrpc_input_stream_set_framing          (JsonrpcInputStream   *self,
+                                                               JsonrpcFraming        framing);
+JSONRPC_AVAILABLE_IN_3_46
+gsize               jsonrpc_input_stream_get_max_size         (JsonrpcInputStream   *self);
+JSONRPC_AVAILABLE_IN_3_46
+void                jsonrpc_input_stream_set_max_size         (JsonrpcInputStream   *self,
+                                                               gsize                 max_size);
+JSONRPC_AVAILABLE_IN_3_46
+gsize               jsonrpc_input_stream_get_spill_threshold  (JsonrpcInputStream   *self);
+JSONRPC_AVAILABLE_IN_3_46
+void                jsonrpc_input_stream_set_spill_threshold  (JsonrpcInputStream   *self,
+                                                               gsize                 spill_threshold);
+JSONRPC_AVAILABLE_IN_3_46
+void                jsonrpc_input_stream_get_pool_stats       (JsonrpcInputStream   *self,
+                                                               guint64              *n_allocations,
+                                                               guint64              *n_reused,
+                                                               gsize                *retained_bytes);
+JSONRPC_AVAILABLE_IN_3_46
+void                jsonrpc_input_stream_read_messages_async  (JsonrpcInputStream   *self,
+                                                               GCancellable         *cancellable,
+                                                               GAsyncReadyCallback   callback,
+                                                               gpointer              user_data);
+JSONRPC_AVAILABLE_IN_3_46
+GPtrArray          *jsonrpc_input_stream_read_messages_finish (JsonrpcInputStream   *self,
+                                                               GAsyncResult         *result,
+                                                               GError              **error);
 
 G_END_DECLS
 
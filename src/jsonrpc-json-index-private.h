@@ -0,0 +1,88 @@
+/* jsonrpc-json-index-private.h
+ *
+ * Copyright (C) 2026 Christian Hergert <chergert@redhat.com>
+ *
+ * This file is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation; either version 2.1 of the License, or (at your option)
+ * any later version.
+ *
+ * This file is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef JSONRPC_JSON_INDEX_PRIVATE_H
+#define JSONRPC_JSON_INDEX_PRIVATE_H
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/*
+ * Bodies smaller than this are parsed without a structural index as the
+ * cost of building the index outweighs the savings.
+ */
+#define JSONRPC_JSON_INDEX_THRESHOLD (64 * 1024)
+
+/*
+ * The number of entries held at once. The index is built a window at a
+ * time as the parser advances, so it takes 16 KiB whatever the size of
+ * the body.
+ */
+#define JSONRPC_JSON_INDEX_WINDOW 4096
+
+typedef struct
+{
+  const guint8 *data;
+  gsize         length;
+
+  /* The offset of the next block to classify */
+  gsize         offset;
+  guint64       in_string;
+  gboolean      escape_carry;
+
+  /* Offsets of the structural characters of the current window */
+  guint32      *entries;
+  guint         n_entries;
+  guint         position;
+} JsonrpcJsonIndex;
+
+void     _jsonrpc_json_index_init  (JsonrpcJsonIndex *index,
+                                    const gchar      *data,
+                                    gsize             length) G_GNUC_INTERNAL;
+void     _jsonrpc_json_index_clear (JsonrpcJsonIndex *index) G_GNUC_INTERNAL;
+gboolean _jsonrpc_json_index_fill  (JsonrpcJsonIndex *index) G_GNUC_INTERNAL;
+
+/*
+ * Gets the offset of the current entry, building the next window of the
+ * index if necessary. Returns %FALSE once every entry has been consumed.
+ */
+static inline gboolean
+_jsonrpc_json_index_peek (JsonrpcJsonIndex *index,
+                          guint32          *offset)
+{
+  if (index->position == index->n_entries && !_jsonrpc_json_index_fill (index))
+    return FALSE;
+
+  *offset = index->entries[index->position];
+
+  return TRUE;
+}
+
+/* Consumes the entry returned by _jsonrpc_json_index_peek() */
+static inline void
+_jsonrpc_json_index_next (JsonrpcJsonIndex *index)
+{
+  g_assert (index->position < index->n_entries);
+
+  index->position++;
+}
+
+G_END_DECLS
+
+#endif /* JSONRPC_JSON_INDEX_PRIVATE_H */
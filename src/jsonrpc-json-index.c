@@ -0,0 +1,412 @@
+/* jsonrpc-json-index.c
+ *
+ * Copyright (C) 2026 Christian Hergert <chergert@redhat.com>
+ *
+ * This file is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation; either version 2.1 of the License, or (at your option)
+ * any later version.
+ *
+ * This file is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define G_LOG_DOMAIN "jsonrpc-json-index"
+
+#include "config.h"
+
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+# include <immintrin.h>
+# if defined(__SSE2__)
+#  define HAVE_SSE2_KERNEL 1
+# endif
+# if defined(__GNUC__) && defined(__x86_64__)
+#  define HAVE_AVX2_KERNEL 1
+# endif
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+# include <arm_neon.h>
+# define HAVE_NEON_KERNEL 1
+#endif
+
+#include "jsonrpc-json-index-private.h"
+
+#if defined(__GNUC__) || defined(__clang__)
+# define ctz64(v) __builtin_ctzll(v)
+#else
+static inline guint
+ctz64 (guint64 v)
+{
+  guint n = 0;
+
+  while ((v & 1) == 0)
+    {
+      v >>= 1;
+      n++;
+    }
+
+  return n;
+}
+#endif
+
+/*
+ * The structural index contains the offset of every quote which opens or
+ * closes a string and every brace, bracket, colon, and comma which is not
+ * within a string. It allows the parser to find the end of a string without
+ * looking at each byte of it. As the parser only moves forward, the index
+ * is built a window at a time rather than for the whole body up front.
+ *
+ * The input is processed in blocks of 64 bytes. A kernel classifies each
+ * byte of the block into bitmasks (one bit per byte) and the remainder of
+ * the work is done with scalar bit operations on those masks. Kernels are
+ * provided for SSE2, AVX2 and NEON along with a portable fallback. Setting
+ * JSONRPC_DISABLE_SIMD in the environment forces the fallback.
+ */
+
+typedef struct
+{
+  guint64 quote;
+  guint64 backslash;
+  guint64 op;
+} BlockMasks;
+
+typedef void (*ClassifyFunc) (const guint8 *block,
+                              BlockMasks   *masks);
+
+static void
+classify_scalar (const guint8 *block,
+                 BlockMasks   *masks)
+{
+  guint64 quote = 0;
+  guint64 backslash = 0;
+  guint64 op = 0;
+
+  for (guint i = 0; i < 64; i++)
+    {
+      guint64 bit = G_GUINT64_CONSTANT (1) << i;
+
+      switch (block[i])
+        {
+        case '"':
+          quote |= bit;
+          break;
+
+        case '\\':
+          backslash |= bit;
+          break;
+
+        case '{': case '}': case '[': case ']': case ':': case ',':
+          op |= bit;
+          break;
+
+        default:
+          break;
+        }
+    }
+
+  masks->quote = quote;
+  masks->backslash = backslash;
+  masks->op = op;
+}
+
+#ifdef HAVE_SSE2_KERNEL
+static void
+classify_sse2 (const guint8 *block,
+               BlockMasks   *masks)
+{
+  const __m128i quote = _mm_set1_epi8 ('"');
+  const __m128i backslash = _mm_set1_epi8 ('\\');
+  const __m128i lbrace = _mm_set1_epi8 ('{');
+  const __m128i rbrace = _mm_set1_epi8 ('}');
+  const __m128i lbracket = _mm_set1_epi8 ('[');
+  const __m128i rbracket = _mm_set1_epi8 (']');
+  const __m128i colon = _mm_set1_epi8 (':');
+  const __m128i comma = _mm_set1_epi8 (',');
+
+  masks->quote = 0;
+  masks->backslash = 0;
+  masks->op = 0;
+
+  for (guint i = 0; i < 4; i++)
+    {
+      __m128i v = _mm_loadu_si128 ((const __m128i *)(gconstpointer)(block + i * 16));
+      __m128i op;
+
+      op = _mm_or_si128 (_mm_or_si128 (_mm_cmpeq_epi8 (v, lbrace),
+                                       _mm_cmpeq_epi8 (v, rbrace)),
+                         _mm_or_si128 (_mm_cmpeq_epi8 (v, lbracket),
+                                       _mm_cmpeq_epi8 (v, rbracket)));
+      op = _mm_or_si128 (op,
+                         _mm_or_si128 (_mm_cmpeq_epi8 (v, colon),
+                                       _mm_cmpeq_epi8 (v, comma)));
+
+      masks->quote |= (guint64)(guint16)_mm_movemask_epi8 (_mm_cmpeq_epi8 (v, quote)) << (i * 16);
+      masks->backslash |= (guint64)(guint16)_mm_movemask_epi8 (_mm_cmpeq_epi8 (v, backslash)) << (i * 16);
+      masks->op |= (guint64)(guint16)_mm_movemask_epi8 (op) << (i * 16);
+    }
+}
+#endif
+
+#ifdef HAVE_AVX2_KERNEL
+__attribute__((target ("avx2")))
+static void
+classify_avx2 (const guint8 *block,
+               BlockMasks   *masks)
+{
+  const __m256i quote = _mm256_set1_epi8 ('"');
+  const __m256i backslash = _mm256_set1_epi8 ('\\');
+  const __m256i lbrace = _mm256_set1_epi8 ('{');
+  const __m256i rbrace = _mm256_set1_epi8 ('}');
+  const __m256i lbracket = _mm256_set1_epi8 ('[');
+  const __m256i rbracket = _mm256_set1_epi8 (']');
+  const __m256i colon = _mm256_set1_epi8 (':');
+  const __m256i comma = _mm256_set1_epi8 (',');
+
+  masks->quote = 0;
+  masks->backslash = 0;
+  masks->op = 0;
+
+  for (guint i = 0; i < 2; i++)
+    {
+      __m256i v = _mm256_loadu_si256 ((const __m256i *)(gconstpointer)(block + i * 32));
+      __m256i op;
+
+      op = _mm256_or_si256 (_mm256_or_si256 (_mm256_cmpeq_epi8 (v, lbrace),
+                                             _mm256_cmpeq_epi8 (v, rbrace)),
+                            _mm256_or_si256 (_mm256_cmpeq_epi8 (v, lbracket),
+                                             _mm256_cmpeq_epi8 (v, rbracket)));
+      op = _mm256_or_si256 (op,
+                            _mm256_or_si256 (_mm256_cmpeq_epi8 (v, colon),
+                                             _mm256_cmpeq_epi8 (v, comma)));
+
+      masks->quote |= (guint64)(guint32)_mm256_movemask_epi8 (_mm256_cmpeq_epi8 (v, quote)) << (i * 32);
+      masks->backslash |= (guint64)(guint32)_mm256_movemask_epi8 (_mm256_cmpeq_epi8 (v, backslash)) << (i * 32);
+      masks->op |= (guint64)(guint32)_mm256_movemask_epi8 (op) << (i * 32);
+    }
+}
+#endif
+
+#ifdef HAVE_NEON_KERNEL
+static inline guint64
+neon_movemask (uint8x16_t v)
+{
+  static const guint8 weights[16] = { 1, 2, 4, 8, 16, 32, 64, 128,
+                                      1, 2, 4, 8, 16, 32, 64, 128 };
+  uint8x16_t m = vandq_u8 (v, vld1q_u8 (weights));
+
+  return (guint64)vaddv_u8 (vget_low_u8 (m)) |
+         ((guint64)vaddv_u8 (vget_high_u8 (m)) << 8);
+}
+
+static void
+classify_neon (const guint8 *block,
+               BlockMasks   *masks)
+{
+  const uint8x16_t quote = vdupq_n_u8 ('"');
+  const uint8x16_t backslash = vdupq_n_u8 ('\\');
+  const uint8x16_t lbrace = vdupq_n_u8 ('{');
+  const uint8x16_t rbrace = vdupq_n_u8 ('}');
+  const uint8x16_t lbracket = vdupq_n_u8 ('[');
+  const uint8x16_t rbracket = vdupq_n_u8 (']');
+  const uint8x16_t colon = vdupq_n_u8 (':');
+  const uint8x16_t comma = vdupq_n_u8 (',');
+
+  masks->quote = 0;
+  masks->backslash = 0;
+  masks->op = 0;
+
+  for (guint i = 0; i < 4; i++)
+    {
+      uint8x16_t v = vld1q_u8 (block + i * 16);
+      uint8x16_t op;
+
+      op = vorrq_u8 (vorrq_u8 (vceqq_u8 (v, lbrace), vceqq_u8 (v, rbrace)),
+                     vorrq_u8 (vceqq_u8 (v, lbracket), vceqq_u8 (v, rbracket)));
+      op = vorrq_u8 (op, vorrq_u8 (vceqq_u8 (v, colon), vceqq_u8 (v, comma)));
+
+      masks->quote |= neon_movemask (vceqq_u8 (v, quote)) << (i * 16);
+      masks->backslash |= neon_movemask (vceqq_u8 (v, backslash)) << (i * 16);
+      masks->op |= neon_movemask (op) << (i * 16);
+    }
+}
+#endif
+
+static ClassifyFunc
+choose_kernel (void)
+{
+  if (g_getenv ("JSONRPC_DISABLE_SIMD") != NULL)
+    return classify_scalar;
+
+#ifdef HAVE_AVX2_KERNEL
+  __builtin_cpu_init ();
+  if (__builtin_cpu_supports ("avx2"))
+    return classify_avx2;
+#endif
+
+#ifdef HAVE_SSE2_KERNEL
+  return classify_sse2;
+#endif
+
+#ifdef HAVE_NEON_KERNEL
+  return classify_neon;
+#endif
+
+  return classify_scalar;
+}
+
+/*
+ * Returns a mask of the bytes which are escaped by a preceding backslash.
+ * @carry is set if the last byte of the block is an escaping backslash.
+ */
+static inline guint64
+find_escaped (guint64   backslash,
+              gboolean *carry)
+{
+  guint64 escaped = 0;
+
+  if (*carry)
+    {
+      escaped = 1;
+      backslash &= ~G_GUINT64_CONSTANT (1);
+    }
+
+  *carry = FALSE;
+
+  /* Backslashes are rare, so walking them one at a time is cheap */
+  while (backslash != 0)
+    {
+      guint bit = ctz64 (backslash);
+
+      backslash &= backslash - 1;
+
+      if (bit == 63)
+        {
+          *carry = TRUE;
+          break;
+        }
+
+      escaped |= G_GUINT64_CONSTANT (1) << (bit + 1);
+      backslash &= ~(G_GUINT64_CONSTANT (1) << (bit + 1));
+    }
+
+  return escaped;
+}
+
+/* Each bit is set if an odd number of bits are set at or below it */
+static inline guint64
+prefix_xor (guint64 bits)
+{
+  bits ^= bits << 1;
+  bits ^= bits << 2;
+  bits ^= bits << 4;
+  bits ^= bits << 8;
+  bits ^= bits << 16;
+  bits ^= bits << 32;
+  return bits;
+}
+
+/**
+ * _jsonrpc_json_index_init:
+ * @index: an uninitialized #JsonrpcJsonIndex
+ * @data: the JSON encoded data
+ * @length: the length of @data in bytes
+ *
+ * Prepares @index to walk the structural characters of @data in order.
+ * Nothing is classified until the first entry is requested.
+ */
+void
+_jsonrpc_json_index_init (JsonrpcJsonIndex *index,
+                          const gchar      *data,
+                          gsize             length)
+{
+  g_return_if_fail (index != NULL);
+  g_return_if_fail (data != NULL);
+  g_return_if_fail (length <= G_MAXUINT32);
+
+  memset (index, 0, sizeof *index);
+
+  index->data = (const guint8 *)data;
+  index->length = length;
+  index->entries = g_new (guint32, JSONRPC_JSON_INDEX_WINDOW);
+}
+
+void
+_jsonrpc_json_index_clear (JsonrpcJsonIndex *index)
+{
+  g_return_if_fail (index != NULL);
+
+  g_clear_pointer (&index->entries, g_free);
+  index->n_entries = 0;
+  index->position = 0;
+}
+
+/**
+ * _jsonrpc_json_index_fill:
+ * @index: a #JsonrpcJsonIndex
+ *
+ * Replaces the consumed entries of @index with those of the following
+ * blocks of the data, as many as fit in the window.
+ *
+ * Returns: %FALSE if there are no entries left
+ */
+gboolean
+_jsonrpc_json_index_fill (JsonrpcJsonIndex *index)
+{
+  static ClassifyFunc classify;
+  guint n = 0;
+
+  g_return_val_if_fail (index != NULL, FALSE);
+  g_return_val_if_fail (index->position == index->n_entries, FALSE);
+
+  if (g_once_init_enter (&classify))
+    g_once_init_leave (&classify, choose_kernel ());
+
+  /* A block contributes at most 64 entries */
+  while (index->offset < index->length && JSONRPC_JSON_INDEX_WINDOW - n >= 64)
+    {
+      guint8 tail[64];
+      const guint8 *block = index->data + index->offset;
+      BlockMasks masks;
+      guint64 quote;
+      guint64 structural;
+
+      /* Pad the final partial block with whitespace */
+      if (index->length - index->offset < 64)
+        {
+          memset (tail, ' ', sizeof tail);
+          memcpy (tail, block, index->length - index->offset);
+          block = tail;
+        }
+
+      classify (block, &masks);
+
+      quote = masks.quote & ~find_escaped (masks.backslash, &index->escape_carry);
+
+      /*
+       * in_string has a bit set for every byte from an opening quote up to,
+       * but not including, the closing quote. Carry the state of the last
+       * byte into the next block.
+       */
+      index->in_string = prefix_xor (quote) ^ (index->in_string >> 63 ? G_MAXUINT64 : 0);
+      structural = (masks.op & ~index->in_string) | quote;
+
+      while (structural != 0)
+        {
+          index->entries[n++] = (guint32)(index->offset + ctz64 (structural));
+          structural &= structural - 1;
+        }
+
+      index->offset += 64;
+    }
+
+  index->n_entries = n;
+  index->position = 0;
+
+  return n > 0;
+}
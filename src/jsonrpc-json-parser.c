@@ -0,0 +1,1105 @@
+/* jsonrpc-json-parser.c
+ *
+ * Copyright (C) 2026 Christian Hergert <chergert@redhat.com>
+ *
+ * This file is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation; either version 2.1 of the License, or (at your option)
+ * any later version.
+ *
+ * This file is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define G_LOG_DOMAIN "jsonrpc-json-parser"
+
+#include "config.h"
+
+#include <errno.h>
+#include <json-glib/json-glib.h>
+#include <string.h>
+
+#include "jsonrpc-json-index-private.h"
+#include "jsonrpc-json-parser-private.h"
+
+/*
+ * This is a single pass parser which produces the same #GVariant that
+ * json_gvariant_deserialize_data() would produce when no signature is
+ * provided, but without building an intermediate #JsonNode tree.
+ *
+ *   object → a{sv}
+ *   array  → av
+ *   string → s
+ *   int    → x
+ *   double → d
+ *   bool   → b
+ *   null   → mv
+ *
+ * As values are parsed they are pushed onto a single stack shared by every
+ * level of nesting. When a container closes, its children are taken from the
+ * top of the stack and handed to g_variant_new_array() directly.
+ *
+ * Members of an object with the same name keep the position of the first
+ * occurrence and the value of the last, just like #JsonObject.
+ *
+ * For large bodies a structural index is built first (see
+ * jsonrpc-json-index.c) so that the end of each string can be found without
+ * scanning it byte by byte.
+ */
+
+#define MAX_DEPTH 1024
+
+typedef struct
+{
+  const gchar *begin;
+  const gchar *pos;
+  const gchar *end;
+
+  /* Parsed values (and member names for objects) of every open container */
+  GPtrArray   *values;
+  GPtrArray   *names;
+
+  /* Body to reference from deferred values, or %NULL to decode everything */
+  GBytes      *bytes;
+
+  /* Structural index, used for large bodies only */
+  JsonrpcJsonIndex index;
+  gboolean     use_index;
+
+  guint        depth;
+} Parser;
+
+static GVariant *parse_value (Parser  *p,
+                              GError **error);
+
+static gboolean
+set_error (Parser       *p,
+           GError      **error,
+           gint          code,
+           const gchar  *message)
+{
+  g_set_error (error,
+               JSON_PARSER_ERROR,
+               code,
+               "%s at offset %"G_GSIZE_FORMAT,
+               message,
+               (gsize)(p->pos - p->begin));
+  return FALSE;
+}
+
+static inline void
+skip_whitespace (Parser *p)
+{
+  while (p->pos < p->end &&
+         (*p->pos == ' ' || *p->pos == '\n' || *p->pos == '\r' || *p->pos == '\t'))
+    p->pos++;
+}
+
+static inline gint
+hex_value (gchar c)
+{
+  if (c >= '0' && c <= '9')
+    return c - '0';
+  else if (c >= 'a' && c <= 'f')
+    return c - 'a' + 10;
+  else if (c >= 'A' && c <= 'F')
+    return c - 'A' + 10;
+  return -1;
+}
+
+static gboolean
+parse_unichar (Parser    *p,
+               gunichar  *ret)
+{
+  gunichar value = 0;
+
+  /* p->pos is just past "\u" */
+  if (p->end - p->pos < 4)
+    return FALSE;
+
+  for (guint i = 0; i < 4; i++)
+    {
+      gint v = hex_value (p->pos[i]);
+
+      if (v < 0)
+        return FALSE;
+
+      value = (value << 4) | v;
+    }
+
+  p->pos += 4;
+  *ret = value;
+
+  return TRUE;
+}
+
+static gboolean
+parse_escape (Parser   *p,
+              GString  *str,
+              GError  **error)
+{
+  gunichar uc;
+
+  /* p->pos is just past the backslash */
+  if (p->pos >= p->end)
+    return set_error (p, error, JSON_PARSER_ERROR_PARSE, "Unterminated string");
+
+  switch (*p->pos++)
+    {
+    case '"':  g_string_append_c (str, '"');  return TRUE;
+    case '\\': g_string_append_c (str, '\\'); return TRUE;
+    case '/':  g_string_append_c (str, '/');  return TRUE;
+    case 'b':  g_string_append_c (str, '\b'); return TRUE;
+    case 'f':  g_string_append_c (str, '\f'); return TRUE;
+    case 'n':  g_string_append_c (str, '\n'); return TRUE;
+    case 'r':  g_string_append_c (str, '\r'); return TRUE;
+    case 't':  g_string_append_c (str, '\t'); return TRUE;
+
+    case 'u':
+      if (!parse_unichar (p, &uc))
+        return set_error (p, error, JSON_PARSER_ERROR_INVALID_DATA, "Invalid unicode escape");
+
+      if (uc >= 0xD800 && uc <= 0xDBFF)
+        {
+          gunichar low;
+
+          if (p->end - p->pos < 2 || p->pos[0] != '\\' || p->pos[1] != 'u')
+            return set_error (p, error, JSON_PARSER_ERROR_INVALID_DATA, "Invalid unicode surrogate pair");
+
+          p->pos += 2;
+
+          if (!parse_unichar (p, &low) || low < 0xDC00 || low > 0xDFFF)
+            return set_error (p, error, JSON_PARSER_ERROR_INVALID_DATA, "Invalid unicode surrogate pair");
+
+          uc = 0x10000 + ((uc - 0xD800) << 10) + (low - 0xDC00);
+        }
+      else if (uc >= 0xDC00 && uc <= 0xDFFF)
+        return set_error (p, error, JSON_PARSER_ERROR_INVALID_DATA, "Invalid unicode surrogate pair");
+      else if (uc == 0)
+        return set_error (p, error, JSON_PARSER_ERROR_INVALID_DATA, "Strings may not contain NUL");
+
+      g_string_append_unichar (str, uc);
+      return TRUE;
+
+    default:
+      p->pos--;
+      return set_error (p, error, JSON_PARSER_ERROR_INVALID_DATA, "Invalid escape sequence");
+    }
+}
+
+/*
+ * Advances the index to the entry for @at, skipping entries which have
+ * been passed by the parser. Returns %FALSE if @at is not structural.
+ */
+static inline gboolean
+seek_index (Parser      *p,
+            const gchar *at)
+{
+  guint32 offset = at - p->begin;
+  guint32 entry;
+
+  while (_jsonrpc_json_index_peek (&p->index, &entry) && entry < offset)
+    _jsonrpc_json_index_next (&p->index);
+
+  return _jsonrpc_json_index_peek (&p->index, &entry) && entry == offset;
+}
+
+/*
+ * Parses a string starting at the opening quote and returns a newly
+ * allocated, UTF-8 validated, copy of its contents.
+ */
+static gchar *
+parse_string (Parser  *p,
+              GError **error)
+{
+  const gchar *begin;
+  GString *str;
+
+  g_assert (*p->pos == '"');
+
+  begin = ++p->pos;
+
+  if (p->use_index)
+    {
+      gboolean found = FALSE;
+      guint32 entry = 0;
+
+      /* The next entry is always the closing quote */
+      if (seek_index (p, begin - 1))
+        {
+          _jsonrpc_json_index_next (&p->index);
+          found = _jsonrpc_json_index_peek (&p->index, &entry);
+        }
+
+      if (!found)
+        {
+          p->pos = p->end;
+          set_error (p, error, JSON_PARSER_ERROR_PARSE, "Unterminated string");
+          return NULL;
+        }
+
+      p->pos = p->begin + entry;
+      _jsonrpc_json_index_next (&p->index);
+
+      g_assert (*p->pos == '"');
+
+      /* Rewind so that escapes are decoded below */
+      if (memchr (begin, '\\', p->pos - begin) != NULL)
+        p->pos = begin;
+    }
+  else
+    {
+      /* Fast path, strings without any escapes can be copied directly */
+      while (p->pos < p->end && *p->pos != '"' && *p->pos != '\\')
+        p->pos++;
+    }
+
+  if (p->pos >= p->end)
+    {
+      set_error (p, error, JSON_PARSER_ERROR_PARSE, "Unterminated string");
+      return NULL;
+    }
+
+  if (*p->pos == '"')
+    {
+      gsize len = p->pos - begin;
+
+      if (!g_utf8_validate (begin, len, NULL))
+        {
+          set_error (p, error, JSON_PARSER_ERROR_INVALID_DATA, "Invalid UTF-8 in string");
+          return NULL;
+        }
+
+      p->pos++;
+
+      return g_strndup (begin, len);
+    }
+
+  str = g_string_new_len (begin, p->pos - begin);
+
+  while (p->pos < p->end)
+    {
+      const gchar *run = p->pos;
+
+      while (p->pos < p->end && *p->pos != '"' && *p->pos != '\\')
+        p->pos++;
+
+      g_string_append_len (str, run, p->pos - run);
+
+      if (p->pos >= p->end)
+        break;
+
+      if (*p->pos == '"')
+        {
+          p->pos++;
+
+          if (!g_utf8_validate (str->str, str->len, NULL))
+            {
+              set_error (p, error, JSON_PARSER_ERROR_INVALID_DATA, "Invalid UTF-8 in string");
+              g_string_free (str, TRUE);
+              return NULL;
+            }
+
+          return g_string_free (str, FALSE);
+        }
+
+      p->pos++;
+
+      if (!parse_escape (p, str, error))
+        {
+          g_string_free (str, TRUE);
+          return NULL;
+        }
+    }
+
+  set_error (p, error, JSON_PARSER_ERROR_PARSE, "Unterminated string");
+  g_string_free (str, TRUE);
+
+  return NULL;
+}
+
+static GVariant *
+parse_number (Parser  *p,
+              GError **error)
+{
+  const gchar *begin = p->pos;
+  gboolean is_double = FALSE;
+  gchar *endptr = NULL;
+
+  if (p->pos < p->end && *p->pos == '-')
+    p->pos++;
+
+  /* Leading zeros are not allowed, such as "01" or "-01" */
+  if (p->pos >= p->end ||
+      !g_ascii_isdigit (*p->pos) ||
+      (*p->pos == '0' && p->pos + 1 < p->end && g_ascii_isdigit (p->pos[1])))
+    {
+      set_error (p, error, JSON_PARSER_ERROR_INVALID_DATA, "Invalid number");
+      return NULL;
+    }
+
+  while (p->pos < p->end && g_ascii_isdigit (*p->pos))
+    p->pos++;
+
+  if (p->pos < p->end && *p->pos == '.')
+    {
+      is_double = TRUE;
+      p->pos++;
+
+      if (p->pos >= p->end || !g_ascii_isdigit (*p->pos))
+        {
+          set_error (p, error, JSON_PARSER_ERROR_INVALID_DATA, "Invalid number");
+          return NULL;
+        }
+
+      while (p->pos < p->end && g_ascii_isdigit (*p->pos))
+        p->pos++;
+    }
+
+  if (p->pos < p->end && (*p->pos == 'e' || *p->pos == 'E'))
+    {
+      is_double = TRUE;
+      p->pos++;
+
+      if (p->pos < p->end && (*p->pos == '+' || *p->pos == '-'))
+        p->pos++;
+
+      if (p->pos >= p->end || !g_ascii_isdigit (*p->pos))
+        {
+          set_error (p, error, JSON_PARSER_ERROR_INVALID_DATA, "Invalid number");
+          return NULL;
+        }
+
+      while (p->pos < p->end && g_ascii_isdigit (*p->pos))
+        p->pos++;
+    }
+
+  /*
+   * The buffer is always NUL terminated and the number is followed by a
+   * character that cannot be part of it, so the conversion stops at p->pos.
+   */
+  if (!is_double)
+    {
+      gint64 v;
+
+      errno = 0;
+      v = g_ascii_strtoll (begin, &endptr, 10);
+
+      if (errno == 0 && endptr == p->pos)
+        return g_variant_new_int64 (v);
+
+      /* Fallback to a double for integers which do not fit */
+    }
+
+  {
+    gdouble v = g_ascii_strtod (begin, &endptr);
+
+    if (endptr != p->pos)
+      {
+        set_error (p, error, JSON_PARSER_ERROR_INVALID_DATA, "Invalid number");
+        return NULL;
+      }
+
+    return g_variant_new_double (v);
+  }
+}
+
+static gboolean
+parse_literal (Parser      *p,
+               const gchar *literal,
+               gsize        len)
+{
+  if ((gsize)(p->end - p->pos) < len || memcmp (p->pos, literal, len) != 0)
+    return FALSE;
+
+  /* Reject things like "nullx" or "true1" */
+  if (p->pos + len < p->end && (g_ascii_isalnum (p->pos[len]) || p->pos[len] == '_'))
+    return FALSE;
+
+  p->pos += len;
+
+  return TRUE;
+}
+
+static void
+pop_values (Parser *p,
+            guint   base)
+{
+  /* Children are floating or full references, unref releases either */
+  for (guint i = base; i < p->values->len; i++)
+    {
+      g_variant_unref (g_ptr_array_index (p->values, i));
+      g_free (g_ptr_array_index (p->names, i));
+    }
+
+  g_ptr_array_set_size (p->values, base);
+  g_ptr_array_set_size (p->names, base);
+}
+
+static void
+merge_duplicate_names (Parser *p,
+                       guint   base)
+{
+  gchar **names = (gchar **)(gpointer)&g_ptr_array_index (p->names, base);
+  GVariant **values = (GVariant **)(gpointer)&g_ptr_array_index (p->values, base);
+  guint n_members = p->values->len - base;
+  g_autoptr(GHashTable) seen = NULL;
+  guint out = 0;
+
+  if (n_members < 2)
+    return;
+
+  /*
+   * Most objects are small enough that comparing names pairwise is cheaper
+   * than hashing them. Only consult a hash table for larger objects.
+   */
+  if (n_members > 8)
+    seen = g_hash_table_new (g_str_hash, g_str_equal);
+
+  for (guint i = 0; i < n_members; i++)
+    {
+      gpointer position = NULL;
+      gboolean found = FALSE;
+      guint j = 0;
+
+      if (seen != NULL)
+        {
+          if ((found = g_hash_table_lookup_extended (seen, names[i], NULL, &position)))
+            j = GPOINTER_TO_UINT (position);
+        }
+      else
+        {
+          for (j = 0; j < out; j++)
+            {
+              if (strcmp (names[j], names[i]) == 0)
+                {
+                  found = TRUE;
+                  break;
+                }
+            }
+        }
+
+      if (found)
+        {
+          /* Keep the first position, but the last value */
+          g_variant_unref (values[j]);
+          values[j] = values[i];
+          g_free (names[i]);
+          continue;
+        }
+
+      names[out] = names[i];
+      values[out] = values[i];
+
+      if (seen != NULL)
+        g_hash_table_insert (seen, names[out], GUINT_TO_POINTER (out));
+
+      out++;
+    }
+
+  g_ptr_array_set_size (p->values, base + out);
+  g_ptr_array_set_size (p->names, base + out);
+}
+
+/*
+ * Moves past the value at the current position without decoding it. Only
+ * enough validation is performed to find where the value ends, the rest
+ * happens when the deferred value is decoded.
+ */
+static gboolean
+skip_value (Parser  *p,
+            GError **error)
+{
+  guint depth = 0;
+
+  skip_whitespace (p);
+
+  if (p->pos >= p->end)
+    return set_error (p, error, JSON_PARSER_ERROR_PARSE, "Unexpected end of data");
+
+  if (*p->pos != '{' && *p->pos != '[' && *p->pos != '"')
+    {
+      const gchar *begin = p->pos;
+
+      while (p->pos < p->end && !strchr (",}] \t\r\n", *p->pos))
+        p->pos++;
+
+      if (p->pos == begin)
+        return set_error (p, error, JSON_PARSER_ERROR_INVALID_BAREWORD, "Unexpected character");
+
+      return TRUE;
+    }
+
+  /* With an index, only structural characters need to be looked at */
+  if (p->use_index && seek_index (p, p->pos))
+    {
+      guint32 entry;
+
+      for (; _jsonrpc_json_index_peek (&p->index, &entry); _jsonrpc_json_index_next (&p->index))
+        {
+          switch (p->begin[entry])
+            {
+            case '{': case '[':
+              depth++;
+              break;
+
+            case '}': case ']':
+              depth--;
+              break;
+
+            default:
+              break;
+            }
+
+          if (depth == 0)
+            {
+              p->pos = p->begin + entry + 1;
+              _jsonrpc_json_index_next (&p->index);
+              return TRUE;
+            }
+        }
+
+      p->pos = p->end;
+
+      return set_error (p, error, JSON_PARSER_ERROR_PARSE, "Unexpected end of data");
+    }
+
+  while (p->pos < p->end)
+    {
+      switch (*p->pos++)
+        {
+        case '"':
+          while (p->pos < p->end && *p->pos != '"')
+            {
+              if (*p->pos == '\\')
+                p->pos++;
+              p->pos++;
+            }
+
+          if (p->pos >= p->end)
+            return set_error (p, error, JSON_PARSER_ERROR_PARSE, "Unterminated string");
+
+          p->pos++;
+          break;
+
+        case '{': case '[':
+          depth++;
+          break;
+
+        case '}': case ']':
+          depth--;
+          break;
+
+        default:
+          break;
+        }
+
+      if (depth == 0)
+        return TRUE;
+    }
+
+  return set_error (p, error, JSON_PARSER_ERROR_PARSE, "Unexpected end of data");
+}
+
+/*
+ * Containers are kept as a "(ay)" referencing the slice of the body they
+ * were found in. Scalars are cheap enough to decode directly.
+ *
+ * A peer using GVariant encoding may send a real "(ay)" so the type alone
+ * cannot identify a deferred value. Instead, the data of every live slice
+ * is recorded in a side table which only the parser can add to. A "(ay)"
+ * of ours never needs to be copied since its alignment is 1, so the data
+ * pointer of the variant is always the data pointer of the slice.
+ */
+typedef struct
+{
+  GBytes        *body;
+  gconstpointer  data;
+} DeferredSlice;
+
+G_LOCK_DEFINE_STATIC (deferred);
+static GHashTable *deferred_slices;
+
+static void
+deferred_slice_free (gpointer data)
+{
+  DeferredSlice *slice = data;
+  guint count;
+
+  G_LOCK (deferred);
+  count = GPOINTER_TO_UINT (g_hash_table_lookup (deferred_slices, slice->data));
+  if (count > 1)
+    g_hash_table_insert (deferred_slices, (gpointer)slice->data, GUINT_TO_POINTER (count - 1));
+  else
+    g_hash_table_remove (deferred_slices, slice->data);
+  G_UNLOCK (deferred);
+
+  g_bytes_unref (slice->body);
+  g_slice_free (DeferredSlice, slice);
+}
+
+static GBytes *
+deferred_slice_new (GBytes *body,
+                    gsize   offset,
+                    gsize   length)
+{
+  DeferredSlice *slice;
+  guint count;
+
+  slice = g_slice_new (DeferredSlice);
+  slice->body = g_bytes_ref (body);
+  slice->data = (const guint8 *)g_bytes_get_data (body, NULL) + offset;
+
+  G_LOCK (deferred);
+  if (deferred_slices == NULL)
+    deferred_slices = g_hash_table_new (NULL, NULL);
+  count = GPOINTER_TO_UINT (g_hash_table_lookup (deferred_slices, slice->data));
+  g_hash_table_insert (deferred_slices, (gpointer)slice->data, GUINT_TO_POINTER (count + 1));
+  G_UNLOCK (deferred);
+
+  return g_bytes_new_with_free_func (slice->data, length, deferred_slice_free, slice);
+}
+
+static GVariant *
+parse_deferred (Parser  *p,
+                GError **error)
+{
+  const gchar *begin;
+  g_autoptr(GBytes) slice = NULL;
+
+  skip_whitespace (p);
+
+  if (p->pos >= p->end || (*p->pos != '{' && *p->pos != '['))
+    return parse_value (p, error);
+
+  begin = p->pos;
+
+  if (!skip_value (p, error))
+    return NULL;
+
+  slice = deferred_slice_new (p->bytes, begin - p->begin, p->pos - begin);
+
+  return g_variant_new_from_bytes (G_VARIANT_TYPE ("(ay)"), slice, TRUE);
+}
+
+static gboolean
+is_deferred_member (Parser      *p,
+                    const gchar *name)
+{
+  return p->bytes != NULL &&
+         p->depth == 1 &&
+         (strcmp (name, "params") == 0 || strcmp (name, "result") == 0);
+}
+
+static GVariant *
+parse_object (Parser  *p,
+              GError **error)
+{
+  guint base = p->values->len;
+  GVariant **entries;
+  GVariant *ret;
+  guint n_entries;
+
+  g_assert (*p->pos == '{');
+
+  p->pos++;
+  skip_whitespace (p);
+
+  if (p->pos < p->end && *p->pos == '}')
+    {
+      p->pos++;
+      return g_variant_new_array (G_VARIANT_TYPE ("{sv}"), NULL, 0);
+    }
+
+  for (;;)
+    {
+      GVariant *value;
+      gchar *name;
+
+      skip_whitespace (p);
+
+      if (p->pos >= p->end || *p->pos != '"')
+        {
+          set_error (p, error, JSON_PARSER_ERROR_INVALID_BAREWORD, "Expected member name");
+          goto failure;
+        }
+
+      if (!(name = parse_string (p, error)))
+        goto failure;
+
+      skip_whitespace (p);
+
+      if (p->pos >= p->end || *p->pos != ':')
+        {
+          g_free (name);
+          set_error (p, error, JSON_PARSER_ERROR_MISSING_COLON, "Expected ':'");
+          goto failure;
+        }
+
+      p->pos++;
+
+      if (is_deferred_member (p, name))
+        value = parse_deferred (p, error);
+      else
+        value = parse_value (p, error);
+
+      if (value == NULL)
+        {
+          g_free (name);
+          goto failure;
+        }
+
+      g_ptr_array_add (p->values, g_variant_new_variant (value));
+      g_ptr_array_add (p->names, name);
+
+      skip_whitespace (p);
+
+      if (p->pos < p->end && *p->pos == ',')
+        {
+          p->pos++;
+          skip_whitespace (p);
+
+          if (p->pos < p->end && *p->pos == '}')
+            {
+              set_error (p, error, JSON_PARSER_ERROR_TRAILING_COMMA, "Trailing comma");
+              goto failure;
+            }
+
+          continue;
+        }
+
+      if (p->pos < p->end && *p->pos == '}')
+        {
+          p->pos++;
+          break;
+        }
+
+      set_error (p, error, JSON_PARSER_ERROR_MISSING_COMMA, "Expected ',' or '}'");
+      goto failure;
+    }
+
+  merge_duplicate_names (p, base);
+
+  entries = (GVariant **)(gpointer)&g_ptr_array_index (p->values, base);
+  n_entries = p->values->len - base;
+
+  for (guint i = 0; i < n_entries; i++)
+    {
+      gchar *name = g_ptr_array_index (p->names, base + i);
+
+      g_ptr_array_index (p->names, base + i) = NULL;
+      entries[i] = g_variant_new_dict_entry (g_variant_new_take_string (name), entries[i]);
+    }
+
+  /* g_variant_new_array() consumes the floating references of the entries */
+  ret = g_variant_new_array (G_VARIANT_TYPE ("{sv}"), entries, n_entries);
+
+  g_ptr_array_set_size (p->values, base);
+  g_ptr_array_set_size (p->names, base);
+
+  return ret;
+
+failure:
+  pop_values (p, base);
+
+  return NULL;
+}
+
+static GVariant *
+parse_array (Parser  *p,
+             GError **error)
+{
+  guint base = p->values->len;
+  GVariant *ret;
+
+  g_assert (*p->pos == '[');
+
+  p->pos++;
+  skip_whitespace (p);
+
+  if (p->pos < p->end && *p->pos == ']')
+    {
+      p->pos++;
+      return g_variant_new_array (G_VARIANT_TYPE_VARIANT, NULL, 0);
+    }
+
+  for (;;)
+    {
+      GVariant *value;
+
+      if (!(value = parse_value (p, error)))
+        goto failure;
+
+      g_ptr_array_add (p->values, g_variant_new_variant (value));
+      g_ptr_array_add (p->names, NULL);
+
+      skip_whitespace (p);
+
+      if (p->pos < p->end && *p->pos == ',')
+        {
+          p->pos++;
+          skip_whitespace (p);
+
+          if (p->pos < p->end && *p->pos == ']')
+            {
+              set_error (p, error, JSON_PARSER_ERROR_TRAILING_COMMA, "Trailing comma");
+              goto failure;
+            }
+
+          continue;
+        }
+
+      if (p->pos < p->end && *p->pos == ']')
+        {
+          p->pos++;
+          break;
+        }
+
+      set_error (p, error, JSON_PARSER_ERROR_MISSING_COMMA, "Expected ',' or ']'");
+      goto failure;
+    }
+
+  ret = g_variant_new_array (G_VARIANT_TYPE_VARIANT,
+                             (GVariant **)(gpointer)&g_ptr_array_index (p->values, base),
+                             p->values->len - base);
+
+  g_ptr_array_set_size (p->values, base);
+  g_ptr_array_set_size (p->names, base);
+
+  return ret;
+
+failure:
+  pop_values (p, base);
+
+  return NULL;
+}
+
+static GVariant *
+parse_value (Parser  *p,
+             GError **error)
+{
+  GVariant *ret = NULL;
+
+  skip_whitespace (p);
+
+  if (p->pos >= p->end)
+    {
+      set_error (p, error, JSON_PARSER_ERROR_PARSE, "Unexpected end of data");
+      return NULL;
+    }
+
+  switch (*p->pos)
+    {
+    case '{':
+    case '[':
+      if (p->depth >= MAX_DEPTH)
+        {
+          set_error (p, error, JSON_PARSER_ERROR_PARSE, "Maximum nesting depth exceeded");
+          return NULL;
+        }
+
+      p->depth++;
+      ret = *p->pos == '{' ? parse_object (p, error) : parse_array (p, error);
+      p->depth--;
+
+      return ret;
+
+    case '"':
+      {
+        gchar *str = parse_string (p, error);
+
+        if (str == NULL)
+          return NULL;
+
+        return g_variant_new_take_string (str);
+      }
+
+    case 't':
+      if (parse_literal (p, "true", 4))
+        return g_variant_new_boolean (TRUE);
+      break;
+
+    case 'f':
+      if (parse_literal (p, "false", 5))
+        return g_variant_new_boolean (FALSE);
+      break;
+
+    case 'n':
+      if (parse_literal (p, "null", 4))
+        return g_variant_new_maybe (G_VARIANT_TYPE_VARIANT, NULL);
+      break;
+
+    case '-':
+    case '0': case '1': case '2': case '3': case '4':
+    case '5': case '6': case '7': case '8': case '9':
+      return parse_number (p, error);
+
+    default:
+      break;
+    }
+
+  set_error (p, error, JSON_PARSER_ERROR_INVALID_BAREWORD, "Unexpected character");
+
+  return NULL;
+}
+
+static GVariant *
+parse_toplevel (const gchar  *data,
+                gsize         length,
+                GBytes       *bytes,
+                GError      **error)
+{
+  GVariant *ret;
+  Parser p;
+
+  g_assert (data != NULL);
+
+  p.begin = data;
+  p.pos = data;
+  p.end = data + length;
+  p.values = g_ptr_array_new ();
+  p.names = g_ptr_array_new ();
+  p.bytes = bytes;
+  p.depth = 0;
+  p.use_index = length >= JSONRPC_JSON_INDEX_THRESHOLD && length <= G_MAXUINT32;
+
+  if (p.use_index)
+    _jsonrpc_json_index_init (&p.index, data, length);
+
+  /* Skip the UTF-8 byte order mark, if any */
+  if (length >= 3 && memcmp (data, "\xEF\xBB\xBF", 3) == 0)
+    p.pos += 3;
+
+  if ((ret = parse_value (&p, error)))
+    {
+      skip_whitespace (&p);
+
+      if (p.pos < p.end)
+        {
+          g_variant_unref (g_variant_ref_sink (ret));
+          ret = NULL;
+          set_error (&p, error, JSON_PARSER_ERROR_PARSE, "Unexpected data after value");
+        }
+    }
+
+  g_assert (p.values->len == 0);
+  g_assert (p.names->len == 0);
+
+  g_ptr_array_unref (p.values);
+  g_ptr_array_unref (p.names);
+  if (p.use_index)
+    _jsonrpc_json_index_clear (&p.index);
+
+  return ret;
+}
+
+/**
+ * _jsonrpc_json_parse:
+ * @data: the JSON encoded data, which must be followed by a NUL byte
+ * @length: the length of @data, not including the trailing NUL byte
+ * @error: a location for a #GError, or %NULL
+ *
+ * Parses @data into a #GVariant matching the output of
+ * json_gvariant_deserialize_data() when no signature is provided.
+ *
+ * Returns: (transfer floating): a #GVariant or %NULL and @error is set.
+ */
+GVariant *
+_jsonrpc_json_parse (const gchar  *data,
+                     gsize         length,
+                     GError      **error)
+{
+  g_return_val_if_fail (data != NULL, NULL);
+  g_return_val_if_fail (data[length] == '\0', NULL);
+
+  return parse_toplevel (data, length, NULL, error);
+}
+
+/**
+ * _jsonrpc_json_parse_envelope:
+ * @bytes: the JSON encoded data, which must be followed by a NUL byte
+ * @error: a location for a #GError, or %NULL
+ *
+ * Like _jsonrpc_json_parse() except that the "params" and "result" members
+ * of a toplevel object are not decoded when they are objects or arrays.
+ * They reference @bytes instead and are decoded with
+ * _jsonrpc_json_parse_deferred() when needed.
+ *
+ * Returns: (transfer floating): a #GVariant or %NULL and @error is set.
+ */
+GVariant *
+_jsonrpc_json_parse_envelope (GBytes  *bytes,
+                              GError **error)
+{
+  const gchar *data;
+  gsize length;
+
+  g_return_val_if_fail (bytes != NULL, NULL);
+
+  data = g_bytes_get_data (bytes, &length);
+
+  g_return_val_if_fail (data != NULL, NULL);
+  g_return_val_if_fail (data[length] == '\0', NULL);
+
+  return parse_toplevel (data, length, bytes, error);
+}
+
+/**
+ * _jsonrpc_json_is_deferred:
+ * @value: (nullable): a #GVariant
+ *
+ * Checks if @value was deferred by _jsonrpc_json_parse_envelope(). A "(ay)"
+ * built any other way, such as one received from a peer, is never deferred.
+ *
+ * Returns: %TRUE if @value must be decoded with _jsonrpc_json_parse_deferred()
+ */
+gboolean
+_jsonrpc_json_is_deferred (GVariant *value)
+{
+  gconstpointer data;
+  gboolean ret;
+
+  if (value == NULL ||
+      !g_variant_is_of_type (value, G_VARIANT_TYPE ("(ay)")) ||
+      !(data = g_variant_get_data (value)))
+    return FALSE;
+
+  G_LOCK (deferred);
+  ret = deferred_slices != NULL && g_hash_table_contains (deferred_slices, data);
+  G_UNLOCK (deferred);
+
+  return ret;
+}
+
+/**
+ * _jsonrpc_json_parse_deferred:
+ * @value: a value created by _jsonrpc_json_parse_envelope()
+ * @error: a location for a #GError, or %NULL
+ *
+ * Decodes a value which was deferred by _jsonrpc_json_parse_envelope().
+ *
+ * Returns: (transfer floating): a #GVariant or %NULL and @error is set.
+ */
+GVariant *
+_jsonrpc_json_parse_deferred (GVariant  *value,
+                              GError   **error)
+{
+  const gchar *data;
+  gsize length;
+
+  g_return_val_if_fail (_jsonrpc_json_is_deferred (value), NULL);
+
+  data = g_variant_get_data (value);
+  length = g_variant_get_size (value);
+
+  /*
+   * The slice is not NUL terminated but it always ends with "}" or "]" and
+   * lies within a NUL terminated body, so it can be parsed in place.
+   */
+  return parse_toplevel (data, length, NULL, error);
+}
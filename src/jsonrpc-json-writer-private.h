@@ -0,0 +1,53 @@
+/* jsonrpc-json-writer-private.h
+ *
+ * Copyright (C) 2026 Christian Hergert <chergert@redhat.com>
+ *
+ * This file is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation; either version 2.1 of the License, or (at your option)
+ * any later version.
+ *
+ * This file is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef JSONRPC_JSON_WRITER_PRIVATE_H
+#define JSONRPC_JSON_WRITER_PRIVATE_H
+
+#include <glib.h>
+
+#include "jsonrpc-buffer-pool-private.h"
+
+G_BEGIN_DECLS
+
+typedef struct
+{
+  JsonrpcBufferPool *pool;
+  guint8            *data;
+  gsize              len;
+  gsize              allocated;
+} JsonrpcJsonWriter;
+
+void    _jsonrpc_json_writer_init        (JsonrpcJsonWriter *writer,
+                                          JsonrpcBufferPool *pool,
+                                          gsize              offset,
+                                          gsize              size_hint) G_GNUC_INTERNAL;
+void    _jsonrpc_json_writer_clear       (JsonrpcJsonWriter *writer) G_GNUC_INTERNAL;
+void    _jsonrpc_json_writer_append      (JsonrpcJsonWriter *writer,
+                                          gconstpointer      data,
+                                          gsize              len) G_GNUC_INTERNAL;
+void    _jsonrpc_json_writer_write       (JsonrpcJsonWriter *writer,
+                                          GVariant          *value) G_GNUC_INTERNAL;
+GBytes *_jsonrpc_json_writer_steal_bytes (JsonrpcJsonWriter *writer,
+                                          gsize              offset) G_GNUC_INTERNAL;
+
+G_DEFINE_AUTO_CLEANUP_CLEAR_FUNC (JsonrpcJsonWriter, _jsonrpc_json_writer_clear)
+
+G_END_DECLS
+
+#endif /* JSONRPC_JSON_WRITER_PRIVATE_H */
@@ -0,0 +1,539 @@
+/* jsonrpc-json-writer.c
+ *
+ * Copyright (C) 2026 Christian Hergert <chergert@redhat.com>
+ *
+ * This file is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation; either version 2.1 of the License, or (at your option)
+ * any later version.
+ *
+ * This file is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define G_LOG_DOMAIN "jsonrpc-json-writer"
+
+#include "config.h"
+
+#include <json-glib/json-glib.h>
+#include <math.h>
+#include <string.h>
+
+#include "jsonrpc-json-parser-private.h"
+#include "jsonrpc-json-writer-private.h"
+
+/*
+ * Writes compact JSON for a #GVariant directly into a buffer from a
+ * #JsonrpcBufferPool, producing the same JSON as json_gvariant_serialize_data()
+ * without building an intermediate #JsonNode tree or string.
+ *
+ * The buffer can start with @offset bytes left unused so that the caller can
+ * prepend headers once the length of the JSON is known, without moving it.
+ *
+ * Values which have no obvious JSON representation (such as dictionaries
+ * with non-string keys) are handed to json-glib so that the output does not
+ * change for them.
+ */
+
+#define MIN_ALLOC_SIZE 512
+#define MAX_DEPTH      1024
+
+static void
+jsonrpc_json_writer_grow (JsonrpcJsonWriter *writer,
+                          gsize              needed)
+{
+  gsize allocated = MAX (writer->allocated, MIN_ALLOC_SIZE);
+  guint8 *data;
+
+  while (allocated < needed)
+    allocated *= 2;
+
+  /* Power of two sizes match the size classes of the pool exactly */
+  data = _jsonrpc_buffer_pool_alloc (writer->pool, allocated);
+
+  if (writer->data != NULL)
+    {
+      memcpy (data, writer->data, writer->len);
+      _jsonrpc_buffer_free (writer->data);
+    }
+
+  writer->data = data;
+  writer->allocated = allocated;
+}
+
+static inline guint8 *
+jsonrpc_json_writer_reserve (JsonrpcJsonWriter *writer,
+                             gsize              len)
+{
+  if G_UNLIKELY (writer->len + len > writer->allocated)
+    jsonrpc_json_writer_grow (writer, writer->len + len);
+
+  return writer->data + writer->len;
+}
+
+static inline void
+jsonrpc_json_writer_putc (JsonrpcJsonWriter *writer,
+                          gchar              c)
+{
+  *jsonrpc_json_writer_reserve (writer, 1) = c;
+  writer->len++;
+}
+
+void
+_jsonrpc_json_writer_init (JsonrpcJsonWriter *writer,
+                           JsonrpcBufferPool *pool,
+                           gsize              offset,
+                           gsize              size_hint)
+{
+  g_assert (writer != NULL);
+  g_assert (pool != NULL);
+
+  writer->pool = pool;
+  writer->data = NULL;
+  writer->len = 0;
+  writer->allocated = 0;
+
+  jsonrpc_json_writer_grow (writer, offset + size_hint);
+
+  writer->len = offset;
+}
+
+void
+_jsonrpc_json_writer_clear (JsonrpcJsonWriter *writer)
+{
+  g_clear_pointer (&writer->data, _jsonrpc_buffer_free);
+  writer->len = 0;
+  writer->allocated = 0;
+}
+
+void
+_jsonrpc_json_writer_append (JsonrpcJsonWriter *writer,
+                             gconstpointer      data,
+                             gsize              len)
+{
+  memcpy (jsonrpc_json_writer_reserve (writer, len), data, len);
+  writer->len += len;
+}
+
+/*
+ * _jsonrpc_json_writer_steal_bytes:
+ *
+ * Transfers the contents of @writer, starting at @offset, to a new #GBytes.
+ * The buffer is returned to the pool when the #GBytes is released.
+ */
+GBytes *
+_jsonrpc_json_writer_steal_bytes (JsonrpcJsonWriter *writer,
+                                  gsize              offset)
+{
+  g_autoptr(GBytes) bytes = NULL;
+
+  g_assert (writer != NULL);
+  g_assert (writer->data != NULL);
+  g_assert (offset <= writer->len);
+
+  bytes = _jsonrpc_buffer_free_to_bytes (g_steal_pointer (&writer->data), writer->len);
+  writer->allocated = 0;
+
+  if (offset == 0)
+    return g_steal_pointer (&bytes);
+
+  return g_bytes_new_from_bytes (bytes, offset, writer->len - offset);
+}
+
+static void
+write_int64 (JsonrpcJsonWriter *writer,
+             gint64             value)
+{
+  gchar buf[24];
+  gchar *p = buf + sizeof buf;
+  guint64 u = value < 0 ? -(guint64)value : (guint64)value;
+
+  do
+    {
+      *--p = '0' + (u % 10);
+      u /= 10;
+    }
+  while (u != 0);
+
+  if (value < 0)
+    *--p = '-';
+
+  _jsonrpc_json_writer_append (writer, p, buf + sizeof buf - p);
+}
+
+static gboolean
+write_double (JsonrpcJsonWriter *writer,
+              gdouble            value)
+{
+  gchar buf[G_ASCII_DTOSTR_BUF_SIZE];
+  gsize len;
+
+  /* There is no JSON for these, leave it to json-glib */
+  if (!isfinite (value))
+    return FALSE;
+
+  g_ascii_dtostr (buf, sizeof buf, value);
+  len = strlen (buf);
+  _jsonrpc_json_writer_append (writer, buf, len);
+
+  /* Make sure the peer decodes it as a double rather than an integer */
+  if (strpbrk (buf, ".eE") == NULL)
+    _jsonrpc_json_writer_append (writer, ".0", 2);
+
+  return TRUE;
+}
+
+static inline gboolean
+byte_needs_escape (guint8 c)
+{
+  return c < 0x20 || c == '"' || c == '\\';
+}
+
+/*
+ * Checks 8 bytes at once for a control character, quote or backslash. Each
+ * test sets the high bit of a byte only if some byte matched, so the result
+ * is exact even though bytes following a match may be flagged as well.
+ */
+static inline gboolean
+word_needs_escape (guint64 w)
+{
+  const guint64 ones = G_GUINT64_CONSTANT (0x0101010101010101);
+  const guint64 high = G_GUINT64_CONSTANT (0x8080808080808080);
+  guint64 quote = w ^ (ones * '"');
+  guint64 backslash = w ^ (ones * '\\');
+  guint64 control = (w - ones * 0x20) & ~w;
+
+  quote = (quote - ones) & ~quote;
+  backslash = (backslash - ones) & ~backslash;
+
+  return ((control | quote | backslash) & high) != 0;
+}
+
+static void
+write_escaped (JsonrpcJsonWriter *writer,
+               guint8             c)
+{
+  static const gchar hex[] = "0123456789abcdef";
+  gchar buf[6] = { '\\', 'u', '0', '0', hex[c >> 4], hex[c & 0xf] };
+
+  switch (c)
+    {
+    case '"':  _jsonrpc_json_writer_append (writer, "\\\"", 2); break;
+    case '\\': _jsonrpc_json_writer_append (writer, "\\\\", 2); break;
+    case '\b': _jsonrpc_json_writer_append (writer, "\\b", 2); break;
+    case '\f': _jsonrpc_json_writer_append (writer, "\\f", 2); break;
+    case '\n': _jsonrpc_json_writer_append (writer, "\\n", 2); break;
+    case '\r': _jsonrpc_json_writer_append (writer, "\\r", 2); break;
+    case '\t': _jsonrpc_json_writer_append (writer, "\\t", 2); break;
+    default:   _jsonrpc_json_writer_append (writer, buf, sizeof buf); break;
+    }
+}
+
+static void
+write_string (JsonrpcJsonWriter *writer,
+              const gchar       *str,
+              gsize              len)
+{
+  const guint8 *p = (const guint8 *)str;
+  const guint8 *end = p + len;
+
+  /* Most strings need no escaping at all, so reserve for that case */
+  jsonrpc_json_writer_reserve (writer, len + 2);
+  jsonrpc_json_writer_putc (writer, '"');
+
+  while (p < end)
+    {
+      const guint8 *run = p;
+
+      while (end - p >= 8)
+        {
+          guint64 w;
+
+          memcpy (&w, p, sizeof w);
+          if (word_needs_escape (w))
+            break;
+          p += 8;
+        }
+
+      while (p < end && !byte_needs_escape (*p))
+        p++;
+
+      _jsonrpc_json_writer_append (writer, run, p - run);
+
+      if (p < end)
+        write_escaped (writer, *p++);
+    }
+
+  jsonrpc_json_writer_putc (writer, '"');
+}
+
+/*
+ * Arrays of fixed size numbers are common in some protocols (such as
+ * semantic tokens) and can be written without creating a #GVariant for
+ * every element.
+ */
+static gboolean
+write_fixed_array (JsonrpcJsonWriter *writer,
+                   GVariant          *value)
+{
+  const gchar *type_string = g_variant_get_type_string (value);
+  gconstpointer data;
+  gsize n_elements;
+
+  g_assert (type_string[0] == 'a');
+
+#define WRITE_ELEMENTS(ctype, write_func)                                 \
+  G_STMT_START {                                                          \
+    const ctype *elements;                                                \
+    data = g_variant_get_fixed_array (value, &n_elements, sizeof (ctype)); \
+    elements = data;                                                      \
+    jsonrpc_json_writer_putc (writer, '[');                               \
+    for (gsize i = 0; i < n_elements; i++)                                \
+      {                                                                   \
+        if (i > 0)                                                        \
+          jsonrpc_json_writer_putc (writer, ',');                         \
+        write_func (writer, elements[i]);                                 \
+      }                                                                   \
+    jsonrpc_json_writer_putc (writer, ']');                               \
+  } G_STMT_END
+
+  switch (type_string[1])
+    {
+    case 'y': WRITE_ELEMENTS (guint8, write_int64); return TRUE;
+    case 'n': WRITE_ELEMENTS (gint16, write_int64); return TRUE;
+    case 'q': WRITE_ELEMENTS (guint16, write_int64); return TRUE;
+    case 'i': WRITE_ELEMENTS (gint32, write_int64); return TRUE;
+    case 'h': WRITE_ELEMENTS (gint32, write_int64); return TRUE;
+    case 'u': WRITE_ELEMENTS (guint32, write_int64); return TRUE;
+    case 'x': WRITE_ELEMENTS (gint64, write_int64); return TRUE;
+    default:  return FALSE;
+    }
+
+#undef WRITE_ELEMENTS
+}
+
+static gboolean write_value (JsonrpcJsonWriter *writer,
+                             GVariant          *value,
+                             guint              depth);
+
+static gboolean
+write_object (JsonrpcJsonWriter *writer,
+              GVariant          *value,
+              guint              depth)
+{
+  gsize n_children = g_variant_n_children (value);
+
+  jsonrpc_json_writer_putc (writer, '{');
+
+  for (gsize i = 0; i < n_children; i++)
+    {
+      g_autoptr(GVariant) entry = g_variant_get_child_value (value, i);
+      g_autoptr(GVariant) key = g_variant_get_child_value (entry, 0);
+      g_autoptr(GVariant) member = g_variant_get_child_value (entry, 1);
+      const gchar *name;
+      gsize name_len;
+
+      if (i > 0)
+        jsonrpc_json_writer_putc (writer, ',');
+
+      name = g_variant_get_string (key, &name_len);
+      write_string (writer, name, name_len);
+      jsonrpc_json_writer_putc (writer, ':');
+
+      if (!write_value (writer, member, depth + 1))
+        return FALSE;
+    }
+
+  jsonrpc_json_writer_putc (writer, '}');
+
+  return TRUE;
+}
+
+static gboolean
+write_array (JsonrpcJsonWriter *writer,
+             GVariant          *value,
+             guint              depth)
+{
+  gsize n_children = g_variant_n_children (value);
+
+  jsonrpc_json_writer_putc (writer, '[');
+
+  for (gsize i = 0; i < n_children; i++)
+    {
+      g_autoptr(GVariant) child = g_variant_get_child_value (value, i);
+
+      if (i > 0)
+        jsonrpc_json_writer_putc (writer, ',');
+
+      if (!write_value (writer, child, depth + 1))
+        return FALSE;
+    }
+
+  jsonrpc_json_writer_putc (writer, ']');
+
+  return TRUE;
+}
+
+/*
+ * A value deferred by _jsonrpc_json_parse_envelope() contains the JSON it
+ * was parsed from, so it is copied as is rather than being decoded first.
+ * Any other "(ay)" is untrusted and written as an array like other tuples.
+ */
+static void
+write_deferred (JsonrpcJsonWriter *writer,
+                GVariant          *value)
+{
+  g_autoptr(GVariant) child = g_variant_get_child_value (value, 0);
+  gconstpointer data;
+  gsize len;
+
+  data = g_variant_get_fixed_array (child, &len, 1);
+  _jsonrpc_json_writer_append (writer, data, len);
+}
+
+static gboolean
+write_value (JsonrpcJsonWriter *writer,
+             GVariant          *value,
+             guint              depth)
+{
+  const gchar *type_string = g_variant_get_type_string (value);
+
+  if (depth > MAX_DEPTH)
+    return FALSE;
+
+  switch (type_string[0])
+    {
+    case 'b':
+      if (g_variant_get_boolean (value))
+        _jsonrpc_json_writer_append (writer, "true", 4);
+      else
+        _jsonrpc_json_writer_append (writer, "false", 5);
+      return TRUE;
+
+    case 'y':
+      write_int64 (writer, g_variant_get_byte (value));
+      return TRUE;
+
+    case 'n':
+      write_int64 (writer, g_variant_get_int16 (value));
+      return TRUE;
+
+    case 'q':
+      write_int64 (writer, g_variant_get_uint16 (value));
+      return TRUE;
+
+    case 'i':
+      write_int64 (writer, g_variant_get_int32 (value));
+      return TRUE;
+
+    case 'h':
+      write_int64 (writer, g_variant_get_handle (value));
+      return TRUE;
+
+    case 'u':
+      write_int64 (writer, g_variant_get_uint32 (value));
+      return TRUE;
+
+    case 'x':
+      write_int64 (writer, g_variant_get_int64 (value));
+      return TRUE;
+
+    case 't':
+      /* json-glib wraps these around, leave that to it */
+      if (g_variant_get_uint64 (value) > G_MAXINT64)
+        return FALSE;
+      write_int64 (writer, g_variant_get_uint64 (value));
+      return TRUE;
+
+    case 'd':
+      return write_double (writer, g_variant_get_double (value));
+
+    case 's':
+    case 'o':
+    case 'g':
+      {
+        gsize len;
+        const gchar *str = g_variant_get_string (value, &len);
+
+        write_string (writer, str, len);
+        return TRUE;
+      }
+
+    case 'v':
+      {
+        g_autoptr(GVariant) child = g_variant_get_variant (value);
+
+        return write_value (writer, child, depth + 1);
+      }
+
+    case 'm':
+      {
+        g_autoptr(GVariant) child = g_variant_get_maybe (value);
+
+        if (child == NULL)
+          {
+            _jsonrpc_json_writer_append (writer, "null", 4);
+            return TRUE;
+          }
+
+        return write_value (writer, child, depth + 1);
+      }
+
+    case 'a':
+      if (type_string[1] == '{')
+        {
+          /* Only string keys map directly to members */
+          if (type_string[2] != 's' && type_string[2] != 'o' && type_string[2] != 'g')
+            return FALSE;
+          return write_object (writer, value, depth);
+        }
+
+      if (write_fixed_array (writer, value))
+        return TRUE;
+
+      return write_array (writer, value, depth);
+
+    case '(':
+      if (_jsonrpc_json_is_deferred (value))
+        {
+          write_deferred (writer, value);
+          return TRUE;
+        }
+
+      return write_array (writer, value, depth);
+
+    default:
+      return FALSE;
+    }
+}
+
+/*
+ * _jsonrpc_json_writer_write:
+ *
+ * Appends the compact JSON representation of @value to @writer.
+ */
+void
+_jsonrpc_json_writer_write (JsonrpcJsonWriter *writer,
+                            GVariant          *value)
+{
+  g_autofree gchar *json = NULL;
+  gsize begin;
+  gsize len = 0;
+
+  g_assert (writer != NULL);
+  g_assert (value != NULL);
+
+  begin = writer->len;
+
+  if G_LIKELY (write_value (writer, value, 0))
+    return;
+
+  writer->len = begin;
+  json = json_gvariant_serialize_data (value, &len);
+  _jsonrpc_json_writer_append (writer, json, len);
+}
@@ -22,6 +22,7 @@
 
 #include <string.h>
 
+#include "jsonrpc-json-parser-private.h"
 #include "jsonrpc-message.h"
 
 #if 0
@@ -675,3 +676,50 @@ jsonrpc_message_parse (GVariant *message,
 
   return ret;
 }
+
+/**
+ * jsonrpc_message_lookup_value:
+ * @message: a [struct@GLib.Variant] containing a message
+ * @key: the key to look up
+ * @error: a location for a [struct@GLib.Error], or %NULL
+ *
+ * Looks up @key in @message like [method@GLib.Variant.lookup_value].
+ *
+ * Messages read by a [class@InputStream] with lazy decoding enabled do not
+ * decode the "params" and "result" members until they are requested. This
+ * function decodes them on demand and must be used to access them.
+ *
+ * Returns: (transfer full) (nullable): a [struct@GLib.Variant] or %NULL if
+ *   @key was not found or could not be decoded, in which case @error is set.
+ *
+ * Since: 3.46
+ */
+GVariant *
+jsonrpc_message_lookup_value (GVariant     *message,
+                              const gchar  *key,
+                              GError      **error)
+{
+  g_autoptr(GVariant) unboxed = NULL;
+  g_autoptr(GVariant) value = NULL;
+  GVariant *decoded;
+
+  g_return_val_if_fail (message != NULL, NULL);
+  g_return_val_if_fail (key != NULL, NULL);
+
+  if (g_variant_is_of_type (message, G_VARIANT_TYPE_VARIANT))
+    message = unboxed = g_variant_get_variant (message);
+
+  if (!g_variant_is_of_type (message, G_VARIANT_TYPE ("a{sv}")))
+    return NULL;
+
+  if (!(value = g_variant_lookup_value (message, key, NULL)))
+    return NULL;
+
+  if (!_jsonrpc_json_is_deferred (value))
+    return g_steal_pointer (&value);
+
+  if ((decoded = _jsonrpc_json_parse_deferred (value, error)))
+    g_variant_take_ref (decoded);
+
+  return decoded;
+}
@@ -230,6 +230,11 @@ gboolean  jsonrpc_message_parse       (GVariant *message, ...) G_GNUC_NULL_TERMI
 JSONRPC_AVAILABLE_IN_3_26
 gboolean  jsonrpc_message_parse_array (GVariantIter *iter, ...) G_GNUC_NULL_TERMINATED;
 
+JSONRPC_AVAILABLE_IN_3_46
+GVariant *jsonrpc_message_lookup_value (GVariant     *message,
+                                        const gchar  *key,
+                                        GError      **error);
+
 G_END_DECLS
 
 #endif /* JSONRPC_MESSAGE_H */
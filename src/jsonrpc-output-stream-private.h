@@ -0,0 +1,36 @@
+/* jsonrpc-output-stream-private.h
+ *
+ * Copyright (C) 2026 Christian Hergert <chergert@redhat.com>
+ *
+ * This file is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation; either version 2.1 of the License, or (at your option)
+ * any later version.
+ *
+ * This file is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef JSONRPC_OUTPUT_STREAM_PRIVATE_H
+#define JSONRPC_OUTPUT_STREAM_PRIVATE_H
+
+#include "jsonrpc-output-stream.h"
+
+G_BEGIN_DECLS
+
+gboolean _jsonrpc_output_stream_queue_message (JsonrpcOutputStream   *self,
+                                               GVariant              *message,
+                                               JsonrpcWritePriority   priority,
+                                               GCancellable          *cancellable,
+                                               GError               **error) G_GNUC_INTERNAL;
+void     _jsonrpc_output_stream_begin_sync    (JsonrpcOutputStream   *self) G_GNUC_INTERNAL;
+void     _jsonrpc_output_stream_end_sync      (JsonrpcOutputStream   *self) G_GNUC_INTERNAL;
+
+G_END_DECLS
+
+#endif /* JSONRPC_OUTPUT_STREAM_PRIVATE_H */
@@ -22,7 +22,9 @@
 
 #include <string.h>
 
-#include "jsonrpc-output-stream.h"
+#include "jsonrpc-buffer-pool-private.h"
+#include "jsonrpc-json-writer-private.h"
+#include "jsonrpc-output-stream-private.h"
 #include "jsonrpc-version.h"
 
 /**
@@ -46,24 +48,195 @@
  * When using GVariant encoding, you have a single allocation created for the
  * #GVariant which means you reduce the memory pressure caused by lots of small
  * allocations.
+ *
+ * If jsonrpc_output_stream_set_compression() has been called, large message
+ * bodies are compressed and sent with a "Content-Encoding" header, which
+ * #JsonrpcInputStream transparently decodes.
+ *
+ * Messages queued with jsonrpc_output_stream_queue_message_async() are
+ * written in order of their #JsonrpcWritePriority, so that a reply does not
+ * have to wait for a large number of notifications to be written first.
+ * Messages of the same priority are always written in the order they were
+ * queued, unless they are given a coalescing key. Such a message replaces
+ * an unwritten message of the same priority and key, taking its place in
+ * the queue, which is useful for notifications which make older ones
+ * obsolete such as progress reports.
+ *
+ * Large messages are serialized on a worker thread so that the main loop
+ * is not blocked meanwhile. They are still written in the order they were
+ * queued in.
+ *
+ * To send the same message to many peers, create a #JsonrpcEncodedMessage
+ * and queue it on each stream with jsonrpc_output_stream_queue_encoded_async().
+ * The message is then serialized once for every encoding in use by the
+ * streams rather than once per stream.
+ *
+ * Messages are normally written as soon as possible, which means that the
+ * first of a burst of messages is usually written on its own. Calling
+ * jsonrpc_output_stream_cork() holds queued messages back until the
+ * matching jsonrpc_output_stream_uncork(), so that they are all written
+ * together.
+ *
+ * Queued messages are never dropped, however the #JsonrpcOutputStream:congested
+ * property is set once the amount of data waiting to be written reaches the
+ * high water mark, and cleared once it drains below the low water mark. Use
+ * jsonrpc_output_stream_wait_writable_async() to throttle producers of
+ * messages while the peer is not keeping up.
+ */
+
+/* Bodies smaller than this are not worth compressing */
+#define JSONRPC_OUTPUT_STREAM_COMPRESSION_THRESHOLD 1024
+
+/*
+ * JSON bodies are written after this many bytes, which is enough for the
+ * Content-Length header (and the blank line) to be prepended in place.
+ */
+#define JSONRPC_OUTPUT_STREAM_HEADER_RESERVE 64
+
+/* The amount of memory kept around by the frame buffer pool */
+#define JSONRPC_OUTPUT_STREAM_MAX_POOLED_SIZE (1024 * 1024)
+
+/*
+ * Queued messages are written together with a single vectored write. These
+ * limit how much is written at once so that completing the messages of a
+ * batch is not delayed for too long. A message larger than the byte limit is
+ * still written, just on its own.
  */
+#define JSONRPC_OUTPUT_STREAM_MAX_VECTORS    64
+#define JSONRPC_OUTPUT_STREAM_MAX_BATCH_SIZE (256 * 1024)
+
+/*
+ * Messages of at least this size, as estimated from their #GVariant, are
+ * serialized on a worker thread when that involves writing JSON or
+ * compressing. Smaller messages serialize faster than the round trip to
+ * the worker would take.
+ */
+#define JSONRPC_OUTPUT_STREAM_THREAD_THRESHOLD (64 * 1024)
+
+/* The default water marks, in bytes. Message counts are not limited. */
+#define JSONRPC_OUTPUT_STREAM_HIGH_WATER_MARK (4 * 1024 * 1024)
+#define JSONRPC_OUTPUT_STREAM_LOW_WATER_MARK  (1024 * 1024)
+
+#define N_WRITE_PRIORITIES (JSONRPC_WRITE_PRIORITY_LOW + 1)
 
 typedef struct
 {
-  GQueue queue;
-  guint  use_gvariant : 1;
-  guint  processing : 1;
+  /* Pending frames, one queue per #JsonrpcWritePriority */
+  GQueue             queues[N_WRITE_PRIORITIES];
+
+  /* The frames being written and their buffers, reused for every write */
+  GPtrArray         *in_flight;
+  GArray            *vectors;
+
+  /* Frame buffers, returned to the pool once they have been written */
+  JsonrpcBufferPool *pool;
+
+  /* Coalescing keys of queued messages to the GList link of their frame */
+  GHashTable        *coalesced;
+
+  /* Tasks from jsonrpc_output_stream_wait_writable_async() */
+  GQueue             waiters;
+
+  /*
+   * The size of the queued and in flight messages. We hold a reference on
+   * ourself while this is not zero so that messages which nobody waits on
+   * are still written.
+   */
+  gsize              n_pending_bytes;
+  guint              n_pending;
+
+  /*
+   * A limit of zero disables the corresponding water mark. The low water
+   * marks are kept as requested and clamped to the high ones when used.
+   */
+  gsize              high_water_bytes;
+  gsize              low_water_bytes;
+  guint              high_water_messages;
+  guint              low_water_messages;
+
+  /* Messages are held back while corked, unless written synchronously */
+  guint              cork_count;
+  guint              n_sync_writes;
+
+  JsonrpcFraming     framing;
+  JsonrpcCompression compression;
+  guint              use_gvariant : 1;
+  guint              processing : 1;
+  guint              congested : 1;
+  /* Set once queued messages were failed by an asynchronous close */
+  guint              closing_async : 1;
 } JsonrpcOutputStreamPrivate;
 
+/*
+ * A message ready to be written. The headers are kept apart from the body
+ * when the body is not ours to write into, such as the serialized data of
+ * a #GVariant, so that neither has to be copied.
+ *
+ * Most messages are sent without waiting for them to be written, so a
+ * #GTask is only created when there is a callback to complete.
+ */
+typedef struct
+{
+  GBytes       *headers;
+  GBytes       *body;
+  gsize         size;
+  guint         priority;
+  gchar        *coalesce_key;
+  GTask        *task;
+  GCancellable *cancellable;
+  /* Tasks of the messages replaced by this one, completed along with it */
+  GPtrArray    *superseded;
+  /* Set while the message is being serialized on a worker thread */
+  guint         pending : 1;
+  /* Set when the frame was discarded while pending, for the worker to free */
+  guint         orphaned : 1;
+} Frame;
+
+/*
+ * What is needed to serialize a message, which does not touch the stream
+ * so that it may happen on a worker thread.
+ */
+typedef struct
+{
+  GVariant           *message;
+  JsonrpcBufferPool  *pool;
+  JsonrpcFraming      framing;
+  JsonrpcCompression  compression;
+  gboolean            use_gvariant;
+} EncodeState;
+
+/*
+ * Frames are cached by encoding: one for newline framing, which is always
+ * uncompressed JSON, and one for each combination of GVariant encoding and
+ * compression with Content-Length framing.
+ */
+#define N_ENCODINGS 5
+
+struct _JsonrpcEncodedMessage
+{
+  gatomicrefcount  ref_count;
+  GMutex           mutex;
+  GVariant        *message;
+  struct {
+    GBytes *headers;
+    GBytes *body;
+  } encodings[N_ENCODINGS];
+};
+
 G_DEFINE_TYPE_WITH_PRIVATE (JsonrpcOutputStream, jsonrpc_output_stream, G_TYPE_DATA_OUTPUT_STREAM)
+G_DEFINE_BOXED_TYPE (JsonrpcEncodedMessage, jsonrpc_encoded_message, jsonrpc_encoded_message_ref, jsonrpc_encoded_message_unref)
 
 static void jsonrpc_output_stream_write_message_async_cb (GObject      *object,
                                                           GAsyncResult *result,
                                                           gpointer      user_data);
+static void frame_discard                                (Frame        *frame);
+static void jsonrpc_output_stream_fail_pending           (JsonrpcOutputStream *self,
+                                                          const GError        *error);
 
 enum {
   PROP_0,
   PROP_USE_GVARIANT,
+  PROP_CONGESTED,
   N_PROPS
 };
 
@@ -84,6 +257,10 @@ jsonrpc_output_stream_get_property (GObject    *object,
       g_value_set_boolean (value, jsonrpc_output_stream_get_use_gvariant (self));
       break;
 
+    case PROP_CONGESTED:
+      g_value_set_boolean (value, jsonrpc_output_stream_get_congested (self));
+      break;
+
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
     }
@@ -108,27 +285,153 @@ jsonrpc_output_stream_set_property (GObject      *object,
     }
 }
 
+static void
+destroy_source (gpointer data)
+{
+  GSource *source = data;
+
+  g_source_destroy (source);
+  g_source_unref (source);
+}
+
+/*
+ * jsonrpc_output_stream_complete_waiter:
+ *
+ * Completes @task, a waiter popped from the queue, with @error or
+ * successfully if @error is %NULL. This steals the reference of the queue.
+ */
+static void
+jsonrpc_output_stream_complete_waiter (GTask        *task,
+                                       const GError *error)
+{
+  g_assert (G_IS_TASK (task));
+
+  /*
+   * The cancellable source and @task reference each other, so destroy the
+   * source or neither would be freed until the cancellable is cancelled.
+   */
+  g_task_set_task_data (task, NULL, NULL);
+
+  if (error != NULL)
+    g_task_return_error (task, g_error_copy (error));
+  else
+    g_task_return_boolean (task, TRUE);
+
+  g_object_unref (task);
+}
+
 static void
 jsonrpc_output_stream_dispose (GObject *object)
 {
   JsonrpcOutputStream *self = (JsonrpcOutputStream *)object;
   JsonrpcOutputStreamPrivate *priv = jsonrpc_output_stream_get_instance_private (self);
 
-  g_queue_foreach (&priv->queue, (GFunc)g_object_unref, NULL);
-  g_queue_clear (&priv->queue);
+  for (guint i = 0; i < N_WRITE_PRIORITIES; i++)
+    {
+      g_queue_foreach (&priv->queues[i], (GFunc)frame_discard, NULL);
+      g_queue_clear (&priv->queues[i]);
+    }
+
+  if (priv->waiters.length > 0)
+    {
+      g_autoptr(GError) error = NULL;
+      GTask *task;
+
+      error = g_error_new_literal (G_IO_ERROR,
+                                   G_IO_ERROR_CLOSED,
+                                   "Stream has been closed");
+
+      while ((task = g_queue_pop_head (&priv->waiters)))
+        jsonrpc_output_stream_complete_waiter (task, error);
+    }
 
   G_OBJECT_CLASS (jsonrpc_output_stream_parent_class)->dispose (object);
 }
 
+static void
+jsonrpc_output_stream_finalize (GObject *object)
+{
+  JsonrpcOutputStream *self = (JsonrpcOutputStream *)object;
+  JsonrpcOutputStreamPrivate *priv = jsonrpc_output_stream_get_instance_private (self);
+
+  g_clear_pointer (&priv->coalesced, g_hash_table_unref);
+  g_clear_pointer (&priv->in_flight, g_ptr_array_unref);
+  g_clear_pointer (&priv->vectors, g_array_unref);
+  g_clear_pointer (&priv->pool, _jsonrpc_buffer_pool_unref);
+
+  G_OBJECT_CLASS (jsonrpc_output_stream_parent_class)->finalize (object);
+}
+
+/*
+ * Fails the messages which are still queued, such as those held back by a
+ * cork, since nothing would write them once the stream is closed.
+ */
+static void
+jsonrpc_output_stream_fail_queued (JsonrpcOutputStream *self)
+{
+  g_autoptr(JsonrpcOutputStream) hold = NULL;
+  g_autoptr(GError) error = NULL;
+
+  g_assert (JSONRPC_IS_OUTPUT_STREAM (self));
+
+  /* Completing the last pending message drops its reference on us */
+  hold = g_object_ref (self);
+
+  error = g_error_new_literal (G_IO_ERROR,
+                               G_IO_ERROR_CLOSED,
+                               "Stream has been closed");
+  jsonrpc_output_stream_fail_pending (self, error);
+}
+
+static gboolean
+jsonrpc_output_stream_close_fn (GOutputStream  *stream,
+                                GCancellable   *cancellable,
+                                GError        **error)
+{
+  JsonrpcOutputStream *self = (JsonrpcOutputStream *)stream;
+  JsonrpcOutputStreamPrivate *priv = jsonrpc_output_stream_get_instance_private (self);
+
+  /* The default close_async() calls us from a worker thread */
+  if (!priv->closing_async)
+    jsonrpc_output_stream_fail_queued (self);
+
+  return G_OUTPUT_STREAM_CLASS (jsonrpc_output_stream_parent_class)->close_fn (stream, cancellable, error);
+}
+
+static void
+jsonrpc_output_stream_close_async (GOutputStream       *stream,
+                                   int                  io_priority,
+                                   GCancellable        *cancellable,
+                                   GAsyncReadyCallback  callback,
+                                   gpointer             user_data)
+{
+  JsonrpcOutputStream *self = (JsonrpcOutputStream *)stream;
+  JsonrpcOutputStreamPrivate *priv = jsonrpc_output_stream_get_instance_private (self);
+
+  jsonrpc_output_stream_fail_queued (self);
+  priv->closing_async = TRUE;
+
+  G_OUTPUT_STREAM_CLASS (jsonrpc_output_stream_parent_class)->close_async (stream,
+                                                                           io_priority,
+                                                                           cancellable,
+                                                                           callback,
+                                                                           user_data);
+}
+
 static void
 jsonrpc_output_stream_class_init (JsonrpcOutputStreamClass *klass)
 {
   GObjectClass *object_class = G_OBJECT_CLASS (klass);
+  GOutputStreamClass *stream_class = G_OUTPUT_STREAM_CLASS (klass);
 
   object_class->dispose = jsonrpc_output_stream_dispose;
+  object_class->finalize = jsonrpc_output_stream_finalize;
   object_class->get_property = jsonrpc_output_stream_get_property;
   object_class->set_property = jsonrpc_output_stream_set_property;
 
+  stream_class->close_fn = jsonrpc_output_stream_close_fn;
+  stream_class->close_async = jsonrpc_output_stream_close_async;
+
   properties [PROP_USE_GVARIANT] =
     g_param_spec_boolean ("use-gvariant",
                          "Use GVariant",
@@ -136,6 +439,22 @@ jsonrpc_output_stream_class_init (JsonrpcOutputStreamClass *klass)
                          FALSE,
                          (G_PARAM_READWRITE | G_PARAM_EXPLICIT_NOTIFY | G_PARAM_STATIC_STRINGS));
 
+  /**
+   * JsonrpcOutputStream:congested:
+   *
+   * If more data is waiting to be written than allowed by the high water
+   * mark. This is cleared once the pending data drains below the low
+   * water mark.
+   *
+   * Since: 3.46
+   */
+  properties [PROP_CONGESTED] =
+    g_param_spec_boolean ("congested",
+                          "Congested",
+                          "If the peer is not keeping up with our messages",
+                          FALSE,
+                          (G_PARAM_READABLE | G_PARAM_EXPLICIT_NOTIFY | G_PARAM_STATIC_STRINGS));
+
   g_object_class_install_properties (object_class, N_PROPS, properties);
 
   jsonrpc_output_stream_debug = !!g_getenv ("JSONRPC_DEBUG");
@@ -146,333 +465,1761 @@ jsonrpc_output_stream_init (JsonrpcOutputStream *self)
 {
   JsonrpcOutputStreamPrivate *priv = jsonrpc_output_stream_get_instance_private (self);
 
-  g_queue_init (&priv->queue);
+  for (guint i = 0; i < N_WRITE_PRIORITIES; i++)
+    g_queue_init (&priv->queues[i]);
+
+  g_queue_init (&priv->waiters);
+
+  priv->coalesced = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+
+  priv->high_water_bytes = JSONRPC_OUTPUT_STREAM_HIGH_WATER_MARK;
+  priv->low_water_bytes = JSONRPC_OUTPUT_STREAM_LOW_WATER_MARK;
+
+  priv->in_flight = g_ptr_array_new ();
+  priv->vectors = g_array_new (FALSE, FALSE, sizeof (GOutputVector));
+  priv->pool = _jsonrpc_buffer_pool_new (JSONRPC_OUTPUT_STREAM_MAX_POOLED_SIZE);
 }
 
-static GBytes *
-jsonrpc_output_stream_create_bytes (JsonrpcOutputStream  *self,
-                                    GVariant             *message,
-                                    GError              **error)
+/*
+ * jsonrpc_output_stream_compress:
+ *
+ * Compresses @len bytes of @data using @compression.
+ *
+ * Returns: (transfer full): a #GByteArray containing the compressed data,
+ *   or %NULL and @error is set.
+ */
+static GByteArray *
+jsonrpc_output_stream_compress (JsonrpcCompression   compression,
+                                const guint8        *data,
+                                gsize                len,
+                                GError             **error)
 {
-  JsonrpcOutputStreamPrivate *priv = jsonrpc_output_stream_get_instance_private (self);
+  g_autoptr(GConverter) converter = NULL;
   g_autoptr(GByteArray) buffer = NULL;
-  g_autofree gchar *message_freeme = NULL;
+  gsize in_pos = 0;
+  gsize out_pos = 0;
+
+  g_assert (compression == JSONRPC_COMPRESSION_GZIP);
+  g_assert (data != NULL);
+
+  converter = G_CONVERTER (g_zlib_compressor_new (G_ZLIB_COMPRESSOR_FORMAT_GZIP, -1));
+
+  /* JSON usually compresses well, so start with a fraction of the input */
+  buffer = g_byte_array_sized_new (len / 4 + 64);
+  g_byte_array_set_size (buffer, len / 4 + 64);
+
+  for (;;)
+    {
+      GConverterResult res;
+      gsize n_read = 0;
+      gsize n_written = 0;
+
+      res = g_converter_convert (converter,
+                                 data + in_pos,
+                                 len - in_pos,
+                                 buffer->data + out_pos,
+                                 buffer->len - out_pos,
+                                 G_CONVERTER_INPUT_AT_END,
+                                 &n_read,
+                                 &n_written,
+                                 error);
+
+      if (res == G_CONVERTER_ERROR)
+        return NULL;
+
+      in_pos += n_read;
+      out_pos += n_written;
+
+      if (res == G_CONVERTER_FINISHED)
+        break;
+
+      if (out_pos == buffer->len)
+        g_byte_array_set_size (buffer, buffer->len * 2);
+    }
+
+  g_byte_array_set_size (buffer, out_pos);
+
+  return g_steal_pointer (&buffer);
+}
+
+static Frame *
+frame_new (GBytes *headers,
+           GBytes *body)
+{
+  Frame *frame = g_slice_new0 (Frame);
+
+  frame->headers = headers;
+  frame->body = body;
+  frame->size = g_bytes_get_size (body);
+
+  if (headers != NULL)
+    frame->size += g_bytes_get_size (headers);
+
+  return frame;
+}
+
+static void
+frame_free (gpointer data)
+{
+  Frame *frame = data;
+
+  g_clear_pointer (&frame->headers, g_bytes_unref);
+  g_clear_pointer (&frame->body, g_bytes_unref);
+  g_clear_pointer (&frame->coalesce_key, g_free);
+  g_clear_pointer (&frame->superseded, g_ptr_array_unref);
+  g_clear_object (&frame->task);
+  g_clear_object (&frame->cancellable);
+  g_slice_free (Frame, frame);
+}
+
+/*
+ * frame_discard:
+ *
+ * Frees @frame unless it is still being serialized, in which case the
+ * worker frees it once done.
+ */
+static void
+frame_discard (Frame *frame)
+{
+  if (frame->pending)
+    frame->orphaned = TRUE;
+  else
+    frame_free (frame);
+}
+
+/*
+ * frame_is_replaceable:
+ *
+ * Checks if a queued @frame may be superseded by a message of @priority.
+ * Frames still being serialized are not, to avoid wasting that work.
+ */
+static gboolean
+frame_is_replaceable (const Frame *frame,
+                      guint        priority)
+{
+  return frame->priority == priority && !frame->pending;
+}
+
+/*
+ * jsonrpc_output_stream_encode:
+ *
+ * Serializes the message of @state into a frame.
+ *
+ * This may be called from a worker thread.
+ */
+static Frame *
+jsonrpc_output_stream_encode (const EncodeState  *state,
+                              GError            **error)
+{
+  GVariant *message = state->message;
+  g_auto(JsonrpcJsonWriter) writer = { 0 };
+  g_autoptr(GByteArray) headers = NULL;
+  g_autoptr(GByteArray) compressed = NULL;
+  g_autoptr(GBytes) body = NULL;
   gconstpointer message_data = NULL;
+  gboolean is_compressed = FALSE;
   gsize message_len = 0;
   gchar header[256];
   gsize len;
 
-  g_assert (JSONRPC_IS_OUTPUT_STREAM (self));
+  g_assert (state != NULL);
   g_assert (message != NULL);
 
-  buffer = g_byte_array_sized_new (g_variant_get_size (message) + 128);
-
   if G_UNLIKELY (jsonrpc_output_stream_debug)
     {
       g_autofree gchar *str = g_variant_print (message, TRUE);
       g_message (">>> %s", str);
     }
 
-  if (priv->use_gvariant)
+  /* Each message is a line of compact JSON, which never contains a newline */
+  if (state->framing == JSONRPC_FRAMING_NEWLINE)
+    {
+      _jsonrpc_json_writer_init (&writer, state->pool, 0, g_variant_get_size (message) + 128);
+      _jsonrpc_json_writer_write (&writer, message);
+      _jsonrpc_json_writer_append (&writer, "\n", 1);
+
+      return frame_new (NULL, _jsonrpc_json_writer_steal_bytes (&writer, 0));
+    }
+
+  if (state->use_gvariant)
     {
-      message_data = g_variant_get_data (message);
-      message_len = g_variant_get_size (message);
+      /* Written straight from the serialized data of @message */
+      body = g_variant_get_data_as_bytes (message);
+      message_data = g_bytes_get_data (body, &message_len);
     }
   else
     {
-      message_freeme = json_gvariant_serialize_data (message, &message_len);
-      message_data = message_freeme;
+      /* Leave room in front of the JSON to prepend the headers later */
+      _jsonrpc_json_writer_init (&writer,
+                                 state->pool,
+                                 JSONRPC_OUTPUT_STREAM_HEADER_RESERVE,
+                                 g_variant_get_size (message) + 128);
+      _jsonrpc_json_writer_write (&writer, message);
+
+      message_data = writer.data + JSONRPC_OUTPUT_STREAM_HEADER_RESERVE;
+      message_len = writer.len - JSONRPC_OUTPUT_STREAM_HEADER_RESERVE;
+    }
+
+  if (state->compression != JSONRPC_COMPRESSION_NONE &&
+      message_len >= JSONRPC_OUTPUT_STREAM_COMPRESSION_THRESHOLD)
+    {
+      if (!(compressed = jsonrpc_output_stream_compress (state->compression, message_data, message_len, error)))
+        return NULL;
+
+      /* Don't make the peer decompress something that didn't shrink */
+      if (compressed->len < message_len)
+        {
+          is_compressed = TRUE;
+          message_len = compressed->len;
+          g_clear_pointer (&body, g_bytes_unref);
+          body = g_byte_array_free_to_bytes (g_steal_pointer (&compressed));
+        }
+      else
+        g_clear_pointer (&compressed, g_byte_array_unref);
     }
 
+  /* The JSON is already in place, so the frame only needs its header */
+  if (body == NULL)
+    {
+      len = g_snprintf (header, sizeof header, "Content-Length: %"G_GSIZE_FORMAT"\r\n\r\n", message_len);
+      g_assert (len <= JSONRPC_OUTPUT_STREAM_HEADER_RESERVE);
+      memcpy (writer.data + JSONRPC_OUTPUT_STREAM_HEADER_RESERVE - len, header, len);
+
+      return frame_new (NULL, _jsonrpc_json_writer_steal_bytes (&writer, JSONRPC_OUTPUT_STREAM_HEADER_RESERVE - len));
+    }
+
+  headers = g_byte_array_sized_new (128);
+
   /* Add Content-Length header */
   len = g_snprintf (header, sizeof header, "Content-Length: %"G_GSIZE_FORMAT"\r\n", message_len);
-  g_byte_array_append (buffer, (const guint8 *)header, len);
+  g_byte_array_append (headers, (const guint8 *)header, len);
+
+  if (is_compressed)
+    g_byte_array_append (headers, (const guint8 *)"Content-Encoding: gzip\r\n", 24);
 
-  if (priv->use_gvariant)
+  if (state->use_gvariant)
     {
       /* Add Content-Type header */
       len = g_snprintf (header, sizeof header, "Content-Type: application/%s\r\n",
-                        priv->use_gvariant ? "gvariant" : "json");
-      g_byte_array_append (buffer, (const guint8 *)header, len);
+                        state->use_gvariant ? "gvariant" : "json");
+      g_byte_array_append (headers, (const guint8 *)header, len);
 
       /* Add our GVariantType for the peer to decode */
       len = g_snprintf (header, sizeof header, "X-GVariant-Type: %s\r\n",
                         (const gchar *)g_variant_get_type_string (message));
-      g_byte_array_append (buffer, (const guint8 *)header, len);
+      g_byte_array_append (headers, (const guint8 *)header, len);
     }
 
-  g_byte_array_append (buffer, (const guint8 *)"\r\n", 2);
+  g_byte_array_append (headers, (const guint8 *)"\r\n", 2);
 
-  /* Add serialized message data */
-  g_byte_array_append (buffer, (const guint8 *)message_data, message_len);
-
-  return g_byte_array_free_to_bytes (g_steal_pointer (&buffer));
+  return frame_new (g_byte_array_free_to_bytes (g_steal_pointer (&headers)),
+                    g_steal_pointer (&body));
 }
 
-JsonrpcOutputStream *
-jsonrpc_output_stream_new (GOutputStream *base_stream)
+static Frame *
+jsonrpc_output_stream_create_frame (JsonrpcOutputStream  *self,
+                                    GVariant             *message,
+                                    GError              **error)
 {
-  return g_object_new (JSONRPC_TYPE_OUTPUT_STREAM,
-                       "base-stream", base_stream,
-                       NULL);
+  JsonrpcOutputStreamPrivate *priv = jsonrpc_output_stream_get_instance_private (self);
+  EncodeState state = {
+    .message = message,
+    .pool = priv->pool,
+    .framing = priv->framing,
+    .compression = priv->compression,
+    .use_gvariant = priv->use_gvariant,
+  };
+
+  g_assert (JSONRPC_IS_OUTPUT_STREAM (self));
+  g_assert (message != NULL);
+
+  return jsonrpc_output_stream_encode (&state, error);
 }
 
-static void
-jsonrpc_output_stream_fail_pending (JsonrpcOutputStream *self)
+static guint
+jsonrpc_output_stream_get_encoding (JsonrpcOutputStream *self)
 {
   JsonrpcOutputStreamPrivate *priv = jsonrpc_output_stream_get_instance_private (self);
-  const GList *iter;
-  GList *list;
 
-  g_assert (JSONRPC_IS_OUTPUT_STREAM (self));
+  if (priv->framing == JSONRPC_FRAMING_NEWLINE)
+    return 0;
+
+  return 1 + priv->use_gvariant + (priv->compression != JSONRPC_COMPRESSION_NONE ? 2 : 0);
+}
+
+/*
+ * jsonrpc_output_stream_create_encoded_frame:
+ *
+ * Like jsonrpc_output_stream_create_frame() but shares the buffers of the
+ * frame with every other stream using the same encoding.
+ */
+static Frame *
+jsonrpc_output_stream_create_encoded_frame (JsonrpcOutputStream    *self,
+                                            JsonrpcEncodedMessage  *encoded,
+                                            GError                **error)
+{
+  guint encoding = jsonrpc_output_stream_get_encoding (self);
+  Frame *frame;
 
-  list = priv->queue.head;
+  g_assert (JSONRPC_IS_OUTPUT_STREAM (self));
+  g_assert (encoded != NULL);
+  g_assert (encoding < N_ENCODINGS);
 
-  priv->queue.head = NULL;
-  priv->queue.tail = NULL;
-  priv->queue.length = 0;
+  g_mutex_lock (&encoded->mutex);
 
-  for (iter = list; iter != NULL; iter = iter->next)
+  if (encoded->encodings[encoding].body != NULL)
     {
-      g_autoptr(GTask) task = iter->data;
+      GBytes *headers = encoded->encodings[encoding].headers;
 
-      g_task_return_new_error (task,
-                               G_IO_ERROR,
-                               G_IO_ERROR_FAILED,
-                               "Task failed due to stream failure");
+      frame = frame_new (headers ? g_bytes_ref (headers) : NULL,
+                         g_bytes_ref (encoded->encodings[encoding].body));
     }
+  else if ((frame = jsonrpc_output_stream_create_frame (self, encoded->message, error)))
+    {
+      if (frame->headers != NULL)
+        encoded->encodings[encoding].headers = g_bytes_ref (frame->headers);
+      encoded->encodings[encoding].body = g_bytes_ref (frame->body);
+    }
+
+  g_mutex_unlock (&encoded->mutex);
+
+  return frame;
+}
 
-  g_list_free (list);
+JsonrpcOutputStream *
+jsonrpc_output_stream_new (GOutputStream *base_stream)
+{
+  return g_object_new (JSONRPC_TYPE_OUTPUT_STREAM,
+                       "base-stream", base_stream,
+                       NULL);
 }
 
 static void
-jsonrpc_output_stream_pump (JsonrpcOutputStream *self)
+jsonrpc_output_stream_update_congested (JsonrpcOutputStream *self)
 {
   JsonrpcOutputStreamPrivate *priv = jsonrpc_output_stream_get_instance_private (self);
-  g_autoptr(GTask) task = NULL;
-  const guint8 *data;
-  GCancellable *cancellable;
-  GBytes *bytes;
-  gsize len;
+  gsize low_water_bytes;
+  guint low_water_messages;
+  gboolean congested;
 
   g_assert (JSONRPC_IS_OUTPUT_STREAM (self));
 
-  if (priv->queue.length == 0)
-    return;
+  low_water_bytes = MIN (priv->low_water_bytes, priv->high_water_bytes);
+  low_water_messages = MIN (priv->low_water_messages, priv->high_water_messages);
 
-  if (priv->processing)
+  if (!priv->congested)
+    congested = (priv->high_water_bytes > 0 && priv->n_pending_bytes >= priv->high_water_bytes) ||
+                (priv->high_water_messages > 0 && priv->n_pending >= priv->high_water_messages);
+  else
+    congested = (priv->high_water_bytes > 0 && priv->n_pending_bytes > low_water_bytes) ||
+                (priv->high_water_messages > 0 && priv->n_pending > low_water_messages);
+
+  if (congested == priv->congested)
     return;
 
-  task = g_queue_pop_head (&priv->queue);
-  bytes = g_task_get_task_data (task);
-  data = g_bytes_get_data (bytes, &len);
-  cancellable = g_task_get_cancellable (task);
+  priv->congested = congested;
 
-  if (g_output_stream_is_closed (G_OUTPUT_STREAM (self)))
-    {
-      g_task_return_new_error (task,
-                               G_IO_ERROR,
-                               G_IO_ERROR_CLOSED,
-                               "Stream has been closed");
-      return;
-    }
+  g_object_notify_by_pspec (G_OBJECT (self), properties [PROP_CONGESTED]);
 
-  priv->processing = TRUE;
+  if (!congested)
+    {
+      GTask *task;
 
-  g_output_stream_write_all_async (G_OUTPUT_STREAM (self),
-                                   data,
-                                   len,
-                                   G_PRIORITY_DEFAULT,
-                                   cancellable,
-                                   jsonrpc_output_stream_write_message_async_cb,
-                                   g_steal_pointer (&task));
+      while (!priv->congested && (task = g_queue_pop_head (&priv->waiters)))
+        jsonrpc_output_stream_complete_waiter (task, NULL);
+    }
 }
 
+/*
+ * jsonrpc_output_stream_release_frame:
+ *
+ * Stops accounting for the message of @frame, which is no longer pending.
+ */
 static void
-jsonrpc_output_stream_write_message_async_cb (GObject      *object,
-                                              GAsyncResult *result,
-                                              gpointer      user_data)
+jsonrpc_output_stream_release_frame (JsonrpcOutputStream *self,
+                                     Frame               *frame)
 {
-  JsonrpcOutputStream *self = (JsonrpcOutputStream *)object;
   JsonrpcOutputStreamPrivate *priv = jsonrpc_output_stream_get_instance_private (self);
-  g_autoptr(GError) error = NULL;
-  g_autoptr(GTask) task = user_data;
-  GBytes *bytes;
-  gsize n_written;
 
-  g_assert (JSONRPC_IS_OUTPUT_STREAM (self));
-  g_assert (G_IS_ASYNC_RESULT (result));
-  g_assert (G_IS_TASK (task));
+  g_assert (priv->n_pending > 0);
+  g_assert (priv->n_pending_bytes >= frame->size);
 
-  priv->processing = FALSE;
+  priv->n_pending_bytes -= frame->size;
 
-  if (!g_output_stream_write_all_finish (G_OUTPUT_STREAM (self), result, &n_written, &error))
-    {
-      g_task_return_error (task, g_steal_pointer (&error));
-      jsonrpc_output_stream_fail_pending (self);
-      return;
-    }
+  /* Our caller still holds a reference, this cannot finalize @self */
+  if (--priv->n_pending == 0)
+    g_object_unref (self);
+}
 
-  bytes = g_task_get_task_data (task);
+/*
+ * jsonrpc_output_stream_complete_frame:
+ *
+ * Releases @frame and completes its task, and the tasks of the messages
+ * it superseded, with @error or successfully if @error is %NULL.
+ */
+static void
+jsonrpc_output_stream_complete_frame (JsonrpcOutputStream *self,
+                                      Frame               *frame,
+                                      const GError        *error)
+{
+  jsonrpc_output_stream_release_frame (self, frame);
 
-  if (g_bytes_get_size (bytes) != n_written)
+  if (frame->superseded != NULL)
     {
-      g_task_return_new_error (task,
-                               G_IO_ERROR,
-                               G_IO_ERROR_CLOSED,
-                               "Failed to write all bytes to peer");
-      jsonrpc_output_stream_fail_pending (self);
-      return;
+      for (guint i = 0; i < frame->superseded->len; i++)
+        {
+          GTask *superseded = g_ptr_array_index (frame->superseded, i);
+
+          if (error != NULL)
+            g_task_return_error (superseded, g_error_copy (error));
+          else
+            {
+              g_task_set_check_cancellable (superseded, FALSE);
+              g_task_return_boolean (superseded, TRUE);
+            }
+        }
     }
 
-  g_task_return_boolean (task, TRUE);
+  if (frame->task != NULL)
+    {
+      if (error != NULL)
+        g_task_return_error (frame->task, g_error_copy (error));
+      else
+        {
+          /* The message was written, even if cancelled meanwhile */
+          g_task_set_check_cancellable (frame->task, FALSE);
+          g_task_return_boolean (frame->task, TRUE);
+        }
+    }
 
-  jsonrpc_output_stream_pump (self);
+  frame_discard (frame);
 }
 
-/**
- * jsonrpc_output_stream_write_message_async:
- * @self: a #JsonrpcOutputStream
- * @message: (transfer none): a #GVariant
- * @cancellable: (nullable): a #GCancellable or %NULL
- * @callback: (nullable): a #GAsyncReadyCallback or %NULL
- * @user_data: closure data for @callback
- *
- * Asynchronously sends a message to the peer.
+/*
+ * jsonrpc_output_stream_get_next_queue:
  *
- * This asynchronous operation will complete once the message has
- * been buffered, and there is no guarantee the peer received it.
+ * Gets the queue of the highest priority which has pending messages.
  *
- * Since: 3.26
+ * Returns: (nullable): a #GQueue or %NULL if nothing is queued
  */
-void
-jsonrpc_output_stream_write_message_async (JsonrpcOutputStream *self,
-                                           GVariant            *message,
-                                           GCancellable        *cancellable,
-                                           GAsyncReadyCallback  callback,
-                                           gpointer             user_data)
+static GQueue *
+jsonrpc_output_stream_get_next_queue (JsonrpcOutputStream *self)
 {
   JsonrpcOutputStreamPrivate *priv = jsonrpc_output_stream_get_instance_private (self);
-  g_autoptr(GBytes) bytes = NULL;
-  g_autoptr(GTask) task = NULL;
-  g_autoptr(GError) error = NULL;
-
-  g_return_if_fail (JSONRPC_IS_OUTPUT_STREAM (self));
-  g_return_if_fail (message != NULL);
-  g_return_if_fail (!cancellable || G_IS_CANCELLABLE (cancellable));
-
-  task = g_task_new (self, cancellable, callback, user_data);
-  g_task_set_source_tag (task, jsonrpc_output_stream_write_message_async);
-  g_task_set_priority (task, G_PRIORITY_LOW);
 
-  if (NULL == (bytes = jsonrpc_output_stream_create_bytes (self, message, &error)))
+  for (guint i = 0; i < N_WRITE_PRIORITIES; i++)
     {
-      g_task_return_error (task, g_steal_pointer (&error));
-      return;
+      if (priv->queues[i].length > 0)
+        return &priv->queues[i];
     }
 
-  g_task_set_task_data (task, g_steal_pointer (&bytes), (GDestroyNotify)g_bytes_unref);
-  g_queue_push_tail (&priv->queue, g_steal_pointer (&task));
-  jsonrpc_output_stream_pump (self);
+  return NULL;
 }
 
-gboolean
-jsonrpc_output_stream_write_message_finish (JsonrpcOutputStream  *self,
-                                            GAsyncResult         *result,
-                                            GError              **error)
+/*
+ * jsonrpc_output_stream_get_ready_queue:
+ *
+ * Like jsonrpc_output_stream_get_next_queue() but skips queues whose next
+ * message is still being serialized, as the messages following it within
+ * that queue must wait for it.
+ *
+ * Returns: (nullable): a #GQueue or %NULL if nothing can be written
+ */
+static GQueue *
+jsonrpc_output_stream_get_ready_queue (JsonrpcOutputStream *self)
+{
+  JsonrpcOutputStreamPrivate *priv = jsonrpc_output_stream_get_instance_private (self);
+
+  for (guint i = 0; i < N_WRITE_PRIORITIES; i++)
+    {
+      if (priv->queues[i].length > 0)
+        {
+          Frame *frame = priv->queues[i].head->data;
+
+          if (!frame->pending)
+            return &priv->queues[i];
+        }
+    }
+
+  return NULL;
+}
+
+/*
+ * jsonrpc_output_stream_uncoalesce:
+ *
+ * Prevents @frame from being replaced by a message queued with the same
+ * coalescing key, as it is no longer waiting in the queue.
+ */
+static void
+jsonrpc_output_stream_uncoalesce (JsonrpcOutputStream *self,
+                                  Frame               *frame)
+{
+  JsonrpcOutputStreamPrivate *priv = jsonrpc_output_stream_get_instance_private (self);
+
+  if (frame->coalesce_key != NULL)
+    {
+      GList *link = g_hash_table_lookup (priv->coalesced, frame->coalesce_key);
+
+      if (link != NULL && link->data == frame)
+        g_hash_table_remove (priv->coalesced, frame->coalesce_key);
+    }
+}
+
+static void
+jsonrpc_output_stream_fail_pending (JsonrpcOutputStream *self,
+                                    const GError        *error)
+{
+  JsonrpcOutputStreamPrivate *priv = jsonrpc_output_stream_get_instance_private (self);
+
+  g_assert (JSONRPC_IS_OUTPUT_STREAM (self));
+  g_assert (error != NULL);
+
+  g_hash_table_remove_all (priv->coalesced);
+
+  for (guint i = 0; i < N_WRITE_PRIORITIES; i++)
+    {
+      const GList *iter;
+      GList *list;
+
+      list = priv->queues[i].head;
+
+      priv->queues[i].head = NULL;
+      priv->queues[i].tail = NULL;
+      priv->queues[i].length = 0;
+
+      for (iter = list; iter != NULL; iter = iter->next)
+        jsonrpc_output_stream_complete_frame (self, iter->data, error);
+
+      g_list_free (list);
+    }
+
+  jsonrpc_output_stream_update_congested (self);
+}
+
+static void
+jsonrpc_output_stream_pump (JsonrpcOutputStream *self)
+{
+  JsonrpcOutputStreamPrivate *priv = jsonrpc_output_stream_get_instance_private (self);
+  g_autoptr(GPtrArray) cancelled = NULL;
+  GCancellable *cancellable = NULL;
+  GQueue *queue;
+  gsize batch_size = 0;
+
+  g_assert (JSONRPC_IS_OUTPUT_STREAM (self));
+
+  if (NULL == (queue = jsonrpc_output_stream_get_next_queue (self)))
+    return;
+
+  if (priv->processing)
+    return;
+
+  /* Messages held back by a cork must not outlive the stream */
+  if (g_output_stream_is_closed (G_OUTPUT_STREAM (self)))
+    {
+      g_autoptr(GError) error = NULL;
+
+      error = g_error_new_literal (G_IO_ERROR,
+                                   G_IO_ERROR_CLOSED,
+                                   "Stream has been closed");
+      jsonrpc_output_stream_fail_pending (self, error);
+
+      return;
+    }
+
+  if (priv->cork_count > 0 && priv->n_sync_writes == 0)
+    return;
+
+  /* Wait for the serialization of the next message to complete */
+  if (NULL == (queue = jsonrpc_output_stream_get_ready_queue (self)))
+    return;
+
+  g_assert (priv->in_flight->len == 0);
+  g_assert (priv->vectors->len == 0);
+
+  /*
+   * Gather as many queued messages as we can so that a burst of messages
+   * becomes a single write instead of a write and main loop iteration for
+   * every message. Higher priorities are drained first, and since each
+   * batch is bounded, a message queued with a higher priority while the
+   * batch is written only has to wait for that batch.
+   */
+  while (queue != NULL)
+    {
+      Frame *frame = g_queue_peek_head (queue);
+      GOutputVector vectors[2];
+      guint n_vectors = 0;
+      gsize frame_size = 0;
+
+      /*
+       * A message cancelled before being written is dropped rather than
+       * written along with the others, which could not be cancelled.
+       */
+      if (g_cancellable_is_cancelled (frame->cancellable))
+        {
+          jsonrpc_output_stream_uncoalesce (self, frame);
+
+          if (cancelled == NULL)
+            cancelled = g_ptr_array_new ();
+          g_ptr_array_add (cancelled, g_queue_pop_head (queue));
+
+          queue = jsonrpc_output_stream_get_ready_queue (self);
+          continue;
+        }
+
+      if (frame->headers != NULL)
+        {
+          vectors[n_vectors].buffer = g_bytes_get_data (frame->headers, &vectors[n_vectors].size);
+          frame_size += vectors[n_vectors++].size;
+        }
+
+      vectors[n_vectors].buffer = g_bytes_get_data (frame->body, &vectors[n_vectors].size);
+      frame_size += vectors[n_vectors++].size;
+
+      if (priv->vectors->len > 0 &&
+          (priv->vectors->len + n_vectors > JSONRPC_OUTPUT_STREAM_MAX_VECTORS ||
+           batch_size + frame_size > JSONRPC_OUTPUT_STREAM_MAX_BATCH_SIZE))
+        break;
+
+      /* Once being written, the message can no longer be replaced */
+      jsonrpc_output_stream_uncoalesce (self, frame);
+
+      g_ptr_array_add (priv->in_flight, g_queue_pop_head (queue));
+      g_array_append_vals (priv->vectors, vectors, n_vectors);
+      batch_size += frame_size;
+
+      queue = jsonrpc_output_stream_get_ready_queue (self);
+    }
+
+  /*
+   * Cancelling one message must not abort the write of the other messages
+   * sharing it, so only a message written on its own can be cancelled.
+   */
+  if (priv->in_flight->len == 1)
+    cancellable = ((Frame *)g_ptr_array_index (priv->in_flight, 0))->cancellable;
+
+  if (priv->in_flight->len > 0)
+    {
+      priv->processing = TRUE;
+
+      g_output_stream_writev_all_async (G_OUTPUT_STREAM (self),
+                                        (GOutputVector *)(gpointer)priv->vectors->data,
+                                        priv->vectors->len,
+                                        G_PRIORITY_DEFAULT,
+                                        cancellable,
+                                        jsonrpc_output_stream_write_message_async_cb,
+                                        NULL);
+    }
+
+  if (cancelled != NULL)
+    {
+      g_autoptr(JsonrpcOutputStream) hold = NULL;
+      g_autoptr(GError) error = NULL;
+      gboolean processing = priv->processing;
+
+      /* Completing the last pending message drops its reference on us */
+      hold = g_object_ref (self);
+
+      error = g_error_new_literal (G_IO_ERROR,
+                                   G_IO_ERROR_CANCELLED,
+                                   "Operation was cancelled");
+
+      /* Messages queued by the callbacks must wait for us to finish */
+      priv->processing = TRUE;
+
+      for (guint i = 0; i < cancelled->len; i++)
+        jsonrpc_output_stream_complete_frame (self, g_ptr_array_index (cancelled, i), error);
+
+      jsonrpc_output_stream_update_congested (self);
+
+      priv->processing = processing;
+
+      if (!processing)
+        jsonrpc_output_stream_pump (self);
+    }
+}
+
+static void
+jsonrpc_output_stream_write_message_async_cb (GObject      *object,
+                                              GAsyncResult *result,
+                                              gpointer      user_data)
+{
+  JsonrpcOutputStream *self = (JsonrpcOutputStream *)object;
+  JsonrpcOutputStreamPrivate *priv = jsonrpc_output_stream_get_instance_private (self);
+  g_autoptr(GError) error = NULL;
+  gsize batch_size = 0;
+  gsize n_written = 0;
+
+  g_assert (JSONRPC_IS_OUTPUT_STREAM (self));
+  g_assert (G_IS_ASYNC_RESULT (result));
+
+  for (guint i = 0; i < priv->vectors->len; i++)
+    batch_size += g_array_index (priv->vectors, GOutputVector, i).size;
+
+  if (g_output_stream_writev_all_finish (G_OUTPUT_STREAM (self), result, &n_written, &error) &&
+      n_written != batch_size)
+    g_set_error (&error,
+                 G_IO_ERROR,
+                 G_IO_ERROR_CLOSED,
+                 "Failed to write all bytes to peer");
+
+  /*
+   * Completing the tasks may queue more messages, which must wait for us
+   * to finish with the current batch. So keep processing set until then.
+   */
+  for (guint i = 0; i < priv->in_flight->len; i++)
+    jsonrpc_output_stream_complete_frame (self, g_ptr_array_index (priv->in_flight, i), error);
+
+  g_ptr_array_set_size (priv->in_flight, 0);
+  g_array_set_size (priv->vectors, 0);
+
+  jsonrpc_output_stream_update_congested (self);
+
+  priv->processing = FALSE;
+
+  if (error != NULL)
+    {
+      g_autoptr(GError) failure = NULL;
+
+      failure = g_error_new_literal (G_IO_ERROR,
+                                     G_IO_ERROR_FAILED,
+                                     "Task failed due to stream failure");
+      jsonrpc_output_stream_fail_pending (self, failure);
+
+      return;
+    }
+
+  jsonrpc_output_stream_pump (self);
+}
+
+static void
+encode_state_free (gpointer data)
+{
+  EncodeState *state = data;
+
+  g_clear_pointer (&state->message, g_variant_unref);
+  g_clear_pointer (&state->pool, _jsonrpc_buffer_pool_unref);
+  g_slice_free (EncodeState, state);
+}
+
+static void
+jsonrpc_output_stream_encode_worker (GTask        *task,
+                                     gpointer      source_object,
+                                     gpointer      task_data,
+                                     GCancellable *cancellable)
+{
+  EncodeState *state = task_data;
+  GError *error = NULL;
+  Frame *frame;
+
+  g_assert (G_IS_TASK (task));
+  g_assert (state != NULL);
+
+  if (!(frame = jsonrpc_output_stream_encode (state, &error)))
+    g_task_return_error (task, error);
+  else
+    g_task_return_pointer (task, frame, frame_free);
+}
+
+static gboolean
+jsonrpc_output_stream_should_thread (JsonrpcOutputStream *self,
+                                     GVariant            *message)
+{
+  JsonrpcOutputStreamPrivate *priv = jsonrpc_output_stream_get_instance_private (self);
+
+  /* GVariant bodies are written as is, leaving nothing to offload */
+  if (priv->framing != JSONRPC_FRAMING_NEWLINE &&
+      priv->use_gvariant &&
+      priv->compression == JSONRPC_COMPRESSION_NONE)
+    return FALSE;
+
+  return g_variant_get_size (message) >= JSONRPC_OUTPUT_STREAM_THREAD_THRESHOLD;
+}
+
+static void
+jsonrpc_output_stream_encode_cb (GObject      *object,
+                                 GAsyncResult *result,
+                                 gpointer      user_data)
+{
+  JsonrpcOutputStream *self = (JsonrpcOutputStream *)object;
+  JsonrpcOutputStreamPrivate *priv = jsonrpc_output_stream_get_instance_private (self);
+  g_autoptr(GError) error = NULL;
+  Frame *frame = user_data;
+  Frame *encoded;
+
+  g_assert (JSONRPC_IS_OUTPUT_STREAM (self));
+  g_assert (G_IS_TASK (result));
+  g_assert (frame != NULL);
+  g_assert (frame->pending);
+
+  encoded = g_task_propagate_pointer (G_TASK (result), &error);
+
+  frame->pending = FALSE;
+
+  /* The stream failed or was closed meanwhile, which completed @frame */
+  if (frame->orphaned)
+    {
+      g_clear_pointer (&encoded, frame_free);
+      frame_free (frame);
+      return;
+    }
+
+  if (encoded == NULL)
+    {
+      GQueue *queue = &priv->queues[frame->priority];
+      GList *link = g_queue_find (queue, frame);
+
+      g_assert (link != NULL);
+
+      if (frame->coalesce_key != NULL &&
+          g_hash_table_lookup (priv->coalesced, frame->coalesce_key) == link)
+        g_hash_table_remove (priv->coalesced, frame->coalesce_key);
+
+      g_queue_delete_link (queue, link);
+
+      jsonrpc_output_stream_complete_frame (self, frame, error);
+    }
+  else
+    {
+      frame->headers = g_steal_pointer (&encoded->headers);
+      frame->body = g_steal_pointer (&encoded->body);
+      frame->size = encoded->size;
+      frame_free (encoded);
+
+      priv->n_pending_bytes += frame->size;
+    }
+
+  jsonrpc_output_stream_update_congested (self);
+  jsonrpc_output_stream_pump (self);
+}
+
+/*
+ * jsonrpc_output_stream_encode_in_thread:
+ *
+ * Starts serializing @message on a worker thread.
+ *
+ * Returns: (transfer full): a pending frame, which is filled in once
+ *   serializing completes
+ */
+static Frame *
+jsonrpc_output_stream_encode_in_thread (JsonrpcOutputStream *self,
+                                        GVariant            *message)
+{
+  JsonrpcOutputStreamPrivate *priv = jsonrpc_output_stream_get_instance_private (self);
+  g_autoptr(GTask) encode_task = NULL;
+  EncodeState *state;
+  Frame *frame;
+
+  g_assert (JSONRPC_IS_OUTPUT_STREAM (self));
+  g_assert (message != NULL);
+
+  /* The settings in use now apply, even if they change meanwhile */
+  state = g_slice_new0 (EncodeState);
+  state->message = g_variant_ref_sink (message);
+  state->pool = _jsonrpc_buffer_pool_ref (priv->pool);
+  state->framing = priv->framing;
+  state->compression = priv->compression;
+  state->use_gvariant = priv->use_gvariant;
+
+  frame = g_slice_new0 (Frame);
+  frame->pending = TRUE;
+
+  encode_task = g_task_new (self, NULL, jsonrpc_output_stream_encode_cb, frame);
+  g_task_set_source_tag (encode_task, jsonrpc_output_stream_encode_in_thread);
+  g_task_set_priority (encode_task, G_PRIORITY_LOW);
+  g_task_set_task_data (encode_task, state, encode_state_free);
+  g_task_run_in_thread (encode_task, jsonrpc_output_stream_encode_worker);
+
+  return frame;
+}
+
+/*
+ * jsonrpc_output_stream_queue_frame:
+ *
+ * Queues @message, or @encoded, for writing. @task is completed once it
+ * has been written, if set.
+ */
+static void
+jsonrpc_output_stream_queue_frame (JsonrpcOutputStream   *self,
+                                   GVariant              *message,
+                                   JsonrpcEncodedMessage *encoded,
+                                   JsonrpcWritePriority   priority,
+                                   const gchar           *coalesce_key,
+                                   GCancellable          *cancellable,
+                                   GTask                 *task)
+{
+  JsonrpcOutputStreamPrivate *priv = jsonrpc_output_stream_get_instance_private (self);
+  g_autoptr(GError) error = NULL;
+  Frame *frame;
+  GList *link;
+
+  g_assert (JSONRPC_IS_OUTPUT_STREAM (self));
+  g_assert ((message != NULL) != (encoded != NULL));
+  g_assert (priority < N_WRITE_PRIORITIES);
+  g_assert (!task || G_IS_TASK (task));
+
+  /*
+   * Large messages are serialized on a worker thread. Their place in the
+   * queue is taken right away so that the order of messages is unchanged.
+   */
+  if (encoded != NULL)
+    frame = jsonrpc_output_stream_create_encoded_frame (self, encoded, &error);
+  else if (jsonrpc_output_stream_should_thread (self, message))
+    frame = jsonrpc_output_stream_encode_in_thread (self, message);
+  else
+    frame = jsonrpc_output_stream_create_frame (self, message, &error);
+
+  if (frame == NULL)
+    {
+      if (task != NULL)
+        {
+          g_task_return_error (task, g_steal_pointer (&error));
+          g_object_unref (task);
+        }
+      else
+        g_debug ("Failed to serialize message: %s", error->message);
+
+      return;
+    }
+
+  frame->priority = priority;
+  frame->coalesce_key = g_strdup (coalesce_key);
+  frame->task = task;
+  frame->cancellable = cancellable ? g_object_ref (cancellable) : NULL;
+
+  if (priv->n_pending++ == 0)
+    g_object_ref (self);
+  priv->n_pending_bytes += frame->size;
+
+  if (coalesce_key != NULL &&
+      (link = g_hash_table_lookup (priv->coalesced, coalesce_key)) &&
+      frame_is_replaceable (link->data, priority))
+    {
+      Frame *superseded = link->data;
+
+      /*
+       * Take the place of the superseded message in the queue, dropping
+       * its buffers right away so that only the latest state is kept.
+       */
+      jsonrpc_output_stream_release_frame (self, superseded);
+
+      frame->superseded = g_steal_pointer (&superseded->superseded);
+
+      if (superseded->task != NULL)
+        {
+          if (frame->superseded == NULL)
+            frame->superseded = g_ptr_array_new_with_free_func (g_object_unref);
+          g_ptr_array_add (frame->superseded, g_steal_pointer (&superseded->task));
+        }
+
+      frame_free (superseded);
+
+      link->data = frame;
+    }
+  else
+    {
+      g_queue_push_tail (&priv->queues[priority], frame);
+
+      if (coalesce_key != NULL)
+        g_hash_table_insert (priv->coalesced,
+                             g_strdup (coalesce_key),
+                             priv->queues[priority].tail);
+    }
+
+  jsonrpc_output_stream_update_congested (self);
+  jsonrpc_output_stream_pump (self);
+}
+
+/*
+ * jsonrpc_output_stream_new_task:
+ *
+ * Creates the task completing a write, which is only needed if there is
+ * a @callback to call.
+ *
+ * Returns: (transfer full) (nullable): a #GTask or %NULL
+ */
+static GTask *
+jsonrpc_output_stream_new_task (JsonrpcOutputStream *self,
+                                GCancellable        *cancellable,
+                                GAsyncReadyCallback  callback,
+                                gpointer             user_data,
+                                gpointer             source_tag)
+{
+  GTask *task;
+
+  if (callback == NULL)
+    return NULL;
+
+  task = g_task_new (self, cancellable, callback, user_data);
+  g_task_set_source_tag (task, source_tag);
+  g_task_set_priority (task, G_PRIORITY_LOW);
+
+  return task;
+}
+
+/**
+ * jsonrpc_output_stream_write_message_async:
+ * @self: a #JsonrpcOutputStream
+ * @message: (transfer none): a #GVariant
+ * @cancellable: (nullable): a #GCancellable or %NULL
+ * @callback: (nullable): a #GAsyncReadyCallback or %NULL
+ * @user_data: closure data for @callback
+ *
+ * Asynchronously sends a message to the peer.
+ *
+ * The message is queued with %JSONRPC_WRITE_PRIORITY_NORMAL.
+ *
+ * This asynchronous operation will complete once the message has
+ * been buffered, and there is no guarantee the peer received it.
+ *
+ * If @callback is %NULL, the message is still written, and the stream
+ * is kept alive until it is, but no state is kept to report completion.
+ *
+ * Since: 3.26
+ */
+void
+jsonrpc_output_stream_write_message_async (JsonrpcOutputStream *self,
+                                           GVariant            *message,
+                                           GCancellable        *cancellable,
+                                           GAsyncReadyCallback  callback,
+                                           gpointer             user_data)
+{
+  GTask *task;
+
+  g_return_if_fail (JSONRPC_IS_OUTPUT_STREAM (self));
+  g_return_if_fail (message != NULL);
+  g_return_if_fail (!cancellable || G_IS_CANCELLABLE (cancellable));
+
+  task = jsonrpc_output_stream_new_task (self, cancellable, callback, user_data, jsonrpc_output_stream_write_message_async);
+
+  jsonrpc_output_stream_queue_frame (self, message, NULL, JSONRPC_WRITE_PRIORITY_NORMAL, NULL, cancellable, task);
+}
+
+/**
+ * jsonrpc_output_stream_queue_message_async:
+ * @self: a #JsonrpcOutputStream
+ * @message: (transfer none): a #GVariant
+ * @priority: the #JsonrpcWritePriority of the message
+ * @coalesce_key: (nullable): a key identifying messages superseding each
+ *   other, or %NULL
+ * @cancellable: (nullable): a #GCancellable or %NULL
+ * @callback: (nullable): a #GAsyncReadyCallback or %NULL
+ * @user_data: closure data for @callback
+ *
+ * Asynchronously sends a message to the peer, ahead of any queued message
+ * of a lower @priority.
+ *
+ * Messages are never interleaved, so a message which is already being
+ * written is completed first.
+ *
+ * If @coalesce_key is set and a message queued with the same @priority
+ * and @coalesce_key has not been written yet, @message replaces it in
+ * the queue. The operation of the replaced message then completes along
+ * with that of @message. This bounds the queue to the latest state of
+ * messages such as "$/progress" for a given token.
+ *
+ * Call jsonrpc_output_stream_write_message_finish() to get the result of
+ * the operation, which completes once the message has been buffered.
+ *
+ * Since: 3.46
+ */
+void
+jsonrpc_output_stream_queue_message_async (JsonrpcOutputStream  *self,
+                                           GVariant             *message,
+                                           JsonrpcWritePriority  priority,
+                                           const gchar          *coalesce_key,
+                                           GCancellable         *cancellable,
+                                           GAsyncReadyCallback   callback,
+                                           gpointer              user_data)
+{
+  GTask *task;
+
+  g_return_if_fail (JSONRPC_IS_OUTPUT_STREAM (self));
+  g_return_if_fail (message != NULL);
+  g_return_if_fail (priority <= JSONRPC_WRITE_PRIORITY_LOW);
+  g_return_if_fail (!cancellable || G_IS_CANCELLABLE (cancellable));
+
+  task = jsonrpc_output_stream_new_task (self, cancellable, callback, user_data, jsonrpc_output_stream_queue_message_async);
+
+  jsonrpc_output_stream_queue_frame (self, message, NULL, priority, coalesce_key, cancellable, task);
+}
+
+/**
+ * jsonrpc_output_stream_queue_encoded_async:
+ * @self: a #JsonrpcOutputStream
+ * @encoded: a #JsonrpcEncodedMessage
+ * @priority: the #JsonrpcWritePriority of the message
+ * @cancellable: (nullable): a #GCancellable or %NULL
+ * @callback: (nullable): a #GAsyncReadyCallback or %NULL
+ * @user_data: closure data for @callback
+ *
+ * Like jsonrpc_output_stream_queue_message_async() but sends a message
+ * which may be shared with other streams, reusing its serialized form if
+ * another stream using the same encoding already serialized it.
+ *
+ * Call jsonrpc_output_stream_write_message_finish() to get the result of
+ * the operation.
+ *
+ * Since: 3.46
+ */
+void
+jsonrpc_output_stream_queue_encoded_async (JsonrpcOutputStream   *self,
+                                           JsonrpcEncodedMessage *encoded,
+                                           JsonrpcWritePriority   priority,
+                                           GCancellable          *cancellable,
+                                           GAsyncReadyCallback    callback,
+                                           gpointer               user_data)
+{
+  GTask *task;
+
+  g_return_if_fail (JSONRPC_IS_OUTPUT_STREAM (self));
+  g_return_if_fail (encoded != NULL);
+  g_return_if_fail (priority <= JSONRPC_WRITE_PRIORITY_LOW);
+  g_return_if_fail (!cancellable || G_IS_CANCELLABLE (cancellable));
+
+  task = jsonrpc_output_stream_new_task (self, cancellable, callback, user_data, jsonrpc_output_stream_queue_encoded_async);
+
+  jsonrpc_output_stream_queue_frame (self, NULL, encoded, priority, NULL, cancellable, task);
+}
+
+gboolean
+jsonrpc_output_stream_write_message_finish (JsonrpcOutputStream  *self,
+                                            GAsyncResult         *result,
+                                            GError              **error)
+{
+  g_return_val_if_fail (JSONRPC_IS_OUTPUT_STREAM (self), FALSE);
+  g_return_val_if_fail (G_IS_TASK (result), FALSE);
+
+  return g_task_propagate_boolean (G_TASK (result), error);
+}
+
+static void
+jsonrpc_output_stream_write_message_sync_cb (GObject      *object,
+                                             GAsyncResult *result,
+                                             gpointer      user_data)
+{
+  JsonrpcOutputStream *self = (JsonrpcOutputStream *)object;
+  GTask *task = user_data;
+  g_autoptr(GError) error = NULL;
+
+  g_assert (JSONRPC_IS_OUTPUT_STREAM (self));
+  g_assert (G_IS_ASYNC_RESULT (result));
+  g_assert (G_IS_TASK (task));
+
+  if (!jsonrpc_output_stream_write_message_finish (self, result, &error))
+    g_task_return_error (task, g_steal_pointer (&error));
+  else
+    g_task_return_boolean (task, TRUE);
+}
+
+/**
+ * jsonrpc_output_stream_write_message:
+ * @self: a #JsonrpcOutputStream
+ * @message: (transfer none): a #GVariant
+ * @cancellable: (nullable): a #GCancellable or %NULL
+ * @error: a location for a #GError, or %NULL
+ *
+ * Synchronously sends a message to the peer.
+ *
+ * This operation will complete once the message has been buffered. There
+ * is no guarantee the peer received it.
+ *
+ * Since: 3.26
+ */
+gboolean
+jsonrpc_output_stream_write_message (JsonrpcOutputStream  *self,
+                                     GVariant             *message,
+                                     GCancellable         *cancellable,
+                                     GError              **error)
+{
+  g_return_val_if_fail (JSONRPC_IS_OUTPUT_STREAM (self), FALSE);
+  g_return_val_if_fail (message != NULL, FALSE);
+  g_return_val_if_fail (!cancellable || G_IS_CANCELLABLE (cancellable), FALSE);
+
+  return _jsonrpc_output_stream_queue_message (self,
+                                               message,
+                                               JSONRPC_WRITE_PRIORITY_NORMAL,
+                                               cancellable,
+                                               error);
+}
+
+/*
+ * _jsonrpc_output_stream_queue_message:
+ *
+ * Like jsonrpc_output_stream_write_message() but queues @message with
+ * @priority, see jsonrpc_output_stream_queue_message_async().
+ */
+gboolean
+_jsonrpc_output_stream_queue_message (JsonrpcOutputStream   *self,
+                                      GVariant              *message,
+                                      JsonrpcWritePriority   priority,
+                                      GCancellable          *cancellable,
+                                      GError               **error)
+{
+  g_autoptr(GTask) task = NULL;
+  g_autoptr(GMainContext) main_context = NULL;
+
+  g_assert (JSONRPC_IS_OUTPUT_STREAM (self));
+  g_assert (message != NULL);
+  g_assert (!cancellable || G_IS_CANCELLABLE (cancellable));
+
+  main_context = g_main_context_ref_thread_default ();
+
+  task = g_task_new (NULL, NULL, NULL, NULL);
+  g_task_set_source_tag (task, jsonrpc_output_stream_write_message);
+
+  /* Waiting for the stream to be uncorked would never complete */
+  _jsonrpc_output_stream_begin_sync (self);
+
+  jsonrpc_output_stream_queue_message_async (self,
+                                             message,
+                                             priority,
+                                             NULL,
+                                             cancellable,
+                                             jsonrpc_output_stream_write_message_sync_cb,
+                                             task);
+
+  while (!g_task_get_completed (task))
+    g_main_context_iteration (main_context, TRUE);
+
+  _jsonrpc_output_stream_end_sync (self);
+
+  return g_task_propagate_boolean (task, error);
+}
+
+/*
+ * _jsonrpc_output_stream_begin_sync:
+ *
+ * Writes messages even if the stream is corked, until
+ * _jsonrpc_output_stream_end_sync() is called. This is needed while
+ * blocking on the completion of a message.
+ */
+void
+_jsonrpc_output_stream_begin_sync (JsonrpcOutputStream *self)
+{
+  JsonrpcOutputStreamPrivate *priv = jsonrpc_output_stream_get_instance_private (self);
+
+  g_assert (JSONRPC_IS_OUTPUT_STREAM (self));
+
+  priv->n_sync_writes++;
+
+  jsonrpc_output_stream_pump (self);
+}
+
+void
+_jsonrpc_output_stream_end_sync (JsonrpcOutputStream *self)
+{
+  JsonrpcOutputStreamPrivate *priv = jsonrpc_output_stream_get_instance_private (self);
+
+  g_assert (JSONRPC_IS_OUTPUT_STREAM (self));
+  g_assert (priv->n_sync_writes > 0);
+
+  priv->n_sync_writes--;
+}
+
+/**
+ * jsonrpc_output_stream_cork:
+ * @self: a #JsonrpcOutputStream
+ *
+ * Holds back messages queued from now on until
+ * jsonrpc_output_stream_uncork() is called, so that a burst of messages
+ * is written to the peer at once rather than the first of them being
+ * written on its own.
+ *
+ * Calls may be nested, in which case messages are written once every
+ * call has been matched by a call to jsonrpc_output_stream_uncork().
+ *
+ * Messages written with jsonrpc_output_stream_write_message() are not
+ * held back, as that would block forever, and are written along with
+ * anything queued before them.
+ *
+ * See also jsonrpc_output_stream_corker_new().
+ *
+ * Since: 3.46
+ */
+void
+jsonrpc_output_stream_cork (JsonrpcOutputStream *self)
+{
+  JsonrpcOutputStreamPrivate *priv = jsonrpc_output_stream_get_instance_private (self);
+
+  g_return_if_fail (JSONRPC_IS_OUTPUT_STREAM (self));
+  g_return_if_fail (priv->cork_count < G_MAXUINT);
+
+  priv->cork_count++;
+}
+
+/**
+ * jsonrpc_output_stream_uncork:
+ * @self: a #JsonrpcOutputStream
+ *
+ * Undoes a call to jsonrpc_output_stream_cork(), writing the messages
+ * held back if this is the last one.
+ *
+ * Since: 3.46
+ */
+void
+jsonrpc_output_stream_uncork (JsonrpcOutputStream *self)
+{
+  JsonrpcOutputStreamPrivate *priv = jsonrpc_output_stream_get_instance_private (self);
+
+  g_return_if_fail (JSONRPC_IS_OUTPUT_STREAM (self));
+  g_return_if_fail (priv->cork_count > 0);
+
+  if (--priv->cork_count == 0)
+    jsonrpc_output_stream_pump (self);
+}
+
+gboolean
+jsonrpc_output_stream_get_use_gvariant (JsonrpcOutputStream *self)
+{
+  JsonrpcOutputStreamPrivate *priv = jsonrpc_output_stream_get_instance_private (self);
+
+  g_return_val_if_fail (JSONRPC_IS_OUTPUT_STREAM (self), FALSE);
+
+  return priv->use_gvariant;
+}
+
+void
+jsonrpc_output_stream_set_use_gvariant (JsonrpcOutputStream *self,
+                                        gboolean             use_gvariant)
+{
+  JsonrpcOutputStreamPrivate *priv = jsonrpc_output_stream_get_instance_private (self);
+
+  g_return_if_fail (JSONRPC_IS_OUTPUT_STREAM (self));
+
+  use_gvariant = !!use_gvariant;
+
+  if (priv->use_gvariant != use_gvariant)
+    {
+      priv->use_gvariant = use_gvariant;
+      g_object_notify_by_pspec (G_OBJECT (self), properties[PROP_USE_GVARIANT]);
+    }
+}
+
+/**
+ * jsonrpc_output_stream_get_framing:
+ * @self: a #JsonrpcOutputStream
+ *
+ * Gets how messages are delimited on the stream.
+ *
+ * Returns: a #JsonrpcFraming
+ *
+ * Since: 3.46
+ */
+JsonrpcFraming
+jsonrpc_output_stream_get_framing (JsonrpcOutputStream *self)
 {
-  g_return_val_if_fail (JSONRPC_IS_OUTPUT_STREAM (self), FALSE);
-  g_return_val_if_fail (G_IS_TASK (result), FALSE);
+  JsonrpcOutputStreamPrivate *priv = jsonrpc_output_stream_get_instance_private (self);
 
-  return g_task_propagate_boolean (G_TASK (result), error);
+  g_return_val_if_fail (JSONRPC_IS_OUTPUT_STREAM (self), JSONRPC_FRAMING_CONTENT_LENGTH);
+
+  return priv->framing;
 }
 
-static void
-jsonrpc_output_stream_write_message_sync_cb (GObject      *object,
-                                             GAsyncResult *result,
-                                             gpointer      user_data)
+/**
+ * jsonrpc_output_stream_set_framing:
+ * @self: a #JsonrpcOutputStream
+ * @framing: a #JsonrpcFraming
+ *
+ * Sets how messages are delimited on the stream.
+ *
+ * With %JSONRPC_FRAMING_NEWLINE, each message is written as a single line
+ * of compact JSON without any headers. Messages are always encoded as JSON
+ * in that case, regardless of #JsonrpcOutputStream:use-gvariant.
+ *
+ * %JSONRPC_FRAMING_AUTO behaves like %JSONRPC_FRAMING_CONTENT_LENGTH as
+ * there is nothing to detect when writing.
+ *
+ * Since: 3.46
+ */
+void
+jsonrpc_output_stream_set_framing (JsonrpcOutputStream *self,
+                                   JsonrpcFraming       framing)
 {
-  JsonrpcOutputStream *self = (JsonrpcOutputStream *)object;
-  GTask *task = user_data;
-  g_autoptr(GError) error = NULL;
+  JsonrpcOutputStreamPrivate *priv = jsonrpc_output_stream_get_instance_private (self);
 
-  g_assert (JSONRPC_IS_OUTPUT_STREAM (self));
-  g_assert (G_IS_ASYNC_RESULT (result));
-  g_assert (G_IS_TASK (task));
+  g_return_if_fail (JSONRPC_IS_OUTPUT_STREAM (self));
+  g_return_if_fail (framing <= JSONRPC_FRAMING_AUTO);
 
-  if (!jsonrpc_output_stream_write_message_finish (self, result, &error))
-    g_task_return_error (task, g_steal_pointer (&error));
-  else
-    g_task_return_boolean (task, TRUE);
+  priv->framing = framing;
 }
 
 /**
- * jsonrpc_output_stream_write_message:
+ * jsonrpc_output_stream_get_compression:
  * @self: a #JsonrpcOutputStream
- * @message: (transfer none): a #GVariant
- * @cancellable: (nullable): a #GCancellable or %NULL
- * @error: a location for a #GError, or %NULL
  *
- * Synchronously sends a message to the peer.
+ * Gets how message bodies are compressed.
  *
- * This operation will complete once the message has been buffered. There
- * is no guarantee the peer received it.
+ * Returns: a #JsonrpcCompression
  *
- * Since: 3.26
+ * Since: 3.46
+ */
+JsonrpcCompression
+jsonrpc_output_stream_get_compression (JsonrpcOutputStream *self)
+{
+  JsonrpcOutputStreamPrivate *priv = jsonrpc_output_stream_get_instance_private (self);
+
+  g_return_val_if_fail (JSONRPC_IS_OUTPUT_STREAM (self), JSONRPC_COMPRESSION_NONE);
+
+  return priv->compression;
+}
+
+/**
+ * jsonrpc_output_stream_set_compression:
+ * @self: a #JsonrpcOutputStream
+ * @compression: a #JsonrpcCompression
+ *
+ * Sets how message bodies are compressed.
+ *
+ * Only bodies large enough to benefit are compressed, the rest are sent
+ * as is. The peer must be able to decode the "Content-Encoding" header,
+ * which is the case for #JsonrpcInputStream.
+ *
+ * Messages are never compressed with %JSONRPC_FRAMING_NEWLINE.
+ *
+ * Since: 3.46
+ */
+void
+jsonrpc_output_stream_set_compression (JsonrpcOutputStream *self,
+                                       JsonrpcCompression   compression)
+{
+  JsonrpcOutputStreamPrivate *priv = jsonrpc_output_stream_get_instance_private (self);
+
+  g_return_if_fail (JSONRPC_IS_OUTPUT_STREAM (self));
+  g_return_if_fail (compression <= JSONRPC_COMPRESSION_GZIP);
+
+  priv->compression = compression;
+}
+
+/**
+ * jsonrpc_output_stream_get_congested:
+ * @self: a #JsonrpcOutputStream
+ *
+ * Gets the #JsonrpcOutputStream:congested property.
+ *
+ * Returns: %TRUE if more data is waiting to be written than allowed by
+ *   the water marks.
+ *
+ * Since: 3.46
  */
 gboolean
-jsonrpc_output_stream_write_message (JsonrpcOutputStream  *self,
-                                     GVariant             *message,
-                                     GCancellable         *cancellable,
-                                     GError              **error)
+jsonrpc_output_stream_get_congested (JsonrpcOutputStream *self)
 {
-  g_autoptr(GTask) task = NULL;
-  g_autoptr(GMainContext) main_context = NULL;
+  JsonrpcOutputStreamPrivate *priv = jsonrpc_output_stream_get_instance_private (self);
 
   g_return_val_if_fail (JSONRPC_IS_OUTPUT_STREAM (self), FALSE);
-  g_return_val_if_fail (message != NULL, FALSE);
-  g_return_val_if_fail (!cancellable || G_IS_CANCELLABLE (cancellable), FALSE);
 
-  main_context = g_main_context_ref_thread_default ();
+  return priv->congested;
+}
 
-  task = g_task_new (NULL, NULL, NULL, NULL);
-  g_task_set_source_tag (task, jsonrpc_output_stream_write_message);
+/**
+ * jsonrpc_output_stream_get_high_water_mark:
+ * @self: a #JsonrpcOutputStream
+ * @max_bytes: (out) (optional): a location for the limit in bytes
+ * @max_messages: (out) (optional): a location for the limit in messages
+ *
+ * Gets the limits set with jsonrpc_output_stream_set_high_water_mark().
+ *
+ * Since: 3.46
+ */
+void
+jsonrpc_output_stream_get_high_water_mark (JsonrpcOutputStream *self,
+                                           gsize               *max_bytes,
+                                           guint               *max_messages)
+{
+  JsonrpcOutputStreamPrivate *priv = jsonrpc_output_stream_get_instance_private (self);
 
-  jsonrpc_output_stream_write_message_async (self,
-                                             message,
-                                             cancellable,
-                                             jsonrpc_output_stream_write_message_sync_cb,
-                                             task);
+  g_return_if_fail (JSONRPC_IS_OUTPUT_STREAM (self));
 
-  while (!g_task_get_completed (task))
-    g_main_context_iteration (main_context, TRUE);
+  if (max_bytes != NULL)
+    *max_bytes = priv->high_water_bytes;
 
-  return g_task_propagate_boolean (task, error);
+  if (max_messages != NULL)
+    *max_messages = priv->high_water_messages;
 }
 
-gboolean
-jsonrpc_output_stream_get_use_gvariant (JsonrpcOutputStream *self)
+/**
+ * jsonrpc_output_stream_set_high_water_mark:
+ * @self: a #JsonrpcOutputStream
+ * @max_bytes: the number of pending bytes making the stream congested, or 0
+ * @max_messages: the number of pending messages making the stream congested, or 0
+ *
+ * Sets how much data may be waiting to be written before the stream is
+ * considered congested. A limit of 0 disables it.
+ *
+ * Messages are still queued past these limits, it is up to the producers
+ * of messages to throttle themselves using #JsonrpcOutputStream:congested
+ * or jsonrpc_output_stream_wait_writable_async().
+ *
+ * By default, the stream becomes congested once 4 MiB are pending.
+ *
+ * Since: 3.46
+ */
+void
+jsonrpc_output_stream_set_high_water_mark (JsonrpcOutputStream *self,
+                                           gsize                max_bytes,
+                                           guint                max_messages)
 {
   JsonrpcOutputStreamPrivate *priv = jsonrpc_output_stream_get_instance_private (self);
 
-  g_return_val_if_fail (JSONRPC_IS_OUTPUT_STREAM (self), FALSE);
+  g_return_if_fail (JSONRPC_IS_OUTPUT_STREAM (self));
 
-  return priv->use_gvariant;
+  priv->high_water_bytes = max_bytes;
+  priv->high_water_messages = max_messages;
+
+  jsonrpc_output_stream_update_congested (self);
 }
 
+/**
+ * jsonrpc_output_stream_get_low_water_mark:
+ * @self: a #JsonrpcOutputStream
+ * @n_bytes: (out) (optional): a location for the limit in bytes
+ * @n_messages: (out) (optional): a location for the limit in messages
+ *
+ * Gets the limits set with jsonrpc_output_stream_set_low_water_mark().
+ *
+ * Since: 3.46
+ */
 void
-jsonrpc_output_stream_set_use_gvariant (JsonrpcOutputStream *self,
-                                        gboolean             use_gvariant)
+jsonrpc_output_stream_get_low_water_mark (JsonrpcOutputStream *self,
+                                          gsize               *n_bytes,
+                                          guint               *n_messages)
 {
   JsonrpcOutputStreamPrivate *priv = jsonrpc_output_stream_get_instance_private (self);
 
   g_return_if_fail (JSONRPC_IS_OUTPUT_STREAM (self));
 
-  use_gvariant = !!use_gvariant;
+  if (n_bytes != NULL)
+    *n_bytes = priv->low_water_bytes;
 
-  if (priv->use_gvariant != use_gvariant)
+  if (n_messages != NULL)
+    *n_messages = priv->low_water_messages;
+}
+
+/**
+ * jsonrpc_output_stream_set_low_water_mark:
+ * @self: a #JsonrpcOutputStream
+ * @n_bytes: the number of pending bytes to drain to
+ * @n_messages: the number of pending messages to drain to
+ *
+ * Sets how much data may be waiting to be written for a congested stream
+ * to no longer be considered congested.
+ *
+ * The limits are clamped to those of the high water mark while in use, and
+ * are ignored for a limit which has been disabled there. Either way, they
+ * are kept as set for when the high water mark changes.
+ *
+ * By default, the stream is no longer congested once 1 MiB or less is
+ * pending.
+ *
+ * Since: 3.46
+ */
+void
+jsonrpc_output_stream_set_low_water_mark (JsonrpcOutputStream *self,
+                                          gsize                n_bytes,
+                                          guint                n_messages)
+{
+  JsonrpcOutputStreamPrivate *priv = jsonrpc_output_stream_get_instance_private (self);
+
+  g_return_if_fail (JSONRPC_IS_OUTPUT_STREAM (self));
+
+  priv->low_water_bytes = n_bytes;
+  priv->low_water_messages = n_messages;
+
+  jsonrpc_output_stream_update_congested (self);
+}
+
+static gboolean
+jsonrpc_output_stream_wait_writable_cancelled (GCancellable *cancellable,
+                                               gpointer      user_data)
+{
+  GTask *task = user_data;
+  JsonrpcOutputStream *self = g_task_get_source_object (task);
+  JsonrpcOutputStreamPrivate *priv = jsonrpc_output_stream_get_instance_private (self);
+
+  g_assert (G_IS_TASK (task));
+  g_assert (JSONRPC_IS_OUTPUT_STREAM (self));
+
+  if (g_queue_remove (&priv->waiters, task))
     {
-      priv->use_gvariant = use_gvariant;
-      g_object_notify_by_pspec (G_OBJECT (self), properties[PROP_USE_GVARIANT]);
+      g_autoptr(GError) error = NULL;
+
+      error = g_error_new_literal (G_IO_ERROR,
+                                   G_IO_ERROR_CANCELLED,
+                                   "Operation was cancelled");
+
+      jsonrpc_output_stream_complete_waiter (task, error);
+    }
+
+  return G_SOURCE_REMOVE;
+}
+
+/**
+ * jsonrpc_output_stream_wait_writable_async:
+ * @self: a #JsonrpcOutputStream
+ * @cancellable: (nullable): a #GCancellable or %NULL
+ * @callback: a #GAsyncReadyCallback to execute upon completion
+ * @user_data: closure data for @callback
+ *
+ * Asynchronously waits for the stream to no longer be congested, which
+ * completes right away if it is not.
+ *
+ * Call jsonrpc_output_stream_wait_writable_finish() to get the result of
+ * the operation.
+ *
+ * Since: 3.46
+ */
+void
+jsonrpc_output_stream_wait_writable_async (JsonrpcOutputStream *self,
+                                           GCancellable        *cancellable,
+                                           GAsyncReadyCallback  callback,
+                                           gpointer             user_data)
+{
+  JsonrpcOutputStreamPrivate *priv = jsonrpc_output_stream_get_instance_private (self);
+  g_autoptr(GTask) task = NULL;
+
+  g_return_if_fail (JSONRPC_IS_OUTPUT_STREAM (self));
+  g_return_if_fail (!cancellable || G_IS_CANCELLABLE (cancellable));
+
+  task = g_task_new (self, cancellable, callback, user_data);
+  g_task_set_source_tag (task, jsonrpc_output_stream_wait_writable_async);
+
+  if (g_task_return_error_if_cancelled (task))
+    return;
+
+  if (!priv->congested)
+    {
+      g_task_return_boolean (task, TRUE);
+      return;
+    }
+
+  if (cancellable != NULL)
+    {
+      GSource *source = g_cancellable_source_new (cancellable);
+
+      g_task_attach_source (task, source, (GSourceFunc)jsonrpc_output_stream_wait_writable_cancelled);
+      g_task_set_task_data (task, source, destroy_source);
     }
+
+  g_queue_push_tail (&priv->waiters, g_steal_pointer (&task));
+}
+
+/**
+ * jsonrpc_output_stream_wait_writable_finish:
+ * @self: a #JsonrpcOutputStream
+ * @result: a #GAsyncResult
+ * @error: a location for a #GError, or %NULL
+ *
+ * Completes an asynchronous request to
+ * jsonrpc_output_stream_wait_writable_async().
+ *
+ * Returns: %TRUE if the stream is no longer congested; otherwise %FALSE
+ *   and @error is set.
+ *
+ * Since: 3.46
+ */
+gboolean
+jsonrpc_output_stream_wait_writable_finish (JsonrpcOutputStream  *self,
+                                            GAsyncResult         *result,
+                                            GError              **error)
+{
+  g_return_val_if_fail (JSONRPC_IS_OUTPUT_STREAM (self), FALSE);
+  g_return_val_if_fail (G_IS_TASK (result), FALSE);
+
+  return g_task_propagate_boolean (G_TASK (result), error);
+}
+
+/**
+ * jsonrpc_encoded_message_new:
+ * @message: (transfer none): a #GVariant
+ *
+ * Creates a message which can be queued on many #JsonrpcOutputStream with
+ * jsonrpc_output_stream_queue_encoded_async() while only being serialized
+ * once for each encoding used by those streams.
+ *
+ * If @message is floating, the floating reference is consumed.
+ *
+ * Returns: (transfer full): a new #JsonrpcEncodedMessage
+ *
+ * Since: 3.46
+ */
+JsonrpcEncodedMessage *
+jsonrpc_encoded_message_new (GVariant *message)
+{
+  JsonrpcEncodedMessage *self;
+
+  g_return_val_if_fail (message != NULL, NULL);
+
+  self = g_slice_new0 (JsonrpcEncodedMessage);
+  g_atomic_ref_count_init (&self->ref_count);
+  g_mutex_init (&self->mutex);
+  self->message = g_variant_ref_sink (message);
+
+  return self;
+}
+
+/**
+ * jsonrpc_encoded_message_ref:
+ * @self: a #JsonrpcEncodedMessage
+ *
+ * Increments the reference count of @self.
+ *
+ * Returns: (transfer full): @self
+ *
+ * Since: 3.46
+ */
+JsonrpcEncodedMessage *
+jsonrpc_encoded_message_ref (JsonrpcEncodedMessage *self)
+{
+  g_return_val_if_fail (self != NULL, NULL);
+
+  g_atomic_ref_count_inc (&self->ref_count);
+
+  return self;
+}
+
+/**
+ * jsonrpc_encoded_message_unref:
+ * @self: (transfer full): a #JsonrpcEncodedMessage
+ *
+ * Decrements the reference count of @self, freeing it once it reaches
+ * zero. Streams the message is queued on keep their own reference to the
+ * serialized data.
+ *
+ * Since: 3.46
+ */
+void
+jsonrpc_encoded_message_unref (JsonrpcEncodedMessage *self)
+{
+  g_return_if_fail (self != NULL);
+
+  if (!g_atomic_ref_count_dec (&self->ref_count))
+    return;
+
+  for (guint i = 0; i < N_ENCODINGS; i++)
+    {
+      g_clear_pointer (&self->encodings[i].headers, g_bytes_unref);
+      g_clear_pointer (&self->encodings[i].body, g_bytes_unref);
+    }
+
+  g_clear_pointer (&self->message, g_variant_unref);
+  g_mutex_clear (&self->mutex);
+  g_slice_free (JsonrpcEncodedMessage, self);
+}
+
+/**
+ * jsonrpc_encoded_message_get_message:
+ * @self: a #JsonrpcEncodedMessage
+ *
+ * Gets the message which is encoded.
+ *
+ * Returns: (transfer none): a #GVariant
+ *
+ * Since: 3.46
+ */
+GVariant *
+jsonrpc_encoded_message_get_message (JsonrpcEncodedMessage *self)
+{
+  g_return_val_if_fail (self != NULL, NULL);
+
+  return self->message;
 }
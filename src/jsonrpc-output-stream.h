@@ -22,11 +22,49 @@
 #include <gio/gio.h>
 #include <json-glib/json-glib.h>
 
+#include "jsonrpc-compression.h"
+#include "jsonrpc-framing.h"
 #include "jsonrpc-version-macros.h"
 
 G_BEGIN_DECLS
 
-#define JSONRPC_TYPE_OUTPUT_STREAM (jsonrpc_output_stream_get_type())
+/**
+ * JsonrpcWritePriority:
+ * @JSONRPC_WRITE_PRIORITY_CONTROL: messages controlling the connection
+ *   itself, such as the cancellation of a call, which are written before
+ *   anything else.
+ * @JSONRPC_WRITE_PRIORITY_REPLY: replies to calls from the peer, which the
+ *   peer is likely to be waiting on.
+ * @JSONRPC_WRITE_PRIORITY_NORMAL: calls and notifications. This is the
+ *   priority used by jsonrpc_output_stream_write_message_async().
+ * @JSONRPC_WRITE_PRIORITY_LOW: messages which may be delayed in favor of
+ *   everything else, such as progress notifications.
+ *
+ * The order in which queued messages are written to the peer. Messages of
+ * the same priority are written in the order they were queued.
+ *
+ * Since: 3.46
+ */
+typedef enum
+{
+  JSONRPC_WRITE_PRIORITY_CONTROL = 0,
+  JSONRPC_WRITE_PRIORITY_REPLY   = 1,
+  JSONRPC_WRITE_PRIORITY_NORMAL  = 2,
+  JSONRPC_WRITE_PRIORITY_LOW     = 3,
+} JsonrpcWritePriority;
+
+/**
+ * JsonrpcEncodedMessage:
+ *
+ * A message which may be sent to many peers, while only being serialized
+ * once for every encoding in use.
+ *
+ * Since: 3.46
+ */
+typedef struct _JsonrpcEncodedMessage JsonrpcEncodedMessage;
+
+#define JSONRPC_TYPE_OUTPUT_STREAM   (jsonrpc_output_stream_get_type())
+#define JSONRPC_TYPE_ENCODED_MESSAGE (jsonrpc_encoded_message_get_type())
 
 JSONRPC_AVAILABLE_IN_3_26
 G_DECLARE_DERIVABLE_TYPE (JsonrpcOutputStream, jsonrpc_output_stream, JSONRPC, OUTPUT_STREAM, GDataOutputStream)
@@ -56,6 +94,47 @@ gboolean             jsonrpc_output_stream_get_use_gvariant     (JsonrpcOutputSt
 JSONRPC_AVAILABLE_IN_3_26
 void                 jsonrpc_output_stream_set_use_gvariant     (JsonrpcOutputStream  *self,
                                                                  gboolean              use_gvariant);
+JSONRPC_AVAILABLE_IN_3_46
+JsonrpcFraming       jsonrpc_output_stream_get_framing          (JsonrpcOutputStream  *self);
+JSONRPC_AVAILABLE_IN_3_46
+void                 jsonrpc_output_stream_set_framing          (JsonrpcOutputStream  *self,
+                                                                 JsonrpcFraming        framing);
+JSONRPC_AVAILABLE_IN_3_46
+JsonrpcCompression   jsonrpc_output_stream_get_compression      (JsonrpcOutputStream  *self);
+JSONRPC_AVAILABLE_IN_3_46
+void                 jsonrpc_output_stream_set_compression      (JsonrpcOutputStream  *self,
+                                                                 JsonrpcCompression    compression);
+JSONRPC_AVAILABLE_IN_3_46
+gboolean             jsonrpc_output_stream_get_congested        (JsonrpcOutputStream  *self);
+JSONRPC_AVAILABLE_IN_3_46
+void                 jsonrpc_output_stream_get_high_water_mark  (JsonrpcOutputStream  *self,
+                                                                 gsize                *max_bytes,
+                                                                 guint                *max_messages);
+JSONRPC_AVAILABLE_IN_3_46
+void                 jsonrpc_output_stream_set_high_water_mark  (JsonrpcOutputStream  *self,
+                                                                 gsize                 max_bytes,
+                                                                 guint                 max_messages);
+JSONRPC_AVAILABLE_IN_3_46
+void                 jsonrpc_output_stream_get_low_water_mark   (JsonrpcOutputStream  *self,
+                                                                 gsize                *n_bytes,
+                                                                 guint                *n_messages);
+JSONRPC_AVAILABLE_IN_3_46
+void                 jsonrpc_output_stream_set_low_water_mark   (JsonrpcOutputStream  *self,
+                                                                 gsize                 n_bytes,
+                                                                 guint                 n_messages);
+JSONRPC_AVAILABLE_IN_3_46
+void                 jsonrpc_output_stream_wait_writable_async  (JsonrpcOutputStream  *self,
+                                                                 GCancellable         *cancellable,
+                                                                 GAsyncReadyCallback   callback,
+                                                                 gpointer              user_data);
+JSONRPC_AVAILABLE_IN_3_46
+gboolean             jsonrpc_output_stream_wait_writable_finish (JsonrpcOutputStream  *self,
+                                                                 GAsyncResult         *result,
+                                                                 GError              **error);
+JSONRPC_AVAILABLE_IN_3_46
+void                 jsonrpc_output_stream_cork                 (JsonrpcOutputStream  *self);
+JSONRPC_AVAILABLE_IN_3_46
+void                 jsonrpc_output_stream_uncork               (JsonrpcOutputStream  *self);
 JSONRPC_AVAILABLE_IN_3_26
 gboolean             jsonrpc_output_stream_write_message        (JsonrpcOutputStream  *self,
                                                                  GVariant             *message,
@@ -67,11 +146,93 @@ void                 jsonrpc_output_stream_write_message_async  (JsonrpcOutputSt
                                                                  GCancellable         *cancellable,
                                                                  GAsyncReadyCallback   callback,
                                                                  gpointer              user_data);
+JSONRPC_AVAILABLE_IN_3_46
+void                 jsonrpc_output_stream_queue_message_async  (JsonrpcOutputStream  *self,
+                                                                 GVariant             *message,
+                                                                 JsonrpcWritePriority  priority,
+                                                                 const gchar          *coalesce_key,
+                                                                 GCancellable         *cancellable,
+                                                                 GAsyncReadyCallback   callback,
+                                                                 gpointer              user_data);
+JSONRPC_AVAILABLE_IN_3_46
+void                 jsonrpc_output_stream_queue_encoded_async  (JsonrpcOutputStream   *self,
+                                                                 JsonrpcEncodedMessage *encoded,
+                                                                 JsonrpcWritePriority   priority,
+                                                                 GCancellable          *cancellable,
+                                                                 GAsyncReadyCallback    callback,
+                                                                 gpointer               user_data);
 JSONRPC_AVAILABLE_IN_3_26
 gboolean             jsonrpc_output_stream_write_message_finish (JsonrpcOutputStream  *self,
                                                                  GAsyncResult         *result,
                                                                  GError              **error);
 
+JSONRPC_AVAILABLE_IN_3_46
+GType                  jsonrpc_encoded_message_get_type    (void) G_GNUC_CONST;
+JSONRPC_AVAILABLE_IN_3_46
+JsonrpcEncodedMessage *jsonrpc_encoded_message_new         (GVariant              *message);
+JSONRPC_AVAILABLE_IN_3_46
+JsonrpcEncodedMessage *jsonrpc_encoded_message_ref         (JsonrpcEncodedMessage *self);
+JSONRPC_AVAILABLE_IN_3_46
+void                   jsonrpc_encoded_message_unref       (JsonrpcEncodedMessage *self);
+JSONRPC_AVAILABLE_IN_3_46
+GVariant              *jsonrpc_encoded_message_get_message (JsonrpcEncodedMessage *self);
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC (JsonrpcEncodedMessage, jsonrpc_encoded_message_unref)
+
+/**
+ * JsonrpcOutputStreamCorker:
+ *
+ * Opaque type used with g_autoptr() to keep a #JsonrpcOutputStream corked
+ * until the end of a scope.
+ *
+ * |[<!-- language="C" -->
+ * {
+ *   g_autoptr(JsonrpcOutputStreamCorker) corker = jsonrpc_output_stream_corker_new (stream);
+ *
+ *   jsonrpc_output_stream_write_message_async (stream, reply, NULL, NULL, NULL);
+ *   jsonrpc_output_stream_write_message_async (stream, notification, NULL, NULL, NULL);
+ * }
+ * ]|
+ *
+ * Since: 3.46
+ */
+typedef void JsonrpcOutputStreamCorker;
+
+/**
+ * jsonrpc_output_stream_corker_new:
+ * @self: a #JsonrpcOutputStream
+ *
+ * Corks @self with jsonrpc_output_stream_cork() until the returned value
+ * is freed with jsonrpc_output_stream_corker_free().
+ *
+ * Returns: a #JsonrpcOutputStreamCorker
+ *
+ * Since: 3.46
+ */
+static inline JsonrpcOutputStreamCorker *
+jsonrpc_output_stream_corker_new (JsonrpcOutputStream *self)
+{
+  jsonrpc_output_stream_cork (self);
+  return (JsonrpcOutputStreamCorker *)g_object_ref (self);
+}
+
+/**
+ * jsonrpc_output_stream_corker_free:
+ * @corker: a #JsonrpcOutputStreamCorker
+ *
+ * Uncorks the stream corked by jsonrpc_output_stream_corker_new().
+ *
+ * Since: 3.46
+ */
+static inline void
+jsonrpc_output_stream_corker_free (JsonrpcOutputStreamCorker *corker)
+{
+  jsonrpc_output_stream_uncork ((JsonrpcOutputStream *)corker);
+  g_object_unref (corker);
+}
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC (JsonrpcOutputStreamCorker, jsonrpc_output_stream_corker_free)
+
 G_END_DECLS
 
 #endif /* JSONRPC_OUTPUT_STREAM_H */
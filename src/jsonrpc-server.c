@@ -22,6 +22,7 @@
 
 #include <stdlib.h>
 
+#include "jsonrpc-client-private.h"
 #include "jsonrpc-input-stream.h"
 #include "jsonrpc-marshalers.h"
 #include "jsonrpc-output-stream.h"
@@ -39,9 +40,10 @@
 
 typedef struct
 {
-  GHashTable *clients;
-  GArray     *handlers;
-  guint       last_handler_id;
+  GHashTable     *clients;
+  GArray         *handlers;
+  guint           last_handler_id;
+  JsonrpcFraming  framing;
 } JsonrpcServerPrivate;
 
 typedef struct
@@ -344,6 +346,9 @@ jsonrpc_server_accept_io_stream (JsonrpcServer *self,
 
   client = jsonrpc_client_new (io_stream);
 
+  if (priv->framing != JSONRPC_FRAMING_CONTENT_LENGTH)
+    jsonrpc_client_set_framing (client, priv->framing);
+
   g_signal_connect_object (client,
                            "failed",
                            G_CALLBACK (jsonrpc_server_client_failed),
@@ -481,3 +486,110 @@ jsonrpc_server_foreach (JsonrpcServer *self,
       foreach_func (client, user_data);
     }
 }
+
+/**
+ * jsonrpc_server_broadcast:
+ * @self: A #JsonrpcServer
+ * @method: The name of the method to call
+ * @params: (transfer none) (nullable): A [struct@GLib.Variant] of parameters or %NULL
+ * @filter: (scope call) (nullable): A [callback@ServerFilter] or %NULL
+ * @filter_data: Closure data for @filter
+ *
+ * Sends a notification to every connected client, or to those for which
+ * @filter returns %TRUE.
+ *
+ * Unlike calling [method@Client.send_notification_async] for each client,
+ * the notification is serialized only once for every encoding in use by
+ * the clients, and the serialized data is shared between them.
+ *
+ * This does not wait for the notification to be written, and clients
+ * which fail to write it are disconnected as usual.
+ *
+ * If @params is floating then the reference is consumed.
+ *
+ * Since: 3.46
+ */
+void
+jsonrpc_server_broadcast (JsonrpcServer       *self,
+                          const gchar         *method,
+                          GVariant            *params,
+                          JsonrpcServerFilter  filter,
+                          gpointer             filter_data)
+{
+  JsonrpcServerPrivate *priv = jsonrpc_server_get_instance_private (self);
+  g_autoptr(JsonrpcEncodedMessage) encoded = NULL;
+  g_autofree gpointer *keys = NULL;
+  GVariantDict dict;
+  guint len;
+
+  g_return_if_fail (JSONRPC_IS_SERVER (self));
+  g_return_if_fail (method != NULL);
+
+  if (params == NULL)
+    params = g_variant_new_maybe (G_VARIANT_TYPE_VARIANT, NULL);
+
+  g_variant_dict_init (&dict, NULL);
+  g_variant_dict_insert (&dict, "jsonrpc", "s", "2.0");
+  g_variant_dict_insert (&dict, "method", "s", method);
+  g_variant_dict_insert_value (&dict, "params", params);
+
+  encoded = jsonrpc_encoded_message_new (g_variant_dict_end (&dict));
+
+  keys = g_hash_table_get_keys_as_array (priv->clients, &len);
+
+  for (guint i = 0; i < len; i++)
+    {
+      JsonrpcClient *client = keys[i];
+
+      g_assert (JSONRPC_IS_CLIENT (client));
+
+      if (filter == NULL || filter (self, client, filter_data))
+        _jsonrpc_client_send_encoded (client, encoded);
+    }
+}
+
+/**
+ * jsonrpc_server_get_framing:
+ * @self: A #JsonrpcServer
+ *
+ * Gets how messages are delimited for the clients accepted by @self.
+ *
+ * Returns: a [enum@Framing]
+ *
+ * Since: 3.46
+ */
+JsonrpcFraming
+jsonrpc_server_get_framing (JsonrpcServer *self)
+{
+  JsonrpcServerPrivate *priv = jsonrpc_server_get_instance_private (self);
+
+  g_return_val_if_fail (JSONRPC_IS_SERVER (self), JSONRPC_FRAMING_CONTENT_LENGTH);
+
+  return priv->framing;
+}
+
+/**
+ * jsonrpc_server_set_framing:
+ * @self: A #JsonrpcServer
+ * @framing: a [enum@Framing]
+ *
+ * Sets how messages are delimited for the clients accepted by @self
+ * from now on, see [method@Client.set_framing].
+ *
+ * The default is %JSONRPC_FRAMING_CONTENT_LENGTH. Use
+ * %JSONRPC_FRAMING_AUTO to accept peers using either framing, which
+ * requires every peer to send a message before it is sent any.
+ *
+ * Since: 3.46
+ */
+void
+jsonrpc_server_set_framing (JsonrpcServer  *self,
+                            JsonrpcFraming  framing)
+{
+  JsonrpcServerPrivate *priv = jsonrpc_server_get_instance_private (self);
+
+  g_return_if_fail (JSONRPC_IS_SERVER (self));
+  g_return_if_fail (framing <= JSONRPC_FRAMING_AUTO);
+
+  priv->framing = framing;
+}
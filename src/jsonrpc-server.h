@@ -65,6 +65,22 @@ typedef void (*JsonrpcServerHandler) (JsonrpcServer *self,
                                       GVariant      *params,
                                       gpointer       user_data);
 
+/**
+ * JsonrpcServerFilter:
+ * @self: a #JsonrpcServer
+ * @client: a #JsonrpcClient
+ * @user_data: closure data
+ *
+ * Decides if a message should be sent to @client.
+ *
+ * Returns: %TRUE to include @client
+ *
+ * Since: 3.46
+ */
+typedef gboolean (*JsonrpcServerFilter) (JsonrpcServer *self,
+                                         JsonrpcClient *client,
+                                         gpointer       user_data);
+
 JSONRPC_AVAILABLE_IN_3_26
 JsonrpcServer *jsonrpc_server_new              (void);
 JSONRPC_AVAILABLE_IN_3_26
@@ -83,6 +99,17 @@ JSONRPC_AVAILABLE_IN_3_28
 void           jsonrpc_server_foreach          (JsonrpcServer        *self,
                                                 GFunc                 foreach_func,
                                                 gpointer              user_data);
+JSONRPC_AVAILABLE_IN_3_46
+void           jsonrpc_server_broadcast        (JsonrpcServer        *self,
+                                                const gchar          *method,
+                                                GVariant             *params,
+                                                JsonrpcServerFilter   filter,
+                                                gpointer              filter_data);
+JSONRPC_AVAILABLE_IN_3_46
+JsonrpcFraming jsonrpc_server_get_framing      (JsonrpcServer        *self);
+JSONRPC_AVAILABLE_IN_3_46
+void           jsonrpc_server_set_framing      (JsonrpcServer        *self,
+                                                JsonrpcFraming        framing);
 
 G_END_DECLS
 
@@ -45,6 +45,7 @@
 #define JSONRPC_VERSION_3_30 (G_ENCODE_VERSION (3, 30))
 #define JSONRPC_VERSION_3_40 (G_ENCODE_VERSION (3, 40))
 #define JSONRPC_VERSION_3_44 (G_ENCODE_VERSION (3, 44))
+#define JSONRPC_VERSION_3_46 (G_ENCODE_VERSION (3, 46))
 
 #if (JSONRPC_MINOR_VERSION == 99)
 # define JSONRPC_VERSION_CUR_STABLE (G_ENCODE_VERSION (JSONRPC_MAJOR_VERSION + 1, 0))
@@ -185,4 +186,18 @@
 # define JSONRPC_AVAILABLE_IN_3_44                 _JSONRPC_EXTERN
 #endif
 
+#if JSONRPC_VERSION_MIN_REQUIRED >= JSONRPC_VERSION_3_46
+# define JSONRPC_DEPRECATED_IN_3_46                JSONRPC_DEPRECATED
+# define JSONRPC_DEPRECATED_IN_3_46_FOR(f)         JSONRPC_DEPRECATED_FOR(f)
+#else
+# define JSONRPC_DEPRECATED_IN_3_46                _JSONRPC_EXTERN
+# define JSONRPC_DEPRECATED_IN_3_46_FOR(f)         _JSONRPC_EXTERN
+#endif
+
+#if JSONRPC_VERSION_MAX_ALLOWED < JSONRPC_VERSION_3_46
+# define JSONRPC_AVAILABLE_IN_3_46                 JSONRPC_UNAVAILABLE(3, 46)
+#else
+# define JSONRPC_AVAILABLE_IN_3_46                 _JSONRPC_EXTERN
+#endif
+
 #endif /* JSONRPC_VERSION_MACROS_H */
@@ -0,0 +1,120 @@
+/* bench-input-stream.c
+ *
+ * Copyright (C) 2026 Christian Hergert <chergert@redhat.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Compares decoding large messages with JsonrpcInputStream against
+ * json_gvariant_deserialize_data(). Run with JSONRPC_DISABLE_SIMD=1 to
+ * measure the portable structural indexing kernel.
+ */
+
+#include <gio/gio.h>
+#include <json-glib/json-glib.h>
+#include <jsonrpc-glib.h>
+#include <string.h>
+
+#define N_ITERATIONS 10
+
+static gchar *
+create_symbols (guint n_symbols)
+{
+  GString *str = g_string_new ("{\"jsonrpc\":\"2.0\",\"id\":1,\"result\":[");
+
+  for (guint i = 0; i < n_symbols; i++)
+    g_string_append_printf (str,
+                            "%s{\"name\":\"symbol_%u\",\"kind\":%u,"
+                            "\"containerName\":\"Namespace\\\\Class%u\","
+                            "\"location\":{\"uri\":\"file:///home/user/src/project/file%u.c\","
+                            "\"range\":{\"start\":{\"line\":%u,\"character\":%u},"
+                            "\"end\":{\"line\":%u,\"character\":%u}}}}",
+                            i ? "," : "", i, i % 26, i % 100, i % 500,
+                            i, i % 80, i + 1, (i + 7) % 80);
+
+  g_string_append (str, "]}");
+
+  return g_string_free (str, FALSE);
+}
+
+static gchar *
+create_semantic_tokens (guint n_tokens)
+{
+  GString *str = g_string_new ("{\"jsonrpc\":\"2.0\",\"id\":2,\"result\":{\"data\":[");
+
+  for (guint i = 0; i < n_tokens; i++)
+    g_string_append_printf (str, "%s%u,%u,%u,%u,%u",
+                            i ? "," : "", i % 3, i % 40, i % 17, i % 23, i % 2);
+
+  g_string_append (str, "]}}");
+
+  return g_string_free (str, FALSE);
+}
+
+static void
+bench (const gchar *name,
+       const gchar *body)
+{
+  gsize len = strlen (body);
+  g_autofree gchar *frame = g_strdup_printf ("Content-Length: %"G_GSIZE_FORMAT"\r\n\r\n%s", len, body);
+  gsize frame_len = strlen (frame);
+  gint64 begin;
+  gint64 json_glib_usec;
+  gint64 stream_usec;
+
+  begin = g_get_monotonic_time ();
+  for (guint i = 0; i < N_ITERATIONS; i++)
+    {
+      g_autoptr(GError) error = NULL;
+      g_autoptr(GVariant) message = json_gvariant_deserialize_data (body, len, NULL, &error);
+
+      g_assert_no_error (error);
+      g_assert_nonnull (message);
+    }
+  json_glib_usec = g_get_monotonic_time () - begin;
+
+  begin = g_get_monotonic_time ();
+  for (guint i = 0; i < N_ITERATIONS; i++)
+    {
+      g_autoptr(GInputStream) base = g_memory_input_stream_new_from_data (frame, frame_len, NULL);
+      g_autoptr(JsonrpcInputStream) stream = jsonrpc_input_stream_new (base);
+      g_autoptr(GVariant) message = NULL;
+      g_autoptr(GError) error = NULL;
+
+      jsonrpc_input_stream_read_message (stream, NULL, &message, &error);
+      g_assert_no_error (error);
+      g_assert_nonnull (message);
+    }
+  stream_usec = g_get_monotonic_time () - begin;
+
+  g_print ("%-16s %6.2lf MiB  json-glib: %8.2lf MiB/s  input-stream: %8.2lf MiB/s\n",
+           name,
+           len / (1024.0 * 1024.0),
+           (len * N_ITERATIONS / (1024.0 * 1024.0)) / (json_glib_usec / (gdouble)G_USEC_PER_SEC),
+           (len * N_ITERATIONS / (1024.0 * 1024.0)) / (stream_usec / (gdouble)G_USEC_PER_SEC));
+}
+
+gint
+main (gint argc,
+      gchar *argv[])
+{
+  g_autofree gchar *symbols = create_symbols (25000);
+  g_autofree gchar *tokens = create_semantic_tokens (200000);
+
+  bench ("symbols", symbols);
+  bench ("semantic-tokens", tokens);
+
+  return 0;
+}
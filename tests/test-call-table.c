@@ -0,0 +1,251 @@
+/* test-call-table.c
+ *
+ * Copyright (C) 2026 Christian Hergert <chergert@redhat.com>
+ *
+ * This file is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation; either version 2.1 of the License, or (at your option)
+ * any later version.
+ *
+ * This file is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "jsonrpc-call-table-private.h"
+
+#define SECOND G_USEC_PER_SEC
+
+/* A whole second in the future, so deadlines fall on a tick of the wheel */
+static gint64
+get_next_second (void)
+{
+  return (g_get_monotonic_time () / SECOND + 1) * SECOND;
+}
+
+static GTask *
+create_task (void)
+{
+  return g_task_new (NULL, NULL, NULL, NULL);
+}
+
+static void
+complete_task (GTask *task)
+{
+  g_assert_nonnull (task);
+
+  g_task_return_boolean (task, TRUE);
+  g_object_unref (task);
+}
+
+static void
+test_skip_busy_slot (void)
+{
+  g_auto(JsonrpcCallTable) table;
+  g_autoptr(GTask) slow = create_task ();
+  gint64 slow_id;
+  gint64 id;
+
+  _jsonrpc_call_table_init (&table);
+
+  slow_id = _jsonrpc_call_table_add (&table, slow, 0);
+  g_assert_cmpint (slow_id, ==, 1);
+
+  /* Go around the slots once while the first call is still pending */
+  for (guint i = 1; i < table.n_slots; i++)
+    {
+      g_autoptr(GTask) task = create_task ();
+
+      id = _jsonrpc_call_table_add (&table, task, 0);
+      g_assert_cmpint (id, ==, i + 1);
+      complete_task (_jsonrpc_call_table_remove (&table, id));
+    }
+
+  /* The next id maps to the slot of the first call, so it is skipped */
+  {
+    g_autoptr(GTask) task = create_task ();
+
+    id = _jsonrpc_call_table_add (&table, task, 0);
+    g_assert_cmpint (id, ==, table.n_slots + 2);
+    g_assert_null (_jsonrpc_call_table_lookup (&table, table.n_slots + 1));
+    g_assert_true (_jsonrpc_call_table_lookup (&table, id) == task);
+    g_assert_true (_jsonrpc_call_table_lookup (&table, slow_id) == slow);
+
+    complete_task (_jsonrpc_call_table_remove (&table, id));
+    complete_task (_jsonrpc_call_table_remove (&table, slow_id));
+  }
+
+  g_assert_cmpint (table.n_calls, ==, 0);
+}
+
+static void
+test_grow (void)
+{
+  g_auto(JsonrpcCallTable) table;
+  g_autoptr(GPtrArray) tasks = g_ptr_array_new_with_free_func (g_object_unref);
+  gsize n_slots;
+
+  _jsonrpc_call_table_init (&table);
+
+  /* Fill three quarters of the initial slots */
+  do
+    {
+      GTask *task = create_task ();
+
+      g_ptr_array_add (tasks, task);
+      g_assert_cmpint (_jsonrpc_call_table_add (&table, task, 0), ==, tasks->len);
+    }
+  while ((table.n_calls + 1) * 4 <= table.n_slots * 3);
+
+  n_slots = table.n_slots;
+  g_assert_cmpint (n_slots, >, 0);
+
+  /* One more call grows the table, keeping every call */
+  {
+    GTask *task = create_task ();
+
+    g_ptr_array_add (tasks, task);
+    g_assert_cmpint (_jsonrpc_call_table_add (&table, task, 0), ==, tasks->len);
+  }
+
+  g_assert_cmpint (table.n_slots, ==, n_slots * 2);
+  g_assert_cmpint (table.n_calls, ==, tasks->len);
+
+  for (guint i = 0; i < tasks->len; i++)
+    {
+      g_assert_true (_jsonrpc_call_table_lookup (&table, i + 1) == g_ptr_array_index (tasks, i));
+      complete_task (_jsonrpc_call_table_remove (&table, i + 1));
+    }
+
+  g_assert_cmpint (table.n_calls, ==, 0);
+}
+
+static void
+test_steal_all (void)
+{
+  g_auto(JsonrpcCallTable) table;
+  g_autoptr(GPtrArray) stolen = NULL;
+  g_autoptr(GTask) task = create_task ();
+
+  _jsonrpc_call_table_init (&table);
+
+  for (guint i = 0; i < 3; i++)
+    {
+      g_autoptr(GTask) pending = create_task ();
+
+      g_assert_cmpint (_jsonrpc_call_table_add (&table, pending, g_get_monotonic_time () + SECOND), ==, i + 1);
+    }
+
+  stolen = _jsonrpc_call_table_steal_all (&table);
+  g_assert_cmpint (stolen->len, ==, 3);
+  for (guint i = 0; i < stolen->len; i++)
+    g_task_return_boolean (g_ptr_array_index (stolen, i), TRUE);
+
+  g_assert_cmpint (table.n_calls, ==, 0);
+  g_assert_cmpint (_jsonrpc_call_table_get_next_expiration (&table), ==, -1);
+
+  /* Ids keep increasing so that late replies are not mistaken for new calls */
+  g_assert_cmpint (_jsonrpc_call_table_add (&table, task, 0), ==, 4);
+  g_assert_null (_jsonrpc_call_table_lookup (&table, 1));
+
+  /* Calls dropped along with the connection are not stale */
+  g_assert_false (_jsonrpc_call_table_is_stale (&table, 1));
+
+  complete_task (_jsonrpc_call_table_remove (&table, 4));
+}
+
+static void
+test_long_deadline (void)
+{
+  g_auto(JsonrpcCallTable) table;
+  g_autoptr(GPtrArray) expired = NULL;
+  g_autoptr(GTask) task = create_task ();
+  gint64 now = get_next_second ();
+  gint64 deadline = now + 10 * SECOND;
+  gint64 id;
+
+  _jsonrpc_call_table_init (&table);
+
+  /* Well beyond a single turn of the wheel */
+  id = _jsonrpc_call_table_add (&table, task, deadline);
+
+  for (gint64 t = now; t < deadline; t += SECOND / 2)
+    {
+      gint64 next = _jsonrpc_call_table_get_next_expiration (&table);
+
+      g_assert_cmpint (next, >, 0);
+      g_assert_cmpint (next, <=, deadline + SECOND);
+
+      expired = _jsonrpc_call_table_steal_expired (&table, t);
+      g_assert_null (expired);
+      g_assert_true (_jsonrpc_call_table_lookup (&table, id) == task);
+    }
+
+  expired = _jsonrpc_call_table_steal_expired (&table, deadline);
+  g_assert_nonnull (expired);
+  g_assert_cmpint (expired->len, ==, 1);
+  g_assert_true (g_ptr_array_index (expired, 0) == task);
+  g_task_return_boolean (task, TRUE);
+
+  g_assert_null (_jsonrpc_call_table_lookup (&table, id));
+  g_assert_cmpint (_jsonrpc_call_table_get_next_expiration (&table), ==, -1);
+}
+
+static void
+test_stale (void)
+{
+  g_auto(JsonrpcCallTable) table;
+  g_autoptr(GPtrArray) expired = NULL;
+  g_autoptr(GTask) completed = create_task ();
+  g_autoptr(GTask) timed_out = create_task ();
+  g_autoptr(GTask) cancelled = create_task ();
+  gint64 now = get_next_second ();
+  gint64 completed_id;
+  gint64 timed_out_id;
+  gint64 cancelled_id;
+
+  _jsonrpc_call_table_init (&table);
+
+  completed_id = _jsonrpc_call_table_add (&table, completed, 0);
+  timed_out_id = _jsonrpc_call_table_add (&table, timed_out, now + SECOND);
+  cancelled_id = _jsonrpc_call_table_add (&table, cancelled, 0);
+
+  /* A reply to a call which completed already is not expected */
+  complete_task (_jsonrpc_call_table_remove (&table, completed_id));
+  g_assert_false (_jsonrpc_call_table_is_stale (&table, completed_id));
+
+  expired = _jsonrpc_call_table_steal_expired (&table, now + SECOND);
+  g_assert_nonnull (expired);
+  g_assert_cmpint (expired->len, ==, 1);
+  g_task_return_boolean (timed_out, TRUE);
+
+  complete_task (_jsonrpc_call_table_remove (&table, cancelled_id));
+  _jsonrpc_call_table_mark_stale (&table, cancelled_id);
+
+  /* Each of them may be replied to once */
+  g_assert_true (_jsonrpc_call_table_is_stale (&table, timed_out_id));
+  g_assert_false (_jsonrpc_call_table_is_stale (&table, timed_out_id));
+  g_assert_true (_jsonrpc_call_table_is_stale (&table, cancelled_id));
+  g_assert_false (_jsonrpc_call_table_is_stale (&table, cancelled_id));
+
+  /* Ids which were never handed out */
+  g_assert_false (_jsonrpc_call_table_is_stale (&table, 0));
+  g_assert_false (_jsonrpc_call_table_is_stale (&table, 100));
+}
+
+gint
+main (gint argc,
+      gchar *argv[])
+{
+  g_test_init (&argc, &argv, NULL);
+  g_test_add_func ("/Jsonrpc/CallTable/skip_busy_slot", test_skip_busy_slot);
+  g_test_add_func ("/Jsonrpc/CallTable/grow", test_grow);
+  g_test_add_func ("/Jsonrpc/CallTable/steal_all", test_steal_all);
+  g_test_add_func ("/Jsonrpc/CallTable/long_deadline", test_long_deadline);
+  g_test_add_func ("/Jsonrpc/CallTable/stale", test_stale);
+  return g_test_run ();
+}
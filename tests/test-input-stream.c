@@ -0,0 +1,661 @@
+/* test-input-stream.c
+ *
+ * Copyright (C) 2026 Christian Hergert <chergert@redhat.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <gio/gio.h>
+#include <json-glib/json-glib.h>
+#include <jsonrpc-glib.h>
+#include <string.h>
+
+static JsonrpcInputStream *
+create_stream (const gchar * const *bodies)
+{
+  g_autoptr(GInputStream) base = NULL;
+  GString *str = g_string_new (NULL);
+
+  for (guint i = 0; bodies[i]; i++)
+    g_string_append_printf (str,
+                            "Content-Length: %u\r\n\r\n%s",
+                            (guint)strlen (bodies[i]),
+                            bodies[i]);
+
+  base = g_memory_input_stream_new_from_data (g_string_free (str, FALSE), -1, g_free);
+
+  return jsonrpc_input_stream_new (base);
+}
+
+static void
+read_messages_cb (GObject      *object,
+                  GAsyncResult *result,
+                  gpointer      user_data)
+{
+  GAsyncResult **ret = user_data;
+
+  *ret = g_object_ref (result);
+}
+
+static GPtrArray *
+read_messages (JsonrpcInputStream  *stream,
+               GError             **error)
+{
+  g_autoptr(GAsyncResult) result = NULL;
+
+  jsonrpc_input_stream_read_messages_async (stream, NULL, read_messages_cb, &result);
+
+  while (result == NULL)
+    g_main_context_iteration (NULL, TRUE);
+
+  return jsonrpc_input_stream_read_messages_finish (stream, result, error);
+}
+
+static void
+test_read_messages (void)
+{
+  static const gchar *bodies[] = {
+    "{\"jsonrpc\":\"2.0\",\"method\":\"a\",\"params\":1}",
+    "{\"jsonrpc\":\"2.0\",\"method\":\"b\",\"params\":2}",
+    "{\"jsonrpc\":\"2.0\",\"method\":\"c\",\"params\":3}",
+    NULL
+  };
+  g_autoptr(JsonrpcInputStream) stream = create_stream (bodies);
+  g_autoptr(GPtrArray) messages = NULL;
+  g_autoptr(GError) error = NULL;
+  guint n_read = 0;
+
+  /* The buffer may not contain everything at once, keep going until EOF */
+  while (n_read < G_N_ELEMENTS (bodies) - 1)
+    {
+      g_clear_pointer (&messages, g_ptr_array_unref);
+      messages = read_messages (stream, &error);
+      g_assert_no_error (error);
+      g_assert_nonnull (messages);
+      g_assert_cmpint (messages->len, >, 0);
+
+      for (guint i = 0; i < messages->len; i++)
+        {
+          GVariant *message = g_ptr_array_index (messages, i);
+          const gchar *method = NULL;
+          gint64 params = 0;
+
+          g_assert_false (g_variant_is_floating (message));
+          g_assert_true (g_variant_lookup (message, "method", "&s", &method));
+          g_assert_true (g_variant_lookup (message, "params", "x", &params));
+          g_assert_cmpint (params, ==, n_read + 1);
+          n_read++;
+        }
+    }
+
+  g_assert_cmpint (n_read, ==, 3);
+
+  g_clear_pointer (&messages, g_ptr_array_unref);
+  messages = read_messages (stream, &error);
+  g_assert_error (error, G_IO_ERROR, G_IO_ERROR_FAILED);
+  g_assert_null (messages);
+}
+
+static void
+test_read_messages_error (void)
+{
+  static const gchar *bodies[] = {
+    "{\"jsonrpc\":\"2.0\",\"method\":\"a\"}",
+    "{\"jsonrpc\":",
+    "{\"jsonrpc\":\"2.0\",\"method\":\"c\"}",
+    NULL
+  };
+  g_autoptr(JsonrpcInputStream) stream = create_stream (bodies);
+  g_autoptr(GPtrArray) messages = NULL;
+  g_autoptr(GError) error = NULL;
+
+  /* The first message must be delivered even though the second is invalid */
+  messages = read_messages (stream, &error);
+  g_assert_no_error (error);
+  g_assert_nonnull (messages);
+  g_assert_cmpint (messages->len, ==, 1);
+  g_clear_pointer (&messages, g_ptr_array_unref);
+
+  messages = read_messages (stream, &error);
+  g_assert_nonnull (error);
+  g_assert_null (messages);
+  g_clear_error (&error);
+
+  /* Reading resumes after the invalid message */
+  messages = read_messages (stream, &error);
+  g_assert_no_error (error);
+  g_assert_nonnull (messages);
+  g_assert_cmpint (messages->len, ==, 1);
+}
+
+static void
+append_string (GString     *str,
+               GRand       *rand,
+               const gchar *prefix)
+{
+  static const gchar *pieces[] = {
+    "a", "b", "c", " ", "\\\"", "\\\\", "\\/", "\\n", "\\t", "\\u00e9",
+    "\\ud83d\\ude00", "é", "{", "}", "[", "]", ":", ",", "\\\\\\\"",
+  };
+  guint len = g_rand_int_range (rand, 0, 80);
+
+  g_string_append_c (str, '"');
+  g_string_append (str, prefix);
+  for (guint i = 0; i < len; i++)
+    g_string_append (str, pieces[g_rand_int_range (rand, 0, G_N_ELEMENTS (pieces))]);
+  g_string_append_c (str, '"');
+}
+
+static void
+append_value (GString *str,
+              GRand   *rand,
+              guint    depth)
+{
+  guint kind = g_rand_int_range (rand, 0, depth > 4 ? 6 : 8);
+  guint n_children;
+
+  switch (kind)
+    {
+    case 0:
+      append_string (str, rand, "");
+      break;
+
+    case 1:
+      g_string_append_printf (str, "%"G_GINT64_FORMAT, ((gint64)g_rand_int (rand) << 16) - G_MAXINT32);
+      break;
+
+    case 2:
+      g_string_append_printf (str, "%d.%d", g_rand_int_range (rand, -1000, 1000), g_rand_int_range (rand, 0, 10));
+      break;
+
+    case 3:
+      g_string_append (str, "true");
+      break;
+
+    case 4:
+      g_string_append (str, "false");
+      break;
+
+    case 5:
+      g_string_append (str, "null");
+      break;
+
+    case 6:
+      n_children = g_rand_int_range (rand, 0, 8);
+      g_string_append_c (str, '[');
+      for (guint i = 0; i < n_children; i++)
+        {
+          if (i > 0)
+            g_string_append (str, g_rand_boolean (rand) ? "," : " ,\n ");
+          append_value (str, rand, depth + 1);
+        }
+      g_string_append_c (str, ']');
+      break;
+
+    case 7:
+    default:
+      n_children = g_rand_int_range (rand, 0, 8);
+      g_string_append_c (str, '{');
+      for (guint i = 0; i < n_children; i++)
+        {
+          g_autofree gchar *prefix = g_strdup_printf ("m%u-", i);
+
+          if (i > 0)
+            g_string_append_c (str, ',');
+          /* Unique member names so duplicate handling does not matter */
+          append_string (str, rand, prefix);
+          g_string_append (str, g_rand_boolean (rand) ? ":" : " : ");
+          append_value (str, rand, depth + 1);
+        }
+      g_string_append_c (str, '}');
+      break;
+    }
+}
+
+static void
+check_json_compat (const gchar *body)
+{
+  g_autoptr(GInputStream) base = NULL;
+  g_autoptr(JsonrpcInputStream) stream = NULL;
+  g_autoptr(GVariant) expected = NULL;
+  g_autoptr(GVariant) message = NULL;
+  g_autoptr(GError) error = NULL;
+  g_autofree gchar *frame = NULL;
+  gboolean r;
+
+  expected = json_gvariant_deserialize_data (body, -1, NULL, &error);
+  g_assert_no_error (error);
+  g_assert_nonnull (expected);
+
+  frame = g_strdup_printf ("Content-Length: %u\r\n\r\n%s", (guint)strlen (body), body);
+  base = g_memory_input_stream_new_from_data (g_steal_pointer (&frame), -1, g_free);
+  stream = jsonrpc_input_stream_new (base);
+
+  r = jsonrpc_input_stream_read_message (stream, NULL, &message, &error);
+  g_assert_no_error (error);
+  g_assert_true (r);
+  g_assert_nonnull (message);
+  g_assert_true (g_variant_equal (message, expected));
+}
+
+static void
+test_json_compat (void)
+{
+  static const gchar *bodies[] = {
+    "{}",
+    "{\"jsonrpc\":\"2.0\",\"id\":1,\"result\":null}",
+    "{\"a\":[],\"b\":{},\"c\":[[],[{}]],\"d\":-0,\"e\":-1.5e3,\"f\":1E-2}",
+    "{\"s\":\"\\\"\\\\\\/\\b\\f\\n\\r\\t\\u0041\\u00e9\\u20ac\\ud83d\\ude00\"}",
+    " \r\n\t{ \"x\" : [ 1 , true , false , null , \"\" ] } \n",
+    "{\"int\":9223372036854775807}",
+    "{\"utf8\":\"héllo wörld ✓\"}",
+  };
+  g_autoptr(GRand) rand = g_rand_new_with_seed (1234);
+
+  for (guint i = 0; i < G_N_ELEMENTS (bodies); i++)
+    check_json_compat (bodies[i]);
+
+  /* Bodies above and below the size where the structural index is used */
+  for (guint i = 0; i < 20; i++)
+    {
+      g_autoptr(GString) str = g_string_new ("{\"jsonrpc\":\"2.0\",\"id\":1,\"result\":[");
+      guint n_items = i < 10 ? g_rand_int_range (rand, 1, 10) : g_rand_int_range (rand, 500, 2000);
+
+      for (guint j = 0; j < n_items; j++)
+        {
+          if (j > 0)
+            g_string_append_c (str, ',');
+          append_value (str, rand, 0);
+        }
+
+      g_string_append (str, "]}");
+
+      check_json_compat (str->str);
+    }
+}
+
+static void
+test_json_invalid (void)
+{
+  static const gchar *bodies[] = {
+    "",
+    "{",
+    "{\"a\":1,}",
+    "[1,]",
+    "{\"a\" 1}",
+    "[1 2]",
+    "{\"a\":tru}",
+    "{\"a\":\"\\ud800\"}",
+    "{\"a\":\"\\x\"}",
+    "{\"a\":\"unterminated}",
+    "{} {}",
+    "[01]",
+    "{\"a\":-01}",
+  };
+
+  for (guint i = 0; i < G_N_ELEMENTS (bodies); i++)
+    {
+      g_autoptr(GInputStream) base = NULL;
+      g_autoptr(JsonrpcInputStream) stream = NULL;
+      g_autoptr(GVariant) message = NULL;
+      g_autoptr(GError) error = NULL;
+      g_autofree gchar *frame = NULL;
+      gboolean r;
+
+      frame = g_strdup_printf ("Content-Length: %u\r\n\r\n%s", (guint)strlen (bodies[i]), bodies[i]);
+      base = g_memory_input_stream_new_from_data (g_steal_pointer (&frame), -1, g_free);
+      stream = jsonrpc_input_stream_new (base);
+
+      r = jsonrpc_input_stream_read_message (stream, NULL, &message, &error);
+      g_assert_nonnull (error);
+      g_assert_false (r);
+      g_assert_null (message);
+    }
+}
+
+static void
+test_lazy_decoding (void)
+{
+  static const gchar *bodies[] = {
+    "{\"jsonrpc\":\"2.0\",\"method\":\"a\",\"params\":{\"x\":[1,\"]}\\\"\",{\"y\":null}]}}",
+    "{\"jsonrpc\":\"2.0\",\"id\":1,\"result\":[{\"a\":\"b\"},[],\"\\\\\"]}",
+    "{\"jsonrpc\":\"2.0\",\"id\":2,\"result\":3}",
+    "{\"jsonrpc\":\"2.0\",\"method\":\"b\"}",
+    NULL
+  };
+  g_autoptr(JsonrpcInputStream) eager = create_stream (bodies);
+  g_autoptr(JsonrpcInputStream) lazy = create_stream (bodies);
+
+  jsonrpc_input_stream_set_lazy_decoding (lazy, TRUE);
+  g_assert_true (jsonrpc_input_stream_get_lazy_decoding (lazy));
+
+  for (guint i = 0; bodies[i]; i++)
+    {
+      g_autoptr(GVariant) expected = NULL;
+      g_autoptr(GVariant) message = NULL;
+      g_autoptr(GError) error = NULL;
+
+      jsonrpc_input_stream_read_message (eager, NULL, &expected, &error);
+      g_assert_no_error (error);
+      jsonrpc_input_stream_read_message (lazy, NULL, &message, &error);
+      g_assert_no_error (error);
+
+      for (guint j = 0; j < 2; j++)
+        {
+          const gchar *key = j == 0 ? "params" : "result";
+          g_autoptr(GVariant) a = g_variant_lookup_value (expected, key, NULL);
+          g_autoptr(GVariant) b = jsonrpc_message_lookup_value (message, key, &error);
+
+          g_assert_no_error (error);
+          g_assert_true ((a == NULL) == (b == NULL));
+          g_assert_true (a == NULL || g_variant_equal (a, b));
+        }
+    }
+}
+
+static void
+test_buffer_pool (void)
+{
+  static const gchar *bodies[] = {
+    "{\"jsonrpc\":\"2.0\",\"method\":\"a\",\"params\":[1,2,3]}",
+    "{\"jsonrpc\":\"2.0\",\"method\":\"b\",\"params\":[4,5,6]}",
+    "{\"jsonrpc\":\"2.0\",\"method\":\"c\",\"params\":[7,8,9]}",
+    "{\"jsonrpc\":\"2.0\",\"method\":\"d\",\"params\":[0,1,2]}",
+    NULL
+  };
+  g_autoptr(JsonrpcInputStream) stream = create_stream (bodies);
+  guint64 n_allocations = 0;
+  guint64 n_reused = 0;
+  gsize retained = 0;
+
+  /* Lazy messages keep their body buffer until they are released */
+  jsonrpc_input_stream_set_lazy_decoding (stream, TRUE);
+
+  for (guint i = 0; bodies[i]; i++)
+    {
+      g_autoptr(GVariant) message = NULL;
+      g_autoptr(GVariant) params = NULL;
+      g_autoptr(GError) error = NULL;
+
+      jsonrpc_input_stream_read_message (stream, NULL, &message, &error);
+      g_assert_no_error (error);
+
+      params = jsonrpc_message_lookup_value (message, "params", &error);
+      g_assert_no_error (error);
+      g_assert_cmpint (g_variant_n_children (params), ==, 3);
+    }
+
+  jsonrpc_input_stream_get_pool_stats (stream, &n_allocations, &n_reused, &retained);
+  g_assert_cmpint (n_allocations, ==, 4);
+  g_assert_cmpint (n_reused, ==, 3);
+  g_assert_cmpint (retained, >, 0);
+}
+
+static gchar *
+create_large_body (guint id)
+{
+  GString *str = g_string_new (NULL);
+
+  g_string_append_printf (str, "{\"jsonrpc\":\"2.0\",\"id\":%u,\"result\":[", id);
+  for (guint i = 0; i < 20000; i++)
+    g_string_append_printf (str, "%s{\"n\":%u,\"s\":\"item %u\"}", i ? "," : "", i, i);
+  g_string_append (str, "]}");
+
+  return g_string_free (str, FALSE);
+}
+
+static void
+test_decode_in_thread (void)
+{
+  g_autofree gchar *large1 = create_large_body (1);
+  g_autofree gchar *large2 = create_large_body (3);
+  const gchar *bodies[] = {
+    large1,
+    "{\"jsonrpc\":\"2.0\",\"id\":2,\"result\":null}",
+    large2,
+    "{\"jsonrpc\":\"2.0\",\"id\":4,\"result\":[4]}",
+    "{\"jsonrpc\":",
+    "{\"jsonrpc\":\"2.0\",\"id\":5,\"result\":5}",
+    NULL
+  };
+  g_autoptr(JsonrpcInputStream) stream = create_stream (bodies);
+  g_autoptr(GError) error = NULL;
+  gint64 expected = 1;
+
+  jsonrpc_input_stream_set_decode_in_thread (stream, TRUE);
+  g_assert_true (jsonrpc_input_stream_get_decode_in_thread (stream));
+
+  /* Messages must arrive in order regardless of where they were decoded */
+  while (expected < 5)
+    {
+      g_autoptr(GPtrArray) messages = read_messages (stream, &error);
+
+      g_assert_no_error (error);
+      g_assert_nonnull (messages);
+
+      for (guint i = 0; i < messages->len; i++)
+        {
+          GVariant *message = g_ptr_array_index (messages, i);
+          g_autoptr(GVariant) result = NULL;
+          gint64 id = 0;
+
+          g_assert_true (g_variant_lookup (message, "id", "x", &id));
+          g_assert_cmpint (id, ==, expected);
+
+          result = g_variant_lookup_value (message, "result", NULL);
+          g_assert_nonnull (result);
+          if (id == 1 || id == 3)
+            g_assert_cmpint (g_variant_n_children (result), ==, 20000);
+
+          expected++;
+        }
+    }
+
+  /* The invalid message is reported, then reading continues after it */
+  g_assert_null (read_messages (stream, &error));
+  g_assert_nonnull (error);
+  g_clear_error (&error);
+
+  {
+    g_autoptr(GPtrArray) messages = read_messages (stream, &error);
+    gint64 id = 0;
+
+    g_assert_no_error (error);
+    g_assert_cmpint (messages->len, ==, 1);
+    g_assert_true (g_variant_lookup (g_ptr_array_index (messages, 0), "id", "x", &id));
+    g_assert_cmpint (id, ==, 5);
+  }
+}
+
+static void
+test_spill (void)
+{
+  g_autofree gchar *large = create_large_body (1);
+  const gchar *bodies[] = {
+    large,
+    "{\"jsonrpc\":\"2.0\",\"id\":2,\"result\":[1,2,3]}",
+    NULL
+  };
+  g_autoptr(GVariantBuilder) builder = NULL;
+  g_autoptr(JsonrpcInputStream) eager = create_stream (bodies);
+  g_autoptr(JsonrpcInputStream) spilled = create_stream (bodies);
+  g_autoptr(JsonrpcInputStream) lazy = create_stream (bodies);
+  g_autoptr(JsonrpcInputStream) gvariant_stream = NULL;
+  g_autoptr(GInputStream) base = NULL;
+  g_autoptr(GVariant) expected = NULL;
+  g_autoptr(GVariant) message = NULL;
+  g_autoptr(GError) error = NULL;
+  GString *str;
+
+  jsonrpc_input_stream_set_spill_threshold (spilled, 1024);
+  jsonrpc_input_stream_set_spill_threshold (lazy, 1024);
+  jsonrpc_input_stream_set_lazy_decoding (lazy, TRUE);
+  g_assert_cmpint (jsonrpc_input_stream_get_spill_threshold (spilled), ==, 1024);
+
+  for (guint i = 0; bodies[i]; i++)
+    {
+      g_autoptr(GVariant) a = NULL;
+      g_autoptr(GVariant) b = NULL;
+      g_autoptr(GVariant) c = NULL;
+      g_autoptr(GVariant) result = NULL;
+      g_autoptr(GVariant) lazy_result = NULL;
+
+      jsonrpc_input_stream_read_message (eager, NULL, &a, &error);
+      g_assert_no_error (error);
+      jsonrpc_input_stream_read_message (spilled, NULL, &b, &error);
+      g_assert_no_error (error);
+      jsonrpc_input_stream_read_message (lazy, NULL, &c, &error);
+      g_assert_no_error (error);
+
+      g_assert_true (g_variant_equal (a, b));
+
+      result = g_variant_lookup_value (a, "result", NULL);
+      lazy_result = jsonrpc_message_lookup_value (c, "result", &error);
+      g_assert_no_error (error);
+      g_assert_true (g_variant_equal (result, lazy_result));
+    }
+
+  /* GVariant bodies are used directly from the mapping */
+  builder = g_variant_builder_new (G_VARIANT_TYPE_VARDICT);
+  g_variant_builder_add (builder, "{sv}", "jsonrpc", g_variant_new_string ("2.0"));
+  g_variant_builder_add (builder, "{sv}", "id", g_variant_new_int64 (1));
+  g_variant_builder_add (builder, "{sv}", "result", g_variant_new_string (large));
+  expected = g_variant_ref_sink (g_variant_builder_end (builder));
+
+  str = g_string_new (NULL);
+  g_string_append_printf (str,
+                          "Content-Length: %"G_GSIZE_FORMAT"\r\n"
+                          "Content-Type: application/gvariant\r\n"
+                          "\r\n",
+                          g_variant_get_size (expected));
+  g_string_append_len (str, g_variant_get_data (expected), g_variant_get_size (expected));
+  base = g_memory_input_stream_new_from_data (g_strndup (str->str, str->len), str->len, g_free);
+  g_string_free (str, TRUE);
+
+  gvariant_stream = jsonrpc_input_stream_new (base);
+  jsonrpc_input_stream_set_spill_threshold (gvariant_stream, 1024);
+  jsonrpc_input_stream_read_message (gvariant_stream, NULL, &message, &error);
+  g_assert_no_error (error);
+  g_assert_true (g_variant_equal (expected, message));
+}
+
+static void
+test_max_size (void)
+{
+  static const gchar *bodies[] = {
+    "{\"jsonrpc\":\"2.0\",\"id\":1,\"result\":[1,2,3]}",
+    NULL
+  };
+  g_autoptr(JsonrpcInputStream) stream = create_stream (bodies);
+  g_autoptr(GVariant) message = NULL;
+  g_autoptr(GError) error = NULL;
+
+  g_assert_cmpint (jsonrpc_input_stream_get_max_size (stream), ==, 16 * 1024 * 1024);
+
+  jsonrpc_input_stream_set_max_size (stream, 16);
+  g_assert_cmpint (jsonrpc_input_stream_get_max_size (stream), ==, 16);
+
+  g_assert_false (jsonrpc_input_stream_read_message (stream, NULL, &message, &error));
+  g_assert_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA);
+  g_assert_null (message);
+}
+
+static void
+test_newline_framing (void)
+{
+  static const gchar data[] =
+    "\n"
+    "{\"jsonrpc\":\"2.0\",\"method\":\"a\",\"params\":1}\n"
+    "{\"jsonrpc\":\"2.0\",\"method\":\"b\",\"params\":2}\r\n"
+    "\r\n"
+    "  {\"jsonrpc\":\"2.0\",\"method\":\"c\",\"params\":3}\n";
+  g_autoptr(GInputStream) base = g_memory_input_stream_new_from_data (data, -1, NULL);
+  g_autoptr(JsonrpcInputStream) stream = jsonrpc_input_stream_new (base);
+  g_autoptr(GError) error = NULL;
+  guint n_read = 0;
+
+  g_assert_cmpint (jsonrpc_input_stream_get_framing (stream), ==, JSONRPC_FRAMING_CONTENT_LENGTH);
+  jsonrpc_input_stream_set_framing (stream, JSONRPC_FRAMING_AUTO);
+
+  while (n_read < 3)
+    {
+      g_autoptr(GPtrArray) messages = read_messages (stream, &error);
+
+      g_assert_no_error (error);
+      g_assert_nonnull (messages);
+
+      for (guint i = 0; i < messages->len; i++)
+        {
+          gint64 params = 0;
+
+          g_assert_true (g_variant_lookup (g_ptr_array_index (messages, i), "params", "x", &params));
+          g_assert_cmpint (params, ==, ++n_read);
+        }
+    }
+
+  g_assert_cmpint (jsonrpc_input_stream_get_framing (stream), ==, JSONRPC_FRAMING_NEWLINE);
+}
+
+static void
+test_newline_long_line (void)
+{
+  g_autoptr(GInputStream) base = NULL;
+  g_autoptr(JsonrpcInputStream) stream = NULL;
+  g_autoptr(GError) error = NULL;
+  GString *str = g_string_new ("{\"jsonrpc\":\"2.0\",\"method\":\"a\",\"params\":\"");
+  guint n_read = 0;
+
+  /* A line much larger than any header block */
+  for (guint i = 0; i < 1024 * 1024; i++)
+    g_string_append_c (str, 'x');
+  g_string_append (str, "\"}\n{\"jsonrpc\":\"2.0\",\"method\":\"b\"}\n");
+
+  base = g_memory_input_stream_new_from_data (g_string_free (str, FALSE), -1, g_free);
+  stream = jsonrpc_input_stream_new (base);
+  jsonrpc_input_stream_set_framing (stream, JSONRPC_FRAMING_NEWLINE);
+
+  while (n_read < 2)
+    {
+      g_autoptr(GPtrArray) messages = read_messages (stream, &error);
+
+      g_assert_no_error (error);
+      g_assert_nonnull (messages);
+
+      n_read += messages->len;
+    }
+
+  g_assert_cmpint (n_read, ==, 2);
+
+  /* The buffer grown for the long line is not kept around */
+  g_assert_cmpint (g_buffered_input_stream_get_buffer_size (G_BUFFERED_INPUT_STREAM (stream)), <=, 64 * 1024);
+}
+
+gint
+main (gint argc,
+      gchar *argv[])
+{
+  g_test_init (&argc, &argv, NULL);
+  g_test_add_func ("/Jsonrpc/InputStream/read_messages", test_read_messages);
+  g_test_add_func ("/Jsonrpc/InputStream/read_messages_error", test_read_messages_error);
+  g_test_add_func ("/Jsonrpc/InputStream/json_compat", test_json_compat);
+  g_test_add_func ("/Jsonrpc/InputStream/json_invalid", test_json_invalid);
+  g_test_add_func ("/Jsonrpc/InputStream/lazy_decoding", test_lazy_decoding);
+  g_test_add_func ("/Jsonrpc/InputStream/buffer_pool", test_buffer_pool);
+  g_test_add_func ("/Jsonrpc/InputStream/decode_in_thread", test_decode_in_thread);
+  g_test_add_func ("/Jsonrpc/InputStream/spill", test_spill);
+  g_test_add_func ("/Jsonrpc/InputStream/max_size", test_max_size);
+  g_test_add_func ("/Jsonrpc/InputStream/newline_framing", test_newline_framing);
+  g_test_add_func ("/Jsonrpc/InputStream/newline_long_line", test_newline_long_line);
+  return g_test_run ();
+}
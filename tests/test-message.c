@@ -354,6 +354,32 @@ test_putv_nonnull (void)
   g_assert_true (g_variant_equal (child, child2));
 }
 
+static void
+test_lookup_tuple (void)
+{
+  static const guint8 data[] = "{\"x\":1}";
+  g_autoptr(GVariant) message = NULL;
+  g_autoptr(GVariant) params = NULL;
+  g_autoptr(GVariant) value = NULL;
+  g_autoptr(GError) error = NULL;
+  GVariantDict dict;
+
+  /* A peer using GVariant encoding may send a real "(ay)" */
+  params = g_variant_take_ref (g_variant_new ("(@ay)",
+                                              g_variant_new_fixed_array (G_VARIANT_TYPE_BYTE,
+                                                                         data, sizeof data - 1, 1)));
+
+  g_variant_dict_init (&dict, NULL);
+  g_variant_dict_insert (&dict, "method", "s", "foo");
+  g_variant_dict_insert_value (&dict, "params", params);
+  message = g_variant_take_ref (g_variant_dict_end (&dict));
+
+  value = jsonrpc_message_lookup_value (message, "params", &error);
+  g_assert_no_error (error);
+  g_assert_nonnull (value);
+  g_assert_true (g_variant_equal (value, params));
+}
+
 gint
 main (gint argc,
       gchar *argv[])
@@ -373,5 +399,6 @@ main (gint argc,
   g_test_add_func ("/Jsonrpc/Message/null_strv", test_null_strv);
   g_test_add_func ("/Jsonrpc/Message/putv_null", test_putv_null);
   g_test_add_func ("/Jsonrpc/Message/putv_nonnull", test_putv_nonnull);
+  g_test_add_func ("/Jsonrpc/Message/lookup_tuple", test_lookup_tuple);
   return g_test_run ();
 }
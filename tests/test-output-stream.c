@@ -0,0 +1,897 @@
+/* test-output-stream.c
+ *
+ * Copyright (C) 2026 Christian Hergert <chergert@redhat.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <gio/gio.h>
+#include <jsonrpc-glib.h>
+#include <string.h>
+
+static GVariant *
+create_message (gint64 id)
+{
+  return JSONRPC_MESSAGE_NEW (
+    "jsonrpc", JSONRPC_MESSAGE_PUT_STRING ("2.0"),
+    "id", JSONRPC_MESSAGE_PUT_INT64 (id),
+    "method", JSONRPC_MESSAGE_PUT_STRING ("a\nb"),
+    "params", "{",
+      "text", JSONRPC_MESSAGE_PUT_STRING ("line 1\nline 2"),
+    "}"
+  );
+}
+
+static GBytes *
+write_messages (JsonrpcFraming framing,
+                guint          n_messages)
+{
+  g_autoptr(GOutputStream) base = g_memory_output_stream_new_resizable ();
+  g_autoptr(JsonrpcOutputStream) stream = jsonrpc_output_stream_new (base);
+  g_autoptr(GError) error = NULL;
+
+  jsonrpc_output_stream_set_framing (stream, framing);
+  g_assert_cmpint (jsonrpc_output_stream_get_framing (stream), ==, framing);
+
+  for (guint i = 0; i < n_messages; i++)
+    {
+      g_autoptr(GVariant) message = create_message (i);
+      gboolean r;
+
+      r = jsonrpc_output_stream_write_message (stream, message, NULL, &error);
+      g_assert_no_error (error);
+      g_assert_true (r);
+    }
+
+  g_output_stream_close (G_OUTPUT_STREAM (stream), NULL, &error);
+  g_assert_no_error (error);
+
+  return g_memory_output_stream_steal_as_bytes (G_MEMORY_OUTPUT_STREAM (base));
+}
+
+static void
+read_messages (GBytes         *bytes,
+               JsonrpcFraming  framing,
+               JsonrpcFraming  expected_framing,
+               guint           n_messages)
+{
+  g_autoptr(GInputStream) base = g_memory_input_stream_new_from_bytes (bytes);
+  g_autoptr(JsonrpcInputStream) stream = jsonrpc_input_stream_new (base);
+
+  jsonrpc_input_stream_set_framing (stream, framing);
+
+  for (guint i = 0; i < n_messages; i++)
+    {
+      g_autoptr(GVariant) expected = create_message (i);
+      g_autoptr(GVariant) message = NULL;
+      g_autoptr(GError) error = NULL;
+
+      jsonrpc_input_stream_read_message (stream, NULL, &message, &error);
+      g_assert_no_error (error);
+      g_assert_true (g_variant_equal (expected, message));
+    }
+
+  g_assert_cmpint (jsonrpc_input_stream_get_framing (stream), ==, expected_framing);
+}
+
+static void
+test_newline_framing (void)
+{
+  g_autoptr(GBytes) bytes = write_messages (JSONRPC_FRAMING_NEWLINE, 3);
+  const gchar *data;
+  gsize len;
+  guint n_lines = 0;
+
+  /* Every message is exactly one line */
+  data = g_bytes_get_data (bytes, &len);
+  for (gsize i = 0; i < len; i++)
+    n_lines += data[i] == '\n';
+  g_assert_cmpint (n_lines, ==, 3);
+  g_assert_cmpint (data[0], ==, '{');
+  g_assert_cmpint (data[len - 1], ==, '\n');
+
+  read_messages (bytes, JSONRPC_FRAMING_NEWLINE, JSONRPC_FRAMING_NEWLINE, 3);
+  read_messages (bytes, JSONRPC_FRAMING_AUTO, JSONRPC_FRAMING_NEWLINE, 3);
+}
+
+static void
+test_content_length_framing (void)
+{
+  g_autoptr(GBytes) bytes = write_messages (JSONRPC_FRAMING_CONTENT_LENGTH, 3);
+
+  g_assert_true (g_str_has_prefix (g_bytes_get_data (bytes, NULL), "Content-Length: "));
+
+  read_messages (bytes, JSONRPC_FRAMING_CONTENT_LENGTH, JSONRPC_FRAMING_CONTENT_LENGTH, 3);
+  read_messages (bytes, JSONRPC_FRAMING_AUTO, JSONRPC_FRAMING_CONTENT_LENGTH, 3);
+}
+
+static void
+test_compression (void)
+{
+  g_autoptr(GOutputStream) base = g_memory_output_stream_new_resizable ();
+  g_autoptr(JsonrpcOutputStream) stream = jsonrpc_output_stream_new (base);
+  g_autoptr(JsonrpcInputStream) input = NULL;
+  g_autoptr(GInputStream) input_base = NULL;
+  g_autoptr(GVariant) small = create_message (1);
+  g_autoptr(GVariant) large = NULL;
+  g_autoptr(GBytes) bytes = NULL;
+  g_autoptr(GError) error = NULL;
+  g_autoptr(GString) text = g_string_new (NULL);
+  g_autofree gchar *data = NULL;
+
+  for (guint i = 0; i < 10000; i++)
+    g_string_append_printf (text, "line %u\n", i);
+
+  large = JSONRPC_MESSAGE_NEW (
+    "jsonrpc", JSONRPC_MESSAGE_PUT_STRING ("2.0"),
+    "id", JSONRPC_MESSAGE_PUT_INT64 (2),
+    "result", "{",
+      "text", JSONRPC_MESSAGE_PUT_STRING (text->str),
+    "}"
+  );
+
+  g_assert_cmpint (jsonrpc_output_stream_get_compression (stream), ==, JSONRPC_COMPRESSION_NONE);
+  jsonrpc_output_stream_set_compression (stream, JSONRPC_COMPRESSION_GZIP);
+
+  jsonrpc_output_stream_write_message (stream, small, NULL, &error);
+  g_assert_no_error (error);
+  jsonrpc_output_stream_write_message (stream, large, NULL, &error);
+  g_assert_no_error (error);
+  g_output_stream_close (G_OUTPUT_STREAM (stream), NULL, &error);
+  g_assert_no_error (error);
+
+  bytes = g_memory_output_stream_steal_as_bytes (G_MEMORY_OUTPUT_STREAM (base));
+  data = g_strndup (g_bytes_get_data (bytes, NULL), g_bytes_get_size (bytes));
+
+  /* Only the large message is compressed, and it shrinks considerably */
+  g_assert_nonnull (strstr (data, "Content-Encoding: gzip\r\n"));
+  g_assert_null (strstr (strstr (data, "Content-Encoding") + 1, "Content-Encoding"));
+  g_assert_cmpint (g_bytes_get_size (bytes), <, text->len / 4);
+
+  input_base = g_memory_input_stream_new_from_bytes (bytes);
+  input = jsonrpc_input_stream_new (input_base);
+
+  for (guint i = 0; i < 2; i++)
+    {
+      g_autoptr(GVariant) message = NULL;
+
+      jsonrpc_input_stream_read_message (input, NULL, &message, &error);
+      g_assert_no_error (error);
+      g_assert_true (g_variant_equal (message, i == 0 ? small : large));
+    }
+}
+
+static void
+test_json_writer (void)
+{
+  g_autoptr(GOutputStream) base = g_memory_output_stream_new_resizable ();
+  g_autoptr(JsonrpcOutputStream) stream = jsonrpc_output_stream_new (base);
+  g_autoptr(GVariant) message = NULL;
+  g_autoptr(GBytes) bytes = NULL;
+  g_autoptr(GError) error = NULL;
+  g_autoptr(GString) long_string = g_string_new (NULL);
+
+  for (guint i = 0; i < 1000; i++)
+    g_string_append (long_string, i % 100 ? "ascii text " : "\"quoted\"\\\t\x01 ünïcödé ");
+
+  message = JSONRPC_MESSAGE_NEW (
+    "jsonrpc", JSONRPC_MESSAGE_PUT_STRING ("2.0"),
+    "id", JSONRPC_MESSAGE_PUT_INT64 (G_MININT64),
+    "method", JSONRPC_MESSAGE_PUT_STRING ("\x1f\r\n\b\f/"),
+    "params", "{",
+      "text", JSONRPC_MESSAGE_PUT_STRING (long_string->str),
+      "empty", JSONRPC_MESSAGE_PUT_STRING (""),
+      "double", JSONRPC_MESSAGE_PUT_DOUBLE (2.0),
+      "small", JSONRPC_MESSAGE_PUT_DOUBLE (-1.5e-300),
+      "bool", JSONRPC_MESSAGE_PUT_BOOLEAN (FALSE),
+      "array", "[",
+        JSONRPC_MESSAGE_PUT_INT64 (1),
+        "{", "}",
+        "[", "]",
+      "]",
+    "}"
+  );
+
+  jsonrpc_output_stream_write_message (stream, message, NULL, &error);
+  g_assert_no_error (error);
+  jsonrpc_output_stream_write_message (stream, message, NULL, &error);
+  g_assert_no_error (error);
+  g_output_stream_close (G_OUTPUT_STREAM (stream), NULL, &error);
+  g_assert_no_error (error);
+
+  bytes = g_memory_output_stream_steal_as_bytes (G_MEMORY_OUTPUT_STREAM (base));
+
+  /* Compact JSON, with the header prepended in front of it */
+  g_assert_true (g_str_has_prefix (g_bytes_get_data (bytes, NULL), "Content-Length: "));
+  g_assert_nonnull (g_strstr_len (g_bytes_get_data (bytes, NULL), 128, "\r\n\r\n{\"jsonrpc\":\"2.0\",\"id\":"));
+
+  {
+    g_autoptr(GInputStream) input_base = g_memory_input_stream_new_from_bytes (bytes);
+    g_autoptr(JsonrpcInputStream) input = jsonrpc_input_stream_new (input_base);
+
+    for (guint i = 0; i < 2; i++)
+      {
+        g_autoptr(GVariant) read_message = NULL;
+
+        jsonrpc_input_stream_read_message (input, NULL, &read_message, &error);
+        g_assert_no_error (error);
+        g_assert_true (g_variant_equal (message, read_message));
+      }
+  }
+}
+
+static void
+test_tuple_bytes (void)
+{
+  static const guint8 data[] = "}\n{\"jsonrpc\":\"2.0\",\"method\":\"injected\"}\n";
+  g_autoptr(GOutputStream) base = g_memory_output_stream_new_resizable ();
+  g_autoptr(JsonrpcOutputStream) stream = jsonrpc_output_stream_new (base);
+  g_autoptr(GVariant) message = NULL;
+  g_autoptr(GBytes) bytes = NULL;
+  g_autoptr(GError) error = NULL;
+  GVariantDict dict;
+  const gchar *str;
+  gsize len;
+
+  /* Only values deferred by the parser may be copied into the frame as is */
+  g_variant_dict_init (&dict, NULL);
+  g_variant_dict_insert (&dict, "jsonrpc", "s", "2.0");
+  g_variant_dict_insert (&dict, "method", "s", "foo");
+  g_variant_dict_insert_value (&dict, "params",
+                               g_variant_new ("(@ay)",
+                                              g_variant_new_fixed_array (G_VARIANT_TYPE_BYTE,
+                                                                         data, sizeof data - 1, 1)));
+  message = g_variant_take_ref (g_variant_dict_end (&dict));
+
+  jsonrpc_output_stream_set_framing (stream, JSONRPC_FRAMING_NEWLINE);
+  jsonrpc_output_stream_write_message (stream, message, NULL, &error);
+  g_assert_no_error (error);
+  g_output_stream_close (G_OUTPUT_STREAM (stream), NULL, &error);
+  g_assert_no_error (error);
+
+  bytes = g_memory_output_stream_steal_as_bytes (G_MEMORY_OUTPUT_STREAM (base));
+  str = g_bytes_get_data (bytes, &len);
+
+  g_assert_cmpint (len, >, 0);
+  g_assert_cmpint (str[len - 1], ==, '\n');
+  g_assert_null (memchr (str, '\n', len - 1));
+  g_assert_null (g_strstr_len (str, len, "injected"));
+}
+
+static void
+test_gvariant_frames (void)
+{
+  for (guint compress = 0; compress < 2; compress++)
+    {
+      g_autoptr(GOutputStream) base = g_memory_output_stream_new_resizable ();
+      g_autoptr(JsonrpcOutputStream) stream = jsonrpc_output_stream_new (base);
+      g_autoptr(GInputStream) input_base = NULL;
+      g_autoptr(JsonrpcInputStream) input = NULL;
+      g_autoptr(GVariant) large = NULL;
+      g_autoptr(GBytes) bytes = NULL;
+      g_autoptr(GError) error = NULL;
+      g_autofree gchar *text = g_strnfill (100000, 'x');
+
+      large = JSONRPC_MESSAGE_NEW (
+        "jsonrpc", JSONRPC_MESSAGE_PUT_STRING ("2.0"),
+        "id", JSONRPC_MESSAGE_PUT_INT64 (100),
+        "result", JSONRPC_MESSAGE_PUT_STRING (text)
+      );
+
+      /* Headers and the serialized variant are written as separate vectors */
+      jsonrpc_output_stream_set_use_gvariant (stream, TRUE);
+      jsonrpc_output_stream_set_compression (stream, compress ? JSONRPC_COMPRESSION_GZIP : JSONRPC_COMPRESSION_NONE);
+
+      for (guint i = 0; i < 3; i++)
+        {
+          g_autoptr(GVariant) message = create_message (i);
+
+          jsonrpc_output_stream_write_message (stream, message, NULL, &error);
+          g_assert_no_error (error);
+        }
+
+      jsonrpc_output_stream_write_message (stream, large, NULL, &error);
+      g_assert_no_error (error);
+      g_output_stream_close (G_OUTPUT_STREAM (stream), NULL, &error);
+      g_assert_no_error (error);
+
+      bytes = g_memory_output_stream_steal_as_bytes (G_MEMORY_OUTPUT_STREAM (base));
+      input_base = g_memory_input_stream_new_from_bytes (bytes);
+      input = jsonrpc_input_stream_new (input_base);
+
+      for (guint i = 0; i < 4; i++)
+        {
+          g_autoptr(GVariant) expected = i < 3 ? create_message (i) : g_variant_ref (large);
+          g_autoptr(GVariant) message = NULL;
+
+          jsonrpc_input_stream_read_message (input, NULL, &message, &error);
+          g_assert_no_error (error);
+          g_assert_true (g_variant_equal (expected, message));
+        }
+
+      if (compress)
+        g_assert_cmpint (g_bytes_get_size (bytes), <, 100000);
+    }
+}
+
+static void
+write_message_cb (GObject      *object,
+                  GAsyncResult *result,
+                  gpointer      user_data)
+{
+  guint *n_completed = user_data;
+  g_autoptr(GError) error = NULL;
+  gboolean r;
+
+  r = jsonrpc_output_stream_write_message_finish (JSONRPC_OUTPUT_STREAM (object), result, &error);
+  g_assert_no_error (error);
+  g_assert_true (r);
+
+  (*n_completed)++;
+}
+
+static void
+test_write_burst (void)
+{
+  g_autoptr(GOutputStream) base = g_memory_output_stream_new_resizable ();
+  g_autoptr(JsonrpcOutputStream) stream = jsonrpc_output_stream_new (base);
+  g_autoptr(GBytes) bytes = NULL;
+  g_autoptr(GError) error = NULL;
+  guint n_completed = 0;
+
+  /* Queued messages are coalesced into vectored writes */
+  for (guint i = 0; i < 500; i++)
+    {
+      g_autoptr(GVariant) message = create_message (i);
+
+      jsonrpc_output_stream_write_message_async (stream, message, NULL, write_message_cb, &n_completed);
+    }
+
+  while (n_completed < 500)
+    g_main_context_iteration (NULL, TRUE);
+
+  g_output_stream_close (G_OUTPUT_STREAM (stream), NULL, &error);
+  g_assert_no_error (error);
+
+  bytes = g_memory_output_stream_steal_as_bytes (G_MEMORY_OUTPUT_STREAM (base));
+  read_messages (bytes, JSONRPC_FRAMING_CONTENT_LENGTH, JSONRPC_FRAMING_CONTENT_LENGTH, 500);
+}
+
+static void
+test_large_message (void)
+{
+  g_autoptr(GOutputStream) base = g_memory_output_stream_new_resizable ();
+  g_autoptr(JsonrpcOutputStream) stream = jsonrpc_output_stream_new (base);
+  g_autoptr(JsonrpcInputStream) input = NULL;
+  g_autoptr(GInputStream) input_base = NULL;
+  g_autoptr(GVariant) large = NULL;
+  g_autoptr(GBytes) bytes = NULL;
+  g_autoptr(GError) error = NULL;
+  g_autofree gchar *text = g_strnfill (256 * 1024, 'x');
+  guint n_completed = 0;
+
+  large = JSONRPC_MESSAGE_NEW (
+    "jsonrpc", JSONRPC_MESSAGE_PUT_STRING ("2.0"),
+    "id", JSONRPC_MESSAGE_PUT_INT64 (0),
+    "method", JSONRPC_MESSAGE_PUT_STRING ("large"),
+    "params", "{",
+      "text", JSONRPC_MESSAGE_PUT_STRING (text),
+    "}"
+  );
+
+  /* The large message is serialized in a thread, yet still written first */
+  jsonrpc_output_stream_write_message_async (stream, large, NULL, write_message_cb, &n_completed);
+
+  for (guint i = 1; i < 4; i++)
+    {
+      g_autoptr(GVariant) message = create_message (i);
+
+      jsonrpc_output_stream_write_message_async (stream, message, NULL, write_message_cb, &n_completed);
+    }
+
+  while (n_completed < 4)
+    g_main_context_iteration (NULL, TRUE);
+
+  g_output_stream_close (G_OUTPUT_STREAM (stream), NULL, &error);
+  g_assert_no_error (error);
+
+  bytes = g_memory_output_stream_steal_as_bytes (G_MEMORY_OUTPUT_STREAM (base));
+  input_base = g_memory_input_stream_new_from_bytes (bytes);
+  input = jsonrpc_input_stream_new (input_base);
+
+  for (guint i = 0; i < 4; i++)
+    {
+      g_autoptr(GVariant) message = NULL;
+      gint64 id = -1;
+
+      jsonrpc_input_stream_read_message (input, NULL, &message, &error);
+      g_assert_no_error (error);
+      g_assert_true (JSONRPC_MESSAGE_PARSE (message, "id", JSONRPC_MESSAGE_GET_INT64 (&id)));
+      g_assert_cmpint (id, ==, i);
+
+      if (i == 0)
+        g_assert_true (g_variant_equal (message, large));
+    }
+}
+
+static void
+test_fire_and_forget (void)
+{
+  g_autoptr(GOutputStream) base = g_memory_output_stream_new_resizable ();
+  JsonrpcOutputStream *stream = jsonrpc_output_stream_new (base);
+  g_autoptr(GBytes) bytes = NULL;
+
+  g_object_add_weak_pointer (G_OBJECT (stream), (gpointer *)&stream);
+
+  for (guint i = 0; i < 100; i++)
+    {
+      g_autoptr(GVariant) message = create_message (i);
+
+      jsonrpc_output_stream_write_message_async (stream, message, NULL, NULL, NULL);
+    }
+
+  /* Queued messages keep the stream alive until they are written */
+  g_object_unref (stream);
+  g_assert_nonnull (stream);
+
+  while (stream != NULL)
+    g_main_context_iteration (NULL, TRUE);
+
+  g_output_stream_close (base, NULL, NULL);
+
+  bytes = g_memory_output_stream_steal_as_bytes (G_MEMORY_OUTPUT_STREAM (base));
+  read_messages (bytes, JSONRPC_FRAMING_CONTENT_LENGTH, JSONRPC_FRAMING_CONTENT_LENGTH, 100);
+}
+
+static void
+test_priority (void)
+{
+  static const gint64 expected[] = { 0, 100, 200, 1, 2, 3 };
+  g_autoptr(GOutputStream) base = g_memory_output_stream_new_resizable ();
+  g_autoptr(JsonrpcOutputStream) stream = jsonrpc_output_stream_new (base);
+  g_autoptr(JsonrpcInputStream) input = NULL;
+  g_autoptr(GInputStream) input_base = NULL;
+  g_autoptr(GBytes) bytes = NULL;
+  g_autoptr(GError) error = NULL;
+  guint n_completed = 0;
+
+  /* The first message is written right away, the rest wait for it */
+  for (guint i = 0; i < 4; i++)
+    {
+      g_autoptr(GVariant) message = create_message (i);
+
+      jsonrpc_output_stream_queue_message_async (stream,
+                                                 message,
+                                                 i == 0 ? JSONRPC_WRITE_PRIORITY_NORMAL : JSONRPC_WRITE_PRIORITY_LOW,
+                                                 NULL,
+                                                 NULL,
+                                                 write_message_cb,
+                                                 &n_completed);
+    }
+
+  {
+    g_autoptr(GVariant) reply = create_message (200);
+    g_autoptr(GVariant) control = create_message (100);
+
+    jsonrpc_output_stream_queue_message_async (stream, reply, JSONRPC_WRITE_PRIORITY_REPLY,
+                                               NULL, NULL, write_message_cb, &n_completed);
+    jsonrpc_output_stream_queue_message_async (stream, control, JSONRPC_WRITE_PRIORITY_CONTROL,
+                                               NULL, NULL, write_message_cb, &n_completed);
+  }
+
+  while (n_completed < G_N_ELEMENTS (expected))
+    g_main_context_iteration (NULL, TRUE);
+
+  g_output_stream_close (G_OUTPUT_STREAM (stream), NULL, &error);
+  g_assert_no_error (error);
+
+  bytes = g_memory_output_stream_steal_as_bytes (G_MEMORY_OUTPUT_STREAM (base));
+  input_base = g_memory_input_stream_new_from_bytes (bytes);
+  input = jsonrpc_input_stream_new (input_base);
+
+  for (guint i = 0; i < G_N_ELEMENTS (expected); i++)
+    {
+      g_autoptr(GVariant) message = NULL;
+      gint64 id = -1;
+
+      jsonrpc_input_stream_read_message (input, NULL, &message, &error);
+      g_assert_no_error (error);
+      g_assert_true (JSONRPC_MESSAGE_PARSE (message, "id", JSONRPC_MESSAGE_GET_INT64 (&id)));
+      g_assert_cmpint (id, ==, expected[i]);
+    }
+}
+
+static void
+test_coalesce (void)
+{
+  static const struct {
+    gint64       id;
+    const gchar *key;
+  } messages[] = {
+    { 0, "progress" },
+    { 1, "progress" },
+    { 2, NULL },
+    { 3, "diagnostics" },
+    { 4, "progress" },
+    { 5, "progress" },
+  };
+  static const gint64 expected[] = { 0, 5, 2, 3 };
+  g_autoptr(GOutputStream) base = g_memory_output_stream_new_resizable ();
+  g_autoptr(JsonrpcOutputStream) stream = jsonrpc_output_stream_new (base);
+  g_autoptr(JsonrpcInputStream) input = NULL;
+  g_autoptr(GInputStream) input_base = NULL;
+  g_autoptr(GBytes) bytes = NULL;
+  g_autoptr(GVariant) message = NULL;
+  g_autoptr(GError) error = NULL;
+  guint n_completed = 0;
+
+  /*
+   * The first message is being written so it cannot be replaced, the
+   * following ones with the same key replace each other in place.
+   */
+  for (guint i = 0; i < G_N_ELEMENTS (messages); i++)
+    {
+      g_autoptr(GVariant) m = create_message (messages[i].id);
+
+      jsonrpc_output_stream_queue_message_async (stream,
+                                                 m,
+                                                 JSONRPC_WRITE_PRIORITY_NORMAL,
+                                                 messages[i].key,
+                                                 NULL,
+                                                 write_message_cb,
+                                                 &n_completed);
+    }
+
+  while (n_completed < G_N_ELEMENTS (messages))
+    g_main_context_iteration (NULL, TRUE);
+
+  g_output_stream_close (G_OUTPUT_STREAM (stream), NULL, &error);
+  g_assert_no_error (error);
+
+  bytes = g_memory_output_stream_steal_as_bytes (G_MEMORY_OUTPUT_STREAM (base));
+  input_base = g_memory_input_stream_new_from_bytes (bytes);
+  input = jsonrpc_input_stream_new (input_base);
+
+  for (guint i = 0; i < G_N_ELEMENTS (expected); i++)
+    {
+      gint64 id = -1;
+
+      g_clear_pointer (&message, g_variant_unref);
+      jsonrpc_input_stream_read_message (input, NULL, &message, &error);
+      g_assert_no_error (error);
+      g_assert_true (JSONRPC_MESSAGE_PARSE (message, "id", JSONRPC_MESSAGE_GET_INT64 (&id)));
+      g_assert_cmpint (id, ==, expected[i]);
+    }
+
+  g_clear_pointer (&message, g_variant_unref);
+  g_assert_false (jsonrpc_input_stream_read_message (input, NULL, &message, &error));
+  g_assert_nonnull (error);
+}
+
+static GBytes *
+write_encoded (JsonrpcEncodedMessage *encoded,
+               JsonrpcFraming         framing,
+               gboolean               use_gvariant)
+{
+  g_autoptr(GOutputStream) base = g_memory_output_stream_new_resizable ();
+  g_autoptr(JsonrpcOutputStream) stream = jsonrpc_output_stream_new (base);
+  g_autoptr(GError) error = NULL;
+  guint n_completed = 0;
+
+  jsonrpc_output_stream_set_framing (stream, framing);
+  jsonrpc_output_stream_set_use_gvariant (stream, use_gvariant);
+
+  for (guint i = 0; i < 2; i++)
+    jsonrpc_output_stream_queue_encoded_async (stream,
+                                               encoded,
+                                               JSONRPC_WRITE_PRIORITY_NORMAL,
+                                               NULL,
+                                               write_message_cb,
+                                               &n_completed);
+
+  while (n_completed < 2)
+    g_main_context_iteration (NULL, TRUE);
+
+  g_output_stream_close (G_OUTPUT_STREAM (stream), NULL, &error);
+  g_assert_no_error (error);
+
+  return g_memory_output_stream_steal_as_bytes (G_MEMORY_OUTPUT_STREAM (base));
+}
+
+static void
+test_encoded_message (void)
+{
+  g_autoptr(JsonrpcEncodedMessage) encoded = NULL;
+  g_autoptr(GBytes) json1 = NULL;
+  g_autoptr(GBytes) json2 = NULL;
+  g_autoptr(GBytes) gvariant = NULL;
+  g_autoptr(GBytes) newline = NULL;
+  g_autoptr(GBytes) expected = NULL;
+  g_autoptr(GVariant) message = create_message (0);
+
+  encoded = jsonrpc_encoded_message_new (message);
+  g_assert_true (jsonrpc_encoded_message_get_message (encoded) == message);
+
+  /* Streams using the same encoding share the serialized message */
+  json1 = write_encoded (encoded, JSONRPC_FRAMING_CONTENT_LENGTH, FALSE);
+  gvariant = write_encoded (encoded, JSONRPC_FRAMING_CONTENT_LENGTH, TRUE);
+  newline = write_encoded (encoded, JSONRPC_FRAMING_NEWLINE, FALSE);
+  json2 = write_encoded (encoded, JSONRPC_FRAMING_CONTENT_LENGTH, FALSE);
+
+  g_assert_true (g_bytes_equal (json1, json2));
+  g_assert_false (g_bytes_equal (json1, gvariant));
+
+  /* And write the same as a message queued on its own would */
+  {
+    g_autoptr(GOutputStream) base = g_memory_output_stream_new_resizable ();
+    g_autoptr(JsonrpcOutputStream) stream = jsonrpc_output_stream_new (base);
+    g_autoptr(GError) error = NULL;
+
+    for (guint i = 0; i < 2; i++)
+      {
+        jsonrpc_output_stream_write_message (stream, message, NULL, &error);
+        g_assert_no_error (error);
+      }
+
+    g_output_stream_close (G_OUTPUT_STREAM (stream), NULL, &error);
+    g_assert_no_error (error);
+
+    expected = g_memory_output_stream_steal_as_bytes (G_MEMORY_OUTPUT_STREAM (base));
+    g_assert_true (g_bytes_equal (json1, expected));
+  }
+
+  read_messages (json1, JSONRPC_FRAMING_CONTENT_LENGTH, JSONRPC_FRAMING_CONTENT_LENGTH, 1);
+  read_messages (gvariant, JSONRPC_FRAMING_CONTENT_LENGTH, JSONRPC_FRAMING_CONTENT_LENGTH, 1);
+  read_messages (newline, JSONRPC_FRAMING_NEWLINE, JSONRPC_FRAMING_NEWLINE, 1);
+}
+
+static void
+write_closed_cb (GObject      *object,
+                 GAsyncResult *result,
+                 gpointer      user_data)
+{
+  gboolean *closed = user_data;
+  g_autoptr(GError) error = NULL;
+  gboolean r;
+
+  r = jsonrpc_output_stream_write_message_finish (JSONRPC_OUTPUT_STREAM (object), result, &error);
+  g_assert_error (error, G_IO_ERROR, G_IO_ERROR_CLOSED);
+  g_assert_false (r);
+
+  *closed = TRUE;
+}
+
+static void
+test_cork (void)
+{
+  g_autoptr(GOutputStream) base = g_memory_output_stream_new_resizable ();
+  g_autoptr(JsonrpcOutputStream) stream = jsonrpc_output_stream_new (base);
+  g_autoptr(GBytes) bytes = NULL;
+  g_autoptr(GError) error = NULL;
+  guint n_completed = 0;
+
+  {
+    g_autoptr(JsonrpcOutputStreamCorker) corker = jsonrpc_output_stream_corker_new (stream);
+
+    jsonrpc_output_stream_cork (stream);
+
+    for (guint i = 0; i < 3; i++)
+      {
+        g_autoptr(GVariant) message = create_message (i);
+
+        jsonrpc_output_stream_write_message_async (stream, message, NULL, write_message_cb, &n_completed);
+      }
+
+    while (g_main_context_iteration (NULL, FALSE)) { }
+
+    g_assert_cmpint (n_completed, ==, 0);
+    g_assert_cmpint (g_memory_output_stream_get_data_size (G_MEMORY_OUTPUT_STREAM (base)), ==, 0);
+
+    /* Still corked by the corker */
+    jsonrpc_output_stream_uncork (stream);
+
+    while (g_main_context_iteration (NULL, FALSE)) { }
+
+    g_assert_cmpint (n_completed, ==, 0);
+  }
+
+  while (n_completed < 3)
+    g_main_context_iteration (NULL, TRUE);
+
+  /* Synchronous writes are never held back */
+  jsonrpc_output_stream_cork (stream);
+
+  {
+    g_autoptr(GVariant) message = create_message (3);
+
+    jsonrpc_output_stream_write_message (stream, message, NULL, &error);
+    g_assert_no_error (error);
+  }
+
+  jsonrpc_output_stream_uncork (stream);
+
+  g_output_stream_close (G_OUTPUT_STREAM (stream), NULL, &error);
+  g_assert_no_error (error);
+
+  bytes = g_memory_output_stream_steal_as_bytes (G_MEMORY_OUTPUT_STREAM (base));
+  read_messages (bytes, JSONRPC_FRAMING_CONTENT_LENGTH, JSONRPC_FRAMING_CONTENT_LENGTH, 4);
+
+  /* Messages held back by a cork fail once the stream is closed */
+  {
+    g_autoptr(GOutputStream) closed_base = g_memory_output_stream_new_resizable ();
+    g_autoptr(GVariant) message = create_message (4);
+    JsonrpcOutputStream *closed = jsonrpc_output_stream_new (closed_base);
+    gboolean failed = FALSE;
+
+    g_object_add_weak_pointer (G_OBJECT (closed), (gpointer *)&closed);
+
+    jsonrpc_output_stream_cork (closed);
+    jsonrpc_output_stream_write_message_async (closed, message, NULL, write_closed_cb, &failed);
+
+    g_output_stream_close (G_OUTPUT_STREAM (closed), NULL, &error);
+    g_assert_no_error (error);
+
+    while (!failed)
+      g_main_context_iteration (NULL, TRUE);
+
+    g_assert_cmpint (g_memory_output_stream_get_data_size (G_MEMORY_OUTPUT_STREAM (closed_base)), ==, 0);
+
+    jsonrpc_output_stream_uncork (closed);
+
+    /* Nothing is left holding a reference on the stream */
+    g_object_unref (closed);
+    g_assert_null (closed);
+  }
+}
+
+static void
+write_cancelled_cb (GObject      *object,
+                    GAsyncResult *result,
+                    gpointer      user_data)
+{
+  gboolean *cancelled = user_data;
+  g_autoptr(GError) error = NULL;
+  gboolean r;
+
+  r = jsonrpc_output_stream_write_message_finish (JSONRPC_OUTPUT_STREAM (object), result, &error);
+  g_assert_error (error, G_IO_ERROR, G_IO_ERROR_CANCELLED);
+  g_assert_false (r);
+
+  *cancelled = TRUE;
+}
+
+static void
+test_cork_cancelled (void)
+{
+  g_autoptr(GOutputStream) base = g_memory_output_stream_new_resizable ();
+  g_autoptr(JsonrpcOutputStream) stream = jsonrpc_output_stream_new (base);
+  g_autoptr(GCancellable) cancellable = g_cancellable_new ();
+  g_autoptr(GBytes) bytes = NULL;
+  g_autoptr(GError) error = NULL;
+  gboolean cancelled = FALSE;
+  guint n_completed = 0;
+
+  jsonrpc_output_stream_cork (stream);
+
+  for (guint i = 0; i < 3; i++)
+    {
+      g_autoptr(GVariant) message = create_message (i);
+
+      /* Cancelled while queued, so it must not be written with the others */
+      if (i == 2)
+        {
+          g_autoptr(GVariant) dropped = create_message (100);
+
+          jsonrpc_output_stream_write_message_async (stream, dropped, cancellable, write_cancelled_cb, &cancelled);
+          g_cancellable_cancel (cancellable);
+        }
+
+      jsonrpc_output_stream_write_message_async (stream, message, NULL, write_message_cb, &n_completed);
+    }
+
+  jsonrpc_output_stream_uncork (stream);
+
+  while (n_completed < 3 || !cancelled)
+    g_main_context_iteration (NULL, TRUE);
+
+  g_output_stream_close (G_OUTPUT_STREAM (stream), NULL, &error);
+  g_assert_no_error (error);
+
+  bytes = g_memory_output_stream_steal_as_bytes (G_MEMORY_OUTPUT_STREAM (base));
+  read_messages (bytes, JSONRPC_FRAMING_CONTENT_LENGTH, JSONRPC_FRAMING_CONTENT_LENGTH, 3);
+}
+
+static void
+wait_writable_cb (GObject      *object,
+                  GAsyncResult *result,
+                  gpointer      user_data)
+{
+  gboolean *writable = user_data;
+  g_autoptr(GError) error = NULL;
+
+  *writable = jsonrpc_output_stream_wait_writable_finish (JSONRPC_OUTPUT_STREAM (object), result, &error);
+  g_assert_no_error (error);
+  g_assert_true (*writable);
+  g_assert_false (jsonrpc_output_stream_get_congested (JSONRPC_OUTPUT_STREAM (object)));
+}
+
+static void
+test_congestion (void)
+{
+  g_autoptr(GOutputStream) base = g_memory_output_stream_new_resizable ();
+  g_autoptr(JsonrpcOutputStream) stream = jsonrpc_output_stream_new (base);
+  gboolean writable = FALSE;
+  guint n_completed = 0;
+  guint n_messages = 0;
+  gsize n_bytes = 0;
+
+  jsonrpc_output_stream_set_high_water_mark (stream, 0, 4);
+  jsonrpc_output_stream_set_low_water_mark (stream, 100, 1);
+  jsonrpc_output_stream_get_low_water_mark (stream, &n_bytes, &n_messages);
+  g_assert_cmpint (n_bytes, ==, 100);
+  g_assert_cmpint (n_messages, ==, 1);
+
+  /* The low water mark survives the high water mark going down and back */
+  jsonrpc_output_stream_set_high_water_mark (stream, 0, 0);
+  jsonrpc_output_stream_set_high_water_mark (stream, 0, 4);
+  jsonrpc_output_stream_get_low_water_mark (stream, &n_bytes, &n_messages);
+  g_assert_cmpint (n_bytes, ==, 100);
+  g_assert_cmpint (n_messages, ==, 1);
+
+  /* Not congested, so this completes right away */
+  jsonrpc_output_stream_wait_writable_async (stream, NULL, wait_writable_cb, &writable);
+  while (!writable)
+    g_main_context_iteration (NULL, TRUE);
+
+  for (guint i = 0; i < 6; i++)
+    {
+      g_autoptr(GVariant) message = create_message (i);
+
+      g_assert_cmpint (jsonrpc_output_stream_get_congested (stream), ==, i >= 4);
+      jsonrpc_output_stream_write_message_async (stream, message, NULL, write_message_cb, &n_completed);
+    }
+
+  g_assert_true (jsonrpc_output_stream_get_congested (stream));
+
+  writable = FALSE;
+  jsonrpc_output_stream_wait_writable_async (stream, NULL, wait_writable_cb, &writable);
+  while (!writable)
+    g_main_context_iteration (NULL, TRUE);
+
+  while (n_completed < 6)
+    g_main_context_iteration (NULL, TRUE);
+}
+
+gint
+main (gint argc,
+      gchar *argv[])
+{
+  g_test_init (&argc, &argv, NULL);
+  g_test_add_func ("/Jsonrpc/OutputStream/newline_framing", test_newline_framing);
+  g_test_add_func ("/Jsonrpc/OutputStream/content_length_framing", test_content_length_framing);
+  g_test_add_func ("/Jsonrpc/OutputStream/compression", test_compression);
+  g_test_add_func ("/Jsonrpc/OutputStream/json_writer", test_json_writer);
+  g_test_add_func ("/Jsonrpc/OutputStream/tuple_bytes", test_tuple_bytes);
+  g_test_add_func ("/Jsonrpc/OutputStream/gvariant_frames", test_gvariant_frames);
+  g_test_add_func ("/Jsonrpc/OutputStream/write_burst", test_write_burst);
+  g_test_add_func ("/Jsonrpc/OutputStream/fire_and_forget", test_fire_and_forget);
+  g_test_add_func ("/Jsonrpc/OutputStream/large_message", test_large_message);
+  g_test_add_func ("/Jsonrpc/OutputStream/priority", test_priority);
+  g_test_add_func ("/Jsonrpc/OutputStream/coalesce", test_coalesce);
+  g_test_add_func ("/Jsonrpc/OutputStream/congestion", test_congestion);
+  g_test_add_func ("/Jsonrpc/OutputStream/encoded_message", test_encoded_message);
+  g_test_add_func ("/Jsonrpc/OutputStream/cork", test_cork);
+  g_test_add_func ("/Jsonrpc/OutputStream/cork_cancelled", test_cork_cancelled);
+  return g_test_run ();
+}
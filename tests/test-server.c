@@ -29,6 +29,42 @@
 #include <signal.h>
 #include <unistd.h>
 
+/*
+ * Creates two streams connected to each other by a pair of pipes, so that
+ * what is written to one of them is read from the other.
+ */
+static void
+create_stream_pair (GIOStream **stream_a,
+                    GIOStream **stream_b)
+{
+  g_autoptr(GInputStream) input_a = NULL;
+  g_autoptr(GInputStream) input_b = NULL;
+  g_autoptr(GOutputStream) output_a = NULL;
+  g_autoptr(GOutputStream) output_b = NULL;
+  g_autoptr(GError) error = NULL;
+  gint pair_a[2];
+  gint pair_b[2];
+  gint r;
+
+  signal (SIGPIPE, SIG_IGN);
+
+  r = g_unix_open_pipe (pair_a, FD_CLOEXEC, &error);
+  g_assert_no_error (error);
+  g_assert_cmpint (r, ==, TRUE);
+
+  r = g_unix_open_pipe (pair_b, FD_CLOEXEC, &error);
+  g_assert_no_error (error);
+  g_assert_cmpint (r, ==, TRUE);
+
+  input_a = g_unix_input_stream_new (pair_a[0], TRUE);
+  input_b = g_unix_input_stream_new (pair_b[0], TRUE);
+  output_a = g_unix_output_stream_new (pair_a[1], TRUE);
+  output_b = g_unix_output_stream_new (pair_b[1], TRUE);
+
+  *stream_a = g_simple_io_stream_new (input_a, output_b);
+  *stream_b = g_simple_io_stream_new (input_b, output_a);
+}
+
 static void
 handle_notification (JsonrpcServer *server,
                      JsonrpcClient *client,
@@ -223,6 +259,792 @@ test_basic_gvariant (void)
   test_basic (TRUE);
 }
 
+static void
+test_newline_framing (void)
+{
+  g_autoptr(JsonrpcServer) server = NULL;
+  g_autoptr(JsonrpcClient) client = NULL;
+  g_autoptr(GIOStream) stream_a = NULL;
+  g_autoptr(GIOStream) stream_b = NULL;
+  g_autoptr(GVariant) return_value = NULL;
+  g_autoptr(GError) error = NULL;
+  gint count = 0;
+  gint r;
+
+  create_stream_pair (&stream_a, &stream_b);
+
+  client = jsonrpc_client_new (stream_a);
+  jsonrpc_client_set_framing (client, JSONRPC_FRAMING_NEWLINE);
+
+  /* Peers are only expected to use Content-Length unless asked for */
+  server = jsonrpc_server_new ();
+  g_assert_cmpint (jsonrpc_server_get_framing (server), ==, JSONRPC_FRAMING_CONTENT_LENGTH);
+  jsonrpc_server_set_framing (server, JSONRPC_FRAMING_AUTO);
+  jsonrpc_server_accept_io_stream (server, stream_b);
+
+  jsonrpc_server_add_handler (server, "do/something", do_something_handler, &count, NULL);
+
+  r = jsonrpc_client_call (client,
+                           "do/something",
+                           g_variant_new_string ("do/something/message"),
+                           NULL,
+                           &return_value,
+                           &error);
+  g_assert_no_error (error);
+  g_assert_cmpint (r, ==, TRUE);
+  g_assert_nonnull (return_value);
+  g_assert_true (g_variant_get_boolean (return_value));
+  g_assert_cmpint (count, ==, 1);
+}
+
+typedef struct
+{
+  JsonrpcClient *client;
+  GVariant      *id;
+} PendingCall;
+
+static void
+slow_handler (JsonrpcServer *server,
+              JsonrpcClient *client,
+              const gchar   *method,
+              GVariant      *id,
+              GVariant      *params,
+              gpointer       user_data)
+{
+  PendingCall *pending = user_data;
+
+  /* Don't reply until the call has timed out */
+  g_set_object (&pending->client, client);
+  pending->id = g_variant_ref (id);
+}
+
+static void
+call_timed_out_cb (GObject      *object,
+                   GAsyncResult *result,
+                   gpointer      user_data)
+{
+  g_autoptr(GVariant) return_value = NULL;
+  g_autoptr(GError) error = NULL;
+  gboolean *completed = user_data;
+  gboolean r;
+
+  r = jsonrpc_client_call_finish (JSONRPC_CLIENT (object), result, &return_value, &error);
+  g_assert_error (error, G_IO_ERROR, G_IO_ERROR_TIMED_OUT);
+  g_assert_false (r);
+  g_assert_null (return_value);
+
+  *completed = TRUE;
+}
+
+static void
+test_deadline (void)
+{
+  g_autoptr(JsonrpcServer) server = NULL;
+  g_autoptr(JsonrpcClient) client = NULL;
+  g_autoptr(GIOStream) stream_a = NULL;
+  g_autoptr(GIOStream) stream_b = NULL;
+  g_autoptr(GVariant) return_value = NULL;
+  g_autoptr(GError) error = NULL;
+  PendingCall pending = { 0 };
+  gboolean completed = FALSE;
+  gint count = 0;
+  gint r;
+
+  create_stream_pair (&stream_a, &stream_b);
+
+  client = jsonrpc_client_new (stream_a);
+
+  server = jsonrpc_server_new ();
+  jsonrpc_server_accept_io_stream (server, stream_b);
+  jsonrpc_server_add_handler (server, "slow", slow_handler, &pending, NULL);
+  jsonrpc_server_add_handler (server, "do/something", do_something_handler, &count, NULL);
+
+  jsonrpc_client_call_with_deadline_async (client,
+                                           "slow",
+                                           NULL,
+                                           g_get_monotonic_time () + 50 * 1000,
+                                           NULL,
+                                           NULL,
+                                           call_timed_out_cb,
+                                           &completed);
+
+  while (!completed)
+    g_main_context_iteration (NULL, TRUE);
+
+  /* A late reply is dropped without failing the connection */
+  g_assert_nonnull (pending.client);
+  r = jsonrpc_client_reply (pending.client, pending.id, g_variant_new_boolean (TRUE), NULL, &error);
+  g_assert_no_error (error);
+  g_assert_cmpint (r, ==, TRUE);
+
+  r = jsonrpc_client_call (client,
+                           "do/something",
+                           g_variant_new_string ("do/something/message"),
+                           NULL,
+                           &return_value,
+                           &error);
+  g_assert_no_error (error);
+  g_assert_cmpint (r, ==, TRUE);
+  g_assert_nonnull (return_value);
+  g_assert_cmpint (count, ==, 1);
+
+  g_clear_object (&pending.client);
+  g_clear_pointer (&pending.id, g_variant_unref);
+}
+
+static void
+cancel_request_cb (JsonrpcServer *server,
+                   JsonrpcClient *client,
+                   const gchar   *method,
+                   GVariant      *params,
+                   gpointer       user_data)
+{
+  gint64 *cancelled_id = user_data;
+
+  g_assert_cmpstr (method, ==, "$/cancelRequest");
+  g_assert_true (g_variant_lookup (params, "id", "x", cancelled_id));
+}
+
+static void
+call_cancelled_cb (GObject      *object,
+                   GAsyncResult *result,
+                   gpointer      user_data)
+{
+  g_autoptr(GVariant) return_value = NULL;
+  g_autoptr(GError) error = NULL;
+  gboolean *completed = user_data;
+  gboolean r;
+
+  r = jsonrpc_client_call_finish (JSONRPC_CLIENT (object), result, &return_value, &error);
+  g_assert_error (error, G_IO_ERROR, G_IO_ERROR_CANCELLED);
+  g_assert_false (r);
+  g_assert_null (return_value);
+
+  *completed = TRUE;
+}
+
+static void
+test_cancel_method (void)
+{
+  g_autoptr(JsonrpcServer) server = NULL;
+  g_autoptr(JsonrpcClient) client = NULL;
+  g_autoptr(GIOStream) stream_a = NULL;
+  g_autoptr(GIOStream) stream_b = NULL;
+  g_autoptr(GCancellable) cancellable = NULL;
+  g_autoptr(GVariant) return_value = NULL;
+  g_autoptr(GVariant) id = NULL;
+  g_autoptr(GError) error = NULL;
+  PendingCall pending = { 0 };
+  gboolean completed = FALSE;
+  gint64 cancelled_id = 0;
+  gint count = 0;
+  gint r;
+
+  create_stream_pair (&stream_a, &stream_b);
+
+  client = jsonrpc_client_new (stream_a);
+  jsonrpc_client_set_cancel_method (client, "$/cancelRequest");
+  g_assert_cmpstr (jsonrpc_client_get_cancel_method (client), ==, "$/cancelRequest");
+
+  server = jsonrpc_server_new ();
+  jsonrpc_server_accept_io_stream (server, stream_b);
+  jsonrpc_server_add_handler (server, "slow", slow_handler, &pending, NULL);
+  jsonrpc_server_add_handler (server, "do/something", do_something_handler, &count, NULL);
+  g_signal_connect (server, "notification", G_CALLBACK (cancel_request_cb), &cancelled_id);
+
+  cancellable = g_cancellable_new ();
+
+  jsonrpc_client_call_with_id_async (client,
+                                     "slow",
+                                     NULL,
+                                     &id,
+                                     cancellable,
+                                     call_cancelled_cb,
+                                     &completed);
+
+  /* Wait for the server to receive the call before cancelling it */
+  while (pending.client == NULL)
+    g_main_context_iteration (NULL, TRUE);
+
+  g_cancellable_cancel (cancellable);
+
+  while (!completed || cancelled_id == 0)
+    g_main_context_iteration (NULL, TRUE);
+
+  g_assert_cmpint (cancelled_id, ==, g_variant_get_int64 (id));
+
+  /* The reply to the cancelled call is dropped without failing the connection */
+  r = jsonrpc_client_reply (pending.client, pending.id, g_variant_new_boolean (TRUE), NULL, &error);
+  g_assert_no_error (error);
+  g_assert_cmpint (r, ==, TRUE);
+
+  r = jsonrpc_client_call (client,
+                           "do/something",
+                           g_variant_new_string ("do/something/message"),
+                           NULL,
+                           &return_value,
+                           &error);
+  g_assert_no_error (error);
+  g_assert_cmpint (r, ==, TRUE);
+  g_assert_nonnull (return_value);
+  g_assert_cmpint (count, ==, 1);
+
+  g_clear_object (&pending.client);
+  g_clear_pointer (&pending.id, g_variant_unref);
+}
+
+static void
+batch_call_cb (GObject      *object,
+               GAsyncResult *result,
+               gpointer      user_data)
+{
+  g_autoptr(GVariant) return_value = NULL;
+  g_autoptr(GError) error = NULL;
+  gchar **reply = user_data;
+  gboolean r;
+
+  r = jsonrpc_client_call_finish (JSONRPC_CLIENT (object), result, &return_value, &error);
+  g_assert_no_error (error);
+  g_assert_true (r);
+  g_assert_nonnull (return_value);
+
+  *reply = g_variant_dup_string (return_value, NULL);
+}
+
+static void
+batch_cancelled_cb (GObject      *object,
+                    GAsyncResult *result,
+                    gpointer      user_data)
+{
+  g_autoptr(GVariant) return_value = NULL;
+  g_autoptr(GError) error = NULL;
+  gboolean *cancelled = user_data;
+  gboolean r;
+
+  r = jsonrpc_client_call_finish (JSONRPC_CLIENT (object), result, &return_value, &error);
+  g_assert_error (error, G_IO_ERROR, G_IO_ERROR_CANCELLED);
+  g_assert_false (r);
+
+  *cancelled = TRUE;
+}
+
+static void
+read_message_cb (GObject      *object,
+                 GAsyncResult *result,
+                 gpointer      user_data)
+{
+  g_autoptr(GError) error = NULL;
+  GVariant **message = user_data;
+  gboolean r;
+
+  r = jsonrpc_input_stream_read_message_finish (JSONRPC_INPUT_STREAM (object), result, message, &error);
+  g_assert_no_error (error);
+  g_assert_true (r);
+}
+
+static GVariant *
+create_reply (GVariant    *id,
+              const gchar *result)
+{
+  GVariantDict dict;
+
+  g_variant_dict_init (&dict, NULL);
+  g_variant_dict_insert (&dict, "jsonrpc", "s", "2.0");
+  g_variant_dict_insert_value (&dict, "id", id);
+  g_variant_dict_insert (&dict, "result", "s", result);
+
+  return g_variant_dict_end (&dict);
+}
+
+static void
+test_batch (void)
+{
+  g_autoptr(JsonrpcClient) client = NULL;
+  g_autoptr(JsonrpcClientBatch) batch = NULL;
+  g_autoptr(JsonrpcInputStream) peer_input = NULL;
+  g_autoptr(JsonrpcOutputStream) peer_output = NULL;
+  g_autoptr(GIOStream) stream_a = NULL;
+  g_autoptr(GIOStream) stream_b = NULL;
+  g_autoptr(GVariant) message = NULL;
+  g_autoptr(GVariant) element = NULL;
+  g_autoptr(GVariant) reply_batch = NULL;
+  g_autoptr(GVariant) first_id = NULL;
+  g_autoptr(GVariant) second_id = NULL;
+  g_autoptr(GCancellable) cancellable = g_cancellable_new ();
+  g_autoptr(GError) error = NULL;
+  g_autofree gchar *first_reply = NULL;
+  g_autofree gchar *second_reply = NULL;
+  GVariant *replies[2];
+  const gchar *method = NULL;
+  gboolean cancelled = FALSE;
+  gint r;
+
+  create_stream_pair (&stream_a, &stream_b);
+  client = jsonrpc_client_new (stream_a);
+
+  /* The peer speaks through the streams directly to control the replies */
+  peer_input = jsonrpc_input_stream_new (g_io_stream_get_input_stream (stream_b));
+  peer_output = jsonrpc_output_stream_new (g_io_stream_get_output_stream (stream_b));
+
+  batch = jsonrpc_client_batch_new (client);
+  jsonrpc_client_batch_add_call (batch, "first", NULL, -1, &first_id, NULL, batch_call_cb, &first_reply);
+  jsonrpc_client_batch_add_notification (batch, "note", g_variant_new_string ("note"));
+  jsonrpc_client_batch_add_call (batch, "second", NULL, -1, &second_id, NULL, batch_call_cb, &second_reply);
+
+  /* Cancelled before the batch is sent, so it is left out */
+  jsonrpc_client_batch_add_call (batch, "dropped", NULL, -1, NULL, cancellable, batch_cancelled_cb, &cancelled);
+  g_cancellable_cancel (cancellable);
+
+  jsonrpc_client_batch_send (batch);
+
+  /* All of the batch arrives as a single message */
+  jsonrpc_input_stream_read_message_async (peer_input, NULL, read_message_cb, &message);
+
+  while (message == NULL)
+    g_main_context_iteration (NULL, TRUE);
+
+  g_assert_cmpint (g_variant_n_children (message), ==, 3);
+
+  g_variant_get_child (message, 0, "v", &element);
+  g_assert_true (g_variant_lookup (element, "method", "&s", &method));
+  g_assert_cmpstr (method, ==, "first");
+  g_clear_pointer (&element, g_variant_unref);
+
+  g_variant_get_child (message, 1, "v", &element);
+  g_assert_true (g_variant_lookup (element, "method", "&s", &method));
+  g_assert_cmpstr (method, ==, "note");
+  g_assert_false (g_variant_lookup (element, "id", "*", NULL));
+  g_clear_pointer (&element, g_variant_unref);
+
+  g_variant_get_child (message, 2, "v", &element);
+  g_assert_true (g_variant_lookup (element, "method", "&s", &method));
+  g_assert_cmpstr (method, ==, "second");
+  g_clear_pointer (&element, g_variant_unref);
+
+  /* Reply to both calls in a batch of our own, out of order */
+  replies[0] = create_reply (second_id, "two");
+  replies[1] = create_reply (first_id, "one");
+  reply_batch = g_variant_ref_sink (g_variant_new_array (G_VARIANT_TYPE_VARDICT, replies, 2));
+
+  r = jsonrpc_output_stream_write_message (peer_output, reply_batch, NULL, &error);
+  g_assert_no_error (error);
+  g_assert_cmpint (r, ==, TRUE);
+
+  while (first_reply == NULL || second_reply == NULL || !cancelled)
+    g_main_context_iteration (NULL, TRUE);
+
+  g_assert_cmpstr (first_reply, ==, "one");
+  g_assert_cmpstr (second_reply, ==, "two");
+}
+
+typedef struct
+{
+  GVariant *later_id;
+  guint     n_notifications;
+} BatchPeer;
+
+static gboolean
+batch_handle_call (JsonrpcClient *client,
+                   const gchar   *method,
+                   GVariant      *id,
+                   GVariant      *params,
+                   BatchPeer     *peer)
+{
+  g_autoptr(GError) error = NULL;
+  gboolean r;
+
+  if (g_str_equal (method, "now"))
+    {
+      r = jsonrpc_client_reply (client, id, g_variant_new_string ("now"), NULL, &error);
+      g_assert_no_error (error);
+      g_assert_true (r);
+      return TRUE;
+    }
+
+  if (g_str_equal (method, "later"))
+    {
+      /* Reply once every other message of the batch was handled */
+      peer->later_id = g_variant_ref (id);
+      return TRUE;
+    }
+
+  return FALSE;
+}
+
+static void
+batch_notification (JsonrpcClient *client,
+                    const gchar   *method,
+                    GVariant      *params,
+                    BatchPeer     *peer)
+{
+  g_assert_cmpstr (method, ==, "note");
+  peer->n_notifications++;
+}
+
+static GVariant *
+create_call (gint64       id,
+             const gchar *method)
+{
+  GVariantDict dict;
+
+  g_variant_dict_init (&dict, NULL);
+  g_variant_dict_insert (&dict, "jsonrpc", "s", "2.0");
+  g_variant_dict_insert (&dict, "id", "x", id);
+  g_variant_dict_insert (&dict, "method", "s", method);
+  g_variant_dict_insert (&dict, "params", "s", method);
+
+  return g_variant_dict_end (&dict);
+}
+
+static void
+test_incoming_batch (void)
+{
+  g_autoptr(JsonrpcClient) client = NULL;
+  g_autoptr(JsonrpcInputStream) peer_input = NULL;
+  g_autoptr(JsonrpcOutputStream) peer_output = NULL;
+  g_autoptr(GIOStream) stream_a = NULL;
+  g_autoptr(GIOStream) stream_b = NULL;
+  g_autoptr(GVariant) batch = NULL;
+  g_autoptr(GVariant) message = NULL;
+  g_autoptr(GVariant) element = NULL;
+  g_autoptr(GError) error = NULL;
+  BatchPeer peer = { 0 };
+  GVariantDict note;
+  GVariant *messages[4];
+  const gchar *result = NULL;
+  gint64 id = 0;
+  gint r;
+
+  create_stream_pair (&stream_a, &stream_b);
+  client = jsonrpc_client_new (stream_a);
+  g_signal_connect (client, "handle-call", G_CALLBACK (batch_handle_call), &peer);
+  g_signal_connect (client, "notification", G_CALLBACK (batch_notification), &peer);
+  jsonrpc_client_start_listening (client);
+
+  peer_input = jsonrpc_input_stream_new (g_io_stream_get_input_stream (stream_b));
+  peer_output = jsonrpc_output_stream_new (g_io_stream_get_output_stream (stream_b));
+
+  g_variant_dict_init (&note, NULL);
+  g_variant_dict_insert (&note, "jsonrpc", "s", "2.0");
+  g_variant_dict_insert (&note, "method", "s", "note");
+  g_variant_dict_insert (&note, "params", "s", "note");
+
+  messages[0] = create_call (1, "now");
+  messages[1] = g_variant_dict_end (&note);
+  messages[2] = create_call (2, "later");
+  messages[3] = create_call (3, "missing");
+  batch = g_variant_ref_sink (g_variant_new_array (G_VARIANT_TYPE_VARDICT, messages, 4));
+
+  r = jsonrpc_output_stream_write_message (peer_output, batch, NULL, &error);
+  g_assert_no_error (error);
+  g_assert_cmpint (r, ==, TRUE);
+
+  while (peer.later_id == NULL || peer.n_notifications == 0)
+    g_main_context_iteration (NULL, TRUE);
+
+  jsonrpc_client_reply_async (client, peer.later_id, g_variant_new_string ("later"), NULL, NULL, NULL);
+
+  /* All of the replies arrive as a single message, in the order they were made */
+  jsonrpc_input_stream_read_message_async (peer_input, NULL, read_message_cb, &message);
+
+  while (message == NULL)
+    g_main_context_iteration (NULL, TRUE);
+
+  g_assert_cmpint (g_variant_n_children (message), ==, 3);
+
+  g_variant_get_child (message, 0, "v", &element);
+  g_assert_true (g_variant_lookup (element, "id", "x", &id));
+  g_assert_cmpint (id, ==, 1);
+  g_assert_true (g_variant_lookup (element, "result", "&s", &result));
+  g_assert_cmpstr (result, ==, "now");
+  g_clear_pointer (&element, g_variant_unref);
+
+  g_variant_get_child (message, 1, "v", &element);
+  g_assert_true (g_variant_lookup (element, "id", "x", &id));
+  g_assert_cmpint (id, ==, 3);
+  g_assert_true (g_variant_lookup (element, "error", "*", NULL));
+  g_clear_pointer (&element, g_variant_unref);
+
+  g_variant_get_child (message, 2, "v", &element);
+  g_assert_true (g_variant_lookup (element, "id", "x", &id));
+  g_assert_cmpint (id, ==, 2);
+  g_assert_true (g_variant_lookup (element, "result", "&s", &result));
+  g_assert_cmpstr (result, ==, "later");
+  g_clear_pointer (&element, g_variant_unref);
+
+  g_clear_pointer (&peer.later_id, g_variant_unref);
+}
+
+static gint64
+get_error_code (GVariant *reply)
+{
+  g_autoptr(GVariant) error = NULL;
+  gint64 code = 0;
+
+  g_assert_true (g_variant_lookup (reply, "id", "*", NULL));
+  g_assert_nonnull ((error = g_variant_lookup_value (reply, "error", NULL)));
+  g_assert_true (g_variant_lookup (error, "code", "x", &code));
+
+  return code;
+}
+
+static void
+test_invalid_batch (void)
+{
+  g_autoptr(JsonrpcClient) client = NULL;
+  g_autoptr(JsonrpcInputStream) peer_input = NULL;
+  g_autoptr(JsonrpcOutputStream) peer_output = NULL;
+  g_autoptr(GIOStream) stream_a = NULL;
+  g_autoptr(GIOStream) stream_b = NULL;
+  g_autoptr(GVariant) batch = NULL;
+  g_autoptr(GVariant) message = NULL;
+  g_autoptr(GVariant) element = NULL;
+  g_autoptr(GError) error = NULL;
+  BatchPeer peer = { 0 };
+  GVariant *messages[2];
+  const gchar *result = NULL;
+  gint r;
+
+  create_stream_pair (&stream_a, &stream_b);
+  client = jsonrpc_client_new (stream_a);
+  g_signal_connect (client, "handle-call", G_CALLBACK (batch_handle_call), &peer);
+  jsonrpc_client_start_listening (client);
+
+  peer_input = jsonrpc_input_stream_new (g_io_stream_get_input_stream (stream_b));
+  peer_output = jsonrpc_output_stream_new (g_io_stream_get_output_stream (stream_b));
+
+  /* An element which is not an object is an error within the reply */
+  messages[0] = g_variant_new_variant (g_variant_new_int64 (1));
+  messages[1] = g_variant_new_variant (create_call (1, "now"));
+  batch = g_variant_ref_sink (g_variant_new_array (G_VARIANT_TYPE_VARIANT, messages, 2));
+
+  r = jsonrpc_output_stream_write_message (peer_output, batch, NULL, &error);
+  g_assert_no_error (error);
+  g_assert_cmpint (r, ==, TRUE);
+
+  jsonrpc_input_stream_read_message_async (peer_input, NULL, read_message_cb, &message);
+
+  while (message == NULL)
+    g_main_context_iteration (NULL, TRUE);
+
+  g_assert_cmpint (g_variant_n_children (message), ==, 2);
+
+  g_variant_get_child (message, 0, "v", &element);
+  g_assert_cmpint (get_error_code (element), ==, JSONRPC_CLIENT_ERROR_INVALID_REQUEST);
+  g_clear_pointer (&element, g_variant_unref);
+
+  g_variant_get_child (message, 1, "v", &element);
+  g_assert_true (g_variant_lookup (element, "result", "&s", &result));
+  g_assert_cmpstr (result, ==, "now");
+  g_clear_pointer (&element, g_variant_unref);
+
+  g_clear_pointer (&message, g_variant_unref);
+  g_clear_pointer (&batch, g_variant_unref);
+
+  /* An empty batch gets a single error, and the connection remains usable */
+  batch = g_variant_ref_sink (g_variant_new_array (G_VARIANT_TYPE_VARIANT, NULL, 0));
+
+  r = jsonrpc_output_stream_write_message (peer_output, batch, NULL, &error);
+  g_assert_no_error (error);
+  g_assert_cmpint (r, ==, TRUE);
+
+  jsonrpc_input_stream_read_message_async (peer_input, NULL, read_message_cb, &message);
+
+  while (message == NULL)
+    g_main_context_iteration (NULL, TRUE);
+
+  g_assert_true (g_variant_is_of_type (message, G_VARIANT_TYPE_VARDICT));
+  g_assert_cmpint (get_error_code (message), ==, JSONRPC_CLIENT_ERROR_INVALID_REQUEST);
+}
+
+static void
+test_batch_id_collision (void)
+{
+  g_autoptr(JsonrpcClient) client = NULL;
+  g_autoptr(JsonrpcInputStream) peer_input = NULL;
+  g_autoptr(JsonrpcOutputStream) peer_output = NULL;
+  g_autoptr(GIOStream) stream_a = NULL;
+  g_autoptr(GIOStream) stream_b = NULL;
+  g_autoptr(GVariant) batch = NULL;
+  g_autoptr(GVariant) call = NULL;
+  g_autoptr(GVariant) message = NULL;
+  g_autoptr(GVariant) element = NULL;
+  g_autoptr(GError) error = NULL;
+  BatchPeer peer = { 0 };
+  GVariant *messages[1];
+  const gchar *result = NULL;
+  gint64 id = 0;
+  gint r;
+
+  create_stream_pair (&stream_a, &stream_b);
+  client = jsonrpc_client_new (stream_a);
+  g_signal_connect (client, "handle-call", G_CALLBACK (batch_handle_call), &peer);
+  jsonrpc_client_start_listening (client);
+
+  peer_input = jsonrpc_input_stream_new (g_io_stream_get_input_stream (stream_b));
+  peer_output = jsonrpc_output_stream_new (g_io_stream_get_output_stream (stream_b));
+
+  messages[0] = create_call (5, "later");
+  batch = g_variant_ref_sink (g_variant_new_array (G_VARIANT_TYPE_VARDICT, messages, 1));
+
+  r = jsonrpc_output_stream_write_message (peer_output, batch, NULL, &error);
+  g_assert_no_error (error);
+  g_assert_cmpint (r, ==, TRUE);
+
+  while (peer.later_id == NULL)
+    g_main_context_iteration (NULL, TRUE);
+
+  /* Reusing the id of the pending call of the batch is rejected on its own */
+  call = g_variant_ref_sink (create_call (5, "now"));
+
+  r = jsonrpc_output_stream_write_message (peer_output, call, NULL, &error);
+  g_assert_no_error (error);
+  g_assert_cmpint (r, ==, TRUE);
+
+  jsonrpc_input_stream_read_message_async (peer_input, NULL, read_message_cb, &message);
+
+  while (message == NULL)
+    g_main_context_iteration (NULL, TRUE);
+
+  g_assert_true (g_variant_is_of_type (message, G_VARIANT_TYPE_VARDICT));
+  g_assert_true (g_variant_lookup (message, "id", "x", &id));
+  g_assert_cmpint (id, ==, 5);
+  g_assert_cmpint (get_error_code (message), ==, JSONRPC_CLIENT_ERROR_INVALID_REQUEST);
+  g_clear_pointer (&message, g_variant_unref);
+
+  /* The reply to the call of the batch still completes the batch */
+  jsonrpc_client_reply_async (client, peer.later_id, g_variant_new_string ("later"), NULL, NULL, NULL);
+
+  jsonrpc_input_stream_read_message_async (peer_input, NULL, read_message_cb, &message);
+
+  while (message == NULL)
+    g_main_context_iteration (NULL, TRUE);
+
+  g_assert_cmpint (g_variant_n_children (message), ==, 1);
+
+  g_variant_get_child (message, 0, "v", &element);
+  g_assert_true (g_variant_lookup (element, "id", "x", &id));
+  g_assert_cmpint (id, ==, 5);
+  g_assert_true (g_variant_lookup (element, "result", "&s", &result));
+  g_assert_cmpstr (result, ==, "later");
+
+  g_clear_pointer (&peer.later_id, g_variant_unref);
+}
+
+static void
+broadcast_client_accepted (JsonrpcServer *server,
+                           JsonrpcClient *client,
+                           gpointer       user_data)
+{
+  GPtrArray *accepted = user_data;
+
+  g_ptr_array_add (accepted, g_object_ref (client));
+}
+
+static gboolean
+broadcast_filter (JsonrpcServer *server,
+                  JsonrpcClient *client,
+                  gpointer       user_data)
+{
+  g_assert (JSONRPC_IS_SERVER (server));
+  g_assert (JSONRPC_IS_CLIENT (client));
+
+  return client != user_data;
+}
+
+static GVariant *
+read_broadcast (JsonrpcInputStream *peer_input,
+                const gchar        *method)
+{
+  g_autoptr(GVariant) message = NULL;
+  const gchar *name = NULL;
+
+  jsonrpc_input_stream_read_message_async (peer_input, NULL, read_message_cb, &message);
+
+  while (message == NULL)
+    g_main_context_iteration (NULL, TRUE);
+
+  g_assert_true (g_variant_lookup (message, "method", "&s", &name));
+  g_assert_cmpstr (name, ==, method);
+  g_assert_false (g_variant_lookup (message, "id", "x", NULL));
+
+  return g_variant_lookup_value (message, "params", NULL);
+}
+
+static void
+test_broadcast (void)
+{
+  g_autoptr(JsonrpcServer) server = NULL;
+  g_autoptr(GPtrArray) accepted = NULL;
+  g_autoptr(GPtrArray) peer_inputs = NULL;
+  g_autoptr(GPtrArray) peer_streams = NULL;
+  g_autoptr(GVariant) params = NULL;
+  JsonrpcInputStream *json_peer;
+  JsonrpcInputStream *gvariant_peer;
+  JsonrpcInputStream *excluded_peer;
+
+  server = jsonrpc_server_new ();
+  accepted = g_ptr_array_new_with_free_func (g_object_unref);
+  peer_inputs = g_ptr_array_new_with_free_func (g_object_unref);
+  peer_streams = g_ptr_array_new_with_free_func (g_object_unref);
+
+  g_signal_connect (server,
+                    "client-accepted",
+                    G_CALLBACK (broadcast_client_accepted),
+                    accepted);
+
+  for (guint i = 0; i < 3; i++)
+    {
+      g_autoptr(GIOStream) stream_a = NULL;
+      g_autoptr(GIOStream) stream_b = NULL;
+
+      create_stream_pair (&stream_a, &stream_b);
+      jsonrpc_server_accept_io_stream (server, stream_b);
+
+      g_ptr_array_add (peer_inputs, jsonrpc_input_stream_new (g_io_stream_get_input_stream (stream_a)));
+      g_ptr_array_add (peer_streams, g_steal_pointer (&stream_a));
+    }
+
+  g_assert_cmpint (accepted->len, ==, 3);
+
+  json_peer = g_ptr_array_index (peer_inputs, 0);
+  gvariant_peer = g_ptr_array_index (peer_inputs, 1);
+  excluded_peer = g_ptr_array_index (peer_inputs, 2);
+
+  /* As if the second peer had upgraded the connection */
+  jsonrpc_client_set_use_gvariant (g_ptr_array_index (accepted, 1), TRUE);
+
+  jsonrpc_server_broadcast (server,
+                            "first",
+                            g_variant_new_uint32 (42),
+                            broadcast_filter,
+                            g_ptr_array_index (accepted, 2));
+  jsonrpc_server_broadcast (server, "second", NULL, NULL, NULL);
+
+  /* JSON has no unsigned integers, so the encoding shows in the type */
+  params = read_broadcast (json_peer, "first");
+  g_assert_nonnull (params);
+  g_assert_true (g_variant_is_of_type (params, G_VARIANT_TYPE_INT64));
+  g_assert_cmpint (g_variant_get_int64 (params), ==, 42);
+  g_clear_pointer (&params, g_variant_unref);
+
+  params = read_broadcast (gvariant_peer, "first");
+  g_assert_nonnull (params);
+  g_assert_true (g_variant_is_of_type (params, G_VARIANT_TYPE_UINT32));
+  g_assert_cmpint (g_variant_get_uint32 (params), ==, 42);
+  g_clear_pointer (&params, g_variant_unref);
+
+  /* The filtered out peer only gets the second notification */
+  params = read_broadcast (excluded_peer, "second");
+  g_clear_pointer (&params, g_variant_unref);
+
+  params = read_broadcast (json_peer, "second");
+  g_clear_pointer (&params, g_variant_unref);
+
+  params = read_broadcast (gvariant_peer, "second");
+  g_clear_pointer (&params, g_variant_unref);
+}
+
 gint
 main (gint   argc,
       gchar *argv[])
@@ -230,5 +1052,13 @@ main (gint   argc,
   g_test_init (&argc, &argv, NULL);
   g_test_add_func ("/Jsonrpc/Server/json", test_basic_json);
   g_test_add_func ("/Jsonrpc/Server/gvariant", test_basic_gvariant);
+  g_test_add_func ("/Jsonrpc/Server/newline-framing", test_newline_framing);
+  g_test_add_func ("/Jsonrpc/Server/deadline", test_deadline);
+  g_test_add_func ("/Jsonrpc/Server/cancel-method", test_cancel_method);
+  g_test_add_func ("/Jsonrpc/Server/batch", test_batch);
+  g_test_add_func ("/Jsonrpc/Server/incoming-batch", test_incoming_batch);
+  g_test_add_func ("/Jsonrpc/Server/invalid-batch", test_invalid_batch);
+  g_test_add_func ("/Jsonrpc/Server/batch-id-collision", test_batch_id_collision);
+  g_test_add_func ("/Jsonrpc/Server/broadcast", test_broadcast);
   return g_test_run ();
 }